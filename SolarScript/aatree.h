@@ -9,24 +9,46 @@
 // http://web.eecs.umich.edu/~sugih/courses/eecs281/f11/lectures/12-AAtrees+Treaps.pdf
 
 // To-do:
-//   [ ] Convert delete to iterative
-//   [ ] Convert insert to iterative
+//   [X] Convert delete to iterative
+//   [X] Convert insert to iterative
 //   [X] Convert get to iterative
 //   [X] Test in valgrind to ensure no memory leaks
 
+/* Insert & remove walk down the tree once, remembering the path in a stack
+   (an AA tree is at most 2*log2(n) deep, so MVM_AATREE_MAX_HEIGHT covers any
+   tree with a 32 bit size), then walk back up it rebalancing. Every walk
+   calls the comparison function once per level.
+
+   Nodes are carved from slabs owned by the tree (each twice the size of the
+   last, up to MVM_AATREE_MAX_SLAB nodes), and removed nodes are kept on a
+   free list for the next insert, so a tree makes a handful of allocations
+   however many nodes it has, & tearing it down frees the slabs rather than
+   walking the nodes (unless their data has to be freed too). */
 
 #include "defs.h"
 #include <stdio.h>
 
 #pragma once
 
+#define MVM_AATREE_MAX_HEIGHT 72 // deepest path walked (with room to spare)
+#define MVM_AATREE_MIN_SLAB 16 // nodes in a tree's first slab
+#define MVM_AATREE_MAX_SLAB 4096 // most nodes in a slab
+
 typedef struct _mvm_AANode
 {
   struct _mvm_AANode *left, *right;
   void *data;
-  uint32_t level;
+  uint32_t level; // 0 for nil, & for nodes on the free list
 } mvm_AANode;
 
+// A block of nodes
+typedef struct _mvm_AASlab
+{
+  struct _mvm_AASlab *next; // slab allocated before this one
+  uint32_t size, used; // nodes in (& handed out from) nodes
+  mvm_AANode nodes[1];
+} mvm_AASlab;
+
 mvm_AANode *mvm_new_AANode( void *data )
 {
   mvm_AANode *n = mvm_malloc(mvm_AANode);
@@ -39,33 +61,39 @@ mvm_AANode *mvm_new_AANode( void *data )
   return n;
 }
 
-void mvm_AANode_decompose( mvm_AANode *self, bool freeData )
-{
-  if ( self ){
-    if ( self->level == 0 ) return;
-    mvm_AANode_decompose(self->left, freeData );
-    mvm_AANode_decompose(self->right, freeData );
-    if ( freeData && self->data ) free( self->data ); 
-    free( self );
-  }
-}
-
 // A simple AA Tree
 typedef struct _mvm_AATree
 {
   mvm_AANode *root; // root of the tree
-  mvm_AANode *nil; // used as leaf-terminator
-  mvm_AANode *last, *deleted; // for recursion in deletion
+  mvm_AANode *nil; // used as leaf-terminator (its data is the last removed)
+  mvm_AASlab *slabs; // newest first
+  mvm_AANode *free_nodes; // removed nodes, linked through left
   uint32_t size; // number of nodes in tree
   int (*comp)( void *a, void *b ); // comparison function for sorting (<0 if a<b, >0 if a>b, 0 if a=b)
 } mvm_AATree;
 
+// Free every node (and their data, with freeData), leaving the tree empty
+void _mvm_AATree_free_nodes( mvm_AATree *t, bool freeData )
+{
+  while ( t->slabs ){
+    mvm_AASlab *s = t->slabs;
+    if ( freeData ){
+      for ( uint32_t i = 0; i < s->used; ++i ){
+        if ( s->nodes[i].level && s->nodes[i].data ) free( s->nodes[i].data );
+      }
+    }
+    t->slabs = s->next;
+    free( s );
+  }
+  t->root = t->nil;
+  t->free_nodes = NULL;
+  t->size = 0;
+}
+
 void mvm_del_AATree( mvm_AATree *t, bool freeData )
 {
   if ( t ){
-    if ( t->root ) mvm_AANode_decompose( t->root, freeData );
-    t->root = NULL;
-    t->size = 0;
+    _mvm_AATree_free_nodes( t, freeData );
     free( t->nil );
     free( t );
   }
@@ -76,59 +104,52 @@ void mvm_del_AATree( mvm_AATree *t, bool freeData )
 void mvm_cleanup_AATree( mvm_AATree *t, bool freeData )
 {
   if ( t ){
-    if ( t->root ) mvm_AANode_decompose( t->root, freeData );
-    t->root = NULL;
-    t->size = 0;
+    _mvm_AATree_free_nodes( t, freeData );
     free( t->nil );
+    t->root = t->nil = NULL;
   }
 }
 
-// Remove all nodes from the tree, potentially freeing data, but keeping the 
+// Remove all nodes from the tree, potentially freeing data, but keeping the
 // tree itself around for later use.
 // NOTE: The last deleted nodes data needs to be manually handled by YOU,
 // __prior__ to calling this function.
 void mvm_AATree_decompose( mvm_AATree *self, bool freeData )
 {
   if ( self ){
-    mvm_AANode_decompose( self->root, freeData );
-    self->root = self->nil;
-    self->size = 0;
-    self->deleted = self->nil;
-    self->last = self->nil;
+    _mvm_AATree_free_nodes( self, freeData );
+    self->nil->data = NULL;
   }
 }
 
-mvm_AATree *mvm_new_AATree( int (*comp)(void *a, void* b) )
-{
-  mvm_AATree *t = mvm_malloc( mvm_AATree );
-  t->size = 0;
-  t->nil = mvm_new_AANode( NULL );
-  t->root = t->nil;
-  t->last = t->deleted = t->nil;
-  t->nil->left = t->nil->right = t->nil;
-  t->comp = comp;
-  return t;
-}
-
 void mvm_init_AATree( mvm_AATree *t, int (*comp)(void *a, void* b) )
 {
   if ( t ){
     t->size = 0;
     t->nil = mvm_new_AANode( NULL );
     t->root = t->nil;
-    t->last = t->deleted = t->nil;
     t->nil->left = t->nil->right = t->nil;
+    t->slabs = NULL;
+    t->free_nodes = NULL;
     t->comp = comp;
   }
 }
 
+mvm_AATree *mvm_new_AATree( int (*comp)(void *a, void* b) )
+{
+  mvm_AATree *t = mvm_malloc( mvm_AATree );
+  mvm_init_AATree( t, comp );
+  return t;
+}
+
 void* mvm_AATree_get( mvm_AATree *t, void *d )
 {
   if ( t ){
     mvm_AANode* cur = t->root;
     while ( cur != t->nil ){
-      if ( t->comp(d,cur->data ) > 0 ) cur = cur->right;
-      else if ( t->comp(d,cur->data ) < 0 ) cur = cur->left;
+      int c = t->comp( d, cur->data );
+      if ( c > 0 ) cur = cur->right;
+      else if ( c < 0 ) cur = cur->left;
       else return cur->data;
     }
   }
@@ -143,9 +164,46 @@ void *mvm_AATree_rval( mvm_AATree *t )
   return NULL;
 }
 
+// A node holding data (one off the free list, or from a slab), NULL if out
+// of memory
+mvm_AANode *_mvm_AATree_new_node( mvm_AATree *t, void *data )
+{
+  mvm_AANode *n = t->free_nodes;
+  if ( n ) t->free_nodes = n->left;
+  else{
+    mvm_AASlab *s = t->slabs;
+    if ( !s || s->used == s->size ){
+      uint32_t size = !s ? MVM_AATREE_MIN_SLAB :
+                      s->size < MVM_AATREE_MAX_SLAB ? s->size*2 : s->size;
+      s = (mvm_AASlab*)malloc( sizeof(mvm_AASlab) +
+                               sizeof(mvm_AANode)*(size - 1) );
+      if ( !s ) return NULL;
+      s->size = size;
+      s->used = 0;
+      s->next = t->slabs;
+      t->slabs = s;
+    }
+    n = &s->nodes[s->used++];
+  }
+
+  n->data = data;
+  n->left = n->right = t->nil;
+  n->level = 1;
+  return n;
+}
+
+// Put n (no longer in the tree) on the free list
+void _mvm_AATree_free_node( mvm_AATree *t, mvm_AANode *n )
+{
+  n->level = 0;
+  n->data = NULL;
+  n->left = t->free_nodes;
+  t->free_nodes = n;
+}
+
 mvm_AANode* _mvm_AATree_skew( mvm_AANode* n )
 {
-  if ( n->level != n->left->level ) return n;
+  if ( !n->level || n->level != n->left->level ) return n;
 
   mvm_AANode* l = n->left;
   n->left = l->right;
@@ -157,7 +215,7 @@ mvm_AANode* _mvm_AATree_skew( mvm_AANode* n )
 
 mvm_AANode* _mvm_AATree_split( mvm_AANode* n )
 {
-  if ( n->right->right->level != n->level ) return n;
+  if ( !n->level || n->right->right->level != n->level ) return n;
 
   mvm_AANode* r = n->right;
   n->right = r->left;
@@ -168,76 +226,100 @@ mvm_AANode* _mvm_AATree_split( mvm_AANode* n )
   return n;
 }
 
-mvm_AANode* _mvm_AATree_insert_rec( mvm_AATree *t, mvm_AANode* n, void* v, const bool *overwrite )
+void mvm_AATree_insert_overwrite( mvm_AATree *t, void* d, bool overwrite )
 {
-  // Recursively traverse down the tree making rotaions via skew and split
-  // as required; because no parent pointer exists in the Node class we use
-  // recursion to keep track of 'important' nodes, as well as the new root
-  // of the tree after the insertion and rebalancing is complete. This is a
-  // very functional programming approach. A non-recursive implementation
-  // would be _slightly_ faster due to less function calls and stack ops.
-  if ( n == t->nil ) {
-    n = mvm_new_AANode( v );
-    n->level =1;
-    n->left = n->right = t->nil;
-
-    ++t->size;
-    return n;
-  }
-  if ( t->comp(v, n->data) < 0 ){
-    n->left = _mvm_AATree_insert_rec( t, n->left, v, overwrite );
-  }
-  else if ( t->comp(v, n->data) > 0 ){
-    n->right = _mvm_AATree_insert_rec( t, n->right, v, overwrite );
-  }
-  else {
-    if ( *overwrite ){
-      n->data = v;
-      return n;
+  // Walk down to where d goes, remembering the way
+  mvm_AANode *path[MVM_AATREE_MAX_HEIGHT];
+  bool right[MVM_AATREE_MAX_HEIGHT];
+  uint32_t top = 0;
+  mvm_AANode *n = t->root;
+  while ( n != t->nil ){
+    int c = t->comp( d, n->data );
+    if ( !c ){
+      if ( overwrite ) n->data = d;
+      return;
     }
+    path[top] = n;
+    right[top++] = c > 0;
+    n = c > 0 ? n->right : n->left;
   }
 
-  n = _mvm_AATree_skew( n );
-  n = _mvm_AATree_split( n );
-  return n;
+  if ( !(n = _mvm_AATree_new_node( t, d )) ) return;
+  ++t->size;
+
+  // & back up, skewing & splitting each node on the way
+  while ( top-- ){
+    mvm_AANode *p = path[top];
+    if ( right[top] ) p->right = n;
+    else p->left = n;
+    n = _mvm_AATree_split( _mvm_AATree_skew( p ) );
+  }
+  t->root = n;
 }
 
-// Might need to update to keep last && deleted inside of the tree!
-mvm_AANode* _mvm_AATree_remove_rec( mvm_AATree *t, mvm_AANode* n, void *v )
+void mvm_AATree_insert( mvm_AATree *t, void* d )
 {
-  if ( n == t->nil ) return n;
-
-  t->last = n;
+  mvm_AATree_insert_overwrite( t, d, false );
+}
 
-  if ( t->comp(v, n->data) < 0 ){
-    n->left = _mvm_AATree_remove_rec( t, n->left, v );
+// Remove the node matching d, if there is one - its data is then kept for
+// mvm_AATree_last_deleted(). Returns whether there was.
+bool mvm_AATree_remove( mvm_AATree *t, void* d )
+{
+  mvm_AANode *path[MVM_AATREE_MAX_HEIGHT];
+  uint32_t top = 0;
+  mvm_AANode *n = t->root;
+  for ( ;; ){
+    if ( n == t->nil ) return false;
+    path[top++] = n;
+    int c = t->comp( d, n->data );
+    if ( !c ) break;
+    n = c > 0 ? n->right : n->left;
   }
-  else{
-    t->deleted = n;
-    n->right = _mvm_AATree_remove_rec( t, n->right, v );
+  t->nil->data = n->data;
+
+  if ( n->left == t->nil || n->right == t->nil ){
+    // Its one child (or nil) takes its place
+    mvm_AANode *child = n->left == t->nil ? n->right : n->left;
+    if ( --top ){
+      mvm_AANode *p = path[top - 1];
+      if ( p->left == n ) p->left = child;
+      else p->right = child;
+    }
+    else t->root = child;
+    _mvm_AATree_free_node( t, n );
   }
-
-  if ( n == t->last && t->deleted != t->nil && !t->comp(v, t->deleted->data) ){
-    t->nil->data = t->deleted->data;
-    t->deleted->data = n->data;
-    t->deleted = t->nil;
-    n = n->right;
-    free( t->last );
-    --t->size;
+  else{
+    // Its successor's data takes its place, and the successor goes
+    mvm_AANode *heir = n->right, *prev = n;
+    while ( heir->left != t->nil ){
+      path[top++] = prev = heir;
+      heir = heir->left;
+    }
+    n->data = heir->data;
+    if ( prev == n ) prev->right = heir->right;
+    else prev->left = heir->right;
+    _mvm_AATree_free_node( t, heir );
   }
-  else if ( n->left->level < n->level-1 || n->right->level < n->level-1 ){
-    --n->level;
-    if ( n->right->level > n->level ){
-        n->right->level = n->level;
+  --t->size;
+
+  // Walk back up, rebalancing
+  while ( top-- ){
+    mvm_AANode *p = path[top];
+    bool was_right = top && path[top - 1]->right == p;
+    if ( p->left->level < p->level - 1 || p->right->level < p->level - 1 ){
+      if ( p->right->level > --p->level ) p->right->level = p->level;
+      p = _mvm_AATree_skew( p );
+      p->right = _mvm_AATree_skew( p->right );
+      p->right->right = _mvm_AATree_skew( p->right->right );
+      p = _mvm_AATree_split( p );
+      p->right = _mvm_AATree_split( p->right );
     }
-    n = _mvm_AATree_skew( n );
-    n->right = _mvm_AATree_skew( n->right );
-    n->right->right = _mvm_AATree_skew( n->right->right );
-    n = _mvm_AATree_split( n );
-    n->right = _mvm_AATree_split( n->right );
+    if ( !top ) t->root = p;
+    else if ( was_right ) path[top - 1]->right = p;
+    else path[top - 1]->left = p;
   }
-
-  return n;
+  return true;
 }
 
 void* mvm_AATree_last_deleted( mvm_AATree *t )
@@ -247,26 +329,10 @@ void* mvm_AATree_last_deleted( mvm_AATree *t )
   return d;
 }
 
-void mvm_AATree_insert( mvm_AATree *t, void* d )
-{
-  const static bool overwrite = false;
-  t->root = _mvm_AATree_insert_rec( t, t->root, d, &overwrite );
-}
-
-void mvm_AATree_insert_overwrite( mvm_AATree *t, void* d, bool overwrite )
-{
-  t->root = _mvm_AATree_insert_rec( t, t->root, d, &overwrite );
-}
-
-bool mvm_AATree_remove( mvm_AATree *t, void* d )
-{
-  return (t->root = _mvm_AATree_remove_rec( t, t->root, d )) ? true : false;
-}
-
 
 // macros:
 #define mvm_tinsert mvm_AATree_insert
 #define mvm_tremove mvm_AATree_remove
 #define mvm_tget mvm_AATree_get
 #define mvm_tlastdel mvm_AATree_last_deleted
-#define mvm_Tree mvm_AATree
\ No newline at end of file
+#define mvm_Tree mvm_AATree
@@ -0,0 +1,524 @@
+/* Batch compilation: many sources compiled at once on worker threads, then
+   linked into one program.
+
+   mvm_compile() keeps no state outside of its own call (op ids & the
+   fingerprint are only read, folding runs on a state of its own - see ir.h -
+   and the intern table it names globals from is locked), so any number of
+   threads can compile at once, as long as ops aren't being registered while
+   they do.
+
+   mvm_link() does the joining, one module at a time & in the order given, so
+   the linked program is the same however the compiles were spread over the
+   threads:
+
+   constants  merged by value: each distinct one is added the first time a
+              module uses it, so modules share one pool
+   globals    merged by name: modules assigning the same global share it
+              (unnamed globals stay each module's own). A global keeps one
+              type (see mvm_compile), so modules giving it different types
+              don't link
+   functions  appended, with a new main calling each module's main in turn,
+              so modules run in the order given
+
+   Modules are compiled knowing the types the ones before them gave globals
+   (see mvm_compile_module), so a module reading another's global reads it
+   as the right type. */
+
+#pragma once
+
+#ifndef MVM_INCLUDE_BATCH
+#define MVM_INCLUDE_BATCH
+
+#include "defs.h"
+#include "bytecode.h"
+#include "flowops.h"
+#include "specialize.h"
+#include "lazy_compiler.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+// A constant of the linked program, for merging equal ones
+typedef struct _mvm_Link_Constant
+{
+  char type;
+  uint64_t bits; // value (see _mvm_IR_bits), or for strings:
+  const char* str; // (interned)
+  uint32_t index; // in the linked program
+} mvm_Link_Constant;
+
+int _mvm_Link_Constant_comp( void* a, void* b )
+{
+  mvm_Link_Constant *ka = (mvm_Link_Constant*)a;
+  mvm_Link_Constant *kb = (mvm_Link_Constant*)b;
+
+  if ( ka->type != kb->type ) return ka->type < kb->type ? -1 : 1;
+  if ( ka->type == MVM_TYPE::string ){
+    return mvm_interned_comp( ka->str, kb->str );
+  }
+  return ka->bits < kb->bits ? -1 : ka->bits > kb->bits ? 1 : 0;
+}
+
+#define MVM_NO_SLOT UINT32_MAX // function not linked yet
+
+/// Links modules into a program one at a time, keeping what it needs to add
+/// or replace more later (see reload.h)
+typedef struct _mvm_Linker
+{
+  mvm_Program *out;
+  mvm_AATree constants; // out's constants (value -> index)
+  mvm_AATree globals; // out's named globals (interned name -> index)
+  uint32_t *kmap, *gmap, *fmap; // a module's indices -> out's
+  uint32_t kcap, gcap, fcap;
+  uint32_t main; // slot of the main made by mvm_Linker_main (or MVM_NO_SLOT)
+  int op_gload, op_gstore, op_gstore_pop, op_gcheck, op_getf, op_setf;
+  int op_call, op_ret;
+} mvm_Linker;
+
+// Link into out (which must be initialized & empty). Global names & string
+// constants in out are interned (see intern.h), so they needn't outlive the
+// modules.
+void mvm_init_Linker( mvm_Linker *lk, mvm_Program *out )
+{
+  lk->out = out;
+  mvm_init_AATree( &lk->constants, _mvm_Link_Constant_comp );
+  mvm_init_AATree( &lk->globals, _mvm_MNode_interned_to_uint32_comp );
+  lk->kmap = lk->gmap = lk->fmap = NULL;
+  lk->kcap = lk->gcap = lk->fcap = 0;
+  lk->main = MVM_NO_SLOT;
+  lk->op_gload = mvm_op_id( "gload" );
+  lk->op_gstore = mvm_op_id( "gstore" );
+  lk->op_gstore_pop = mvm_op_id( "gstore_pop" );
+  lk->op_gcheck = mvm_op_id( "gcheck" );
+  lk->op_getf = mvm_op_id( "getf" );
+  lk->op_setf = mvm_op_id( "setf" );
+  lk->op_call = mvm_op_id( "call" );
+  lk->op_ret = mvm_op_id( "ret" );
+}
+
+void mvm_cleanup_Linker( mvm_Linker *lk )
+{
+  if ( lk ){
+    free( lk->kmap );
+    free( lk->gmap );
+    free( lk->fmap );
+    mvm_cleanup_AATree( &lk->constants, true );
+    mvm_cleanup_AATree( &lk->globals, true );
+    lk->kmap = lk->gmap = lk->fmap = NULL;
+  }
+}
+
+// Index of constant o in out, adding it if it's new (MVM_ERROR if it can't be)
+int _mvm_Linker_constant( mvm_Linker *lk, mvm_Object o )
+{
+  mvm_Link_Constant key = { mvm_obj_type( o ), 0, NULL, 0 };
+  if ( key.type == MVM_TYPE::string ){
+    if ( !(key.str = mvm_intern( mvm_obj_string( o ) )) ) return MVM_ERROR;
+    mvm_obj_set_pointer( o, MVM_TYPE::string, key.str );
+  }
+  else key.bits = _mvm_IR_bits( o );
+
+  mvm_Link_Constant *n =
+    (mvm_Link_Constant*)mvm_AATree_get( &lk->constants, &key );
+  if ( n ) return (int)n->index;
+
+  int k = mvm_Program_add_constant( lk->out, o );
+  if ( k < 0 || !(n = mvm_malloc(mvm_Link_Constant)) ) return MVM_ERROR;
+  *n = key;
+  n->index = (uint32_t)k;
+  mvm_AATree_insert( &lk->constants, n );
+  return k;
+}
+
+// Index of the global named name in out (a new one for NULL), adding it if
+// it's new. MVM_ERROR if it can't be.
+int _mvm_Linker_global( mvm_Linker *lk, const char* name )
+{
+  if ( !name ) return mvm_Program_add_global( lk->out, NULL );
+
+  mvm_MNode_cstr_to_uint32 key = { mvm_intern( name ), 0 };
+  if ( !key.key ) return MVM_ERROR;
+  mvm_MNode_cstr_to_uint32 *gn =
+    (mvm_MNode_cstr_to_uint32*)mvm_AATree_get( &lk->globals, &key );
+  if ( gn ) return (int)gn->value;
+
+  if ( !(gn = mvm_malloc(mvm_MNode_cstr_to_uint32)) ) return MVM_ERROR;
+  int g = mvm_Program_add_global( lk->out, key.key );
+  if ( g < 0 ){
+    free( gn );
+    return MVM_ERROR;
+  }
+  gn->key = key.key;
+  gn->value = (uint32_t)g;
+  mvm_AATree_insert( &lk->globals, gn );
+  return g;
+}
+
+// Instruction i of module m, with its constants, globals, functions & jump
+// targets moved to where they are in the linked program (the module's code
+// starting at instruction code). Returns false if something it refers to
+// doesn't fit (or isn't in the module).
+bool _mvm_Linker_instr( const mvm_Linker *lk, const mvm_Program *m,
+                        mvm_Instr *i, uint32_t code )
+{
+  uint32_t op = MVM_OP(*i), arg = MVM_ARG(*i);
+
+  switch ( MVM_FLOW.kind[op] ){
+    case MVM_FLOW_JMP:
+    case MVM_FLOW_JT:
+    case MVM_FLOW_JF:
+    case MVM_FLOW_BRANCH:
+      *i = MVM_INSTR(op, arg + code);
+      return arg + code <= 0xffffff;
+    case MVM_FLOW_CALL:
+      if ( arg >= m->nfuncs || lk->fmap[arg] > 0xffffff ) return false;
+      *i = MVM_INSTR(op, lk->fmap[arg]);
+      return true;
+  }
+
+  if ( (int)op == lk->op_gload || (int)op == lk->op_gstore ||
+       (int)op == lk->op_gstore_pop || (int)op == lk->op_gcheck ){
+    if ( arg >= m->nglobals ) return false;
+    *i = MVM_INSTR(op, lk->gmap[arg]);
+    return true;
+  }
+
+  const uint32_t *kmap = lk->kmap;
+  switch ( (int)op == lk->op_getf || (int)op == lk->op_setf ? MVM_SPEC_PUSHK :
+           MVM_SPEC.kind[op] ){
+    case MVM_SPEC_PUSHK:
+    case MVM_SPEC_K_NUM:
+    case MVM_SPEC_IPK_NUM:
+      if ( arg >= m->nk ) return false;
+      *i = MVM_INSTR(op, kmap[arg]);
+      break;
+    case MVM_SPEC_PUSHK2:{
+      uint32_t a = arg & (MVM_PUSHK2_MAX - 1), b = arg >> 12;
+      if ( a >= m->nk || b >= m->nk || kmap[a] >= MVM_PUSHK2_MAX ||
+           kmap[b] >= MVM_PUSHK2_MAX ){
+        return false;
+      }
+      *i = MVM_INSTR(op, kmap[a] | (kmap[b] << 12));
+      break;
+    }
+    case MVM_SPEC_RLOADK:{
+      uint32_t k = MVM_ARG_AB(*i);
+      if ( k >= m->nk ) return false;
+      *i = MVM_INSTR3(op, MVM_ARG_D(*i), kmap[k] & 0xff, kmap[k] >> 8);
+      break;
+    }
+  }
+  return true;
+}
+
+// Make sure map (of capacity *cap) has room for n entries
+bool _mvm_Linker_room( uint32_t **map, uint32_t *cap, uint32_t n )
+{
+  if ( n <= *cap ) return true;
+  uint32_t *m = (uint32_t*)realloc( *map, sizeof(uint32_t)*n );
+  if ( !m ) return false;
+  *map = m;
+  *cap = n;
+  return true;
+}
+
+/// Link module m into the linker's program: its constants & globals are
+/// merged, and its code appended. slots holds the function table slot of
+/// each of m's functions: MVM_NO_SLOT ones get a new slot (which is written
+/// back), the rest are pointed at the new code, so callers of the old version
+/// get the new one. Returns MVM_OK, MVM_ERROR_BAD_PROGRAM if m can't be
+/// linked, MVM_ERROR_GLOBAL_TYPE if it types a global differently to the
+/// program, or MVM_ERROR_OUT_OF_MEMORY. On an error some of m's constants &
+/// globals may have been added, but no code, function or type is changed.
+int mvm_Linker_add( mvm_Linker *lk, const mvm_Program *m, uint32_t *slots )
+{
+  mvm_Program *out = lk->out;
+  if ( !_mvm_Linker_room( &lk->kmap, &lk->kcap, m->nk ) ||
+       !_mvm_Linker_room( &lk->gmap, &lk->gcap, m->nglobals ) ||
+       !_mvm_Linker_room( &lk->fmap, &lk->fcap, m->nfuncs ) ){
+    return MVM_ERROR_OUT_OF_MEMORY;
+  }
+
+  for ( uint32_t i = 0; i < m->nk; ++i ){
+    int k = _mvm_Linker_constant( lk, m->k[i] );
+    if ( k < 0 ) return MVM_ERROR_OUT_OF_MEMORY;
+    lk->kmap[i] = (uint32_t)k;
+  }
+
+  for ( uint32_t i = 0; i < m->nglobals; ++i ){
+    int g = _mvm_Linker_global( lk, m->gnames[i] );
+    if ( g < 0 ) return MVM_ERROR_OUT_OF_MEMORY;
+    lk->gmap[i] = (uint32_t)g;
+
+    char t = out->gtypes[g];
+    if ( t != MVM_TYPE_UNKNOWN && m->gtypes[i] != MVM_TYPE_UNKNOWN &&
+         m->gtypes[i] != t ){
+      return MVM_ERROR_GLOBAL_TYPE;
+    }
+  }
+
+  // Slots are settled first, since calls are linked to them
+  uint32_t nfuncs = out->nfuncs;
+  for ( uint32_t i = 0; i < m->nfuncs; ++i ){
+    lk->fmap[i] = slots[i] != MVM_NO_SLOT ? slots[i] : nfuncs++;
+    if ( lk->fmap[i] >= nfuncs ) return MVM_ERROR_BAD_PROGRAM;
+  }
+
+  // Code is linked onto the end, & dropped again if it doesn't link
+  uint32_t code = out->size;
+  for ( uint32_t i = 0; i < m->size; ++i ){
+    mvm_Instr in = mvm_unquicken( m->code[i] );
+    int result = !_mvm_Linker_instr( lk, m, &in, code ) ?
+                   MVM_ERROR_BAD_PROGRAM :
+                 mvm_Program_emit( out, in ) < 0 ? MVM_ERROR_OUT_OF_MEMORY :
+                 MVM_OK;
+    if ( result != MVM_OK ){
+      out->size = code;
+      return result;
+    }
+  }
+
+  while ( out->nfuncs < nfuncs ){
+    if ( !_MVM_GROW( out->funcs, out->nfuncs, out->fcap, mvm_Function ) ){
+      out->size = code;
+      return MVM_ERROR_OUT_OF_MEMORY;
+    }
+    ++out->nfuncs;
+  }
+  for ( uint32_t i = 0; i < m->nfuncs; ++i ){
+    out->funcs[lk->fmap[i]] = m->funcs[i];
+    out->funcs[lk->fmap[i]].entry += code;
+    slots[i] = lk->fmap[i];
+  }
+  for ( uint32_t i = 0; i < m->nglobals; ++i ){
+    if ( m->gtypes[i] != MVM_TYPE_UNKNOWN ){
+      mvm_Program_type_global( out, lk->gmap[i], m->gtypes[i] );
+    }
+  }
+  out->checked = false;
+
+  return MVM_OK;
+}
+
+/// Give the linker's program a new main calling the functions in mains (of
+/// no arguments) in order. Called again, it replaces the main it made before
+/// (in the same slot). Returns MVM_OK or MVM_ERROR_OUT_OF_MEMORY.
+int mvm_Linker_main( mvm_Linker *lk, const uint32_t *mains, uint32_t n )
+{
+  mvm_Program *out = lk->out;
+  uint32_t code = out->size;
+  bool worked = true;
+  for ( uint32_t i = 0; i < n && worked; ++i ){
+    worked = mvm_Program_emit( out, MVM_INSTR(lk->op_call, mains[i]) ) >= 0;
+  }
+  worked = worked && mvm_Program_emit( out, MVM_INSTR(lk->op_ret, 0) ) >= 0;
+
+  int main = !worked ? MVM_ERROR : lk->main != MVM_NO_SLOT ? (int)lk->main :
+             mvm_Program_add_function( out, 0, 0 );
+  if ( main < 0 ){
+    out->size = code;
+    return MVM_ERROR_OUT_OF_MEMORY;
+  }
+
+  out->funcs[main].entry = code;
+  out->main = lk->main = (uint32_t)main;
+  out->checked = false;
+  return MVM_OK;
+}
+
+// Link the n programs in modules into out (which must be initialized &
+// empty), see the top of this file. Global names & string constants in out
+// are interned (see intern.h).
+// Returns MVM_OK, MVM_ERROR_BAD_PROGRAM if a module can't be linked,
+// MVM_ERROR_GLOBAL_TYPE if modules disagree on a global's type, or
+// MVM_ERROR_OUT_OF_MEMORY.
+int mvm_link( mvm_Program *out, const mvm_Program *modules, uint32_t n )
+{
+  mvm_Linker lk;
+  mvm_init_Linker( &lk, out );
+
+  uint32_t *slots = NULL, *mains = (uint32_t*)malloc( sizeof(uint32_t)*(n + 1) );
+  uint32_t nmains = 0;
+  int result = mains ? MVM_OK : MVM_ERROR_OUT_OF_MEMORY;
+
+  for ( uint32_t m = 0; m < n && result == MVM_OK; ++m ){
+    const mvm_Program *p = &modules[m];
+    if ( p->nfuncs && (p->main >= p->nfuncs || p->funcs[p->main].nargs) ){
+      result = MVM_ERROR_BAD_PROGRAM;
+      break;
+    }
+
+    uint32_t *s = (uint32_t*)realloc( slots, sizeof(uint32_t)*(p->nfuncs + 1) );
+    if ( !s ){
+      result = MVM_ERROR_OUT_OF_MEMORY;
+      break;
+    }
+    slots = s;
+    for ( uint32_t i = 0; i < p->nfuncs; ++i ) slots[i] = MVM_NO_SLOT;
+
+    result = mvm_Linker_add( &lk, p, slots );
+    if ( p->nfuncs ) mains[nmains++] = slots[p->main];
+  }
+  if ( result == MVM_OK ) result = mvm_Linker_main( &lk, mains, nmains );
+
+  free( slots );
+  free( mains );
+  mvm_cleanup_Linker( &lk );
+  return result;
+}
+
+// Sources being compiled by mvm_compile_batch()
+typedef struct _mvm_Batch
+{
+  const char* const* texts;
+  uint32_t n;
+  const char** bytes; // what mvm_compile() gave for each source
+  char** errs; // & the error it set
+  uint32_t next; // next source to compile (taken atomically)
+} mvm_Batch;
+
+void *_mvm_batch_main( void *arg )
+{
+  mvm_Batch *b = (mvm_Batch*)arg;
+  uint32_t i;
+  while ( (i = __atomic_fetch_add( &b->next, 1, __ATOMIC_RELAXED )) < b->n ){
+    b->bytes[i] = mvm_compile( b->texts[i], &b->errs[i] );
+  }
+  return NULL;
+}
+
+// Whether module m gives the globals it shares with types (see
+// mvm_compile_module) the same types
+bool _mvm_batch_agrees( mvm_AATree *types, const mvm_Program *m )
+{
+  for ( uint32_t i = 0; i < m->nglobals; ++i ){
+    if ( !m->gnames[i] ) continue;
+    mvm_MNode_cstr_to_uint32 key = { mvm_intern( m->gnames[i] ), 0 };
+    mvm_MNode_cstr_to_uint32 *tn = !key.key ? NULL :
+      (mvm_MNode_cstr_to_uint32*)mvm_AATree_get( types, &key );
+    if ( tn && (char)tn->value != m->gtypes[i] ) return false;
+  }
+  return true;
+}
+
+// Add the types module m gives globals to types (for the ones it doesn't
+// have yet). Returns false if out of memory.
+bool _mvm_batch_add_types( mvm_AATree *types, const mvm_Program *m )
+{
+  for ( uint32_t i = 0; i < m->nglobals; ++i ){
+    if ( !m->gnames[i] || m->gtypes[i] == MVM_TYPE_UNKNOWN ) continue;
+    mvm_MNode_cstr_to_uint32 key = { mvm_intern( m->gnames[i] ),
+                                     (uint32_t)m->gtypes[i] };
+    if ( !key.key ) return false;
+    if ( mvm_AATree_get( types, &key ) ) continue;
+
+    mvm_MNode_cstr_to_uint32 *tn = mvm_malloc(mvm_MNode_cstr_to_uint32);
+    if ( !tn ) return false;
+    *tn = key;
+    mvm_AATree_insert( types, tn );
+  }
+  return true;
+}
+
+/// Compile the n sources in texts on nthreads threads (0 for one per CPU,
+/// the calling thread being one of them), & link them (see mvm_link) into p,
+/// which must be initialized & empty. The result doesn't depend on nthreads.
+/// Returns MVM_OK, or an error with *err (if err isn't NULL) set to a message
+/// naming the first source that failed (which you must free).
+int mvm_compile_batch( mvm_Program *p, const char* const* texts, uint32_t n,
+                       uint32_t nthreads, char** err )
+{
+  if ( !nthreads ){
+    long cpus = sysconf( _SC_NPROCESSORS_ONLN );
+    nthreads = cpus > 0 ? (uint32_t)cpus : 1;
+  }
+  if ( nthreads > n ) nthreads = n ? n : 1;
+  if ( err ) *err = NULL;
+
+  mvm_Batch b = { texts, n, NULL, NULL, 0 };
+  b.bytes = (const char**)calloc( n ? n : 1, sizeof(const char*) );
+  b.errs = (char**)calloc( n ? n : 1, sizeof(char*) );
+  mvm_Program *modules = (mvm_Program*)calloc( n ? n : 1, sizeof(mvm_Program) );
+  pthread_t *threads = (pthread_t*)calloc( nthreads, sizeof(pthread_t) );
+  int result = b.bytes && b.errs && modules && threads ? MVM_OK :
+               MVM_ERROR_OUT_OF_MEMORY;
+
+  // Threads that can't be started just leave more for the rest
+  uint32_t started = 0;
+  if ( result == MVM_OK ){
+    while ( started + 1 < nthreads &&
+            !pthread_create( &threads[started], NULL, _mvm_batch_main, &b ) ){
+      ++started;
+    }
+    _mvm_batch_main( &b );
+    for ( uint32_t i = 0; i < started; ++i ) pthread_join( threads[i], NULL );
+  }
+
+  // The threads compiled every source not knowing the types the ones before
+  // it give globals. Going through them in order, one that disagrees with
+  // those (or didn't compile, maybe for want of them) is compiled again
+  // knowing them, so sources end up as if they'd been compiled one by one.
+  mvm_AATree types;
+  mvm_init_AATree( &types, _mvm_MNode_interned_to_uint32_comp );
+  uint32_t loaded = 0;
+  for ( ; loaded < n && result == MVM_OK; ++loaded ){
+    mvm_Program *m = &modules[loaded];
+    mvm_init_Program( m );
+    for ( int pass = 0; pass < 2; ++pass ){
+      const char* bytes = b.bytes[loaded];
+      result = !bytes ? MVM_ERROR :
+        mvm_Program_load( m, bytes, ((const mvm_Bytecode_Header*)bytes)->size );
+      bool agrees = result == MVM_OK && _mvm_batch_agrees( &types, m );
+      if ( pass || !loaded || agrees || (bytes && result != MVM_OK) ) break;
+
+      mvm_cleanup_Program( m );
+      free( (void*)bytes );
+      free( b.errs[loaded] );
+      b.errs[loaded] = NULL;
+      b.bytes[loaded] = mvm_compile_module( texts[loaded], &types,
+                                            &b.errs[loaded] );
+    }
+    if ( result == MVM_OK && !_mvm_batch_add_types( &types, m ) ){
+      result = MVM_ERROR_OUT_OF_MEMORY;
+    }
+    if ( result != MVM_OK && err ){
+      const char* why = b.errs[loaded] ? b.errs[loaded] : "Bad bytecode";
+      *err = (char*)malloc( strlen( why ) + 32 );
+      if ( *err ) sprintf( *err, "Source %u: %s", loaded, why );
+    }
+  }
+
+  // Linked into a scratch program then saved & loaded, so p owns everything
+  // & none of it points into the modules
+  if ( result == MVM_OK ){
+    mvm_Program linked;
+    mvm_init_Program( &linked );
+    uint32_t size = 0;
+    char *bytes = NULL;
+    result = mvm_link( &linked, modules, n );
+    if ( result == MVM_OK && !(bytes = mvm_Program_save( &linked, &size )) ){
+      result = MVM_ERROR_OUT_OF_MEMORY;
+    }
+    if ( result == MVM_OK ) result = mvm_Program_load( p, bytes, size );
+    if ( result != MVM_OK && err && !*err ){
+      *err = (char*)malloc( 64 );
+      if ( *err ) sprintf( *err, "Sources couldn't be linked (error %d)", result );
+    }
+    free( bytes );
+    mvm_cleanup_Program( &linked );
+  }
+
+  for ( uint32_t i = 0; i < n && b.bytes && b.errs; ++i ){
+    free( (void*)b.bytes[i] );
+    free( b.errs[i] );
+  }
+  for ( uint32_t i = 0; i < loaded; ++i ) mvm_cleanup_Program( &modules[i] );
+  mvm_cleanup_AATree( &types, true );
+  free( b.bytes );
+  free( b.errs );
+  free( modules );
+  free( threads );
+  return result;
+}
+
+#endif // MVM_INCLUDE_BATCH
@@ -0,0 +1,570 @@
+/* Programs: whole compiled scripts, as opposed to the straight-line chunks in
+   chunk.h. A program is one block of code shared by all of its functions,
+   plus the constants, globals & function table it refers to. Functions
+   branch & call each other with the control ops in flowops.h, and run with
+   mvm_call() (see vm.h).
+
+   Programs are built in memory with the mvm_Program_* functions, and saved
+   & loaded as one flat block of bytes:
+
+   [ header | constants | globals | functions | code | strings ]
+
+   Everything is fixed width & 8 (or 4) byte aligned in the platform's byte
+   order, so loading is a bounds check & a copy - the code is used exactly as
+   stored, and nothing is decoded per op. Instructions use the same 32 bit
+   encoding as chunks; jump targets are absolute instruction indices.
+
+   header    - mvm_Bytecode_Header (including a fingerprint of the op table,
+               since opcodes depend on which ops a build registers)
+   constants - nk x mvm_Bytecode_Constant (numbers & integers are stored as
+               64 bit, so a program loads whatever MVM_DOUBLE etc. are)
+   globals   - nglobals x mvm_Bytecode_Global (name & type of each global)
+   functions - nfuncs x mvm_Function
+   code      - ncode x mvm_Instr
+   strings   - nul terminated strings (string constants & global names) */
+
+#pragma once
+
+#ifndef MVM_INCLUDE_BYTECODE
+#define MVM_INCLUDE_BYTECODE
+
+#include "defs.h"
+#include "object.h"
+#include "chunk.h"
+
+#include <stdio.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MVM_MMAP // files can be mapped (otherwise they're read into memory)
+#endif
+
+#define MVM_BYTECODE_MAGIC 0x424d564d // "MVMB" in little endian
+#define MVM_BYTECODE_VERSION 2
+
+#define MVM_ERROR_BAD_PROGRAM -800 // malformed bytecode, or a bad jump/call
+#define MVM_ERROR_GLOBAL_TYPE -801 // a global of another type than the
+                                   // program keeps it as (see gcheck), or
+                                   // modules disagreeing on one (see batch.h)
+
+#define MVM_NO_NAME 0xffffffff // global without a name
+
+// 64 bit FNV-1a hash of size bytes at p, continuing from hash (start with
+// MVM_HASH_SEED)
+#define MVM_HASH_SEED 0xcbf29ce484222325ull
+
+uint64_t mvm_hash_bytes( const void *p, size_t size, uint64_t hash )
+{
+  const unsigned char *b = (const unsigned char*)p;
+  for ( size_t i = 0; i < size; ++i ){
+    hash ^= b[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+// Fingerprint of the registered ops (names in opcode order), see flowops.h
+uint32_t mvm_op_fingerprint();
+
+// Instruction i as it was before quickening, see quicken.h
+mvm_Instr mvm_unquicken( mvm_Instr i );
+
+/// A function in a program's function table
+typedef struct _mvm_Function
+{
+  uint32_t entry; // index of the function's first instruction
+  uint16_t nargs; // arguments, which become registers 0..nargs-1
+  uint16_t nregs; // size of the register window (at least nargs)
+} mvm_Function;
+
+typedef struct _mvm_Bytecode_Header
+{
+  uint32_t magic; // MVM_BYTECODE_MAGIC
+  uint32_t version; // MVM_BYTECODE_VERSION
+  uint32_t size; // size of the whole block, header included
+  uint32_t main; // index of the function to run first
+  uint32_t nk; // number of constants
+  uint32_t nglobals; // number of globals
+  uint32_t nfuncs; // number of functions
+  uint32_t ncode; // number of instructions
+  uint32_t nstrings; // size of the strings section in bytes
+  uint32_t ops; // mvm_op_fingerprint() of the VM that saved it
+} mvm_Bytecode_Header;
+
+typedef struct _mvm_Bytecode_Constant
+{
+  uint32_t type; // MVM_TYPE
+  uint32_t pad;
+  union{
+    double n; // number
+    int64_t i; // integer
+    uint64_t b; // boolean (0 or 1)
+    uint64_t s; // string (offset in strings)
+  } data;
+} mvm_Bytecode_Constant;
+
+typedef struct _mvm_Bytecode_Global
+{
+  uint32_t name; // offset in strings, or MVM_NO_NAME
+  int32_t type; // MVM_TYPE the program keeps it (MVM_TYPE_UNKNOWN for any)
+} mvm_Bytecode_Global;
+
+typedef struct _mvm_Program
+{
+  mvm_Instr *code; // instructions of every function
+  uint32_t size; // number of instructions in code
+  uint32_t cap; // allocated size of code
+
+  mvm_Object *k; // constants
+  uint32_t nk;
+  uint32_t kcap;
+
+  mvm_Object *globals; // values of the globals
+  const char **gnames; // names of the globals (NULL for unnamed)
+  char *gtypes; // MVM_TYPE each global always holds (MVM_TYPE_UNKNOWN for any)
+  uint32_t nglobals;
+  uint32_t gcap;
+
+  mvm_Function *funcs; // function table
+  uint32_t nfuncs;
+  uint32_t fcap;
+
+  uint32_t main; // function to run first
+
+  char *data; // bytes strings point into (loaded programs only)
+  const char *map; // file the program runs from (mapped programs only)
+  uint32_t map_size; // size of map
+  bool checked; // whether mvm_Program_check() has passed
+
+#ifdef MVM_JIT
+  // Set up by mvm_continue_call() (see jit.h)
+  struct _mvm_JitFunc *jit; // what the JIT keeps for each function, or NULL
+  uint32_t njit; // functions in jit
+#endif
+} mvm_Program;
+
+void mvm_init_Program( mvm_Program *p )
+{
+  memset( p, 0, sizeof(mvm_Program) );
+}
+
+void _mvm_unmap_file( const char *p, uint32_t size );
+
+#ifdef MVM_JIT
+void mvm_jit_cleanup_Program( mvm_Program *p ); // see jit.h
+#endif
+
+void mvm_cleanup_Program( mvm_Program *p )
+{
+  if ( p ){
+#ifdef MVM_JIT
+    mvm_jit_cleanup_Program( p );
+#endif
+    // Mapped programs' code & functions are in the mapping
+    if ( p->code && !p->map ) free( p->code );
+    if ( p->funcs && !p->map ) free( p->funcs );
+    if ( p->map ) _mvm_unmap_file( p->map, p->map_size );
+    if ( p->k ) free( p->k );
+    if ( p->globals ) free( p->globals );
+    if ( p->gnames ) free( p->gnames );
+    if ( p->gtypes ) free( p->gtypes );
+    if ( p->data ) free( p->data );
+    mvm_init_Program( p );
+  }
+}
+
+// Make room for one more element in an array of T, false if out of memory
+#define _MVM_GROW( P, N, CAP, T )\
+  ((N) < (CAP) || _mvm_grow( (void**)&(P), &(CAP), sizeof(T) ))
+
+bool _mvm_grow( void **p, uint32_t *cap, size_t size )
+{
+  uint32_t c = *cap ? *cap*2 : 16;
+  void *n = realloc( *p, size*c );
+  if ( !n ) return false;
+  *p = n;
+  *cap = c;
+  return true;
+}
+
+// Append an instruction, returns its index or MVM_ERROR if out of memory
+int mvm_Program_emit( mvm_Program *p, mvm_Instr i )
+{
+  if ( p->map ) return MVM_ERROR; // code is read only
+  if ( !_MVM_GROW( p->code, p->size, p->cap, mvm_Instr ) ) return MVM_ERROR;
+
+  p->checked = false;
+  p->code[p->size] = i;
+  return (int)p->size++;
+}
+
+// Point the jump at instruction j to target (for forward jumps)
+void mvm_Program_patch( mvm_Program *p, uint32_t j, uint32_t target )
+{
+  if ( p->map ) return;
+  p->code[j] = MVM_INSTR(MVM_OP(p->code[j]), target);
+  p->checked = false;
+}
+
+// Append a constant, returns its index or MVM_ERROR if out of memory/space
+int mvm_Program_add_constant( mvm_Program *p, mvm_Object o )
+{
+  if ( p->nk == MVM_MAX_CONSTANTS ) return MVM_ERROR;
+  if ( !_MVM_GROW( p->k, p->nk, p->kcap, mvm_Object ) ) return MVM_ERROR;
+
+  p->k[p->nk] = o;
+  return (int)p->nk++;
+}
+
+int mvm_Program_add_number( mvm_Program *p, mvmnum n )
+{
+  mvm_Object o;
+  mvm_obj_set_number( o, n );
+  return mvm_Program_add_constant( p, o );
+}
+
+int mvm_Program_add_int( mvm_Program *p, mvmint i )
+{
+  mvm_Object o;
+  mvm_obj_set_int( o, i );
+  return mvm_Program_add_constant( p, o );
+}
+
+int mvm_Program_add_bool( mvm_Program *p, mvmbool b )
+{
+  mvm_Object o;
+  mvm_obj_set_bool( o, b );
+  return mvm_Program_add_constant( p, o );
+}
+
+// str isn't copied, so it must outlive the program
+int mvm_Program_add_string( mvm_Program *p, const char* str )
+{
+  mvm_Object o;
+  mvm_obj_set_pointer( o, MVM_TYPE::string, str );
+  return mvm_Program_add_constant( p, o );
+}
+
+// Add a global (initially the number 0, of any type - see
+// mvm_Program_type_global), returns its index or MVM_ERROR. name may be NULL,
+// and isn't copied.
+int mvm_Program_add_global( mvm_Program *p, const char* name )
+{
+  if ( p->nglobals >= (1u << 24) ) return MVM_ERROR; // arg is 24 bits
+  if ( p->nglobals == p->gcap ){
+    uint32_t cap = p->gcap, tcap = p->gcap;
+    if ( !_mvm_grow( (void**)&p->globals, &cap, sizeof(mvm_Object) ) ||
+         !_mvm_grow( (void**)&p->gtypes, &tcap, sizeof(char) ) ||
+         !_mvm_grow( (void**)&p->gnames, &p->gcap, sizeof(const char*) ) ){
+      return MVM_ERROR;
+    }
+  }
+
+  mvm_obj_set_number( p->globals[p->nglobals], 0.0f );
+  p->gnames[p->nglobals] = name;
+  p->gtypes[p->nglobals] = MVM_TYPE_UNKNOWN;
+  return (int)p->nglobals++;
+}
+
+// Record that global g only ever holds values of type t (the compiler
+// relies on it, and linking checks modules agree - see batch.h)
+void mvm_Program_type_global( mvm_Program *p, uint32_t g, char t )
+{
+  if ( g < p->nglobals ) p->gtypes[g] = t;
+}
+
+// Index of the global called name, or MVM_NOT_FOUND
+int mvm_Program_find_global( const mvm_Program *p, const char* name )
+{
+  for ( uint32_t i = 0; i < p->nglobals; ++i ){
+    if ( p->gnames[i] && !strcmp( p->gnames[i], name ) ) return (int)i;
+  }
+  return MVM_NOT_FOUND;
+}
+
+// Start a new function at the next instruction emitted, returns its index
+// or MVM_ERROR
+int mvm_Program_add_function( mvm_Program *p, uint16_t nargs, uint16_t nregs )
+{
+  if ( nregs < nargs || nregs > MVM_MAX_REGISTERS || p->map ) return MVM_ERROR;
+  if ( !_MVM_GROW( p->funcs, p->nfuncs, p->fcap, mvm_Function ) ){
+    return MVM_ERROR;
+  }
+
+  p->funcs[p->nfuncs] = { p->size, nargs, nregs };
+  p->checked = false;
+  return (int)p->nfuncs++;
+}
+
+// Saving & loading:
+
+#define _MVM_ALIGN8( N ) (((N) + 7) & ~(size_t)7)
+
+// Write p as one block of bytes (see the top of the file), returns the block
+// (free() it when done) & sets *size, or NULL if p holds constants that
+// can't be saved (pointers & compounds) or there's no memory.
+char *mvm_Program_save( const mvm_Program *p, uint32_t *size )
+{
+  // Strings section: string constants, then global names
+  size_t nstrings = 0;
+  for ( uint32_t i = 0; i < p->nk; ++i ){
+    MVM_TYPE t = (MVM_TYPE)mvm_obj_type( p->k[i] );
+    if ( t == MVM_TYPE::string ) nstrings += strlen( mvm_obj_string( p->k[i] ) ) + 1;
+    else if ( t == MVM_TYPE::pointer || t == MVM_TYPE::compound ) return NULL;
+  }
+  for ( uint32_t i = 0; i < p->nglobals; ++i ){
+    if ( p->gnames[i] ) nstrings += strlen( p->gnames[i] ) + 1;
+  }
+
+  size_t ko = sizeof(mvm_Bytecode_Header);
+  size_t go = ko + sizeof(mvm_Bytecode_Constant)*p->nk;
+  size_t fo = go + sizeof(mvm_Bytecode_Global)*p->nglobals;
+  size_t co = fo + sizeof(mvm_Function)*p->nfuncs;
+  size_t so = co + sizeof(mvm_Instr)*p->size;
+  size_t total = _MVM_ALIGN8( so + nstrings );
+  if ( total > UINT32_MAX ) return NULL;
+
+  char *b = (char*)calloc( 1, total );
+  if ( !b ) return NULL;
+
+  mvm_Bytecode_Header *h = (mvm_Bytecode_Header*)b;
+  h->magic = MVM_BYTECODE_MAGIC;
+  h->version = MVM_BYTECODE_VERSION;
+  h->size = (uint32_t)total;
+  h->main = p->main;
+  h->nk = p->nk;
+  h->nglobals = p->nglobals;
+  h->nfuncs = p->nfuncs;
+  h->ncode = p->size;
+  h->nstrings = (uint32_t)nstrings;
+  h->ops = mvm_op_fingerprint();
+
+  char *strs = b + so;
+  size_t si = 0;
+
+  mvm_Bytecode_Constant *k = (mvm_Bytecode_Constant*)(b + ko);
+  for ( uint32_t i = 0; i < p->nk; ++i ){
+    MVM_TYPE t = (MVM_TYPE)mvm_obj_type( p->k[i] );
+    k[i].type = (uint32_t)t;
+    switch ( t ){
+      case MVM_TYPE::number: k[i].data.n = (double)mvm_obj_number( p->k[i] ); break;
+      case MVM_TYPE::integer: k[i].data.i = (int64_t)mvm_obj_int( p->k[i] ); break;
+      case MVM_TYPE::boolean: k[i].data.b = mvm_obj_bool( p->k[i] ) ? 1 : 0; break;
+      default:{
+        const char* str = mvm_obj_string( p->k[i] );
+        size_t len = strlen( str ) + 1;
+        memcpy( strs + si, str, len );
+        k[i].data.s = si;
+        si += len;
+      }
+    }
+  }
+
+  mvm_Bytecode_Global *g = (mvm_Bytecode_Global*)(b + go);
+  for ( uint32_t i = 0; i < p->nglobals; ++i ){
+    if ( p->gnames[i] ){
+      size_t len = strlen( p->gnames[i] ) + 1;
+      memcpy( strs + si, p->gnames[i], len );
+      g[i].name = (uint32_t)si;
+      si += len;
+    }
+    else{
+      g[i].name = MVM_NO_NAME;
+    }
+    g[i].type = p->gtypes[i];
+  }
+
+  if ( p->nfuncs ) memcpy( b + fo, p->funcs, sizeof(mvm_Function)*p->nfuncs );
+  // Saved code is as compiled, so it can run where it can't be quickened
+  // (& so de-quickened) in place, like mapped programs
+  mvm_Instr *code = (mvm_Instr*)(b + co);
+  for ( uint32_t i = 0; i < p->size; ++i ) code[i] = mvm_unquicken( p->code[i] );
+
+  *size = (uint32_t)total;
+  return b;
+}
+
+// Check that every jump & call in p lands inside it (so the executor doesn't
+// have to), & that functions with unchecked ops start with a deep enough
+// room (see flowops.h). Returns MVM_OK or MVM_ERROR_BAD_PROGRAM.
+int mvm_Program_check( mvm_Program *p );
+
+// Read a program saved by mvm_Program_save() into p. With copy, everything
+// is copied out of bytes; without, p's code, functions & strings point into
+// bytes, which must stay put (& 8 byte aligned) as long as p is used.
+int _mvm_Program_read( mvm_Program *p, const char *bytes, uint32_t size,
+                       bool copy )
+{
+  const mvm_Bytecode_Header *h = (const mvm_Bytecode_Header*)bytes;
+  if ( size < sizeof(mvm_Bytecode_Header) || h->magic != MVM_BYTECODE_MAGIC ||
+       h->version != MVM_BYTECODE_VERSION || h->size > size ||
+       h->ops != mvm_op_fingerprint() || (uintptr_t)bytes % 8 ){
+    return MVM_ERROR_BAD_PROGRAM;
+  }
+
+  // Sizes in 64 bits, so huge counts can't wrap around
+  uint64_t ko = sizeof(mvm_Bytecode_Header);
+  uint64_t go = ko + (uint64_t)sizeof(mvm_Bytecode_Constant)*h->nk;
+  uint64_t fo = go + (uint64_t)sizeof(mvm_Bytecode_Global)*h->nglobals;
+  uint64_t co = fo + (uint64_t)sizeof(mvm_Function)*h->nfuncs;
+  uint64_t so = co + (uint64_t)sizeof(mvm_Instr)*h->ncode;
+  if ( so + h->nstrings > h->size || h->nk > MVM_MAX_CONSTANTS ||
+       (h->nstrings && bytes[so + h->nstrings - 1] != '\0') ){
+    return MVM_ERROR_BAD_PROGRAM;
+  }
+
+  // Constants & globals are always copied: constants have to be turned into
+  // objects, and globals are written to
+  p->k = (mvm_Object*)malloc( sizeof(mvm_Object)*(h->nk ? h->nk : 1) );
+  p->globals = (mvm_Object*)malloc( sizeof(mvm_Object)*(h->nglobals ? h->nglobals : 1) );
+  p->gnames = (const char**)malloc( sizeof(const char*)*(h->nglobals ? h->nglobals : 1) );
+  p->gtypes = (char*)malloc( h->nglobals ? h->nglobals : 1 );
+  if ( copy ){
+    p->data = (char*)malloc( h->nstrings ? h->nstrings : 1 );
+    p->code = (mvm_Instr*)malloc( sizeof(mvm_Instr)*(h->ncode ? h->ncode : 1) );
+    p->funcs = (mvm_Function*)malloc( sizeof(mvm_Function)*(h->nfuncs ? h->nfuncs : 1) );
+  }
+  if ( !p->k || !p->globals || !p->gnames || !p->gtypes ||
+       (copy && (!p->data || !p->code || !p->funcs)) ){
+    mvm_cleanup_Program( p );
+    return MVM_ERROR_OUT_OF_MEMORY;
+  }
+
+  const char *strs = bytes + so;
+  if ( copy ){
+    memcpy( p->data, bytes + so, h->nstrings );
+    memcpy( p->code, bytes + co, sizeof(mvm_Instr)*h->ncode );
+    memcpy( p->funcs, bytes + fo, sizeof(mvm_Function)*h->nfuncs );
+    strs = p->data;
+    p->cap = h->ncode;
+    p->fcap = h->nfuncs;
+  }
+  else{
+    p->code = (mvm_Instr*)(bytes + co);
+    p->funcs = (mvm_Function*)(bytes + fo);
+  }
+  p->size = h->ncode;
+  p->nfuncs = h->nfuncs;
+  p->nk = p->kcap = h->nk;
+  p->nglobals = p->gcap = h->nglobals;
+  p->main = h->main;
+
+  int result = MVM_OK;
+  const mvm_Bytecode_Constant *k = (const mvm_Bytecode_Constant*)(bytes + ko);
+  for ( uint32_t i = 0; i < h->nk && result == MVM_OK; ++i ){
+    switch ( k[i].type ){
+      case MVM_TYPE::number: mvm_obj_set_number( p->k[i], (mvmnum)k[i].data.n ); break;
+      case MVM_TYPE::integer: mvm_obj_set_int( p->k[i], (mvmint)k[i].data.i ); break;
+      case MVM_TYPE::boolean: mvm_obj_set_bool( p->k[i], k[i].data.b != 0 ); break;
+      case MVM_TYPE::string:
+        if ( k[i].data.s >= h->nstrings ) result = MVM_ERROR_BAD_PROGRAM;
+        else mvm_obj_set_pointer( p->k[i], MVM_TYPE::string, strs + k[i].data.s );
+        break;
+      default: result = MVM_ERROR_BAD_PROGRAM;
+    }
+  }
+
+  const mvm_Bytecode_Global *g = (const mvm_Bytecode_Global*)(bytes + go);
+  for ( uint32_t i = 0; i < h->nglobals && result == MVM_OK; ++i ){
+    mvm_obj_set_number( p->globals[i], 0.0f );
+    p->gtypes[i] = (char)g[i].type;
+    if ( g[i].type < MVM_TYPE_UNKNOWN || g[i].type > MVM_TYPE::compound ){
+      result = MVM_ERROR_BAD_PROGRAM;
+    }
+    else if ( g[i].name == MVM_NO_NAME ) p->gnames[i] = NULL;
+    else if ( g[i].name < h->nstrings ) p->gnames[i] = strs + g[i].name;
+    else result = MVM_ERROR_BAD_PROGRAM;
+  }
+
+  // (Mapped code too: it runs as is, so a bad entry has to fail here)
+  if ( result == MVM_OK ) result = mvm_Program_check( p );
+  if ( result != MVM_OK ){
+    if ( !copy ) p->code = NULL, p->funcs = NULL;
+    mvm_cleanup_Program( p );
+  }
+
+  return result;
+}
+
+// Load a program saved by mvm_Program_save() into p (which must be
+// initialized & empty). The bytes are copied, so they can be freed after.
+// Returns MVM_OK, or MVM_ERROR_BAD_PROGRAM if they're malformed.
+int mvm_Program_load( mvm_Program *p, const char *bytes, uint32_t size )
+{
+  return _mvm_Program_read( p, bytes, size, true );
+}
+
+// Map (or read) the whole of the file at path, NULL if it can't be. Unmap it
+// with _mvm_unmap_file.
+const char *_mvm_map_file( const char* path, uint32_t *size )
+{
+#ifdef MVM_MMAP
+  int fd = open( path, O_RDONLY );
+  if ( fd < 0 ) return NULL;
+
+  struct stat st;
+  void *p = MAP_FAILED;
+  if ( !fstat( fd, &st ) && st.st_size > 0 && st.st_size <= UINT32_MAX ){
+    p = mmap( NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  }
+  close( fd );
+
+  if ( p == MAP_FAILED ) return NULL;
+  *size = (uint32_t)st.st_size;
+  return (const char*)p;
+#else
+  FILE *f = fopen( path, "rb" );
+  if ( !f ) return NULL;
+
+  char *p = NULL;
+  long n = 0;
+  if ( !fseek( f, 0, SEEK_END ) && (n = ftell( f )) > 0 &&
+       !fseek( f, 0, SEEK_SET ) && (p = (char*)malloc( (size_t)n )) &&
+       fread( p, 1, (size_t)n, f ) != (size_t)n ){
+    free( p );
+    p = NULL;
+  }
+  fclose( f );
+
+  *size = (uint32_t)n;
+  return p;
+#endif
+}
+
+void _mvm_unmap_file( const char *p, uint32_t size )
+{
+#ifdef MVM_MMAP
+  munmap( (void*)p, size );
+#else
+  free( (void*)p );
+#endif
+}
+
+// Map the program saved (by mvm_Program_save) in the file at path into p
+// (which must be initialized & empty), & run it from there: code, functions
+// & string constants are used in place instead of being copied (the code is
+// still checked, like mvm_Program_load's), and processes mapping the same
+// file share them. Mapped code is read only, so it isn't quickened (see quicken.h), and
+// can't be added to. Returns MVM_OK, or an error like mvm_Program_load.
+int mvm_Program_map( mvm_Program *p, const char* path )
+{
+  uint32_t size = 0;
+  const char *f = _mvm_map_file( path, &size );
+  if ( !f ) return MVM_ERROR;
+
+  int result = _mvm_Program_read( p, f, size, false );
+  if ( result == MVM_OK ){
+    p->map = f;
+    p->map_size = size;
+  }
+  else{
+    _mvm_unmap_file( f, size );
+  }
+
+  return result;
+}
+
+#endif // MVM_INCLUDE_BYTECODE
@@ -0,0 +1,136 @@
+/* An on-disk cache of compiled programs, so scripts that haven't changed
+   since the last launch skip mvm_compile() entirely.
+
+   Each entry is one file in the cache directory, named after a 64 bit hash
+   of the source, holding a small header (which repeats the hash & the
+   source's size, to catch collisions) followed by the bytecode block from
+   mvm_Program_save(). Entries are mapped straight from disk & run in place
+   (see mvm_Program_map), after being validated like any other bytecode
+   (version, op table, bounds, the room guarding unchecked ops), so a stale or
+   corrupt entry is just a miss: the source is compiled again & the entry
+   replaced. Entries are written to a temporary file & renamed into place,
+   so a crash or a concurrent writer never leaves half an entry behind. */
+
+#pragma once
+
+#ifndef MVM_INCLUDE_CACHE
+#define MVM_INCLUDE_CACHE
+
+#include "defs.h"
+#include "bytecode.h"
+#include "lazy_compiler.h"
+
+#include <stdio.h>
+
+#define MVM_CACHE_MAGIC 0x434d564d // "MVMC" in little endian
+#define MVM_CACHE_VERSION 1
+
+typedef struct _mvm_Cache_Header
+{
+  uint32_t magic; // MVM_CACHE_MAGIC
+  uint32_t version; // MVM_CACHE_VERSION
+  uint64_t hash; // mvm_hash_bytes() of the source
+  uint32_t source_size; // size of the source in bytes
+  uint32_t size; // size of the bytecode block that follows
+} mvm_Cache_Header;
+
+// Path of the cache entry for a source with the given hash (free() it)
+char *mvm_cache_path( const char* dir, uint64_t hash )
+{
+  size_t len = strlen( dir ) + 32;
+  char *path = (char*)malloc( len );
+  if ( path ){
+    snprintf( path, len, "%s/%016llx.mvmb", dir, (unsigned long long)hash );
+  }
+  return path;
+}
+
+// Map the cache entry at path into p, if it's for this source
+bool _mvm_cache_read( mvm_Program *p, const char* path, uint64_t hash,
+                      uint32_t source_size )
+{
+  uint32_t size = 0;
+  const char *f = _mvm_map_file( path, &size );
+  if ( !f ) return false;
+
+  const mvm_Cache_Header *h = (const mvm_Cache_Header*)f;
+  bool hit = size >= sizeof(mvm_Cache_Header) &&
+             h->magic == MVM_CACHE_MAGIC && h->version == MVM_CACHE_VERSION &&
+             h->hash == hash && h->source_size == source_size &&
+             h->size <= size - sizeof(mvm_Cache_Header) &&
+             _mvm_Program_read( p, f + sizeof(mvm_Cache_Header), h->size,
+                                false ) == MVM_OK;
+
+  // The program runs from the mapping, so it's unmapped with the program
+  if ( hit ){
+    p->map = f;
+    p->map_size = size;
+  }
+  else{
+    _mvm_unmap_file( f, size );
+  }
+  return hit;
+}
+
+// Write bytes as the cache entry at path (best effort - failing to cache
+// isn't an error)
+void _mvm_cache_write( const char* path, uint64_t hash, uint32_t source_size,
+                       const char *bytes, uint32_t size )
+{
+  size_t len = strlen( path ) + 32;
+  char *tmp = (char*)malloc( len );
+  if ( !tmp ) return;
+#ifdef MVM_MMAP
+  snprintf( tmp, len, "%s.%ld.tmp", path, (long)getpid() );
+#else
+  snprintf( tmp, len, "%s.tmp", path );
+#endif
+
+  mvm_Cache_Header h = { MVM_CACHE_MAGIC, MVM_CACHE_VERSION, hash,
+                         source_size, size };
+  FILE *f = fopen( tmp, "wb" );
+  bool written = f && fwrite( &h, sizeof(h), 1, f ) == 1 &&
+                 fwrite( bytes, 1, size, f ) == size;
+  if ( f && fclose( f ) ) written = false;
+
+  if ( !written || rename( tmp, path ) ) remove( tmp );
+  free( tmp );
+}
+
+// Load the program compiled from text into p (which must be initialized &
+// empty), from the cache in dir if it's there, otherwise compiling it & then
+// caching it. Sets *hit (if not NULL) to whether it came from the cache.
+// Returns MVM_OK, or an error with *err set like mvm_compile().
+int mvm_compile_cached( mvm_Program *p, const char* dir, const char* text,
+                        char** err, bool *hit )
+{
+  size_t source_size = strlen( text );
+  uint64_t hash = mvm_hash_bytes( text, source_size, MVM_HASH_SEED );
+  char *path = mvm_cache_path( dir, hash );
+
+  if ( hit ) *hit = false;
+  if ( path && source_size <= UINT32_MAX &&
+       _mvm_cache_read( p, path, hash, (uint32_t)source_size ) ){
+    if ( hit ) *hit = true;
+    free( path );
+    return MVM_OK;
+  }
+
+  const char *bytes = mvm_compile( text, err );
+  if ( !bytes ){
+    free( path );
+    return MVM_ERROR;
+  }
+
+  uint32_t size = ((const mvm_Bytecode_Header*)bytes)->size;
+  int result = mvm_Program_load( p, bytes, size );
+  if ( result == MVM_OK && path && source_size <= UINT32_MAX ){
+    _mvm_cache_write( path, hash, (uint32_t)source_size, bytes, size );
+  }
+
+  free( (void*)bytes );
+  free( path );
+  return result;
+}
+
+#endif // MVM_INCLUDE_CACHE
@@ -0,0 +1,189 @@
+/* A chunk is a unit of compiled bytecode: instructions plus the constants
+   they refer to. Chunks run in one of two modes:
+
+   stack    - ops pop/push mvm_State::s like mvm_exec() always has
+   register - three-address ops addressing a window of registers at the base
+              of the chunk's frame (see regops.h)
+
+   Every instruction is one 32 bit word, so decoding never branches on the
+   op's width:
+
+   [ op:8 | arg:24 ]         stack ops (arg is e.g. a constant index)
+   [ op:8 | d:8 | a:8 | b:8 ] register ops (destination & two sources) */
+
+#pragma once
+
+#include "defs.h"
+#include "object.h"
+
+#ifdef MVM_JIT
+#include <sys/mman.h>
+#endif
+
+typedef uint32_t mvm_Instr;
+
+#define MVM_CHUNK_STACK 0
+#define MVM_CHUNK_REGISTER 1
+
+#define MVM_MAX_REGISTERS 256 // registers are addressed by one byte
+#define MVM_MAX_CONSTANTS 65536 // rloadk addresses constants with 16 bits
+
+// Encoding:
+#define MVM_INSTR( OP, ARG ) ((mvm_Instr)(OP) | ((mvm_Instr)(ARG) << 8))
+#define MVM_INSTR3( OP, D, A, B ) ((mvm_Instr)(OP) | ((mvm_Instr)(D) << 8) |\
+                                   ((mvm_Instr)(A) << 16) | ((mvm_Instr)(B) << 24))
+// Decoding:
+#define MVM_OP( I ) ((I) & 0xff)
+#define MVM_ARG( I ) ((I) >> 8)
+#define MVM_ARG_D( I ) (((I) >> 8) & 0xff)
+#define MVM_ARG_A( I ) (((I) >> 16) & 0xff)
+#define MVM_ARG_B( I ) ((I) >> 24)
+#define MVM_ARG_AB( I ) ((I) >> 16) // a & b as one 16 bit operand
+
+typedef struct _mvm_Chunk
+{
+  mvm_Instr *code; // instructions
+  uint32_t size; // number of instructions in code
+  uint32_t cap; // allocated size of code (#instructions)
+
+  mvm_Object *k; // constants
+  uint32_t nk; // number of constants
+  uint32_t kcap; // allocated size of k (#objects)
+
+  char mode; // MVM_CHUNK_STACK or MVM_CHUNK_REGISTER
+  uint32_t nregs; // size of the register window (register mode only)
+
+  // Set by mvm_specialize() (see specialize.h)
+  mvm_Instr *generic; // unspecialized code, run when the guard fails
+  uint32_t generic_size; // number of instructions in generic
+  char *guard; // types that must be on top of the stack on entry
+  uint32_t nguard; // number of types in guard
+  uint32_t max_stack; // most objects pushed above the entry stack
+
+#ifdef MVM_JIT
+  // Set by mvm_jit_compile() (see jit.h)
+  void *jit; // native code, or NULL while c is interpreted
+  uint32_t jit_size; // size of the mapping at jit
+  uint32_t calls; // number of times c has run (until it gets compiled)
+#endif
+} mvm_Chunk;
+
+void mvm_init_Chunk( mvm_Chunk *c, char mode, uint32_t nregs )
+{
+  if ( c ){
+    c->code = NULL;
+    c->size = c->cap = 0;
+    c->k = NULL;
+    c->nk = c->kcap = 0;
+    c->mode = mode;
+    c->nregs = mode == MVM_CHUNK_REGISTER ? nregs : 0;
+    c->generic = NULL;
+    c->generic_size = 0;
+    c->guard = NULL;
+    c->nguard = c->max_stack = 0;
+#ifdef MVM_JIT
+    c->jit = NULL;
+    c->jit_size = c->calls = 0;
+#endif
+  }
+}
+
+mvm_Chunk *mvm_new_Chunk( char mode, uint32_t nregs )
+{
+  if ( nregs > MVM_MAX_REGISTERS ) return NULL;
+
+  mvm_Chunk *c = mvm_malloc(mvm_Chunk);
+  mvm_init_Chunk( c, mode, nregs );
+  return c;
+}
+
+// To cleanup a chunk that's created on the stack, call this!
+void mvm_cleanup_Chunk( mvm_Chunk *c )
+{
+  if ( c ){
+    if ( c->code ) free( c->code );
+    if ( c->k ) free( c->k );
+    if ( c->generic ) free( c->generic );
+    if ( c->guard ) free( c->guard );
+    c->code = NULL;
+    c->k = NULL;
+    c->generic = NULL;
+    c->guard = NULL;
+    c->generic_size = c->nguard = c->max_stack = 0;
+#ifdef MVM_JIT
+    if ( c->jit ) munmap( c->jit, c->jit_size );
+    c->jit = NULL;
+    c->jit_size = c->calls = 0;
+#endif
+    c->size = c->cap = c->nk = c->kcap = 0;
+  }
+}
+
+void mvm_del_Chunk( mvm_Chunk *c )
+{
+  if ( c ){
+    mvm_cleanup_Chunk( c );
+    free( c );
+  }
+}
+
+// Append an instruction, returns its index or MVM_ERROR if out of memory
+int mvm_Chunk_emit( mvm_Chunk *c, mvm_Instr i )
+{
+  if ( c->size == c->cap ){
+    uint32_t cap = c->cap ? c->cap*2 : 16;
+    mvm_Instr *code = (mvm_Instr*)realloc( c->code, sizeof(mvm_Instr)*cap );
+    if ( !code ) return MVM_ERROR;
+    c->code = code;
+    c->cap = cap;
+  }
+
+  c->code[c->size] = i;
+  return (int)c->size++;
+}
+
+// Append a constant, returns its index or MVM_ERROR if out of memory/space
+int mvm_Chunk_add_constant( mvm_Chunk *c, mvm_Object o )
+{
+  if ( c->nk == MVM_MAX_CONSTANTS ) return MVM_ERROR;
+
+  if ( c->nk == c->kcap ){
+    uint32_t cap = c->kcap ? c->kcap*2 : 8;
+    mvm_Object *k = (mvm_Object*)realloc( c->k, sizeof(mvm_Object)*cap );
+    if ( !k ) return MVM_ERROR;
+    c->k = k;
+    c->kcap = cap;
+  }
+
+  c->k[c->nk] = o;
+  return (int)c->nk++;
+}
+
+int mvm_Chunk_add_number( mvm_Chunk *c, mvmnum n )
+{
+  mvm_Object o;
+  mvm_obj_set_number( o, n );
+  return mvm_Chunk_add_constant( c, o );
+}
+
+int mvm_Chunk_add_bool( mvm_Chunk *c, mvmbool b )
+{
+  mvm_Object o;
+  mvm_obj_set_bool( o, b );
+  return mvm_Chunk_add_constant( c, o );
+}
+
+int mvm_Chunk_add_int( mvm_Chunk *c, mvmint i )
+{
+  mvm_Object o;
+  mvm_obj_set_int( o, i );
+  return mvm_Chunk_add_constant( c, o );
+}
+
+// str isn't copied, so it must outlive the chunk (& any state running it)
+int mvm_Chunk_add_string( mvm_Chunk *c, const char* str )
+{
+  mvm_Object o;
+  mvm_obj_set_pointer( o, MVM_TYPE::string, str );
+  return mvm_Chunk_add_constant( c, o );
+}
@@ -18,10 +18,75 @@ typedef struct _mvm_Compound
                 // (wrapped in an object)
 } mvm_Compound;
 
+// A named child of a compound. The name is stored right after the field, so
+// one free() gets rid of both.
+typedef struct _mvm_Field
+{
+  const char* name;
+  mvm_Object value;
+} mvm_Field;
+
+int _mvm_Field_comp( void *a, void *b )
+{
+  return strcmp( ((mvm_Field*)a)->name, ((mvm_Field*)b)->name );
+}
+
+// name is the compound's type name, it isn't copied (and may be NULL)
+mvm_Compound *mvm_new_Compound( const char* name )
+{
+  mvm_Compound *c = mvm_malloc(mvm_Compound);
+  if ( c ){
+    c->name = name;
+    mvm_init_AATree( &c->children, _mvm_Field_comp );
+  }
+
+  return c;
+}
 
 void mvm_del_Object_compound( mvm_Compound *o );
 
+// The field of c called name, or NULL if it has none
+mvm_Object *mvm_Compound_get( mvm_Compound *c, const char* name )
+{
+  mvm_Field key;
+  memset( &key, 0, sizeof(key) );
+  key.name = name;
+  mvm_Field *f = (mvm_Field*)get( &c->children, &key );
+  return f ? &f->value : NULL;
+}
+
+// Set (or add) the field of c called name to a copy of o.
+// Returns MVM_OK, or MVM_ERROR if out of memory.
+int mvm_Compound_set( mvm_Compound *c, const char* name, const mvm_Object *o )
+{
+  mvm_Object *v = mvm_Compound_get( c, name );
+  if ( v ){
+    *v = *o;
+    return MVM_OK;
+  }
+
+  size_t len = strlen( name );
+  mvm_Field *f = (mvm_Field*)malloc( sizeof(mvm_Field) + len + 1 );
+  if ( !f ) return MVM_ERROR;
+
+  memcpy( (char*)(f + 1), name, len + 1 );
+  f->name = (const char*)(f + 1);
+  f->value = *o;
+  insert( &c->children, f );
+
+  return MVM_OK;
+}
+
+// Frees c & its fields, but not compounds its fields refer to
+void mvm_del_Object_compound( mvm_Compound *o )
+{
+  if ( o ){
+    mvm_cleanup_AATree( &o->children, true );
+    free( o );
+  }
+}
+
 #undef insert
 #undef remove
 #undef get
-#undef map
\ No newline at end of file
+#undef map
@@ -4,12 +4,13 @@
 
 #include "defs.h"
 #include "aatree.h"
+#include "intern.h"
 
 #define map mvm_AATree
 
 typedef struct _mvm_Conf
 {
-  const char* name;
+  const char* name; // (interned)
   map children;
 } mvm_Conf;
 
@@ -18,7 +19,7 @@ int mvm_Conf_comp( void *a, void *b )
   mvm_Conf *ca = (mvm_Conf*)a;
   mvm_Conf *cb = (mvm_Conf*)b;
 
-  return strcmp(ca->name, cb->name);
+  return mvm_interned_comp(ca->name, cb->name);
 }
 
 mvm_Conf *mvm_new_Cond( const char* name )
@@ -26,14 +27,16 @@ mvm_Conf *mvm_new_Cond( const char* name )
   if ( !name ) return NULL;
 
   mvm_Conf *c = mvm_malloc(mvm_Conf);
-  mvm_Conf *c = mvm_malloc(mvm_Conf);
-  
-  c->name = (const char*)malloc(strlen(name)+1);
-  strcpy( (char*)c->name, name );
+  if ( !c ) return NULL;
+
+  if ( !(c->name = mvm_intern( name )) ){
+    free( c );
+    return NULL;
+  }
 
   mvm_init_AATree( &c->children, mvm_Conf_comp );
 
   return c;
 }
 
-#undef map mvm_AATree
\ No newline at end of file
+#undef map
\ No newline at end of file
@@ -9,11 +9,46 @@
 #include <stdlib.h>
 #include <string.h>
 
+// Numeric width, picked at build time: MVM_DOUBLE makes numbers doubles,
+// MVM_INT64 makes integers 64 bit, and MVM_NUMERIC_64 does both. The mvm_pow,
+// mvm_fabs & mvm_strtonum macros pick the matching C functions.
+#ifdef MVM_NUMERIC_64
+  #ifndef MVM_DOUBLE
+    #define MVM_DOUBLE
+  #endif
+  #ifndef MVM_INT64
+    #define MVM_INT64
+  #endif
+#endif
+
+#if defined(MVM_INT64) && defined(MVM_NAN_BOXING)
+  #error "NaN-boxed objects only have room for 32 bit integers"
+#endif
+
 typedef unsigned int mvmop;
 typedef unsigned char mvmbyte;
+typedef unsigned char mvmbool;
+
+#ifdef MVM_DOUBLE
+typedef double mvmnum;
+  #define mvm_pow( A, B ) pow( A, B )
+  #define mvm_fabs( A ) fabs( A )
+  #define mvm_strtonum( S, E ) strtod( S, E )
+#else
 typedef float mvmnum;
+  #define mvm_pow( A, B ) powf( A, B )
+  #define mvm_fabs( A ) fabsf( A )
+  #define mvm_strtonum( S, E ) strtof( S, E )
+#endif
+
+#ifdef MVM_INT64
+typedef int64_t mvmint;
+typedef uint64_t mvmuint; // (integer ops wrap around using this)
+#else
 typedef int32_t mvmint;
-typedef unsigned char mvmbool;
+typedef uint32_t mvmuint;
+#endif
+#define MVM_INT_BITS ((uint32_t)sizeof(mvmint)*8)
 
 #ifndef __cplusplus
   #ifndef bool
@@ -24,14 +59,17 @@ typedef unsigned char mvmbool;
 #endif
 
 enum MVM_TYPE{
-  number, // 32 or 64bit float
-  integer, // 32 or 64bit integer
+  number, // 32 or 64bit float (see MVM_DOUBLE)
+  integer, // 32 or 64bit integer (see MVM_INT64)
   string, // const char*
   boolean, // 8bit boolean (unsigned char)
   pointer, // 32 or 64bit void* pointer
   compound // 32 or 64bit void* pointer to an mvm_Compound
 };
 
+// Type isn't known statically (or for a program's globals, can be any)
+#define MVM_TYPE_UNKNOWN -1
+
 // Error codes
 #define MVM_OK 1
 #define MVM_NOT_OK 0
@@ -53,6 +91,10 @@ enum MVM_TYPE{
 #define MVM_ERROR_BELOW_BOUNDS -302
 #define MVM_ERROR_STACK_OVERFLOW -400 // attempted to put too much in stack
 #define MVM_ERROR_STACK_UNDERFLOW -401 // attempted remove from empty stack
+#define MVM_ERROR_DIV_BY_ZERO -500 // integer division or modulo by 0
+#define MVM_ERROR_OUT_OF_MEMORY -600 // an allocation failed
+#define MVM_ERROR_HEAP_FULL -601 // the state owns hs allocations already
+#define MVM_ERROR_NO_FIELD -700 // compound has no field with that name
 
 // This is the maximum allowed depth of a scope parsed by the compiler - it
 // should be plenty enough! This is NOT the maximum recursion depth, which is
@@ -60,6 +102,35 @@ enum MVM_TYPE{
 // objects are returned from or passed to functions.
 #define MVM_COMPILER_MAX_SCOPE_DEPTH 128
 
+// The JIT (jit.h) emits x86-64 code into mmap'd memory, so it's only
+// available there - everywhere else MVM_JIT is ignored.
+#if defined(MVM_JIT) && \
+    !(defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__)))
+  #undef MVM_JIT
+#endif
+
+// MVM_STACK_GUARD (see state.h) reserves stacks with mmap & catches overflows
+// with a guard page, so it needs the same.
+#if defined(MVM_STACK_GUARD) && !(defined(__unix__) || defined(__APPLE__))
+  #undef MVM_STACK_GUARD
+#endif
+
+// mvm_call() dispatches with computed gotos (a GNU extension, see
+// mvm_continue_call in vm.h) where the compiler has them, and with a switch
+// everywhere else or when MVM_NO_THREADING is defined.
+#if defined(__GNUC__) && !defined(MVM_NO_THREADING)
+  #define MVM_THREADED
+#endif
+
+// Storage class for per-thread globals
+#if defined(__cplusplus)
+  #define MVM_THREAD_LOCAL thread_local
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+  #define MVM_THREAD_LOCAL _Thread_local
+#else
+  #define MVM_THREAD_LOCAL __thread
+#endif
+
 // Allocate memory of with size of sizeof(T)
 #define mvm_malloc( T ) (T*)malloc(sizeof(T))
 
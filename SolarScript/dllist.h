@@ -4,7 +4,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <time.h>
-#include "../M64Script/defs.h"
+#include "defs.h"
 
 typedef struct _mvm_List_Node
 {
@@ -0,0 +1,438 @@
+/* Control flow: compares, globals, branches & calls, for programs (see
+   bytecode.h).
+
+   Compares work like every other builtin op (operands left on the stack,
+   bool pushed), but the control ops - jmp, jt, jf, call & ret - change where
+   execution carries on, so mvm_call() runs them itself instead of through
+   the dispatch table. Their exec functions only exist to give them opcodes
+   & names; run anywhere else (mvm_exec, chunks) they're an invalid op.
+
+   jmp t    carry on at instruction t
+   jt t     pop a bool, jump to t if it's true
+   jf t     pop a bool, jump to t if it's false
+   call f   call function f with its nargs arguments on top of the stack,
+            which become its first registers
+   ret n    return the top n objects to the caller, in place of the
+            arguments
+
+   mvm_fuse_program() (see superops.h) also turns a compare followed by jt or
+   jf into one branch op, e.g. lt_jf, which mvm_call() runs with the test in
+   MVM_FLOW. */
+
+#pragma once
+
+#ifndef MVM_INCLUDE_FLOWOPS
+#define MVM_INCLUDE_FLOWOPS
+
+#include "defs.h"
+#include "state.h"
+#include "bytecode.h"
+#include "ops.h"
+
+// How mvm_call() runs each op
+#define MVM_FLOW_OP 0 // any other op (through the dispatch table)
+#define MVM_FLOW_JMP 1
+#define MVM_FLOW_JT 2
+#define MVM_FLOW_JF 3
+#define MVM_FLOW_CALL 4
+#define MVM_FLOW_RET 5
+#define MVM_FLOW_BRANCH 6 // a compare & a jt/jf (jump to arg if test gives on)
+
+// How each op moves the stack, so mvm_Program_check() can follow the depth of
+// functions with unchecked ops
+#define MVM_EFFECT_UNKNOWN 0 // depth after it can't be known
+#define MVM_EFFECT_FIXED 1 // reads the top reads objects, moves sp by delta
+#define MVM_EFFECT_POP 2 // drops the top arg objects
+#define MVM_EFFECT_NIP 3 // drops the arg objects under the top
+#define MVM_EFFECT_RET 4 // returns the top arg objects
+#define MVM_EFFECT_REGS 5 // no stack effect, registers d, a & b not checked
+
+struct __MVM_FLOW__
+{
+  char kind[MVM_MAX_OPS]; // MVM_FLOW_* of each op
+  // MVM_FLOW_BRANCH ops: the compare, giving 1 or 0 (or -1 with the state's
+  // error set), & which of them jumps
+  int (*test[MVM_MAX_OPS])( mvm_State *s );
+  int on[MVM_MAX_OPS];
+  char effect[MVM_MAX_OPS]; // MVM_EFFECT_* of each op
+  signed char reads[MVM_MAX_OPS], delta[MVM_MAX_OPS]; // MVM_EFFECT_FIXED
+  // Ops that don't check the stack (or registers) they use, so they're only
+  // safe behind a room at least as deep as the function they're in goes
+  bool guarded[MVM_MAX_OPS];
+  uint32_t room; // opcode of room
+} MVM_FLOW;
+
+// Set the stack effect of op
+void mvm_set_effect( uint32_t op, char effect, int reads, int delta,
+                     bool guarded )
+{
+  MVM_FLOW.effect[op] = effect;
+  MVM_FLOW.reads[op] = (signed char)reads;
+  MVM_FLOW.delta[op] = (signed char)delta;
+  MVM_FLOW.guarded[op] = guarded;
+}
+
+// How many objects op (with arg) reads off the top of the stack & how far it
+// moves sp, false if that isn't known ahead of time
+bool _mvm_effect_of( uint32_t op, uint32_t arg, int *reads, int *delta )
+{
+  switch ( MVM_FLOW.effect[op] ){
+    case MVM_EFFECT_FIXED:
+      *reads = MVM_FLOW.reads[op];
+      *delta = MVM_FLOW.delta[op];
+      return true;
+    case MVM_EFFECT_REGS:
+      *reads = *delta = 0;
+      return true;
+    case MVM_EFFECT_POP:
+      *reads = (int)arg;
+      *delta = -(int)arg;
+      return true;
+    case MVM_EFFECT_NIP:
+      *reads = (int)arg + 1;
+      *delta = -(int)arg;
+      return true;
+  }
+  return false;
+}
+
+// Give op the stack effect of op a followed by op b with arg barg (for fused
+// ops); left unknown if either of theirs is
+void mvm_set_effect_seq( uint32_t op, uint32_t a, uint32_t b, uint32_t barg )
+{
+  int ra, da, rb, db;
+  if ( !_mvm_effect_of( a, 0, &ra, &da ) ||
+       !_mvm_effect_of( b, barg, &rb, &db ) ){
+    return;
+  }
+
+  mvm_set_effect( op, MVM_EFFECT_FIXED, ra > rb - da ? ra : rb - da, da + db,
+                  MVM_FLOW.guarded[a] || MVM_FLOW.guarded[b] );
+}
+
+// Push EXPR(a, b) as a bool, for a & b of type T
+#define MVM_DEF_CMP( NAME, CT, T, EXPR )\
+  int _mvm_op_exec_##NAME()\
+  {\
+    bool worked = false;\
+    CT a = mvm_get_##T( 2, &worked );\
+    if ( !worked ){\
+      mvm_set_error( MVM_BAD_ARG_1 );\
+      return 0;\
+    }\
+    CT b = mvm_get_##T( 1, &worked );\
+    if ( !worked ){\
+      mvm_set_error( MVM_BAD_ARG_2 );\
+      return 0;\
+    }\
+    mvm_push_bool( EXPR );\
+    return 1;\
+  }
+
+// numbers:
+MVM_DEF_CMP( lt, mvmnum, number, a < b )
+MVM_DEF_CMP( le, mvmnum, number, a <= b )
+MVM_DEF_CMP( gt, mvmnum, number, a > b )
+MVM_DEF_CMP( ge, mvmnum, number, a >= b )
+MVM_DEF_CMP( eq, mvmnum, number, a == b )
+MVM_DEF_CMP( ne, mvmnum, number, a != b )
+
+// integers:
+MVM_DEF_CMP( ilt, mvmint, int, a < b )
+MVM_DEF_CMP( ile, mvmint, int, a <= b )
+MVM_DEF_CMP( igt, mvmint, int, a > b )
+MVM_DEF_CMP( ige, mvmint, int, a >= b )
+MVM_DEF_CMP( ieq, mvmint, int, a == b )
+MVM_DEF_CMP( ine, mvmint, int, a != b )
+
+// Drop the top arg objects
+int _mvm_op_exec_pop()
+{
+  uint32_t n = mvm_arg();
+  if ( n > MVM_STATE->sp ){
+    mvm_set_error( MVM_ERROR_STACK_UNDERFLOW );
+    return 0;
+  }
+
+  mvm_pop( n );
+
+  return -(int)n;
+}
+
+// Push global arg of the program being run
+int _mvm_op_exec_gload()
+{
+  mvm_State *s = MVM_STATE;
+  uint32_t i = mvm_arg();
+  if ( i >= s->ng ){
+    mvm_set_error( MVM_BAD_ARG_1 );
+    return 0;
+  }
+
+  mvm_push_object( &s->g[i] );
+
+  return 1;
+}
+
+// global arg = a (any type, a is left on the stack)
+int _mvm_op_exec_gstore()
+{
+  mvm_State *s = MVM_STATE;
+  uint32_t i = mvm_arg();
+  if ( i >= s->ng ){
+    mvm_set_error( MVM_BAD_ARG_0 );
+    return 0;
+  }
+  if ( !s->sp ){
+    mvm_set_error( MVM_BAD_ARG_1 );
+    return 0;
+  }
+
+  s->g[i] = s->s[s->sp - 1];
+
+  return 0;
+}
+
+// Part of the entry guard of compiled code (see mvm_IR_emit): global arg must
+// hold the type the program keeps it as, or MVM_ERROR_GLOBAL_TYPE is set
+int _mvm_op_exec_gcheck()
+{
+  mvm_State *s = MVM_STATE;
+  uint32_t i = mvm_arg();
+  if ( i >= s->ng ){
+    mvm_set_error( MVM_BAD_ARG_0 );
+    return 0;
+  }
+
+  if ( s->gt && s->gt[i] != MVM_TYPE_UNKNOWN &&
+       mvm_obj_type( s->g[i] ) != s->gt[i] ){
+    mvm_set_error( MVM_ERROR_GLOBAL_TYPE );
+  }
+
+  return 0;
+}
+
+// The rest of the entry guard: make room for arg more objects on the stack,
+// which the unchecked ops after it push to without checking (&
+// mvm_Program_check() makes sure arg covers them)
+int _mvm_op_exec_room()
+{
+  if ( !mvm_reserve_stack( MVM_STATE, mvm_arg() ) ){
+    mvm_set_error( MVM_ERROR_STACK_OVERFLOW );
+  }
+
+  return 0;
+}
+
+// The control ops only run inside mvm_call()
+int _mvm_op_exec_flow()
+{
+  mvm_set_error( MVM_ERROR_INVALID_OP );
+  return 0;
+}
+
+#define _mvm_op_exec_jmp _mvm_op_exec_flow
+#define _mvm_op_exec_jt _mvm_op_exec_flow
+#define _mvm_op_exec_jf _mvm_op_exec_flow
+#define _mvm_op_exec_call _mvm_op_exec_flow
+#define _mvm_op_exec_ret _mvm_op_exec_flow
+
+// Fill in MVM_FLOW, once the ops are registered (called by MVM_INIT)
+int mvm_init_flow()
+{
+  const char* names[] = { "jmp", "jt", "jf", "call", "ret" };
+  const char kinds[] = { MVM_FLOW_JMP, MVM_FLOW_JT, MVM_FLOW_JF,
+                         MVM_FLOW_CALL, MVM_FLOW_RET };
+
+  memset( MVM_FLOW.kind, MVM_FLOW_OP, sizeof(MVM_FLOW.kind) );
+  memset( MVM_FLOW.test, 0, sizeof(MVM_FLOW.test) );
+  memset( MVM_FLOW.effect, MVM_EFFECT_UNKNOWN, sizeof(MVM_FLOW.effect) );
+  memset( MVM_FLOW.guarded, 0, sizeof(MVM_FLOW.guarded) );
+  for ( uint32_t i = 0; i < sizeof(kinds); ++i ){
+    int op = mvm_op_id( names[i] );
+    if ( op < 0 ) return MVM_ERROR;
+    MVM_FLOW.kind[op] = kinds[i];
+  }
+
+  int room = mvm_op_id( "room" );
+  if ( room < 0 ) return MVM_ERROR;
+  MVM_FLOW.room = (uint32_t)room;
+
+  // The builtin ops' stack effects (fused, specialized & quick ops get theirs
+  // from these, see mvm_set_effect_seq)
+#define effect( NAME, EFFECT, READS, DELTA )\
+  {\
+    int op = mvm_op_id( #NAME );\
+    if ( op < 0 ) return MVM_ERROR;\
+    mvm_set_effect( (uint32_t)op, MVM_EFFECT_##EFFECT, READS, DELTA, false );\
+  }
+#define effects_2_1( A, B, C, D, E, F )\
+  effect( A, FIXED, 2, 1 ) effect( B, FIXED, 2, 1 ) effect( C, FIXED, 2, 1 )\
+  effect( D, FIXED, 2, 1 ) effect( E, FIXED, 2, 1 ) effect( F, FIXED, 2, 1 )
+
+  effects_2_1( and, or, nand, nor, xor, nxor )
+  effects_2_1( add, sub, mul, div, pow, iadd )
+  effects_2_1( lt, le, gt, ge, eq, ne )
+  effects_2_1( ilt, ile, igt, ige, ieq, ine )
+  effects_2_1( isub, imul, idiv, imod, band, bor )
+  effect( bxor, FIXED, 2, 1 ) effect( shl, FIXED, 2, 1 )
+  effect( shr, FIXED, 2, 1 )
+  effect( not, FIXED, 1, 1 ) effect( abs, FIXED, 1, 1 )
+  effect( ineg, FIXED, 1, 1 ) effect( bnot, FIXED, 1, 1 )
+  effect( itof, FIXED, 1, 1 ) effect( ftoi, FIXED, 1, 1 )
+  effect( ipadd, FIXED, 2, 0 ) effect( ipsub, FIXED, 2, 0 )
+  effect( ipmul, FIXED, 2, 0 ) effect( ipdiv, FIXED, 2, 0 )
+  effect( ippow, FIXED, 2, 0 )
+  effect( ipabs, FIXED, 1, 0 ) effect( ipnot, FIXED, 1, 0 )
+  effect( pushk, FIXED, 0, 1 ) effect( gload, FIXED, 0, 1 )
+  effect( rpush, FIXED, 0, 1 ) effect( gstore, FIXED, 1, 0 )
+  effect( rstore, FIXED, 1, 0 ) effect( gcheck, FIXED, 0, 0 )
+  effect( room, FIXED, 0, 0 ) effect( jmp, FIXED, 0, 0 )
+  effect( jt, FIXED, 1, -1 ) effect( jf, FIXED, 1, -1 )
+  effect( pop, POP, 0, 0 ) effect( nip, NIP, 0, 0 ) effect( ret, RET, 0, 0 )
+
+  // (the other register ops check their registers)
+  const char* regops[] = { "rmov", "rloadk", "rnot", "rand", "ror", "rnand",
+                           "rnor", "rxor", "rnxor", "radd", "rsub", "rmul",
+                           "rdiv", "rpow", "rabs", "riadd", "risub", "rimul",
+                           "rband", "rbor", "rbxor", "rshl", "rshr", "rlt",
+                           "rle", "req", "rilt", "rile", "rieq" };
+  for ( uint32_t i = 0; i < sizeof(regops)/sizeof(regops[0]); ++i ){
+    int op = mvm_op_id( regops[i] );
+    if ( op < 0 ) return MVM_ERROR;
+    mvm_set_effect( (uint32_t)op, MVM_EFFECT_FIXED, 0, 0, false );
+  }
+
+#undef effects_2_1
+#undef effect
+
+  return MVM_OK;
+}
+
+uint32_t mvm_op_fingerprint()
+{
+  uint64_t h = MVM_HASH_SEED;
+  for ( uint32_t i = 0; i < MVM.num_ops; ++i ){
+    h = mvm_hash_bytes( MVM.op_names[i], strlen( MVM.op_names[i] ) + 1, h );
+  }
+  return (uint32_t)(h ^ (h >> 32));
+}
+
+// Follow the stack depth through function fn of p over every path from its
+// entry (depth 0, just above its registers). Functions with guarded ops are
+// only safe to run if the depth is known at every op, never below what an op
+// reads, & the function starts with a room at least as deep as it goes.
+// depth & queue are p->size long, with depth all -1 (& left that way).
+bool _mvm_Program_depth_ok( const mvm_Program *p, uint32_t fn,
+                            int32_t *depth, uint32_t *queue )
+{
+  const mvm_Function *f = &p->funcs[fn];
+  const int32_t unknown = -2;
+  uint32_t n = 0;
+  int32_t max = 0;
+  bool guarded = false, bad = false;
+
+  depth[f->entry] = 0;
+  queue[n++] = f->entry;
+  for ( uint32_t q = 0; q < n; ++q ){
+    uint32_t pc = queue[q];
+    mvm_Instr ins = p->code[pc];
+    uint32_t op = MVM_OP(ins), arg = MVM_ARG(ins);
+    int32_t d = depth[pc];
+    int reads, delta;
+
+    if ( MVM_FLOW.guarded[op] ){
+      guarded = true;
+      if ( MVM_FLOW.effect[op] == MVM_EFFECT_REGS &&
+           (MVM_ARG_D(ins) >= f->nregs || MVM_ARG_A(ins) >= f->nregs ||
+            MVM_ARG_B(ins) >= f->nregs) ){
+        bad = true;
+      }
+    }
+    if ( MVM_FLOW.effect[op] == MVM_EFFECT_RET ) continue; // (checks itself)
+
+    if ( d == unknown || !_mvm_effect_of( op, arg, &reads, &delta ) ||
+         reads > d ){
+      bad = true;
+      d = unknown;
+    }
+    else if ( (d += delta) > max ) max = d;
+
+    uint32_t next[2], nnext = 0;
+    switch ( MVM_FLOW.kind[op] ){
+      case MVM_FLOW_JT:
+      case MVM_FLOW_JF:
+      case MVM_FLOW_BRANCH:
+        next[nnext++] = pc + 1;
+        // fall through
+      case MVM_FLOW_JMP:
+        next[nnext++] = arg;
+        break;
+      default:
+        next[nnext++] = pc + 1;
+    }
+    for ( uint32_t i = 0; i < nnext; ++i ){
+      if ( next[i] >= p->size ) continue; // (runs off the end, an error)
+      if ( depth[next[i]] == -1 ){
+        depth[next[i]] = d;
+        queue[n++] = next[i];
+      }
+      else if ( depth[next[i]] != d ) bad = true;
+    }
+  }
+
+  for ( uint32_t i = 0; i < n; ++i ) depth[queue[i]] = -1;
+
+  mvm_Instr first = p->code[f->entry];
+  return !guarded || (!bad && MVM_OP(first) == MVM_FLOW.room &&
+                      MVM_ARG(first) >= (uint32_t)max);
+}
+
+int mvm_Program_check( mvm_Program *p )
+{
+  if ( p->nfuncs && p->main >= p->nfuncs ) return MVM_ERROR_BAD_PROGRAM;
+
+  for ( uint32_t i = 0; i < p->nfuncs; ++i ){
+    const mvm_Function *f = &p->funcs[i];
+    if ( f->entry >= p->size || f->nregs < f->nargs ||
+         f->nregs > MVM_MAX_REGISTERS ){
+      return MVM_ERROR_BAD_PROGRAM;
+    }
+  }
+
+  bool guarded = false;
+  for ( uint32_t i = 0; i < p->size; ++i ){
+    uint32_t arg = MVM_ARG(p->code[i]);
+    switch ( MVM_FLOW.kind[MVM_OP(p->code[i])] ){
+      case MVM_FLOW_JMP:
+      case MVM_FLOW_JT:
+      case MVM_FLOW_JF:
+      case MVM_FLOW_BRANCH:
+        if ( arg >= p->size ) return MVM_ERROR_BAD_PROGRAM;
+        break;
+      case MVM_FLOW_CALL:
+        if ( arg >= p->nfuncs ) return MVM_ERROR_BAD_PROGRAM;
+        break;
+    }
+    guarded = guarded || MVM_FLOW.guarded[MVM_OP(p->code[i])];
+  }
+
+  // Only programs with guarded ops need their stack depths followed
+  if ( guarded ){
+    int32_t *depth = (int32_t*)malloc( sizeof(int32_t)*p->size );
+    uint32_t *queue = (uint32_t*)malloc( sizeof(uint32_t)*p->size );
+    bool ok = depth && queue;
+    if ( ok ) memset( depth, 0xff, sizeof(int32_t)*p->size ); // all -1
+    for ( uint32_t i = 0; ok && i < p->nfuncs; ++i ){
+      ok = _mvm_Program_depth_ok( p, i, depth, queue );
+    }
+    free( depth );
+    free( queue );
+    if ( !ok ) return MVM_ERROR_BAD_PROGRAM;
+  }
+
+  p->checked = true;
+  return MVM_OK;
+}
+
+#endif // MVM_INCLUDE_FLOWOPS
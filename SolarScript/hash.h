@@ -0,0 +1,175 @@
+/* Fast non-cryptographic hashing, for hash maps (see hmap.h) & anything else
+   that needs well mixed 64 bit hashes of strings or numbers in memory.
+
+   Strings are hashed 8 bytes at a time (in the style of wyhash): each pair of
+   words is folded into the state with a 64x64->128 bit multiply, and long
+   strings run three independent lanes of that so the multiplies overlap.
+   Keys of up to 16 bytes - most identifiers - take a few loads & two
+   multiplies, with no loop. Nothing is read outside [p, p + size).
+
+   Numbers go through mvm_hash_mix(), so hashes of nearby integers (or of
+   pointers, which share their low & high bits) land far apart.
+
+   These hashes aren't stable between builds or machines (they depend on
+   byte order) - use mvm_hash_bytes() in bytecode.h for anything stored. */
+
+#pragma once
+
+#ifndef MVM_INCLUDE_HASH
+#define MVM_INCLUDE_HASH
+
+#include "defs.h"
+
+typedef uint64_t mvm_hash;
+
+#define MVM_HASH_STR_SEED 0x2d358dccaa6c78a5ull // default seed of mvm_hash_str
+
+// Scramble the bits of x, so every bit of the result depends on all of x's
+// (the splitmix64 finalizer)
+inline mvm_hash mvm_hash_mix( uint64_t x )
+{
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+// *a & *b become the low & high halves of *a * *b
+inline void _mvm_hash_mul128( uint64_t *a, uint64_t *b )
+{
+#ifdef __SIZEOF_INT128__
+  __uint128_t r = (__uint128_t)*a * *b;
+  *a = (uint64_t)r;
+  *b = (uint64_t)(r >> 64);
+#else
+  uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+  uint64_t hh = ha*hb, hl = ha*lb, lh = la*hb, ll = la*lb;
+  uint64_t mid = (ll >> 32) + (uint32_t)hl + (uint32_t)lh;
+  *a = (mid << 32) | (uint32_t)ll;
+  *b = hh + (hl >> 32) + (lh >> 32) + (mid >> 32);
+#endif
+}
+
+// Both halves of a * b, folded together
+inline uint64_t _mvm_hash_mum( uint64_t a, uint64_t b )
+{
+  _mvm_hash_mul128( &a, &b );
+  return a ^ b;
+}
+
+inline uint64_t _mvm_hash_read64( const unsigned char *p )
+{
+  uint64_t v;
+  memcpy( &v, p, sizeof(v) );
+  return v;
+}
+
+inline uint64_t _mvm_hash_read32( const unsigned char *p )
+{
+  uint32_t v;
+  memcpy( &v, p, sizeof(v) );
+  return v;
+}
+
+// Hash of size bytes at p, with the given seed (MVM_HASH_STR_SEED if in doubt)
+mvm_hash mvm_hash_str( const void *p, size_t size, uint64_t seed )
+{
+  const uint64_t k0 = 0xa0761d6478bd642full, k1 = 0xe7037ed1a0b428dbull,
+                 k2 = 0x8ebc6af09c88c6e3ull, k3 = 0x589965cc75374cc3ull;
+  const unsigned char *b = (const unsigned char*)p;
+  uint64_t x, y;
+
+  seed ^= _mvm_hash_mum( seed ^ k0, k1 );
+  if ( size <= 16 ){
+    if ( size >= 4 ){
+      // Two (maybe overlapping) 4 byte reads from each end cover it
+      size_t mid = (size >> 3) << 2;
+      x = (_mvm_hash_read32( b ) << 32) | _mvm_hash_read32( b + mid );
+      y = (_mvm_hash_read32( b + size - 4 ) << 32) |
+          _mvm_hash_read32( b + size - 4 - mid );
+    }
+    else if ( size ){
+      x = ((uint64_t)b[0] << 16) | ((uint64_t)b[size >> 1] << 8) | b[size - 1];
+      y = 0;
+    }
+    else x = y = 0;
+  }
+  else{
+    size_t left = size;
+    if ( left > 48 ){
+      uint64_t lane1 = seed, lane2 = seed;
+      do{
+        seed = _mvm_hash_mum( _mvm_hash_read64( b ) ^ k1,
+                              _mvm_hash_read64( b + 8 ) ^ seed );
+        lane1 = _mvm_hash_mum( _mvm_hash_read64( b + 16 ) ^ k2,
+                               _mvm_hash_read64( b + 24 ) ^ lane1 );
+        lane2 = _mvm_hash_mum( _mvm_hash_read64( b + 32 ) ^ k3,
+                               _mvm_hash_read64( b + 40 ) ^ lane2 );
+        b += 48;
+        left -= 48;
+      } while ( left > 48 );
+      seed ^= lane1 ^ lane2;
+    }
+    while ( left > 16 ){
+      seed = _mvm_hash_mum( _mvm_hash_read64( b ) ^ k1,
+                            _mvm_hash_read64( b + 8 ) ^ seed );
+      b += 16;
+      left -= 16;
+    }
+    // The last 16 bytes (overlapping what's been hashed already, if need be)
+    x = _mvm_hash_read64( b + left - 16 );
+    y = _mvm_hash_read64( b + left - 8 );
+  }
+
+  x ^= k1;
+  y ^= seed;
+  _mvm_hash_mul128( &x, &y );
+  return _mvm_hash_mum( x ^ k0 ^ (uint64_t)size, y ^ k1 );
+}
+
+// Hash of a null terminated string
+inline mvm_hash mvm_hash_cstr( const char *str )
+{
+  return mvm_hash_str( str, strlen( str ), MVM_HASH_STR_SEED );
+}
+
+// Same as mvm_hash_cstr, but works with non-null terminated strings (the
+// first size chars of str)
+inline mvm_hash mvm_hash_scstr( const char *str, uint32_t size )
+{
+  return mvm_hash_str( str, size, MVM_HASH_STR_SEED );
+}
+
+// Floating point numbers hash by value: -0 hashes like 0, and every NaN the
+// same
+inline mvm_hash mvm_hash_double( double d )
+{
+  uint64_t bits = 0x7ff8000000000000ull;
+  if ( d == 0.0 ) bits = 0;
+  else if ( d == d ) memcpy( &bits, &d, sizeof(bits) );
+  return mvm_hash_mix( bits );
+}
+
+inline mvm_hash mvm_hash_float( float f )
+{
+  return mvm_hash_double( (double)f );
+}
+
+#define MVM_DEF_HASH_FUNCTION_FOR_PRIMATIVE( NAME, TYPE ) \
+  inline mvm_hash NAME(TYPE t){return mvm_hash_mix((uint64_t)t);}
+
+//------------------------------------------------------------------------------
+// Some default hash functions
+// Regular integers:
+MVM_DEF_HASH_FUNCTION_FOR_PRIMATIVE( mvm_hash_int, int )
+MVM_DEF_HASH_FUNCTION_FOR_PRIMATIVE( mvm_hash_uint, unsigned int )
+MVM_DEF_HASH_FUNCTION_FOR_PRIMATIVE( mvm_hash_longlong, long long int )
+MVM_DEF_HASH_FUNCTION_FOR_PRIMATIVE( mvm_hash_ulonglong, unsigned long long int )
+// stdint integers:
+MVM_DEF_HASH_FUNCTION_FOR_PRIMATIVE( mvm_hash_uint32, uint32_t )
+MVM_DEF_HASH_FUNCTION_FOR_PRIMATIVE( mvm_hash_uint64, uint64_t )
+MVM_DEF_HASH_FUNCTION_FOR_PRIMATIVE( mvm_hash_int32, int32_t )
+MVM_DEF_HASH_FUNCTION_FOR_PRIMATIVE( mvm_hash_int64, int64_t )
+
+#endif // MVM_INCLUDE_HASH
@@ -1,85 +1,253 @@
-/* A hashmap, which is used for all non-primative data types in M64Script */
+/* A hash map from objects to objects, for the non-primative data types in
+   M64Script (and anywhere an mvm_AATree is only used for lookups).
+
+   It's open addressing with Robin Hood probing: every slot remembers how far
+   it is from the slot its hash wants (its distance), and an insert that
+   meets a slot closer to home than itself takes that slot & carries on
+   inserting the one it displaced. That keeps probe lengths short & even,
+   and lets a lookup stop as soon as it meets a slot closer to home than the
+   key would be. Removal shifts the following slots back by one instead of
+   leaving a tombstone, so a map never fills up with dead slots.
+
+   Keys are compared by value: numbers by ==, strings by their contents,
+   pointers & compounds by address. Strings aren't copied - a key's string
+   has to outlive its entry, as with the keys of the compiler's trees. */
+
+#pragma once
+
+#ifndef MVM_INCLUDE_HMAP
+#define MVM_INCLUDE_HMAP
+
 #include "defs.h"
 #include "object.h"
+#include "hash.h"
 #include <stdlib.h>
-#include <stdatomic.h>
 
-#pragma once
+#define MVM_HMAP_MIN_CAP 8 // capacity of a map's first table
+#define MVM_HMAP_END 0xffffffff // no slot (see mvm_HMap_next)
 
-typedef uint64_t mvm_hash;
+typedef struct _mvm_HMap_Slot
+{
+  mvm_Object key, value;
+  uint32_t hash; // low bits of the key's hash
+  uint32_t dist; // 1 + distance from the key's home slot (0 if empty)
+} mvm_HMap_Slot;
 
-// A simple hash-map without buckets (to be changed to use buckets!)
 typedef struct _mvm_HMap
 {
-  mvm_Object *array;
-  uint32_t size; // Size of array
-  uint32_t count; // Number of objects in array
-  mvm_hash (*hash)(void* d); // Hashing algorithm for data
+  mvm_HMap_Slot *slots;
+  uint32_t cap; // number of slots (a power of 2, or 0 before the first set)
+  uint32_t count; // number of entries
 } mvm_HMap;
 
-// Creates & returns a new hmap
-mvm_HMap *mvm_new_hmap( mvm_hash (*hash_func)(void*) )
+// Whether a & b are the same key (see the top of this file)
+bool mvm_obj_equal( const mvm_Object *a, const mvm_Object *b )
+{
+  char type = mvm_obj_type( *a );
+  if ( type != mvm_obj_type( *b ) ) return false;
+
+  switch ( type ){
+    case MVM_TYPE::number:{
+      mvmnum x = mvm_obj_number( *a ), y = mvm_obj_number( *b );
+      return x == y || (x != x && y != y);
+    }
+    case MVM_TYPE::integer: return mvm_obj_int( *a ) == mvm_obj_int( *b );
+    case MVM_TYPE::boolean: return !mvm_obj_bool( *a ) == !mvm_obj_bool( *b );
+    case MVM_TYPE::string:
+      return mvm_obj_string( *a ) == mvm_obj_string( *b ) ||
+             !strcmp( mvm_obj_string( *a ), mvm_obj_string( *b ) );
+    default: return mvm_obj_pointer( *a ) == mvm_obj_pointer( *b );
+  }
+}
+
+// It's YOUR job to ensure obj is valid - not this functions! Objects that
+// are mvm_obj_equal() hash the same.
+inline mvm_hash mvm_hash_object( const mvm_Object *obj )
+{
+  char type = mvm_obj_type( *obj );
+  mvm_hash h;
+
+  switch ( type ){
+    case MVM_TYPE::number:
+      h = mvm_hash_double( (double)mvm_obj_number( *obj ) );
+      break;
+    case MVM_TYPE::integer:
+      h = mvm_hash_int64( (int64_t)mvm_obj_int( *obj ) );
+      break;
+    case MVM_TYPE::boolean:
+      h = mvm_hash_uint32( mvm_obj_bool( *obj ) ? 1 : 0 );
+      break;
+    case MVM_TYPE::string: h = mvm_hash_cstr( mvm_obj_string( *obj ) ); break;
+    default: h = mvm_hash_uint64( (uint64_t)(uintptr_t)mvm_obj_pointer( *obj ) );
+  }
+
+  // Equal values of different types (1 & 1.0, say) needn't collide
+  return h ^ mvm_hash_mix( (uint64_t)type );
+}
+
+void mvm_init_HMap( mvm_HMap *m )
 {
-  mvm_HMap *m = (mvm_HMap*)malloc(sizeof(mvm_HMap));
+  if ( m ){
+    m->slots = NULL;
+    m->cap = m->count = 0;
+  }
+}
 
+// To cleanup a map that's created on the stack, call this! (Keys & values
+// aren't freed - they're the caller's.)
+void mvm_cleanup_HMap( mvm_HMap *m )
+{
   if ( m ){
-    m->array = (mvm_Object*)malloc(sizeof(mvm_Object)*8);
-    m->size = m->count = 0;
-    m->hash = hash_func;
+    free( m->slots );
+    mvm_init_HMap( m );
   }
+}
 
+mvm_HMap *mvm_new_HMap()
+{
+  mvm_HMap *m = mvm_malloc(mvm_HMap);
+  mvm_init_HMap( m );
   return m;
 }
 
-// djb2 hashing
-inline mvm_hash mvm_hash_cstr( unsigned char *str )
+void mvm_del_HMap( mvm_HMap *m )
 {
-  unsigned long hash = 5381;
-  int c;
-  while (c = *str++)  hash = hash * 33 + c;
-  return hash;
+  if ( m ){
+    mvm_cleanup_HMap( m );
+    free( m );
+  }
 }
 
-// Same as mvm_hash_cstr, but works with non-null terminated strings
-inline mvm_hash mvm_hash_scstr( unsigned char *str, uint32_t size )
+// Remove every entry, keeping the slots for later use
+void mvm_HMap_clear( mvm_HMap *m )
 {
-  mvm_hash hash = 5381;
-  int c;
-  while ( size ) hash = hash * 33 + str[size--];
-  return hash;
+  if ( m->slots ) memset( m->slots, 0, sizeof(mvm_HMap_Slot)*m->cap );
+  m->count = 0;
 }
 
-// It's YOUR job to ensure obj is valid - not this functions!
-inline mvm_hash mvm_hash_object( const mvm_Object *obj )
+// Slot holding key, or MVM_HMAP_END
+uint32_t _mvm_HMap_find( const mvm_HMap *m, const mvm_Object *key,
+                         uint32_t hash )
 {
-  switch ( obj->type ){
-    case MVM_TYPE::number:
-      break;
-    case MVM_TYPE::integer:
-      break;
-    case MVM_TYPE::boolean:
-      break;
-    case MVM_TYPE::string:
+  if ( !m->count ) return MVM_HMAP_END;
+
+  uint32_t mask = m->cap - 1;
+  for ( uint32_t i = hash & mask, dist = 1;; i = (i + 1) & mask, ++dist ){
+    const mvm_HMap_Slot *s = &m->slots[i];
+    // Robin Hood: key would have taken any slot closer to home than it
+    if ( s->dist < dist ) return MVM_HMAP_END;
+    if ( s->hash == hash && mvm_obj_equal( &s->key, key ) ) return i;
+  }
+}
+
+// Put slot s (whose key isn't in the map) into the map, which has room
+void _mvm_HMap_place( mvm_HMap *m, mvm_HMap_Slot s )
+{
+  uint32_t mask = m->cap - 1;
+  s.dist = 1;
+  for ( uint32_t i = s.hash & mask;; i = (i + 1) & mask, ++s.dist ){
+    mvm_HMap_Slot *t = &m->slots[i];
+    if ( !t->dist ){
+      *t = s;
       break;
+    }
+    if ( t->dist < s.dist ){
+      mvm_HMap_Slot poorer = *t;
+      *t = s;
+      s = poorer;
+    }
+  }
+  ++m->count;
+}
+
+// Move the map's entries into a table of cap slots
+int _mvm_HMap_resize( mvm_HMap *m, uint32_t cap )
+{
+  mvm_HMap_Slot *slots = (mvm_HMap_Slot*)calloc( cap, sizeof(mvm_HMap_Slot) );
+  if ( !slots ) return MVM_ERROR_OUT_OF_MEMORY;
+
+  mvm_HMap_Slot *old = m->slots;
+  uint32_t oldcap = m->cap;
+  m->slots = slots;
+  m->cap = cap;
+  m->count = 0;
+  for ( uint32_t i = 0; i < oldcap; ++i ){
+    if ( old[i].dist ) _mvm_HMap_place( m, old[i] );
+  }
+  free( old );
+  return MVM_OK;
+}
+
+// Value of key in m, or NULL if it isn't there. The pointer is good until the
+// map's next set or remove.
+mvm_Object *mvm_HMap_get( const mvm_HMap *m, const mvm_Object *key )
+{
+  uint32_t i = _mvm_HMap_find( m, key, (uint32_t)mvm_hash_object( key ) );
+  return i == MVM_HMAP_END ? NULL : &m->slots[i].value;
+}
+
+// Set the value of key in m, adding it if it isn't there. Returns MVM_OK, or
+// MVM_ERROR_OUT_OF_MEMORY (leaving the map as it was).
+int mvm_HMap_set( mvm_HMap *m, const mvm_Object *key, const mvm_Object *value )
+{
+  uint32_t hash = (uint32_t)mvm_hash_object( key );
+  uint32_t i = _mvm_HMap_find( m, key, hash );
+  if ( i != MVM_HMAP_END ){
+    m->slots[i].value = *value;
+    return MVM_OK;
+  }
+
+  // Kept at most 7/8 full
+  if ( (uint64_t)(m->count + 1)*8 > (uint64_t)m->cap*7 ){
+    if ( m->cap > UINT32_MAX/2 ) return MVM_ERROR_OUT_OF_MEMORY;
+    int result = _mvm_HMap_resize( m, m->cap ? m->cap*2 : MVM_HMAP_MIN_CAP );
+    if ( result != MVM_OK ) return result;
+  }
+
+  mvm_HMap_Slot s;
+  s.key = *key;
+  s.value = *value;
+  s.hash = hash;
+  _mvm_HMap_place( m, s );
+  return MVM_OK;
+}
+
+// Remove key from m, storing its value in *value (if not NULL). Returns
+// whether it was there.
+bool mvm_HMap_remove( mvm_HMap *m, const mvm_Object *key, mvm_Object *value )
+{
+  uint32_t i = _mvm_HMap_find( m, key, (uint32_t)mvm_hash_object( key ) );
+  if ( i == MVM_HMAP_END ) return false;
+  if ( value ) *value = m->slots[i].value;
+
+  // Shift the slots after it back by one, up to an empty slot or one that's
+  // already home
+  uint32_t mask = m->cap - 1;
+  for ( uint32_t j = (i + 1) & mask; m->slots[j].dist > 1;
+        i = j, j = (j + 1) & mask ){
+    m->slots[i] = m->slots[j];
+    --m->slots[i].dist;
+  }
+  memset( &m->slots[i], 0, sizeof(mvm_HMap_Slot) );
+  --m->count;
+  return true;
+}
+
+// Iterate over m's entries, in no particular order: start with *i = 0, and
+// each call sets *key & *value to the next entry until it returns false. The
+// map mustn't be changed while iterating, other than through *value.
+bool mvm_HMap_next( const mvm_HMap *m, uint32_t *i, const mvm_Object **key,
+                    mvm_Object **value )
+{
+  for ( ; *i < m->cap; ++*i ){
+    if ( m->slots[*i].dist ){
+      *key = &m->slots[*i].key;
+      *value = &m->slots[*i].value;
+      ++*i;
+      return true;
+    }
   }
+  return false;
 }
 
-#define MVM_DEF_HASH_FUNCTION_FOR_PRIMATIVE( NAME, TYPE ) \
-  inline mvm_hash NAME(TYPE t){return mvm_hash_scstr((unsigned char*)&t,\
-                                                     sizeof(TYPE));}
-
-//------------------------------------------------------------------------------
-// Some default hash functions
-// Regular integers:
-MVM_DEF_HASH_FUNCTION_FOR_PRIMATIVE( mvm_hash_int, int )
-MVM_DEF_HASH_FUNCTION_FOR_PRIMATIVE( mvm_hash_uint, unsigned int )
-MVM_DEF_HASH_FUNCTION_FOR_PRIMATIVE( mvm_hash_longlong, long long int )
-MVM_DEF_HASH_FUNCTION_FOR_PRIMATIVE( mvm_hash_ulonglong, unsigned long long int )
-// stdint integers:
-MVM_DEF_HASH_FUNCTION_FOR_PRIMATIVE( mvm_hash_uint32, uint32_t )
-MVM_DEF_HASH_FUNCTION_FOR_PRIMATIVE( mvm_hash_uint64, uint64_t )
-MVM_DEF_HASH_FUNCTION_FOR_PRIMATIVE( mvm_hash_int32, int32_t )
-MVM_DEF_HASH_FUNCTION_FOR_PRIMATIVE( mvm_hash_int64, int64_t )
-// Floating point numbers:
-MVM_DEF_HASH_FUNCTION_FOR_PRIMATIVE( mvm_hash_float, float )
-MVM_DEF_HASH_FUNCTION_FOR_PRIMATIVE( mvm_hash_double, double )
\ No newline at end of file
+#endif // MVM_INCLUDE_HMAP
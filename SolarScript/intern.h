@@ -0,0 +1,216 @@
+/* Interned strings: one shared, read only copy of each distinct string, so
+   two interned strings are equal exactly when their pointers are.
+
+   Op names, the compiler's & linker's global names & string constants are
+   interned, which turns their trees' comparisons into pointer compares
+   (see mvm_interned_comp) and stores each name once however many programs
+   or modules use it. Interned strings stay put until MVM_CLEANUP, so don't
+   hold on to one after that.
+
+   The table is shared by every thread (batch compiles intern from worker
+   threads), split into shards by hash, each behind its own mutex, so
+   threads interning different names rarely wait on each other. Strings are
+   carved from large blocks rather than malloc'd one by one, & nothing is
+   ever removed, so each shard is plain linear probing. */
+
+#pragma once
+
+#ifndef MVM_INCLUDE_INTERN
+#define MVM_INCLUDE_INTERN
+
+#include "defs.h"
+#include "hash.h"
+
+#include <pthread.h>
+
+#define MVM_INTERN_BLOCK 16384 // bytes of strings per block (unless longer)
+#define MVM_INTERN_MIN_CAP 64 // slots in a shard's first allocation
+#define MVM_INTERN_SHARDS 16 // (a power of 2)
+
+// A block of interned strings
+typedef struct _mvm_Intern_Block
+{
+  struct _mvm_Intern_Block *next; // block filled before this one
+  size_t size, used; // bytes in (& used of) data
+  char data[1];
+} mvm_Intern_Block;
+
+typedef struct _mvm_Intern_Slot
+{
+  uint64_t hash;
+  const char* str; // NULL if the slot is empty
+  uint32_t len;
+} mvm_Intern_Slot;
+
+// The strings whose hashes' top bits pick it
+typedef struct _mvm_Intern_Shard
+{
+  pthread_mutex_t lock;
+  mvm_Intern_Slot *slots;
+  uint32_t cap, count; // cap is a power of 2 (or 0)
+  mvm_Intern_Block *blocks; // most recent first
+} mvm_Intern_Shard;
+
+#define _MVM_INTERN_SHARD { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, NULL }
+#define _MVM_INTERN_SHARDS_4 _MVM_INTERN_SHARD, _MVM_INTERN_SHARD,\
+  _MVM_INTERN_SHARD, _MVM_INTERN_SHARD
+
+struct __MVM_INTERN__
+{
+  mvm_Intern_Shard shards[MVM_INTERN_SHARDS];
+} MVM_INTERN = { { _MVM_INTERN_SHARDS_4, _MVM_INTERN_SHARDS_4,
+                   _MVM_INTERN_SHARDS_4, _MVM_INTERN_SHARDS_4 } };
+
+// Shard of strings with this hash (the slots use its low bits)
+mvm_Intern_Shard *_mvm_intern_shard( uint64_t hash )
+{
+  return &MVM_INTERN.shards[hash >> 60 & (MVM_INTERN_SHARDS - 1)];
+}
+
+// Order of two interned strings, for trees of them (by address, which is
+// stable but has nothing to do with their text)
+int mvm_interned_comp( const char* a, const char* b )
+{
+  return a < b ? -1 : a > b ? 1 : 0;
+}
+
+// Slot of the len bytes at s in shard t, or the empty slot it would go in
+// (t's lock held)
+mvm_Intern_Slot *_mvm_intern_find( mvm_Intern_Shard *t, const char* s,
+                                   uint32_t len, uint64_t hash )
+{
+  uint32_t mask = t->cap - 1;
+  for ( uint32_t i = (uint32_t)hash & mask;; i = (i + 1) & mask ){
+    mvm_Intern_Slot *slot = &t->slots[i];
+    if ( !slot->str || (slot->hash == hash && slot->len == len &&
+                        !memcmp( slot->str, s, len )) ){
+      return slot;
+    }
+  }
+}
+
+// Room for size bytes in a block of shard t (t's lock held), NULL if out of
+// memory
+char *_mvm_intern_alloc( mvm_Intern_Shard *t, size_t size )
+{
+  mvm_Intern_Block *b = t->blocks;
+  if ( !b || b->size - b->used < size ){
+    size_t n = size > MVM_INTERN_BLOCK ? size : MVM_INTERN_BLOCK;
+    if ( !(b = (mvm_Intern_Block*)malloc( sizeof(mvm_Intern_Block) + n )) ){
+      return NULL;
+    }
+    b->size = n;
+    b->used = 0;
+    // A big string gets a block of its own, behind the one being filled
+    if ( n > MVM_INTERN_BLOCK && t->blocks ){
+      b->next = t->blocks->next;
+      t->blocks->next = b;
+    }
+    else{
+      b->next = t->blocks;
+      t->blocks = b;
+    }
+  }
+  char *p = b->data + b->used;
+  b->used += size;
+  return p;
+}
+
+// Double shard t's table (t's lock held)
+bool _mvm_intern_grow( mvm_Intern_Shard *t )
+{
+  uint32_t cap = t->cap ? t->cap*2 : MVM_INTERN_MIN_CAP;
+  mvm_Intern_Slot *old = t->slots;
+  mvm_Intern_Slot *slots = (mvm_Intern_Slot*)calloc( cap,
+                                                     sizeof(mvm_Intern_Slot) );
+  if ( !slots || !cap ){
+    free( slots );
+    return false;
+  }
+
+  uint32_t oldcap = t->cap;
+  t->slots = slots;
+  t->cap = cap;
+  for ( uint32_t i = 0; i < oldcap; ++i ){
+    if ( old[i].str ){
+      *_mvm_intern_find( t, old[i].str, old[i].len, old[i].hash ) = old[i];
+    }
+  }
+  free( old );
+  return true;
+}
+
+/// The interned copy of the len bytes at s (which needn't be nul terminated),
+/// interning them if they aren't already. NULL if out of memory.
+const char* mvm_intern_slice( const char* s, uint32_t len )
+{
+  uint64_t hash = mvm_hash_str( s, len, MVM_HASH_STR_SEED );
+  mvm_Intern_Shard *t = _mvm_intern_shard( hash );
+  const char* str = NULL;
+
+  pthread_mutex_lock( &t->lock );
+  // Kept at most 3/4 full
+  if ( (uint64_t)(t->count + 1)*4 <= (uint64_t)t->cap*3 ||
+       _mvm_intern_grow( t ) ){
+    mvm_Intern_Slot *slot = _mvm_intern_find( t, s, len, hash );
+    char *copy = NULL;
+    if ( slot->str ) str = slot->str;
+    else if ( (copy = _mvm_intern_alloc( t, (size_t)len + 1 )) ){
+      memcpy( copy, s, len );
+      copy[len] = '\0';
+      slot->hash = hash;
+      slot->str = str = copy;
+      slot->len = len;
+      ++t->count;
+    }
+  }
+  pthread_mutex_unlock( &t->lock );
+
+  return str;
+}
+
+/// The interned copy of s, interning it if it isn't already. NULL if out of
+/// memory.
+const char* mvm_intern( const char* s )
+{
+  size_t len = strlen( s );
+  return len <= UINT32_MAX ? mvm_intern_slice( s, (uint32_t)len ) : NULL;
+}
+
+/// The interned copy of s if it's been interned, otherwise NULL (so nothing
+/// that's looked up by an interned name can have this name)
+const char* mvm_interned( const char* s )
+{
+  size_t len = strlen( s );
+  uint64_t hash = mvm_hash_str( s, len, MVM_HASH_STR_SEED );
+  mvm_Intern_Shard *t = _mvm_intern_shard( hash );
+  const char* str = NULL;
+
+  pthread_mutex_lock( &t->lock );
+  if ( t->count && len <= UINT32_MAX ){
+    str = _mvm_intern_find( t, s, (uint32_t)len, hash )->str;
+  }
+  pthread_mutex_unlock( &t->lock );
+
+  return str;
+}
+
+// Free every interned string (called by MVM_CLEANUP)
+void mvm_cleanup_interned()
+{
+  for ( uint32_t i = 0; i < MVM_INTERN_SHARDS; ++i ){
+    mvm_Intern_Shard *t = &MVM_INTERN.shards[i];
+    pthread_mutex_lock( &t->lock );
+    while ( t->blocks ){
+      mvm_Intern_Block *next = t->blocks->next;
+      free( t->blocks );
+      t->blocks = next;
+    }
+    free( t->slots );
+    t->slots = NULL;
+    t->cap = t->count = 0;
+    pthread_mutex_unlock( &t->lock );
+  }
+}
+
+#endif // MVM_INCLUDE_INTERN
@@ -0,0 +1,445 @@
+/* A three-address IR between the compiler's parser & bytecode (see
+   lazy_compiler.h), so programs are optimized before they're emitted.
+
+   Scripts are straight-line code for now, so the IR is one list of
+   instructions where every instruction defines one value, named by its
+   index - SSA without any phis. Values are only ever made through the
+   mvm_IR_* builders below, which optimize as they go:
+
+   constant folding     an op whose operands are all constants is run there &
+                        then, through the VM's own dispatch table on a scratch
+                        state, so folded results match run time exactly (wrap
+                        around, NaNs, numeric modes). Ops that fail (like a
+                        divide by zero) are left to fail at run time.
+   copy propagation     a global's current value is tracked through stores, so
+                        reading it back (or `x = y`) is the value itself, not a
+                        load
+   CSE                  an op with the same operands as an earlier one is that
+                        one's value (ops are pure)
+
+   & mvm_IR_emit() finishes with dead code elimination - only the last store
+   to each global is kept, and only values it needs are emitted - before
+   turning the IR into stack code. Values used more than once are kept in
+   registers of the function being emitted.
+
+   Every value's type is known, so ops are emitted as their unchecked
+   versions (see MVM_SPEC.unchecked in specialize.h) wherever there's one.
+   What they'd have checked is checked once, by an entry guard starting the
+   function: room for the deepest the code's stack gets, and a gcheck of
+   each global it reads (the only values whose type comes from outside).
+
+   Globals keep one type (see mvm_compile), so a load is typed as whatever
+   the compiler has settled the global's type to be. */
+
+#pragma once
+
+#ifndef MVM_INCLUDE_IR
+#define MVM_INCLUDE_IR
+
+#include "defs.h"
+#include "state.h"
+#include "ops.h"
+#include "bytecode.h"
+#include "specialize.h"
+#include "aatree.h"
+
+// Instructions that aren't VM ops
+#define MVM_IR_CONST -1 // the constant k
+#define MVM_IR_GLOAD -2 // global a, as it was before the program ran
+#define MVM_IR_GSTORE -3 // global a = value b (doesn't define a value)
+
+#define MVM_IR_NONE UINT32_MAX // no value (out of memory)
+
+typedef struct _mvm_IR_Instr
+{
+  int op; // MVM_IR_* or an opcode (which is pure & pushes one result)
+  uint32_t a, b; // operand values (b is unused by unary ops)
+  char nargs; // number of operand values (0 - 2)
+  char type; // MVM_TYPE of the value
+  mvm_Object k; // value of MVM_IR_CONST
+} mvm_IR_Instr;
+
+typedef struct _mvm_IR
+{
+  mvm_IR_Instr *code;
+  uint32_t size, cap;
+  uint32_t *current; // value each global holds (MVM_IR_NONE until it's used)
+  uint32_t nglobals, gcap;
+  mvm_AATree values; // values by instruction, for CSE (see mvm_IR_Node)
+  mvm_State *fold; // scratch state ops are folded on
+} mvm_IR;
+
+// An instruction & the value it defines, for looking up identical ones
+typedef struct _mvm_IR_Node
+{
+  int op;
+  uint32_t a, b;
+  uint64_t bits; // constant's type & value (see _mvm_IR_bits)
+  uint32_t value;
+} mvm_IR_Node;
+
+int _mvm_IR_Node_comp( void* a, void* b )
+{
+  mvm_IR_Node *na = (mvm_IR_Node*)a;
+  mvm_IR_Node *nb = (mvm_IR_Node*)b;
+
+  if ( na->op != nb->op ) return na->op < nb->op ? -1 : 1;
+  if ( na->a != nb->a ) return na->a < nb->a ? -1 : 1;
+  if ( na->b != nb->b ) return na->b < nb->b ? -1 : 1;
+  return na->bits < nb->bits ? -1 : na->bits > nb->bits ? 1 : 0;
+}
+
+// Bits of constant o, so equal constants (of the same type) compare equal.
+// The type goes in the node's a, this is just the value.
+uint64_t _mvm_IR_bits( mvm_Object o )
+{
+  uint64_t bits = 0;
+  switch ( mvm_obj_type( o ) ){
+    case MVM_TYPE::number:{
+      double d = (double)mvm_obj_number( o );
+      memcpy( &bits, &d, sizeof(bits) );
+      break;
+    }
+    case MVM_TYPE::integer: bits = (uint64_t)(int64_t)mvm_obj_int( o ); break;
+    case MVM_TYPE::boolean: bits = mvm_obj_bool( o ) ? 1 : 0; break;
+  }
+  return bits;
+}
+
+int mvm_init_IR( mvm_IR *ir )
+{
+  ir->code = NULL;
+  ir->size = ir->cap = 0;
+  ir->current = NULL;
+  ir->nglobals = ir->gcap = 0;
+  mvm_init_AATree( &ir->values, _mvm_IR_Node_comp );
+  ir->fold = mvm_new_State( 16, 0, 0 );
+  return ir->fold ? MVM_OK : MVM_ERROR_OUT_OF_MEMORY;
+}
+
+void mvm_cleanup_IR( mvm_IR *ir )
+{
+  if ( ir ){
+    if ( ir->code ) free( ir->code );
+    if ( ir->current ) free( ir->current );
+    if ( ir->fold ) mvm_del_State( ir->fold );
+    mvm_cleanup_AATree( &ir->values, true );
+    ir->code = NULL;
+    ir->current = NULL;
+    ir->fold = NULL;
+  }
+}
+
+// Add instruction i, or find the identical one added before. Returns its value.
+uint32_t _mvm_IR_add( mvm_IR *ir, const mvm_IR_Instr *i )
+{
+  mvm_IR_Node key = { i->op, i->a, i->b, 0, 0 };
+  if ( i->op == MVM_IR_CONST ){
+    key.a = (uint32_t)mvm_obj_type( i->k );
+    key.bits = _mvm_IR_bits( i->k );
+  }
+
+  mvm_IR_Node *n = NULL;
+  if ( i->op != MVM_IR_GSTORE ){
+    n = (mvm_IR_Node*)mvm_AATree_get( &ir->values, &key );
+    if ( n ) return n->value;
+  }
+
+  if ( ir->size == MVM_IR_NONE ||
+       !_MVM_GROW( ir->code, ir->size, ir->cap, mvm_IR_Instr ) ){
+    return MVM_IR_NONE;
+  }
+  if ( i->op != MVM_IR_GSTORE ){
+    if ( !(n = mvm_malloc(mvm_IR_Node)) ) return MVM_IR_NONE;
+    *n = key;
+    n->value = ir->size;
+    mvm_AATree_insert( &ir->values, n );
+  }
+
+  ir->code[ir->size] = *i;
+  return ir->size++;
+}
+
+uint32_t mvm_IR_const( mvm_IR *ir, mvm_Object k )
+{
+  mvm_IR_Instr i = { MVM_IR_CONST, 0, 0, 0, mvm_obj_type( k ), k };
+  return _mvm_IR_add( ir, &i );
+}
+
+// Run op on the constant operands of i, and make i the constant it gives.
+// Returns false (leaving i alone) if the op fails.
+bool _mvm_IR_fold( mvm_IR *ir, mvm_IR_Instr *i )
+{
+  mvm_State *prev = MVM_STATE, *s = ir->fold;
+  MVM_STATE = s;
+
+  s->sp = 0;
+  s->error = MVM_OK;
+  s->ir = 0;
+  mvm_push_object( &ir->code[i->a].k );
+  if ( i->nargs > 1 ) mvm_push_object( &ir->code[i->b].k );
+  MVM.dispatch[i->op]();
+
+  bool folded = s->error == MVM_OK && s->sp == (uint32_t)i->nargs + 1 &&
+                mvm_obj_is( s->s[s->sp - 1], i->type );
+  if ( folded ){
+    i->op = MVM_IR_CONST;
+    i->a = i->b = 0;
+    i->nargs = 0;
+    i->k = s->s[s->sp - 1];
+  }
+
+  s->sp = 0;
+  MVM_STATE = prev;
+  return folded;
+}
+
+uint32_t _mvm_IR_op( mvm_IR *ir, int op, char type, char nargs, uint32_t a,
+                     uint32_t b )
+{
+  if ( a == MVM_IR_NONE || b == MVM_IR_NONE || op < 0 || !MVM.dispatch[op] ){
+    return MVM_IR_NONE;
+  }
+
+  mvm_IR_Instr i = { op, a, b, nargs, type, {} };
+  if ( ir->code[a].op == MVM_IR_CONST && ir->code[b].op == MVM_IR_CONST ){
+    _mvm_IR_fold( ir, &i );
+  }
+
+  return _mvm_IR_add( ir, &i );
+}
+
+// The value of op (an opcode) on value a, of the given type
+uint32_t mvm_IR_unop( mvm_IR *ir, int op, char type, uint32_t a )
+{
+  return _mvm_IR_op( ir, op, type, 1, a, a );
+}
+
+// The value of op (an opcode) on values a & b, of the given type
+uint32_t mvm_IR_binop( mvm_IR *ir, int op, char type, uint32_t a, uint32_t b )
+{
+  return _mvm_IR_op( ir, op, type, 2, a, b );
+}
+
+// Make room to track global g, returns false if there isn't any
+bool _mvm_IR_global( mvm_IR *ir, uint32_t g )
+{
+  while ( g >= ir->nglobals ){
+    if ( !_MVM_GROW( ir->current, ir->nglobals, ir->gcap, uint32_t ) ){
+      return false;
+    }
+    ir->current[ir->nglobals++] = MVM_IR_NONE;
+  }
+  return true;
+}
+
+// The value of global g, which holds values of the given type
+uint32_t mvm_IR_load( mvm_IR *ir, uint32_t g, char type )
+{
+  if ( !_mvm_IR_global( ir, g ) ) return MVM_IR_NONE;
+
+  if ( ir->current[g] == MVM_IR_NONE ){
+    mvm_IR_Instr i = { MVM_IR_GLOAD, g, 0, 0, type, {} };
+    ir->current[g] = _mvm_IR_add( ir, &i );
+  }
+
+  return ir->current[g];
+}
+
+// global g = value v. Returns MVM_OK or an error.
+int mvm_IR_store( mvm_IR *ir, uint32_t g, uint32_t v )
+{
+  if ( v == MVM_IR_NONE || !_mvm_IR_global( ir, g ) ){
+    return MVM_ERROR_OUT_OF_MEMORY;
+  }
+
+  mvm_IR_Instr i = { MVM_IR_GSTORE, g, v, 1, ir->code[v].type, {} };
+  if ( _mvm_IR_add( ir, &i ) == MVM_IR_NONE ) return MVM_ERROR_OUT_OF_MEMORY;
+
+  ir->current[g] = v;
+  return MVM_OK;
+}
+
+// Emitting state: which values are live, how many times they're used, and
+// the register holding each one that's kept (MVM_IR_NONE if not)
+typedef struct _mvm_IR_Emit
+{
+  mvm_IR *ir;
+  mvm_Program *p;
+  uint32_t *uses;
+  uint32_t *reg; // (or for constants, their index in p's constants)
+  bool *done; // whether a kept value is in its register yet
+  uint32_t depth, max; // objects the code has on the stack, & the most
+  int result;
+  int op_pushk, op_gload, op_gstore, op_pop, op_nip, op_rpush, op_rstore;
+  int op_gcheck, op_room;
+} mvm_IR_Emit;
+
+void _mvm_IR_emit_op( mvm_IR_Emit *e, mvm_Instr i )
+{
+  if ( e->result == MVM_OK && mvm_Program_emit( e->p, i ) < 0 ){
+    e->result = MVM_ERROR_OUT_OF_MEMORY;
+  }
+}
+
+// Count n more objects on the stack (fewer for negative n) by the code
+void _mvm_IR_emit_depth( mvm_IR_Emit *e, int n )
+{
+  e->depth += n;
+  if ( e->depth > e->max ) e->max = e->depth;
+}
+
+// Emit code pushing value v
+void _mvm_IR_emit_value( mvm_IR_Emit *e, uint32_t v )
+{
+  const mvm_IR_Instr *i = &e->ir->code[v];
+
+  if ( i->op != MVM_IR_CONST && e->reg[v] != MVM_IR_NONE && e->done[v] ){
+    _mvm_IR_emit_op( e, MVM_INSTR3(e->op_rpush, 0, e->reg[v], 0) );
+    _mvm_IR_emit_depth( e, 1 );
+    return;
+  }
+
+  switch ( i->op ){
+    case MVM_IR_CONST:
+      if ( e->reg[v] == MVM_IR_NONE ){
+        int k = mvm_Program_add_constant( e->p, i->k );
+        if ( k < 0 ) e->result = MVM_ERROR;
+        e->reg[v] = (uint32_t)k;
+      }
+      _mvm_IR_emit_op( e, MVM_INSTR(e->op_pushk, e->reg[v]) );
+      _mvm_IR_emit_depth( e, 1 );
+      return;
+    case MVM_IR_GLOAD:
+      _mvm_IR_emit_op( e, MVM_INSTR(e->op_gload, i->a) );
+      _mvm_IR_emit_depth( e, 1 );
+      break;
+    default:
+      _mvm_IR_emit_value( e, i->a );
+      if ( i->nargs > 1 ) _mvm_IR_emit_value( e, i->b );
+      if ( MVM_SPEC.unchecked[i->op] != MVM_NO_SPEC ){
+        // The result replaces the operands in place
+        _mvm_IR_emit_op( e, MVM_INSTR(MVM_SPEC.unchecked[i->op], 0) );
+      }
+      else{
+        _mvm_IR_emit_op( e, MVM_INSTR(i->op, 0) );
+        _mvm_IR_emit_depth( e, 1 );
+        _mvm_IR_emit_op( e, MVM_INSTR(e->op_nip, i->nargs) );
+      }
+      _mvm_IR_emit_depth( e, 1 - (int)i->nargs - (MVM_SPEC.unchecked[i->op] == MVM_NO_SPEC) );
+      break;
+  }
+
+  if ( e->reg[v] != MVM_IR_NONE ){
+    _mvm_IR_emit_op( e, MVM_INSTR3(e->op_rstore, e->reg[v], 0, 0) );
+    e->done[v] = true;
+  }
+}
+
+// Emit ir's stores (after dead code elimination) to the end of p, as the
+// body of function fn, whose register count is set to what the code needs.
+// Constants are added to p as they're used. Returns MVM_OK or an error.
+int mvm_IR_emit( mvm_IR *ir, mvm_Program *p, uint32_t fn )
+{
+  mvm_IR_Emit e;
+  e.ir = ir;
+  e.p = p;
+  e.result = MVM_OK;
+  e.op_pushk = mvm_op_id( "pushk" );
+  e.op_gload = mvm_op_id( "gload" );
+  e.op_gstore = mvm_op_id( "gstore" );
+  e.op_pop = mvm_op_id( "pop" );
+  e.op_nip = mvm_op_id( "nip" );
+  e.op_rpush = mvm_op_id( "rpush" );
+  e.op_rstore = mvm_op_id( "rstore" );
+  e.op_gcheck = mvm_op_id( "gcheck" );
+  e.op_room = mvm_op_id( "room" );
+  e.depth = e.max = 0;
+
+  uint32_t n = ir->size ? ir->size : 1;
+  bool *stored = (bool*)calloc( ir->nglobals ? ir->nglobals : 1, sizeof(bool) );
+  e.uses = (uint32_t*)calloc( n, sizeof(uint32_t) );
+  e.reg = (uint32_t*)malloc( n*sizeof(uint32_t) );
+  e.done = (bool*)calloc( n, sizeof(bool) );
+  if ( !stored || !e.uses || !e.reg || !e.done ){
+    e.result = MVM_ERROR_OUT_OF_MEMORY;
+  }
+
+  // Only the last store to each global is live, and not even that if it
+  // stores the value the global started with. Live stores are marked by
+  // giving them a use.
+  for ( uint32_t v = ir->size; v-- > 0 && e.result == MVM_OK; ){
+    const mvm_IR_Instr *i = &ir->code[v];
+    if ( i->op == MVM_IR_GSTORE && !stored[i->a] ){
+      stored[i->a] = true;
+      const mvm_IR_Instr *x = &ir->code[i->b];
+      if ( !(x->op == MVM_IR_GLOAD && x->a == i->a) ) e.uses[v] = 1;
+    }
+  }
+
+  // Operands come before the values using them, so one backward pass finds
+  // every live value & counts its uses
+  for ( uint32_t v = ir->size; v-- > 0 && e.result == MVM_OK; ){
+    const mvm_IR_Instr *i = &ir->code[v];
+    if ( !e.uses[v] ) continue;
+    if ( i->op == MVM_IR_GSTORE ) ++e.uses[i->b];
+    else if ( i->op >= 0 ){
+      ++e.uses[i->a];
+      if ( i->nargs > 1 ) ++e.uses[i->b];
+    }
+  }
+
+  // Values used more than once are computed once into a register (constants
+  // are as cheap to push again), as are globals' starting values when the
+  // global is stored to, since the store would change what a load gives
+  uint32_t nregs = 0;
+  for ( uint32_t v = 0; v < ir->size && e.result == MVM_OK; ++v ){
+    const mvm_IR_Instr *i = &ir->code[v];
+    bool keep = i->op == MVM_IR_GLOAD ? e.uses[v] && stored[i->a] :
+                i->op >= 0 && e.uses[v] > 1;
+    e.reg[v] = MVM_IR_NONE;
+    if ( keep && nregs < MVM_MAX_REGISTERS ) e.reg[v] = nregs++;
+    else if ( keep && i->op == MVM_IR_GLOAD ) e.result = MVM_ERROR;
+  }
+  if ( e.result == MVM_OK ){
+    p->funcs[fn].nregs = (uint16_t)nregs;
+  }
+
+  // The entry guard (its room is patched in once the code's emitted), then
+  // starting values, then the stores in order
+  int room = e.result == MVM_OK ?
+             mvm_Program_emit( p, MVM_INSTR(e.op_room, 0) ) : MVM_ERROR;
+  if ( room < 0 ) e.result = MVM_ERROR_OUT_OF_MEMORY;
+  for ( uint32_t v = 0; v < ir->size && e.result == MVM_OK; ++v ){
+    const mvm_IR_Instr *i = &ir->code[v];
+    if ( i->op == MVM_IR_GLOAD && e.uses[v] ){
+      _mvm_IR_emit_op( &e, MVM_INSTR(e.op_gcheck, i->a) );
+    }
+  }
+  for ( uint32_t v = 0; v < ir->size && e.result == MVM_OK; ++v ){
+    const mvm_IR_Instr *i = &ir->code[v];
+    if ( i->op == MVM_IR_GLOAD && e.reg[v] != MVM_IR_NONE ){
+      _mvm_IR_emit_value( &e, v );
+      _mvm_IR_emit_op( &e, MVM_INSTR(e.op_pop, 1) );
+      _mvm_IR_emit_depth( &e, -1 );
+    }
+  }
+  for ( uint32_t v = 0; v < ir->size && e.result == MVM_OK; ++v ){
+    const mvm_IR_Instr *i = &ir->code[v];
+    if ( i->op == MVM_IR_GSTORE && e.uses[v] ){
+      _mvm_IR_emit_value( &e, i->b );
+      _mvm_IR_emit_op( &e, MVM_INSTR(e.op_gstore, i->a) );
+      _mvm_IR_emit_op( &e, MVM_INSTR(e.op_pop, 1) );
+      _mvm_IR_emit_depth( &e, -1 );
+    }
+  }
+  if ( e.result == MVM_OK ) mvm_Program_patch( p, (uint32_t)room, e.max );
+
+  free( stored );
+  free( e.uses );
+  free( e.reg );
+  free( e.done );
+  return e.result;
+}
+
+#endif // MVM_INCLUDE_IR
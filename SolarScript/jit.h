@@ -0,0 +1,567 @@
+/* A baseline template JIT from chunks & program functions to x86-64 machine
+   code.
+
+   Build with MVM_JIT defined to enable it (it's only available on x86-64
+   unix-likes, see defs.h). mvm_exec_chunk() counts how many times each chunk
+   runs and compiles it once the count reaches MVM_JIT_THRESHOLD.
+   mvm_continue_call() counts the calls of each function of a program plus
+   the jumps back within it (so a hot loop gets compiled even if its function
+   is only called once), and compiles the function at the same threshold.
+
+   Every instruction is translated on its own, in order, so the native code
+   keeps exactly the same mvm_State stack semantics as the interpreter:
+
+   - most ops become a call to their exec function, with ir & ip set up first
+     so mvm_arg() works as usual. The instruction is baked in as it was when
+     compiled: only the interpreter loop quickens, so a generic op stays a
+     call to the generic op (a quick op still de-quickens its instruction,
+     but the native code keeps calling it)
+   - some of the unchecked ops from specialize.h (add_nn, radd_nn, ...) are
+     emitted in-line as SSE in chunks, since they run behind the chunk's
+     entry guard
+   - in functions, jumps within the function become native jumps, & jt, jf &
+     the fused branches call their test (see MVM_FLOW) & jump on the result
+
+   After each call the error flag is checked and, if set, the native code
+   returns the index of the next instruction. mvm_exec_chunk() picks up the
+   interpreter loop from there, so leaving native code is possible after any
+   instruction. Functions' native code can also be entered at any of their
+   instructions (through a table), since it hands call, ret, jumps out of the
+   function & running out of budget back to mvm_continue_call(), & carries on
+   when the call returns or the next slice starts. Code is written to a plain
+   mmap'd buffer which is made executable (and read-only) once it's
+   complete.
+
+   Native code points straight at the instructions it was made from, so a
+   program's is thrown away whenever its code changes - a reload can do that
+   between two slices of a call, so mvm_continue_call() looks at the start of
+   every slice (see _mvm_call_check). */
+
+#pragma once
+
+#ifndef MVM_INCLUDE_JIT
+#define MVM_INCLUDE_JIT
+
+#include "defs.h"
+
+#ifdef MVM_JIT
+
+#include "state.h"
+#include "chunk.h"
+#include "specialize.h"
+#include "bytecode.h"
+#include "flowops.h"
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+#ifndef MVM_JIT_THRESHOLD
+#define MVM_JIT_THRESHOLD 64 // runs of a chunk (calls + loops of a function)
+#endif                           // before it's compiled
+
+// Compiled chunk: runs from the first instruction & returns the index of the
+// next instruction to interpret. *diff gets the stack difference.
+typedef uint32_t (*mvm_JitFn)( mvm_State *s, int *diff );
+
+// Compiled function: runs from instruction at of its code, at most *budget
+// instructions (*budget is left with what's left of it). Returns the index
+// (in the program) of the next instruction to interpret.
+typedef uint32_t (*mvm_JitFuncFn)( mvm_State *s, uint32_t at,
+                                   uint32_t *budget );
+
+// What the JIT keeps for each function of a program (see mvm_Program)
+typedef struct _mvm_JitFunc
+{
+  uint32_t hot; // calls & jumps back, until it's compiled
+  uint32_t start, end; // instructions compiled: start up to (not incl.) end
+  void *code; // native code, or NULL while it's interpreted
+  uint32_t size; // size of the mapping at code
+} mvm_JitFunc;
+
+// Growable buffer to assemble code into
+typedef struct _mvm_JitBuf
+{
+  uint8_t *p;
+  uint32_t size, cap;
+  bool failed; // ran out of memory at some point
+} mvm_JitBuf;
+
+void _mvm_jit_bytes( mvm_JitBuf *b, const void *d, uint32_t n )
+{
+  if ( b->size + n > b->cap ){
+    uint32_t cap = b->cap ? b->cap*2 : 4096;
+    while ( cap < b->size + n ) cap *= 2;
+    uint8_t *p = (uint8_t*)realloc( b->p, cap );
+    if ( !p ){
+      b->failed = true;
+      return;
+    }
+    b->p = p;
+    b->cap = cap;
+  }
+  memcpy( b->p + b->size, d, n );
+  b->size += n;
+}
+
+#define MVM_JIT_EMIT( B, ... ) do{\
+    const uint8_t _b[] = { __VA_ARGS__ };\
+    _mvm_jit_bytes( B, _b, sizeof(_b) );\
+  }while(0)
+
+void _mvm_jit_u32( mvm_JitBuf *b, uint32_t v ){ _mvm_jit_bytes( b, &v, 4 ); }
+void _mvm_jit_u64( mvm_JitBuf *b, uint64_t v ){ _mvm_jit_bytes( b, &v, 8 ); }
+
+// Offsets into mvm_State used by the templates (rbx holds the state)
+#define MVM_JIT_OFF_SP ((uint32_t)offsetof(mvm_State, sp))
+#define MVM_JIT_OFF_FP ((uint32_t)offsetof(mvm_State, fp))
+#define MVM_JIT_OFF_S ((uint32_t)offsetof(mvm_State, s))
+#define MVM_JIT_OFF_IR ((uint32_t)offsetof(mvm_State, ir))
+#define MVM_JIT_OFF_IP ((uint32_t)offsetof(mvm_State, ip))
+#define MVM_JIT_OFF_ERROR ((uint32_t)offsetof(mvm_State, error))
+
+// The in-line templates assume the plain tagged layout
+// (NaN-boxed chunks still get compiled, every op is just called)
+bool _mvm_jit_can_inline()
+{
+#ifdef MVM_NAN_BOXING
+  return false;
+#else
+  return (sizeof(mvmnum) == 4 || sizeof(mvmnum) == 8) &&
+         sizeof(mvm_Object) == 16 &&
+         offsetof(mvm_Object, type) == 0 && offsetof(mvm_Object, data) == 8;
+#endif
+}
+
+// Scalar SSE prefix: F3 for single (movss, addss...), F2 for double
+#define MVM_JIT_FP ((uint8_t)(sizeof(mvmnum) == 8 ? 0xF2 : 0xF3))
+
+// SSE opcode (the byte after F3 0F) of the in-line number op, or 0
+uint8_t _mvm_jit_sse_op( uint32_t op, bool *reg )
+{
+  static const char* stack[] = { "add_nn", "sub_nn", "mul_nn", "div_nn" };
+  static const char* regs[] = { "radd_nn", "rsub_nn", "rmul_nn", "rdiv_nn" };
+  static const uint8_t sse[] = { 0x58, 0x5C, 0x59, 0x5E }; // add,sub,mul,div
+
+  for ( int i = 0; i < 4; ++i ){
+    if ( (int)op == mvm_op_id( stack[i] ) ){ *reg = false; return sse[i]; }
+    if ( (int)op == mvm_op_id( regs[i] ) ){ *reg = true; return sse[i]; }
+  }
+
+  return 0;
+}
+
+// rdx = &s->s[s->REG] where OFF is the offset of sp or fp in mvm_State
+void _mvm_jit_slot_base( mvm_JitBuf *b, uint32_t off )
+{
+  MVM_JIT_EMIT( b, 0x8B, 0x83 ); _mvm_jit_u32( b, off ); // mov eax,[rbx+off]
+  MVM_JIT_EMIT( b, 0x48, 0x8B, 0x93 );
+  _mvm_jit_u32( b, MVM_JIT_OFF_S ); // mov rdx,[rbx+s]
+  MVM_JIT_EMIT( b, 0x48, 0xC1, 0xE0, 0x04 ); // shl rax,4
+  MVM_JIT_EMIT( b, 0x48, 0x01, 0xC2 ); // add rdx,rax
+}
+
+// a <op> b on the two numbers on top of the stack, result pushed
+void _mvm_jit_inline_stack( mvm_JitBuf *b, uint8_t sse )
+{
+  _mvm_jit_slot_base( b, MVM_JIT_OFF_SP );
+  MVM_JIT_EMIT( b, MVM_JIT_FP, 0x0F, 0x10, 0x42, 0xE8 ); // movss xmm0,[rdx-24]
+  MVM_JIT_EMIT( b, MVM_JIT_FP, 0x0F, sse, 0x42, 0xF8 ); // <op>ss xmm0,[rdx-8]
+  MVM_JIT_EMIT( b, 0xC6, 0x02, (uint8_t)MVM_TYPE::number ); // mov byte [rdx],T
+  MVM_JIT_EMIT( b, MVM_JIT_FP, 0x0F, 0x11, 0x42, 0x08 ); // movss [rdx+8],xmm0
+  MVM_JIT_EMIT( b, 0xFF, 0x83 ); _mvm_jit_u32( b, MVM_JIT_OFF_SP ); // inc sp
+  MVM_JIT_EMIT( b, 0x41, 0x83, 0xC4, 0x01 ); // add r12d,1
+}
+
+// r[d] = r[a] <op> r[b] on number registers
+void _mvm_jit_inline_reg( mvm_JitBuf *b, uint8_t sse, mvm_Instr i )
+{
+  _mvm_jit_slot_base( b, MVM_JIT_OFF_FP );
+  MVM_JIT_EMIT( b, MVM_JIT_FP, 0x0F, 0x10, 0x82 ); // movss xmm0,[rdx+a*16+8]
+  _mvm_jit_u32( b, MVM_ARG_A(i)*16 + 8 );
+  MVM_JIT_EMIT( b, MVM_JIT_FP, 0x0F, sse, 0x82 ); // <op>ss xmm0,[rdx+b*16+8]
+  _mvm_jit_u32( b, MVM_ARG_B(i)*16 + 8 );
+  MVM_JIT_EMIT( b, 0xC6, 0x82 ); // mov byte [rdx+d*16],T
+  _mvm_jit_u32( b, MVM_ARG_D(i)*16 );
+  MVM_JIT_EMIT( b, (uint8_t)MVM_TYPE::number );
+  MVM_JIT_EMIT( b, MVM_JIT_FP, 0x0F, 0x11, 0x82 ); // movss [rdx+d*16+8],xmm0
+  _mvm_jit_u32( b, MVM_ARG_D(i)*16 + 8 );
+}
+
+// Call the exec function of instruction *ip (as i), adding what it returns
+// to r12d if diff, then leave if it set an error
+void _mvm_jit_call( mvm_JitBuf *b, mvm_Instr *ip, mvm_Instr i, int (*exec)(),
+                    bool diff, uint32_t *exit_patch )
+{
+  MVM_JIT_EMIT( b, 0xC7, 0x83 ); // mov dword [rbx+ir],i
+  _mvm_jit_u32( b, MVM_JIT_OFF_IR );
+  _mvm_jit_u32( b, i );
+  MVM_JIT_EMIT( b, 0x48, 0xB8 ); _mvm_jit_u64( b, (uint64_t)ip ); // mov rax,ip
+  MVM_JIT_EMIT( b, 0x48, 0x89, 0x83 );
+  _mvm_jit_u32( b, MVM_JIT_OFF_IP ); // mov [rbx+ip],rax
+  MVM_JIT_EMIT( b, 0x48, 0xB8 ); _mvm_jit_u64( b, (uint64_t)exec );
+  MVM_JIT_EMIT( b, 0xFF, 0xD0 ); // call rax
+  if ( diff ) MVM_JIT_EMIT( b, 0x41, 0x01, 0xC4 ); // add r12d,eax
+  MVM_JIT_EMIT( b, 0x83, 0xBB ); // cmp dword [rbx+error],MVM_OK
+  _mvm_jit_u32( b, MVM_JIT_OFF_ERROR );
+  MVM_JIT_EMIT( b, (uint8_t)MVM_OK );
+  MVM_JIT_EMIT( b, 0x0F, 0x85 ); // jne exit stub (patched later)
+  *exit_patch = b->size;
+  _mvm_jit_u32( b, 0 );
+}
+
+// Patch the rel32 at b->p[at] to jump to b->size
+void _mvm_jit_patch_here( mvm_JitBuf *b, uint32_t at )
+{
+  int32_t rel = (int32_t)(b->size - (at + 4));
+  memcpy( b->p + at, &rel, 4 );
+}
+
+// Compile c to native code. Returns MVM_OK, or MVM_ERROR if compilation
+// failed (c then stays interpreted).
+int mvm_jit_compile( mvm_Chunk *c )
+{
+  if ( c->jit ) return MVM_OK;
+
+  mvm_JitBuf b = { NULL, 0, 0, false };
+  uint32_t *exits = (uint32_t*)malloc( sizeof(uint32_t)*(c->size + 1) );
+  uint32_t *exit_pc = (uint32_t*)malloc( sizeof(uint32_t)*(c->size + 1) );
+  uint32_t nexits = 0;
+  bool inline_ok = _mvm_jit_can_inline();
+  if ( !exits || !exit_pc ){
+    free( exits ); free( exit_pc );
+    return MVM_ERROR;
+  }
+
+  // Prologue: rbx = state, r13 = diff out, r12d = diff
+  MVM_JIT_EMIT( &b, 0x53, 0x41, 0x54, 0x41, 0x55 ); // push rbx,r12,r13
+  MVM_JIT_EMIT( &b, 0x48, 0x89, 0xFB ); // mov rbx,rdi
+  MVM_JIT_EMIT( &b, 0x49, 0x89, 0xF5 ); // mov r13,rsi
+  MVM_JIT_EMIT( &b, 0x45, 0x31, 0xE4 ); // xor r12d,r12d
+
+  uint32_t i = 0;
+  for ( ; i < c->size; ++i ){
+    uint32_t op = MVM_OP(c->code[i]);
+    bool reg = false;
+    uint8_t sse = inline_ok ? _mvm_jit_sse_op( op, &reg ) : 0;
+
+    if ( sse && !reg ){
+      _mvm_jit_inline_stack( &b, sse );
+    }
+    else if ( sse && reg && c->mode == MVM_CHUNK_REGISTER ){
+      _mvm_jit_inline_reg( &b, sse, c->code[i] );
+    }
+    else if ( MVM.dispatch[op] ){
+      exit_pc[nexits] = i + 1;
+      _mvm_jit_call( &b, &c->code[i], c->code[i], MVM.dispatch[op], true,
+                     &exits[nexits++] );
+    }
+    else{
+      break; // leave the invalid op for the interpreter to report
+    }
+  }
+
+  // Fell off the end (or hit an op we can't run): return i
+  MVM_JIT_EMIT( &b, 0xB8 ); _mvm_jit_u32( &b, i ); // mov eax,i
+  MVM_JIT_EMIT( &b, 0xE9 ); // jmp epilogue
+  uint32_t to_epilogue = b.size;
+  _mvm_jit_u32( &b, 0 );
+
+  // Exit stubs: return the index after the instruction that failed
+  for ( uint32_t e = 0; e < nexits; ++e ){
+    _mvm_jit_patch_here( &b, exits[e] );
+    MVM_JIT_EMIT( &b, 0xB8 ); _mvm_jit_u32( &b, exit_pc[e] ); // mov eax,pc
+    MVM_JIT_EMIT( &b, 0xE9 ); // jmp epilogue
+    exits[e] = b.size;
+    _mvm_jit_u32( &b, 0 );
+  }
+
+  // Epilogue: *diff = r12d, restore & return eax
+  _mvm_jit_patch_here( &b, to_epilogue );
+  for ( uint32_t e = 0; e < nexits; ++e ) _mvm_jit_patch_here( &b, exits[e] );
+  MVM_JIT_EMIT( &b, 0x45, 0x89, 0x65, 0x00 ); // mov [r13],r12d
+  MVM_JIT_EMIT( &b, 0x41, 0x5D, 0x41, 0x5C, 0x5B ); // pop r13,r12,rbx
+  MVM_JIT_EMIT( &b, 0xC3 ); // ret
+
+  free( exits );
+  free( exit_pc );
+
+  if ( b.failed ){
+    free( b.p );
+    return MVM_ERROR;
+  }
+
+  // Copy into fresh pages, then flip them from writable to executable
+  void *mem = mmap( NULL, b.size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+  if ( mem == MAP_FAILED ){
+    free( b.p );
+    return MVM_ERROR;
+  }
+  memcpy( mem, b.p, b.size );
+  free( b.p );
+  if ( mprotect( mem, b.size, PROT_READ | PROT_EXEC ) ){
+    munmap( mem, b.size );
+    return MVM_ERROR;
+  }
+
+  c->jit = mem;
+  c->jit_size = b.size;
+
+  return MVM_OK;
+}
+
+// Run compiled chunk c from its first instruction, adding its stack
+// difference to *diff. Returns the index of the next instruction to interpret.
+uint32_t mvm_jit_run( mvm_Chunk *c, int *diff )
+{
+  int d = 0;
+  uint32_t pc = ((mvm_JitFn)c->jit)( MVM_STATE, &d );
+  *diff += d;
+  return pc;
+}
+
+// The test jt & jf run in native code: pop a bool, giving 1 or 0 (or -1
+// with the error set if it isn't one)
+int _mvm_jit_test_bool( mvm_State *s )
+{
+  bool worked = false;
+  mvmbool b = mvm_get_bool( 1, &worked );
+  if ( !worked ){
+    s->error = MVM_BAD_ARG_1;
+    return -1;
+  }
+  --s->sp;
+  return b ? 1 : 0;
+}
+
+// Code from a jump to be patched to instruction target once it's emitted
+typedef struct _mvm_JitJump
+{
+  uint32_t at; // rel32 to patch
+  uint32_t target; // index in the function
+} mvm_JitJump;
+
+// Copy b into fresh pages & flip them from writable to executable, returns
+// them (& sets *size) or NULL
+void *_mvm_jit_map( mvm_JitBuf *b, uint32_t *size )
+{
+  void *mem = mmap( NULL, b->size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+  if ( mem == MAP_FAILED ) return NULL;
+  memcpy( mem, b->p, b->size );
+  if ( mprotect( mem, b->size, PROT_READ | PROT_EXEC ) ){
+    munmap( mem, b->size );
+    return NULL;
+  }
+  *size = b->size;
+  return mem;
+}
+
+// Compile function fn of p to native code (see the top of the file): its
+// instructions are the ones from its entry up to the next function's. Returns
+// MVM_OK, or MVM_ERROR if compilation failed (fn then stays interpreted).
+int mvm_jit_compile_function( mvm_Program *p, uint32_t fn )
+{
+  if ( !p->jit || fn >= p->njit ) return MVM_ERROR;
+  mvm_JitFunc *j = &p->jit[fn];
+  if ( j->code ) return MVM_OK;
+
+  uint32_t start = p->funcs[fn].entry, end = p->size;
+  for ( uint32_t i = 0; i < p->nfuncs; ++i ){
+    uint32_t e = p->funcs[i].entry;
+    if ( e > start && e < end ) end = e;
+  }
+  uint32_t n = end - start;
+
+  mvm_JitBuf b = { NULL, 0, 0, false };
+  uint32_t *label = (uint32_t*)malloc( sizeof(uint32_t)*n );
+  uint32_t *exits = (uint32_t*)malloc( sizeof(uint32_t)*3*n ); // (at most 3
+  uint32_t *exit_pc = (uint32_t*)malloc( sizeof(uint32_t)*3*n ); // per instr)
+  mvm_JitJump *jumps = (mvm_JitJump*)malloc( sizeof(mvm_JitJump)*n );
+  uint32_t nexits = 0, njumps = 0;
+  if ( !label || !exits || !exit_pc || !jumps ){
+    free( label ); free( exits ); free( exit_pc ); free( jumps );
+    return MVM_ERROR;
+  }
+
+  // Prologue: rbx = state, r13 = budget out, r12d = budget, then through the
+  // table to instruction at
+  MVM_JIT_EMIT( &b, 0x53, 0x41, 0x54, 0x41, 0x55 ); // push rbx,r12,r13
+  MVM_JIT_EMIT( &b, 0x48, 0x89, 0xFB ); // mov rbx,rdi
+  MVM_JIT_EMIT( &b, 0x49, 0x89, 0xD5 ); // mov r13,rdx
+  MVM_JIT_EMIT( &b, 0x44, 0x8B, 0x22 ); // mov r12d,[rdx]
+  MVM_JIT_EMIT( &b, 0x89, 0xF6 ); // mov esi,esi
+  MVM_JIT_EMIT( &b, 0x48, 0x8D, 0x05 ); // lea rax,[rip+table]
+  uint32_t to_table = b.size;
+  _mvm_jit_u32( &b, 0 );
+  MVM_JIT_EMIT( &b, 0x48, 0x63, 0x0C, 0xB0 ); // movsxd rcx,[rax+rsi*4]
+  MVM_JIT_EMIT( &b, 0x48, 0x01, 0xC8 ); // add rax,rcx
+  MVM_JIT_EMIT( &b, 0xFF, 0xE0 ); // jmp rax
+
+  for ( uint32_t i = 0; i < n; ++i ){
+    label[i] = b.size;
+    mvm_Instr *ip = &p->code[start + i];
+    mvm_Instr in = p->map ? mvm_unquicken( *ip ) : *ip; // (can't de-quicken)
+    uint32_t op = MVM_OP(in), arg = MVM_ARG(in);
+    char kind = MVM_FLOW.kind[op];
+
+    // Calls, returns & invalid ops are left for the interpreter to run
+    if ( kind == MVM_FLOW_CALL || kind == MVM_FLOW_RET ||
+         (kind == MVM_FLOW_OP && !MVM.dispatch[op]) ){
+      MVM_JIT_EMIT( &b, 0xB8 ); _mvm_jit_u32( &b, start + i ); // mov eax,pc
+      exit_pc[nexits] = UINT32_MAX; // (jumps straight to the epilogue)
+      MVM_JIT_EMIT( &b, 0xE9 ); // jmp epilogue
+      exits[nexits++] = b.size;
+      _mvm_jit_u32( &b, 0 );
+      continue;
+    }
+
+    // Out of budget: stop before this instruction
+    MVM_JIT_EMIT( &b, 0x45, 0x85, 0xE4 ); // test r12d,r12d
+    MVM_JIT_EMIT( &b, 0x0F, 0x84 ); // jz exit stub
+    exit_pc[nexits] = start + i;
+    exits[nexits++] = b.size;
+    _mvm_jit_u32( &b, 0 );
+    MVM_JIT_EMIT( &b, 0x41, 0xFF, 0xCC ); // dec r12d
+
+    if ( kind == MVM_FLOW_OP ){
+      exit_pc[nexits] = start + i + 1;
+      _mvm_jit_call( &b, ip, in, MVM.dispatch[op], false, &exits[nexits++] );
+      continue;
+    }
+    else if ( kind == MVM_FLOW_JMP ){
+      MVM_JIT_EMIT( &b, 0xE9 ); // jmp target
+    }
+    else{
+      int (*test)( mvm_State* ) = kind == MVM_FLOW_BRANCH ?
+                                  MVM_FLOW.test[op] : _mvm_jit_test_bool;
+      int on = kind == MVM_FLOW_BRANCH ? MVM_FLOW.on[op] : kind == MVM_FLOW_JT;
+      MVM_JIT_EMIT( &b, 0x48, 0x89, 0xDF ); // mov rdi,rbx
+      MVM_JIT_EMIT( &b, 0x48, 0xB8 ); _mvm_jit_u64( &b, (uint64_t)test );
+      MVM_JIT_EMIT( &b, 0xFF, 0xD0 ); // call rax
+      MVM_JIT_EMIT( &b, 0x85, 0xC0 ); // test eax,eax
+      MVM_JIT_EMIT( &b, 0x0F, 0x88 ); // js exit stub
+      exit_pc[nexits] = start + i + 1;
+      exits[nexits++] = b.size;
+      _mvm_jit_u32( &b, 0 );
+      MVM_JIT_EMIT( &b, 0x83, 0xF8, (uint8_t)on ); // cmp eax,on
+      MVM_JIT_EMIT( &b, 0x0F, 0x84 ); // je target
+    }
+
+    // Jumps within the function are patched once every label is known, the
+    // rest leave for the interpreter to carry on at their target
+    if ( arg >= start && arg < end ){
+      jumps[njumps].at = b.size;
+      jumps[njumps++].target = arg - start;
+    }
+    else{
+      exit_pc[nexits] = arg;
+      exits[nexits++] = b.size;
+    }
+    _mvm_jit_u32( &b, 0 );
+  }
+
+  // Fell off the end of the function
+  MVM_JIT_EMIT( &b, 0xB8 ); _mvm_jit_u32( &b, end ); // mov eax,end
+  MVM_JIT_EMIT( &b, 0xE9 ); // jmp epilogue
+  uint32_t to_epilogue = b.size;
+  _mvm_jit_u32( &b, 0 );
+
+  // Exit stubs: return the instruction to carry on at
+  for ( uint32_t e = 0; e < nexits; ++e ){
+    if ( exit_pc[e] == UINT32_MAX ) continue;
+    _mvm_jit_patch_here( &b, exits[e] );
+    MVM_JIT_EMIT( &b, 0xB8 ); _mvm_jit_u32( &b, exit_pc[e] ); // mov eax,pc
+    MVM_JIT_EMIT( &b, 0xE9 ); // jmp epilogue
+    exits[e] = b.size;
+    _mvm_jit_u32( &b, 0 );
+  }
+
+  // Epilogue: *budget = r12d, restore & return eax
+  _mvm_jit_patch_here( &b, to_epilogue );
+  for ( uint32_t e = 0; e < nexits; ++e ) _mvm_jit_patch_here( &b, exits[e] );
+  MVM_JIT_EMIT( &b, 0x45, 0x89, 0x65, 0x00 ); // mov [r13],r12d
+  MVM_JIT_EMIT( &b, 0x41, 0x5D, 0x41, 0x5C, 0x5B ); // pop r13,r12,rbx
+  MVM_JIT_EMIT( &b, 0xC3 ); // ret
+
+  // The table: where each instruction's code is, from the table
+  _mvm_jit_patch_here( &b, to_table );
+  uint32_t table = b.size;
+  for ( uint32_t i = 0; i < n; ++i ){
+    _mvm_jit_u32( &b, (uint32_t)((int32_t)label[i] - (int32_t)table) );
+  }
+
+  if ( !b.failed ){
+    for ( uint32_t k = 0; k < njumps; ++k ){
+      int32_t rel = (int32_t)(label[jumps[k].target] - (jumps[k].at + 4));
+      memcpy( b.p + jumps[k].at, &rel, 4 );
+    }
+  }
+
+  free( label );
+  free( exits );
+  free( exit_pc );
+  free( jumps );
+
+  void *mem = b.failed ? NULL : _mvm_jit_map( &b, &j->size );
+  free( b.p );
+  if ( !mem ) return MVM_ERROR;
+
+  j->code = mem;
+  j->start = start;
+  j->end = end;
+
+  return MVM_OK;
+}
+
+// Count a call of function fn of p, or a jump back within it
+void mvm_jit_count( mvm_Program *p, uint32_t fn )
+{
+  if ( fn >= p->njit && fn < p->nfuncs ){ // (functions added since)
+    mvm_JitFunc *jit = (mvm_JitFunc*)realloc( p->jit,
+                                              sizeof(mvm_JitFunc)*p->nfuncs );
+    if ( !jit ) return;
+    memset( jit + p->njit, 0, sizeof(mvm_JitFunc)*(p->nfuncs - p->njit) );
+    p->jit = jit;
+    p->njit = p->nfuncs;
+  }
+  if ( fn < p->njit && p->jit[fn].hot < MVM_JIT_THRESHOLD ) ++p->jit[fn].hot;
+}
+
+// Run function fn of p natively from *pc (compiling it first if it's hot),
+// moving *pc to the instruction to interpret next & taking what ran off
+// *budget. Returns false if fn isn't compiled or *pc isn't in its code.
+bool mvm_jit_run_function( mvm_Program *p, uint32_t fn, uint32_t *pc,
+                           uint32_t *budget )
+{
+  if ( !p->jit || fn >= p->njit || !*budget ) return false;
+  mvm_JitFunc *j = &p->jit[fn];
+  if ( !j->code ){
+    if ( j->hot < MVM_JIT_THRESHOLD ) return false;
+    if ( mvm_jit_compile_function( p, fn ) != MVM_OK ){
+      j->hot = 0; // try again later
+      return false;
+    }
+  }
+  if ( *pc < j->start || *pc >= j->end ) return false;
+
+  *pc = ((mvm_JitFuncFn)j->code)( MVM_STATE, *pc - j->start, budget );
+  return true;
+}
+
+// Throw away p's native code & counts (its code has changed, or it's being
+// cleaned up)
+void mvm_jit_cleanup_Program( mvm_Program *p )
+{
+  if ( !p->jit ) return;
+  for ( uint32_t i = 0; i < p->njit; ++i ){
+    if ( p->jit[i].code ) munmap( p->jit[i].code, p->jit[i].size );
+  }
+  free( p->jit );
+  p->jit = NULL;
+  p->njit = 0;
+}
+
+#endif // MVM_JIT
+
+#endif // MVM_INCLUDE_JIT
@@ -5,10 +5,17 @@
 
 
 /* A super lazy compiler from text to MVM bytecode */
+
+#pragma once
+
 #include "defs.h"
 #include "vm.h"
 #include "state.h"
 #include "dllist.h"
+#include "lexer.h"
+#include "ir.h"
+
+#include <errno.h>
 
 typedef struct _mvm_Map_Node_cstr_to_uint32
 {
@@ -24,90 +31,33 @@ int _mvm_MNode_cstr_to_uint32_comp( void* a, void* b )
   return strcmp( na->key, nb->key );
 }
 
-char* mvm_grow_char_array( char* src, uint32_t size, uint32_t new_size )
+// For nodes whose keys are interned (see intern.h)
+int _mvm_MNode_interned_to_uint32_comp( void* a, void* b )
 {
-  char* dest = (char*)malloc(sizeof(char)*new_size);
+  mvm_MNode_cstr_to_uint32 *na = (mvm_MNode_cstr_to_uint32*)a;
+  mvm_MNode_cstr_to_uint32 *nb = (mvm_MNode_cstr_to_uint32*)b;
 
-  if ( dest ){
-    for ( uint32_t i = 0; i < (size < new_size ? size : new_size); ++i ){
-      dest[i] = src[i];
-    }
-    if ( src ) free( src );
-    return dest;
-  }
-  else{
-    return NULL;
-  }
+  return mvm_interned_comp( na->key, nb->key );
 }
 
-// Parse a token from text & set token to the tokens text (space separated data)
-void _mvm_skip_whitespace( const char* text, uint32_t *i )
+// Convert the text of an MVM_TOKEN_NUMBER or MVM_TOKEN_INT token to the number
+// or integer it stands for, at the width the MVM was built with (see MVM_DOUBLE &
+// MVM_INT64 in defs.h). Returns false if the token doesn't fit.
+bool mvm_token_to_number( const char* text, mvmnum *n )
 {
-  if ( text ){
-    while ( text[*i] == ' ' ||
-            text[*i] == '\n' ||
-            text[*i] == '\t' ||
-            text[*i] == '\r' ) {
-      ++(*i);
-    }
-  }
-}
-
-// Parses a token into a new char* (which you must free)
-char* _mvm_parse_token( const char* text, uint32_t *i ){
-  uint32_t ss = 8;
-  char* s = (char*)malloc(ss);
-  uint32_t si = 0;
-
-  _mvm_skip_whitespace( text, i );
-  if ( text[*i] ){ // not at EOL
-    while ( text[*i] && 
-            text[*i] != ' ' &&
-            text[*i] != '\n' &&
-            text[*i] != '\t' &&
-            text[*i] != '\r' ) {
-      s[si] = text[*i];
-      si += 1;
-      (*i) += 1;
-      if ( si > (ss - 2) ){
-        s = mvm_grow_char_array( s, ss, ss*2 );
-        ss = ss*2;
-      }
-    }
-
-    // shrink ss down to size:
-    s = mvm_grow_char_array( s, ss, si+1 );
-
-    s[si] = '\0'; // add null terminator
-
-    return s;
-  }
-  else{
-    if ( s ) free(s);
-    return NULL;
-  }
+  char *end = NULL;
+  errno = 0;
+  *n = mvm_strtonum( text, &end );
+  return end && *end == '\0' && errno != ERANGE;
 }
 
-// Check if a token is a number of the form [.]?[0-9]*[.]?[0-9]*
-// 1 = int, 2 = float, 0 = not a number
-int mvm_token_is_number( const char* text )
+bool mvm_token_to_int( const char* text, mvmint *i )
 {
-  bool saw_dot = false; // Whether a decimal has been seen yet
-  uint32_t i = 0;
-  while ( text[i] != '\0' ){
-    if ( text[i] == '.' ){
-      if ( saw_dot ){
-        return 0; // too many decimals in number
-      }
-      saw_dot = true;
-    }
-    else if ( !(text[i] > ('0'-1) && text[i] < ('9'+1)) ){
-      return 0; // Something other than a number was found in the token
-    }
-    ++i;
-  }
-
-  return i ? (saw_dot ? 2 : 1) : 0;
+  char *end = NULL;
+  errno = 0;
+  long long v = strtoll( text, &end, 10 );
+  *i = (mvmint)v;
+  return end && *end == '\0' && errno != ERANGE && (long long)*i == v;
 }
 
 // 0 = not boolean, 1 = true, 2 = false
@@ -118,7 +68,7 @@ int mvm_token_is_boolean( const char* text )
 
 typedef struct _mvm_Var_Node
 {
-  const char* name;
+  const char* name; // interned
   const char type;
 } mvm_Var_Node;
 
@@ -131,7 +81,7 @@ int _mvm_Var_Node_comp( void* a, void* b )
   mvm_Var_Node *va = (mvm_Var_Node*)a;
   mvm_Var_Node *vb = (mvm_Var_Node*)b;
 
-  return strcmp(va->name, vb->name);
+  return mvm_interned_comp(va->name, vb->name);
 }
 
 
@@ -140,65 +90,397 @@ typedef struct _mvm_Scope
   mvm_Tree vars;
 } mvm_Scope;
 
-// Returns bytecode version of the provided ASCII text code.
-// Bytecode layout is:
-// [constants|globals|user functions in order of declaration]
-const char* mvm_compile( const char* text, char** err )
+// The constant token t stands for, in *k. Returns false if t isn't one.
+bool _mvm_compile_constant( const mvm_Lexer *l, const mvm_Token *t,
+                            mvm_Object *k )
 {
-  uint32_t i = 0;
+  // The converters want nul terminated text, and no constant is this long
+  char str[64];
+  if ( t->length >= sizeof(str) ) return false;
+  memcpy( str, l->src + t->offset, t->length );
+  str[t->length] = '\0';
+
+  mvmnum num;
+  mvmint i;
+  if ( t->kind == MVM_TOKEN_INT ){
+    if ( !mvm_token_to_int( str, &i ) ) return false;
+    mvm_obj_set_int( *k, i );
+  }
+  else if ( t->kind == MVM_TOKEN_NUMBER ){
+    if ( !mvm_token_to_number( str, &num ) ) return false;
+    mvm_obj_set_number( *k, num );
+  }
+  else if ( t->kind == MVM_TOKEN_NAME && mvm_token_is_boolean( str ) ){
+    mvm_obj_set_bool( *k, mvm_token_is_boolean( str ) == 1 );
+  }
+  else{
+    return false;
+  }
+  return true;
+}
+
+// Binary operators, by precedence (loosest first). Each names the op it
+// stands for with number, integer & boolean operands, or NULL if it doesn't
+// take them. An integer with a number is done as numbers.
+typedef struct _mvm_Binary_Op
+{
+  const char* text;
+  int prec;
+  bool compare; // whether the result is a boolean (not the operands' type)
+  const char* ops[3]; // number, integer & boolean ops
+} mvm_Binary_Op;
+
+const mvm_Binary_Op MVM_BINARY_OPS[] = {
+  { "or", 1, false, { NULL, NULL, "or" } },
+  { "||", 1, false, { NULL, NULL, "or" } },
+  { "nor", 1, false, { NULL, NULL, "nor" } },
+  { "xor", 2, false, { NULL, NULL, "xor" } },
+  { "nxor", 2, false, { NULL, NULL, "nxor" } },
+  { "and", 3, false, { NULL, NULL, "and" } },
+  { "&&", 3, false, { NULL, NULL, "and" } },
+  { "nand", 3, false, { NULL, NULL, "nand" } },
+  { "==", 4, true, { "eq", "ieq", "nxor" } },
+  { "!=", 4, true, { "ne", "ine", "xor" } },
+  { "<", 4, true, { "lt", "ilt", NULL } },
+  { "<=", 4, true, { "le", "ile", NULL } },
+  { ">", 4, true, { "gt", "igt", NULL } },
+  { ">=", 4, true, { "ge", "ige", NULL } },
+  { "|", 5, false, { NULL, "bor", "or" } },
+  { "^", 6, false, { NULL, "bxor", "xor" } },
+  { "&", 7, false, { NULL, "band", "and" } },
+  { "<<", 8, false, { NULL, "shl", NULL } },
+  { ">>", 8, false, { NULL, "shr", NULL } },
+  { "+", 9, false, { "add", "iadd", NULL } },
+  { "-", 9, false, { "sub", "isub", NULL } },
+  { "*", 10, false, { "mul", "imul", NULL } },
+  { "/", 10, false, { "div", "idiv", NULL } },
+  { "%", 10, false, { NULL, "imod", NULL } },
+};
+
+#define MVM_NUM_BINARY_OPS (sizeof(MVM_BINARY_OPS)/sizeof(MVM_BINARY_OPS[0]))
+
+#define MVM_MAX_NESTING 256 // deepest an expression can nest
+
+// Names that can't be globals
+bool _mvm_is_keyword( const mvm_Lexer *l, const mvm_Token *t )
+{
+  const char* words[] = { "true", "false", "not", "and", "or", "xor", "nand",
+                          "nor", "nxor" };
+  for ( uint32_t i = 0; i < sizeof(words)/sizeof(words[0]); ++i ){
+    if ( mvm_token_is( l, t, words[i] ) ) return true;
+  }
+  return false;
+}
+
+typedef struct _mvm_Compiler
+{
+  mvm_Lexer l;
+  mvm_Token t; // next token
+  mvm_Program p;
+  mvm_IR ir;
+  mvm_AATree globals; // globals declared so far (interned name -> index)
+  const mvm_AATree *types; // types other modules give globals (or NULL)
+  uint32_t depth; // how deep the expression being compiled is nested
+  uint32_t line; // line the statement being compiled starts on
+  const char* error; // what went wrong, NULL if nothing has yet
+  // Opcodes, looked up once per compile (MVM_NOT_FOUND for a NULL op)
+  int op_itof, op_mul, op_ineg, op_bnot, op_not, op_ret;
+  int op_binary[MVM_NUM_BINARY_OPS][3]; // MVM_BINARY_OPS' ops
+} mvm_Compiler;
+
+// Look up the opcodes c emits
+void _mvm_compile_ops( mvm_Compiler *c )
+{
+  c->op_itof = mvm_op_id( "itof" );
+  c->op_mul = mvm_op_id( "mul" );
+  c->op_ineg = mvm_op_id( "ineg" );
+  c->op_bnot = mvm_op_id( "bnot" );
+  c->op_not = mvm_op_id( "not" );
+  c->op_ret = mvm_op_id( "ret" );
+  for ( uint32_t i = 0; i < MVM_NUM_BINARY_OPS; ++i ){
+    for ( int j = 0; j < 3; ++j ){
+      const char* name = MVM_BINARY_OPS[i].ops[j];
+      c->op_binary[i][j] = name ? mvm_op_id( name ) : MVM_NOT_FOUND;
+    }
+  }
+}
 
-  // Need a list of tokens!!! Linked list time!
-  mvm_List l;
-  mvm_init_List( &l );
+void _mvm_compile_next( mvm_Compiler *c )
+{
+  mvm_lex( &c->l, &c->t );
+}
 
+// Index of the global named by token t, or MVM_NOT_FOUND. With add, a new
+// global is added if there isn't one (MVM_ERROR if it can't be).
+int _mvm_compile_global( mvm_Compiler *c, const mvm_Token *t, bool add )
+{
+  mvm_MNode_cstr_to_uint32 key = {
+    mvm_intern_slice( c->l.src + t->offset, t->length ), 0 };
+  if ( !key.key ) return MVM_ERROR;
+  mvm_MNode_cstr_to_uint32 *gn =
+    (mvm_MNode_cstr_to_uint32*)mvm_AATree_get( &c->globals, &key );
+  if ( gn ) return (int)gn->value;
+  if ( !add ) return MVM_NOT_FOUND;
+
+  // Globals are named by the interned name, so nothing's copied
+  int g = MVM_ERROR;
+  if ( (gn = mvm_malloc(mvm_MNode_cstr_to_uint32)) ){
+    g = mvm_Program_add_global( &c->p, key.key );
+  }
+  if ( g >= 0 ){
+    *gn = key;
+    gn->value = (uint32_t)g;
+    mvm_AATree_insert( &c->globals, gn );
+
+    // A global other modules use already has its type
+    mvm_MNode_cstr_to_uint32 *tn = !c->types ? NULL :
+      (mvm_MNode_cstr_to_uint32*)mvm_AATree_get( (mvm_AATree*)c->types, &key );
+    if ( tn ) mvm_Program_type_global( &c->p, (uint32_t)g, (char)tn->value );
+  }
+  else{
+    free( gn );
+  }
+  return g;
+}
 
+// Check that v was made, setting the error if not
+uint32_t _mvm_compile_made( mvm_Compiler *c, uint32_t v )
+{
+  if ( v == MVM_IR_NONE && !c->error ) c->error = "Out of memory";
+  return v;
+}
 
-  while ( text[i] ){
-    char* token = _mvm_parse_token( text, &i );
-    if ( !token ){
-      printf( "EOF reached\n\n" );
-      break;
+// Value of a op b, for binary operator o
+uint32_t _mvm_compile_binary( mvm_Compiler *c, const mvm_Binary_Op *o,
+                              uint32_t a, uint32_t b )
+{
+  char ta = c->ir.code[a].type, tb = c->ir.code[b].type;
+  const int *ops = c->op_binary[o - MVM_BINARY_OPS];
+  if ( ta == MVM_TYPE::integer && tb == MVM_TYPE::number && o->ops[0] ){
+    a = mvm_IR_unop( &c->ir, c->op_itof, ta = tb, a );
+  }
+  else if ( ta == MVM_TYPE::number && tb == MVM_TYPE::integer && o->ops[0] ){
+    b = mvm_IR_unop( &c->ir, c->op_itof, tb = ta, b );
+  }
+
+  int op = ta != tb ? MVM_NOT_FOUND :
+           ta == MVM_TYPE::number ? ops[0] :
+           ta == MVM_TYPE::integer ? ops[1] :
+           ta == MVM_TYPE::boolean ? ops[2] : MVM_NOT_FOUND;
+  if ( op < 0 ){
+    c->error = "Operands don't fit the operator";
+    return MVM_IR_NONE;
+  }
+
+  char type = o->compare ? (char)MVM_TYPE::boolean : ta;
+  return _mvm_compile_made( c, mvm_IR_binop( &c->ir, op, type, a, b ) );
+}
+
+uint32_t _mvm_compile_expr( mvm_Compiler *c, int prec );
+
+// A constant, global, parenthesized expression or unary operator & operand
+uint32_t _mvm_compile_unary( mvm_Compiler *c )
+{
+  mvm_Lexer *l = &c->l;
+  mvm_Token t = c->t;
+  mvm_Object k;
+
+  if ( ++c->depth > MVM_MAX_NESTING ){
+    c->error = "Expression is nested too deeply";
+    return MVM_IR_NONE;
+  }
+
+  uint32_t v = MVM_IR_NONE;
+  if ( mvm_token_is( l, &t, "(" ) ){
+    _mvm_compile_next( c );
+    v = _mvm_compile_expr( c, 1 );
+    if ( !c->error && !mvm_token_is( l, &c->t, ")" ) ){
+      c->error = "Expected ')'";
+    }
+    _mvm_compile_next( c );
+  }
+  else if ( _mvm_compile_constant( l, &t, &k ) ){
+    _mvm_compile_next( c );
+    v = _mvm_compile_made( c, mvm_IR_const( &c->ir, k ) );
+  }
+  else if ( t.kind == MVM_TOKEN_NAME && !_mvm_is_keyword( l, &t ) ){
+    _mvm_compile_next( c );
+    int g = _mvm_compile_global( c, &t, false );
+    if ( g < 0 ) c->error = "Unknown global";
+    else{
+      // Read before anything's stored, it's still the number it starts as
+      if ( c->p.gtypes[g] == MVM_TYPE_UNKNOWN ){
+        mvm_Program_type_global( &c->p, (uint32_t)g, MVM_TYPE::number );
+      }
+      v = _mvm_compile_made( c,
+        mvm_IR_load( &c->ir, (uint32_t)g, c->p.gtypes[g] ) );
+    }
+  }
+  else if ( mvm_token_is( l, &t, "-" ) || mvm_token_is( l, &t, "!" ) ||
+            mvm_token_is( l, &t, "not" ) || mvm_token_is( l, &t, "~" ) ){
+    _mvm_compile_next( c );
+    uint32_t a = _mvm_compile_unary( c );
+    char type = a == MVM_IR_NONE ? 0 : c->ir.code[a].type;
+    int op = MVM_NOT_FOUND;
+    if ( c->error ){
+      // (already reported)
+    }
+    else if ( mvm_token_is( l, &t, "-" ) && type == MVM_TYPE::number ){
+      // There's no number negate, but * -1 gets -0 & NaNs right
+      mvm_obj_set_number( k, (mvmnum)-1 );
+      v = _mvm_compile_made( c, mvm_IR_binop( &c->ir, c->op_mul, type, a,
+                                              mvm_IR_const( &c->ir, k ) ) );
+    }
+    else if ( mvm_token_is( l, &t, "-" ) ){
+      op = type == MVM_TYPE::integer ? c->op_ineg : MVM_NOT_FOUND;
+    }
+    else if ( mvm_token_is( l, &t, "~" ) ){
+      op = type == MVM_TYPE::integer ? c->op_bnot : MVM_NOT_FOUND;
     }
     else{
-      printf( "Parsed token \"%s\", i = %u\n", token, i );
-      mvm_List_append( &l, (void*)token );
+      op = type == MVM_TYPE::boolean ? c->op_not : MVM_NOT_FOUND;
+    }
+
+    if ( op >= 0 ){
+      v = _mvm_compile_made( c, mvm_IR_unop( &c->ir, op, type, a ) );
+    }
+    else if ( v == MVM_IR_NONE && !c->error ){
+      c->error = "Operand doesn't fit the operator";
+    }
+  }
+  else{
+    c->error = "Expected an expression";
+  }
+
+  --c->depth;
+  return c->error ? MVM_IR_NONE : v;
+}
+
+// An expression of binary operators binding at least as tightly as prec
+uint32_t _mvm_compile_expr( mvm_Compiler *c, int prec )
+{
+  uint32_t v = _mvm_compile_unary( c );
+
+  while ( !c->error ){
+    const mvm_Binary_Op *o = NULL;
+    if ( c->t.kind == MVM_TOKEN_OP || c->t.kind == MVM_TOKEN_NAME ){
+      for ( uint32_t i = 0; i < MVM_NUM_BINARY_OPS; ++i ){
+        if ( mvm_token_is( &c->l, &c->t, MVM_BINARY_OPS[i].text ) ){
+          o = &MVM_BINARY_OPS[i];
+          break;
+        }
+      }
     }
+    if ( !o || o->prec < prec ) break;
+
+    _mvm_compile_next( c );
+    uint32_t b = _mvm_compile_expr( c, o->prec + 1 );
+    if ( !c->error ) v = _mvm_compile_binary( c, o, v, b );
   }
 
-  mvm_AATree constants; // list of all constants declared
-  mvm_init_AATree( &constants, _mvm_MNode_cstr_to_uint32_comp );
+  return c->error ? MVM_IR_NONE : v;
+}
+
+// Returns bytecode version of the provided ASCII text code (a block saved by
+// mvm_Program_save, see bytecode.h - free() it when done), or NULL with *err
+// set to a message (which you must free) if it doesn't compile.
+// A program is a list of `name = expression` statements (optionally ended by
+// `;`), run by its main function, which assign globals. Expressions are made
+// of constants, globals assigned earlier (or by the same statement, which
+// reads the value the global had before), parentheses & the operators in
+// MVM_BINARY_OPS, plus unary - ! not ~. They're typed as they're compiled &
+// optimized on the way through (see ir.h), so only what the program's final
+// globals need is emitted.
+// A global keeps one type for good: the type of the first value stored to
+// it, or number if it's read first (as it starts out as one). Main is run
+// again & again, so storing another type would break the code reading it.
+const char* mvm_compile( const char* text, char** err );
+
+// mvm_compile() for one module of many (see batch.h & reload.h): types is a
+// tree of mvm_MNode_cstr_to_uint32 (interned name -> MVM_TYPE, compared by
+// _mvm_MNode_interned_to_uint32_comp) holding the types the other modules
+// have given globals, which this one reads them as & has to keep. It may be
+// NULL.
+const char* mvm_compile_module( const char* text, const mvm_AATree *types,
+                                char** err )
+{
+  mvm_Compiler c;
+  mvm_init_Lexer( &c.l, text, (uint32_t)strlen( text ) );
+  mvm_init_Program( &c.p );
+  mvm_init_AATree( &c.globals, _mvm_MNode_interned_to_uint32_comp );
+  c.types = types;
+  c.depth = 0;
+  c.line = 1;
+  c.error = NULL;
+  _mvm_compile_ops( &c );
+  c.p.main = (uint32_t)mvm_Program_add_function( &c.p, 0, 0 );
+  if ( mvm_init_IR( &c.ir ) != MVM_OK ) c.error = "Out of memory";
+
+  // Tokens are pulled straight from the lexer, one statement at a time
+  _mvm_compile_next( &c );
+  while ( !c.error && c.t.kind != MVM_TOKEN_END ){
+    if ( mvm_token_is( &c.l, &c.t, ";" ) ){
+      _mvm_compile_next( &c );
+      continue;
+    }
+
+    mvm_Token name = c.t;
+    c.line = name.line;
+    _mvm_compile_next( &c );
+    if ( name.kind != MVM_TOKEN_NAME || _mvm_is_keyword( &c.l, &name ) ||
+         !mvm_token_is( &c.l, &c.t, "=" ) ){
+      c.error = "Expected 'name = expression'";
+      break;
+    }
+    _mvm_compile_next( &c );
 
-  // go through the tokens and identify constants (unique numbers, strings and booleans)
-  mvm_List_Node *c = l.head;
-  uint32_t const_loc = 0;
+    int g = _mvm_compile_global( &c, &name, true );
+    if ( g < 0 ){
+      c.error = "Too many globals";
+      break;
+    }
 
-  while ( c ){
-    char* str = (char*)c->data;
-    if ( mvm_token_is_number(str) ){
-      mvm_MNode_cstr_to_uint32 *n = mvm_malloc(mvm_MNode_cstr_to_uint32);
-      *n = {str, const_loc++};
-      mvm_AATree_insert_overwrite( &constants, n , true );
-      printf( "Token '%s' can be converted safely to a number\n", str );
+    uint32_t v = _mvm_compile_expr( &c, 1 );
+    char type = v == MVM_IR_NONE ? (char)MVM_TYPE_UNKNOWN : c.ir.code[v].type;
+    if ( c.error ){
+      // (already reported)
+    }
+    else if ( c.p.gtypes[g] != MVM_TYPE_UNKNOWN && c.p.gtypes[g] != type ){
+      c.error = "Global's type can't change";
     }
-    else if ( mvm_token_is_boolean(str) ){
-      mvm_MNode_cstr_to_uint32 *n = mvm_malloc(mvm_MNode_cstr_to_uint32);
-      *n = {str, const_loc++};
-      mvm_AATree_insert_overwrite( &constants, n , true );
-      printf( "Token '%s' can be converted safely to a boolean\n", str );
+    else if ( mvm_IR_store( &c.ir, (uint32_t)g, v ) != MVM_OK ){
+      c.error = "Out of memory";
     }
-    c = c->n;
+    else{
+      mvm_Program_type_global( &c.p, (uint32_t)g, type );
+    }
+  }
+
+  if ( !c.error && (mvm_IR_emit( &c.ir, &c.p, c.p.main ) != MVM_OK ||
+                    mvm_Program_emit( &c.p, MVM_INSTR(c.op_ret, 0) ) < 0) ){
+    c.error = "Program is too big";
   }
 
-  mvm_AATree globals; // list of all global variables
-  mvm_AATree scopes; // list of scopes (head = deepest, tail = global)
+  char* bytes = NULL;
+  uint32_t size = 0;
+  if ( !c.error ) mvm_fuse_program( &c.p );
+  if ( !c.error && !(bytes = mvm_Program_save( &c.p, &size )) ){
+    c.error = "Out of memory";
+  }
 
-  // Convert the list of tokens l into bytecode  
+  if ( c.error && err ){
+    *err = (char*)malloc( strlen( c.error ) + 32 );
+    if ( *err ) sprintf( *err, "%s (line %u)", c.error, c.line );
+  }
 
-  // cleanup the token list
-  mvm_List_shred( &l );
+  mvm_cleanup_Program( &c.p );
+  mvm_cleanup_IR( &c.ir );
+  mvm_cleanup_AATree( &c.globals, true );
 
-  // Cleanup the constants tree
-  mvm_cleanup_AATree( &constants, true );
+  return bytes;
+}
 
-  return NULL; // Set this to something!
-}
\ No newline at end of file
+const char* mvm_compile( const char* text, char** err )
+{
+  return mvm_compile_module( text, NULL, err );
+}
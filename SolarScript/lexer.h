@@ -0,0 +1,175 @@
+/* A streaming lexer for SolarScript source. Tokens are slices of the source
+   (offset & length) rather than copies, so lexing allocates nothing - the
+   compiler pulls one token at a time & only copies what it keeps (names of
+   globals etc).
+
+   Tokens:
+
+   names     [A-Za-z_][A-Za-z0-9_]*        (true & false are names too)
+   integers  [0-9]+
+   numbers   [0-9]*.[0-9]*                 (at least one digit)
+   strings   "..." with \ escapes, on one line (the slice includes the quotes)
+   operators == != <= >= && || << >> .. += -= *= /= and single characters
+             = + - * / % < > ! ( ) { } [ ] , . ; : ^ & | ~
+   comments  // to the end of the line, and C style block comments (both are
+             skipped, like spaces)
+
+   The source doesn't have to be nul terminated, so it can be a slice of a
+   bigger buffer or a mapped file. */
+
+#pragma once
+
+#ifndef MVM_INCLUDE_LEXER
+#define MVM_INCLUDE_LEXER
+
+#include "defs.h"
+
+// Token kinds
+#define MVM_TOKEN_END 0 // end of the source
+#define MVM_TOKEN_NAME 1
+#define MVM_TOKEN_INT 2
+#define MVM_TOKEN_NUMBER 3
+#define MVM_TOKEN_STRING 4
+#define MVM_TOKEN_OP 5
+#define MVM_TOKEN_ERROR 6 // unterminated string or comment, or a stray byte
+
+typedef struct _mvm_Token
+{
+  uint32_t offset; // start of the token in the source
+  uint32_t length; // length of the token in bytes
+  uint32_t line; // line the token starts on (from 1)
+  char kind; // MVM_TOKEN_*
+} mvm_Token;
+
+typedef struct _mvm_Lexer
+{
+  const char* src; // source being lexed
+  uint32_t size; // size of src in bytes
+  uint32_t pos; // offset of the next byte to look at
+  uint32_t line; // line pos is on
+} mvm_Lexer;
+
+void mvm_init_Lexer( mvm_Lexer *l, const char* src, uint32_t size )
+{
+  l->src = src;
+  l->size = size;
+  l->pos = 0;
+  l->line = 1;
+}
+
+// Character classes (unsigned compares, so one branch each)
+#define _MVM_IS_DIGIT( C ) ((unsigned char)((C) - '0') < 10)
+#define _MVM_IS_ALPHA( C ) ((unsigned char)(((C) | 32) - 'a') < 26 || (C) == '_')
+
+// Whether a followed by b is a two character operator
+bool _mvm_is_op2( char a, char b )
+{
+  switch ( a ){
+    case '=': case '<': case '>': return b == '=' || b == a;
+    case '&': case '|': case '.': return b == a;
+    case '!': case '+': case '-': case '*': case '/': return b == '=';
+  }
+  return false;
+}
+
+// Skip spaces, newlines & comments. Returns false on an unterminated comment.
+bool _mvm_lex_skip( mvm_Lexer *l )
+{
+  const char* s = l->src;
+  uint32_t i = l->pos, n = l->size;
+
+  while ( i < n ){
+    char c = s[i];
+    if ( c == '\n' ){
+      ++l->line;
+      ++i;
+    }
+    else if ( c == ' ' || c == '\t' || c == '\r' ){
+      ++i;
+    }
+    else if ( c == '/' && i + 1 < n && s[i + 1] == '/' ){
+      while ( i < n && s[i] != '\n' ) ++i;
+    }
+    else if ( c == '/' && i + 1 < n && s[i + 1] == '*' ){
+      i += 2;
+      while ( i + 1 < n && !(s[i] == '*' && s[i + 1] == '/') ){
+        if ( s[i] == '\n' ) ++l->line;
+        ++i;
+      }
+      if ( i + 1 >= n ){
+        l->pos = n;
+        return false;
+      }
+      i += 2;
+    }
+    else{
+      break;
+    }
+  }
+
+  l->pos = i;
+  return true;
+}
+
+// Read the next token into t, returns its kind
+char mvm_lex( mvm_Lexer *l, mvm_Token *t )
+{
+  bool closed = _mvm_lex_skip( l );
+  const char* s = l->src;
+  uint32_t i = l->pos, n = l->size;
+
+  t->offset = i;
+  t->line = l->line;
+
+  if ( !closed ) t->kind = MVM_TOKEN_ERROR;
+  else if ( i >= n ) t->kind = MVM_TOKEN_END;
+  else{
+    char c = s[i++];
+
+    if ( _MVM_IS_ALPHA( c ) ){
+      while ( i < n && (_MVM_IS_ALPHA( s[i] ) || _MVM_IS_DIGIT( s[i] )) ) ++i;
+      t->kind = MVM_TOKEN_NAME;
+    }
+    else if ( _MVM_IS_DIGIT( c ) ||
+              (c == '.' && i < n && _MVM_IS_DIGIT( s[i] )) ){
+      bool dot = c == '.';
+      while ( i < n && (_MVM_IS_DIGIT( s[i] ) || (s[i] == '.' && !dot)) ){
+        dot = dot || s[i] == '.';
+        ++i;
+      }
+      t->kind = dot ? MVM_TOKEN_NUMBER : MVM_TOKEN_INT;
+    }
+    else if ( c == '"' ){
+      while ( i < n && s[i] != '"' && s[i] != '\n' ){
+        i += s[i] == '\\' && i + 1 < n && s[i + 1] != '\n' ? 2 : 1;
+      }
+      if ( i < n && s[i] == '"' ){
+        ++i;
+        t->kind = MVM_TOKEN_STRING;
+      }
+      else{
+        t->kind = MVM_TOKEN_ERROR;
+      }
+    }
+    else if ( strchr( "=+-*/%<>!(){}[],.;:^&|~", c ) && c ){
+      if ( i < n && _mvm_is_op2( c, s[i] ) ) ++i;
+      t->kind = MVM_TOKEN_OP;
+    }
+    else{
+      t->kind = MVM_TOKEN_ERROR;
+    }
+  }
+
+  t->length = i - t->offset;
+  l->pos = i;
+  return t->kind;
+}
+
+// Whether t's text is exactly text
+bool mvm_token_is( const mvm_Lexer *l, const mvm_Token *t, const char* text )
+{
+  return strlen( text ) == t->length &&
+         !memcmp( l->src + t->offset, text, t->length );
+}
+
+#endif // MVM_INCLUDE_LEXER
@@ -0,0 +1,350 @@
+// Copyright (C) 2021 Quin J. G. Rider (QuinJRider@Gmail.com)
+// This is proprietary source code, and as such you have no rights to do
+// anything with it without written permission from the copyright holder
+// stated on the first line.
+
+/* Throughput benchmarks for the MVM. Build & run with `make bench`, which
+   builds this once per numeric mode (see MVM_DOUBLE etc. in defs.h) so the
+   modes can be compared side by side. */
+
+#include <stdio.h>
+#include "vm.h"
+#include "lazy_compiler.h"
+#include "batch.h"
+#include "hmap.h"
+#include "strings.h"
+
+#define BENCH_RUNS 200000
+
+// Time calls of c (which leaves nothing on the stack) & print ops per second
+void bench_chunk( const char* name, mvm_Chunk *c, uint32_t ops_per_run )
+{
+  mvm_State *s = mvm_get_state();
+  double start = mvm_now();
+  for ( uint32_t i = 0; i < BENCH_RUNS; ++i ){
+    mvm_exec_chunk( c );
+    s->sp = 0;
+  }
+  double took = mvm_now() - start;
+
+  if ( s->error != MVM_OK ) printf( "%s: error %d\n", name, s->error );
+  printf( "  %-28s %8.1f Mops/s\n", name,
+          (double)BENCH_RUNS*ops_per_run/took/1e6 );
+}
+
+// One step of x += v*dt, v += a*dt, in register mode (r0 = x, r1 = v)
+void bench_integrate( bool specialize )
+{
+  mvm_Chunk c;
+  mvm_init_Chunk( &c, MVM_CHUNK_REGISTER, 5 );
+  mvm_Chunk_add_number( &c, (mvmnum)1.5e11 ); // x (~1 AU, in m)
+  mvm_Chunk_add_number( &c, (mvmnum)2.98e4 ); // v
+  mvm_Chunk_add_number( &c, (mvmnum)-5.9e-3 ); // a
+  mvm_Chunk_add_number( &c, (mvmnum)60.0 ); // dt
+  mvm_Chunk_emit( &c, MVM_INSTR3(mvm_op_id("rloadk"), 0, 0, 0) );
+  mvm_Chunk_emit( &c, MVM_INSTR3(mvm_op_id("rloadk"), 1, 1, 0) );
+  mvm_Chunk_emit( &c, MVM_INSTR3(mvm_op_id("rloadk"), 2, 2, 0) );
+  mvm_Chunk_emit( &c, MVM_INSTR3(mvm_op_id("rloadk"), 3, 3, 0) );
+  for ( int i = 0; i < 16; ++i ){
+    mvm_Chunk_emit( &c, MVM_INSTR3(mvm_op_id("rmul"), 4, 1, 3) ); // v*dt
+    mvm_Chunk_emit( &c, MVM_INSTR3(mvm_op_id("radd"), 0, 0, 4) );
+    mvm_Chunk_emit( &c, MVM_INSTR3(mvm_op_id("rmul"), 4, 2, 3) ); // a*dt
+    mvm_Chunk_emit( &c, MVM_INSTR3(mvm_op_id("radd"), 1, 1, 4) );
+  }
+
+  if ( specialize ){
+    mvm_specialize( &c, NULL, 0 );
+    bench_chunk( "integrate (registers, spec)", &c, c.size );
+  }
+  else{
+    bench_chunk( "integrate (registers)", &c, c.size );
+  }
+  mvm_cleanup_Chunk( &c );
+}
+
+// A chain of stack arithmetic, quickened as it runs
+void bench_stack()
+{
+  mvm_Chunk c;
+  mvm_init_Chunk( &c, MVM_CHUNK_STACK, 0 );
+  mvm_Chunk_add_number( &c, (mvmnum)1.0000001 );
+  mvm_Chunk_emit( &c, MVM_INSTR(mvm_op_id("pushk"), 0) );
+  mvm_Chunk_emit( &c, MVM_INSTR(mvm_op_id("pushk"), 0) );
+  for ( int i = 0; i < 16; ++i ){
+    mvm_Chunk_emit( &c, MVM_INSTR(mvm_op_id("ipmul"), 0) );
+    mvm_Chunk_emit( &c, MVM_INSTR(mvm_op_id("ipadd"), 0) );
+  }
+
+  bench_chunk( "arith (stack, quickened)", &c, c.size );
+  mvm_cleanup_Chunk( &c );
+}
+
+// Lex & compile ~4MB of generated source (1000 globals, many constants)
+void bench_compile()
+{
+  const uint32_t lines = 200000;
+  size_t cap = (size_t)lines*48, size = 0;
+  char *src = (char*)malloc( cap );
+  for ( uint32_t i = 0; i < lines; ++i ){
+    char *line = src + size;
+    size_t left = cap - size;
+    switch ( i % 4 ){
+      case 0: size += snprintf( line, left, "orbit_%u = %u.%u // period\n",
+                                i % 1000, i % 5000, i % 97 ); break;
+      case 1: size += snprintf( line, left, "mass_%u = %u\n",
+                                i % 1000, i % 5000 ); break;
+      case 2: size += snprintf( line, left, "/* flag */ lit_%u = true\n",
+                                i % 1000 ); break;
+      default: size += snprintf( line, left, "radius_%u = .%u\n",
+                                 i % 1000, i % 5000 );
+    }
+  }
+
+  mvm_Lexer l;
+  mvm_Token t;
+  uint64_t tokens = 0;
+  double start = mvm_now();
+  mvm_init_Lexer( &l, src, (uint32_t)size );
+  while ( mvm_lex( &l, &t ) != MVM_TOKEN_END ) ++tokens;
+  double took = mvm_now() - start;
+  printf( "  %-28s %8.1f Mtokens/s (%.1f MB/s)\n", "lex", tokens/took/1e6,
+          size/took/1e6 );
+
+  char *error = NULL;
+  start = mvm_now();
+  const char* bytes = mvm_compile( src, &error );
+  took = mvm_now() - start;
+  if ( error ){
+    printf( "compile: %s\n", error );
+    free( error );
+  }
+  printf( "  %-28s %8.1f Mtokens/s (%.1f MB/s)\n", "compile", tokens/took/1e6,
+          size/took/1e6 );
+
+  free( (void*)bytes );
+  free( src );
+}
+
+// Compile many modules serially & on every CPU (see batch.h)
+void bench_compile_batch()
+{
+  const uint32_t modules = 64, lines = 4000;
+  const char** srcs = (const char**)malloc( sizeof(const char*)*modules );
+  size_t total = 0;
+  for ( uint32_t m = 0; m < modules; ++m ){
+    size_t cap = (size_t)lines*64, size = 0;
+    char *src = (char*)malloc( cap );
+    for ( uint32_t i = 0; i < lines; ++i ){
+      size += snprintf( src + size, cap - size,
+                        "m%u_%u = %u.5 * (%u + %u) - %u / 3.0\n", m, i % 500,
+                        i % 97, i % 13, m, i );
+    }
+    srcs[m] = src;
+    total += size;
+  }
+
+  long cpus = sysconf( _SC_NPROCESSORS_ONLN );
+  uint32_t threads[] = { 1, cpus > 1 ? (uint32_t)cpus : 1 };
+  for ( uint32_t t = 0; t < (threads[1] > 1 ? 2u : 1u); ++t ){
+    mvm_Program p;
+    mvm_init_Program( &p );
+    char *error = NULL;
+    double start = mvm_now();
+    if ( mvm_compile_batch( &p, srcs, modules, threads[t], &error ) != MVM_OK ){
+      printf( "batch compile: %s\n", error ? error : "failed" );
+      free( error );
+    }
+    double took = mvm_now() - start;
+    char name[48];
+    snprintf( name, sizeof(name), "batch compile, %u thread%s", threads[t],
+              threads[t] > 1 ? "s" : "" );
+    printf( "  %-28s %8.1f MB/s\n", name, total/took/1e6 );
+    mvm_cleanup_Program( &p );
+  }
+
+  for ( uint32_t m = 0; m < modules; ++m ) free( (void*)srcs[m] );
+  free( srcs );
+}
+
+// Name -> index tables (like the compiler's globals) as an mvm_AATree & an
+// mvm_HMap: insert n names, then look each one up 16 times
+void bench_tables( uint32_t n )
+{
+  const size_t len = 24; // room for "orbit_" & any uint32_t
+  char *names = (char*)malloc( n*len );
+  for ( uint32_t i = 0; i < n; ++i ){
+    snprintf( names + i*len, len, "orbit_%u", i*7919u % n );
+  }
+  const uint32_t lookups = 16;
+  uint64_t found = 0;
+  char label[32];
+
+  mvm_AATree t;
+  mvm_init_AATree( &t, _mvm_MNode_cstr_to_uint32_comp );
+  double start = mvm_now();
+  for ( uint32_t i = 0; i < n; ++i ){
+    mvm_MNode_cstr_to_uint32 *node = mvm_malloc(mvm_MNode_cstr_to_uint32);
+    node->key = names + i*len;
+    node->value = i;
+    mvm_AATree_insert( &t, node );
+  }
+  double inserted = mvm_now();
+  for ( uint32_t r = 0; r < lookups; ++r ){
+    for ( uint32_t i = 0; i < n; ++i ){
+      mvm_MNode_cstr_to_uint32 key = { names + i*len, 0 };
+      found += mvm_AATree_get( &t, &key ) != NULL;
+    }
+  }
+  double took = mvm_now();
+  snprintf( label, sizeof(label), "AATree, %u names", n );
+  printf( "  %-28s %8.1f Minserts/s %8.1f Mgets/s\n", label,
+          n/(inserted - start)/1e6, (double)n*lookups/(took - inserted)/1e6 );
+  mvm_cleanup_AATree( &t, true );
+
+  mvm_HMap m;
+  mvm_init_HMap( &m );
+  start = mvm_now();
+  for ( uint32_t i = 0; i < n; ++i ){
+    mvm_Object k, v;
+    mvm_obj_set_pointer( k, MVM_TYPE::string, names + i*len );
+    mvm_obj_set_int( v, (mvmint)i );
+    mvm_HMap_set( &m, &k, &v );
+  }
+  inserted = mvm_now();
+  for ( uint32_t r = 0; r < lookups; ++r ){
+    for ( uint32_t i = 0; i < n; ++i ){
+      mvm_Object k;
+      mvm_obj_set_pointer( k, MVM_TYPE::string, names + i*len );
+      found += mvm_HMap_get( &m, &k ) != NULL;
+    }
+  }
+  took = mvm_now();
+  snprintf( label, sizeof(label), "HMap, %u names", n );
+  printf( "  %-28s %8.1f Minserts/s %8.1f Mgets/s\n", label,
+          n/(inserted - start)/1e6, (double)n*lookups/(took - inserted)/1e6 );
+  mvm_cleanup_HMap( &m );
+
+  if ( found != (uint64_t)n*lookups*2 ) printf( "tables: lookups failed\n" );
+  free( names );
+}
+
+// Hashing throughput at key sizes from 8B to 64KB: mvm_hash_str (hash.h) &
+// the byte-at-a-time FNV-1a of mvm_hash_bytes (bytecode.h)
+void bench_hash()
+{
+  const size_t sizes[] = { 8, 64, 512, 4096, 65536 }, total = 64 << 20;
+  unsigned char *buf = (unsigned char*)malloc( 65536 + 64 );
+  for ( size_t i = 0; i < 65536 + 64; ++i ) buf[i] = (unsigned char)(i*131 + 7);
+
+  for ( uint32_t k = 0; k < sizeof(sizes)/sizeof(sizes[0]); ++k ){
+    size_t size = sizes[k], runs = total/size;
+    uint64_t h = 0;
+    char label[32];
+
+    // Keys at varying offsets, each depending on the last hash, so calls
+    // can't be hoisted out of the loop
+    double start = mvm_now();
+    for ( size_t r = 0; r < runs; ++r ){
+      h = mvm_hash_str( buf + (h & 63), size, MVM_HASH_STR_SEED );
+    }
+    double fast = mvm_now() - start;
+    start = mvm_now();
+    for ( size_t r = 0; r < runs; ++r ){
+      h = mvm_hash_bytes( buf + (h & 63), size, MVM_HASH_SEED );
+    }
+    double fnv = mvm_now() - start;
+
+    snprintf( label, sizeof(label), "hash %uB keys", (uint32_t)size );
+    printf( "  %-28s %8.2f GB/s (FNV-1a %.2f GB/s)\n", label,
+            runs*size/fast/1e9, runs*size/fnv/1e9 );
+    if ( !h ) printf( "hash: zero hash\n" ); // (keeps the loops alive)
+  }
+  free( buf );
+}
+
+// Format log lines onto one growing string: copying the whole text into a
+// new allocation on every append (the old mvm_String_append), mvm_String
+// (geometric growth) & mvm_Rope (blocks, joined up once at the end)
+void bench_strings()
+{
+  const uint32_t lines = 200000, naive_lines = 5000;
+  char line[96];
+  char label[40];
+
+  double start = mvm_now();
+  char *text = (char*)calloc( 1, 1 );
+  size_t len = 0;
+  for ( uint32_t i = 0; i < naive_lines; ++i ){
+    int n = snprintf( line, sizeof(line), "[%9.3f] body %u at (%.2f, %.2f)\n",
+                      i*0.016, i % 9, i*1.5, i*-0.25 );
+    char *grown = (char*)malloc( len + n + 1 );
+    memcpy( grown, text, len );
+    memcpy( grown + len, line, n + 1 );
+    free( text );
+    text = grown;
+    len += n;
+  }
+  double took = mvm_now() - start;
+  snprintf( label, sizeof(label), "log, copy each, %u lines", naive_lines );
+  printf( "  %-28s %8.1f MB/s\n", label, len/took/1e6 );
+  free( text );
+
+  mvm_String s;
+  mvm_init_String( &s );
+  start = mvm_now();
+  for ( uint32_t i = 0; i < lines; ++i ){
+    mvm_String_appendf( &s, "[%9.3f] body %u at (%.2f, %.2f)\n", i*0.016,
+                        i % 9, i*1.5, i*-0.25 );
+  }
+  took = mvm_now() - start;
+  snprintf( label, sizeof(label), "log, mvm_String, %u lines", lines );
+  printf( "  %-28s %8.1f MB/s\n", label, s.len/took/1e6 );
+  uint32_t expected = s.len;
+  mvm_cleanup_String( &s );
+
+  mvm_Rope r;
+  mvm_init_Rope( &r );
+  start = mvm_now();
+  for ( uint32_t i = 0; i < lines; ++i ){
+    int n = snprintf( line, sizeof(line), "[%9.3f] body %u at (%.2f, %.2f)\n",
+                      i*0.016, i % 9, i*1.5, i*-0.25 );
+    mvm_Rope_append_n( &r, line, n );
+  }
+  mvm_Rope_flatten( &r, &s );
+  took = mvm_now() - start;
+  snprintf( label, sizeof(label), "log, mvm_Rope, %u lines", lines );
+  printf( "  %-28s %8.1f MB/s\n", label, s.len/took/1e6 );
+  if ( s.len != expected ) printf( "strings: rope was %u bytes\n", s.len );
+  mvm_cleanup_String( &s );
+  mvm_cleanup_Rope( &r );
+}
+
+int main( int argc, const char* argv[] )
+{
+  if ( MVM_INIT() != MVM_OK ){
+    printf( "Failed to initialize the MVM!\n" );
+    return MVM_ERROR;
+  }
+
+  mvm_State *s = mvm_new_State( 1024, 0, 0 );
+  mvm_set_state( s );
+
+  printf( "mvmnum: %u bit, mvmint: %u bit, objects: %u bytes\n",
+          (uint32_t)sizeof(mvmnum)*8, (uint32_t)sizeof(mvmint)*8,
+          (uint32_t)sizeof(mvm_Object) );
+
+  bench_stack();
+  bench_integrate( false );
+  bench_integrate( true );
+  bench_compile();
+  bench_compile_batch();
+  bench_tables( 1000 );
+  bench_tables( 100000 );
+  bench_hash();
+  bench_strings();
+
+  mvm_del_State( s );
+  MVM_CLEANUP();
+
+  return 0;
+}
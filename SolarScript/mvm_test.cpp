@@ -1,5 +1,46 @@
 #include "vm.h"
 #include "lazy_compiler.h"
+#include "cache.h"
+#include "batch.h"
+#include "reload.h"
+#include "hmap.h"
+#include "strings.h"
+
+#include "sched.h"
+
+#include <pthread.h>
+
+// Each thread sums 1..n on its own state & chunks, storing the result in *arg
+void* sum_thread( void *arg )
+{
+  mvmnum *n = (mvmnum*)arg;
+  mvm_State *s = mvm_new_State( 1024, 0, 0 );
+  mvm_Chunk inc, acc;
+  bool worked = false;
+
+  mvm_set_state( s );
+  mvm_init_Chunk( &inc, MVM_CHUNK_STACK, 0 ); // i += 1
+  mvm_Chunk_add_number( &inc, 1.0f );
+  mvm_Chunk_emit( &inc, MVM_INSTR(mvm_op_id("pushk"), 0) );
+  mvm_Chunk_emit( &inc, MVM_INSTR(mvm_op_id("ipadd"), 0) );
+  mvm_init_Chunk( &acc, MVM_CHUNK_STACK, 0 ); // sum += i
+  mvm_Chunk_emit( &acc, MVM_INSTR(mvm_op_id("ipadd"), 0) );
+
+  mvm_push_number( 0.0f ); // sum
+  mvm_push_number( 0.0f ); // i
+  for ( uint32_t i = 0; i < (uint32_t)*n; ++i ){
+    mvm_exec_chunk( &inc );
+    mvm_pop( 1 );
+    mvm_exec_chunk( &acc );
+  }
+
+  *n = s->error == MVM_OK ? mvm_get_number( 2, &worked ) : -1.0f;
+
+  mvm_cleanup_Chunk( &inc );
+  mvm_cleanup_Chunk( &acc );
+  mvm_del_State( s );
+  return NULL;
+}
 
 int main( int argc, const char* argv[] )
 {
@@ -9,7 +50,7 @@ int main( int argc, const char* argv[] )
     return result;
   }
 
-  // The CPU speed doesn't do anything yet!
+  // A CPU speed of 0 means no ops per second limit (see mvm_ops_left)
   mvm_State *s = mvm_new_State( 0, 0, 0 );
   if ( !s ){
     printf( "Failed to create MVM state!\n" );
@@ -32,9 +73,1432 @@ int main( int argc, const char* argv[] )
   if ( error ){
     printf( "Result (error code): %s\n", error );
     free(error);
+    result = MVM_ERROR;
+  }
+  else{
+    mvm_Program p;
+    mvm_init_Program( &p );
+    int g = MVM_NOT_FOUND;
+    if ( mvm_Program_load( &p, bytes, ((const mvm_Bytecode_Header*)bytes)->size )
+           != MVM_OK || mvm_call( &p, p.main ) != MVM_OK ||
+         (g = mvm_Program_find_global( &p, "n2" )) < 0 ||
+         mvm_obj_number( p.globals[g] ) != (mvmnum)23.4 ||
+         !mvm_obj_is( p.globals[3], MVM_TYPE::boolean ) ||
+         mvm_obj_bool( p.globals[3] ) ){
+      printf( "Compiled program didn't run (error %d)\n", s->error );
+      result = MVM_ERROR;
+    }
+    mvm_cleanup_Program( &p );
+    free( (void*)bytes );
+  }
+
+  // Test the optimizer: folding (bool ops too), copy propagation, CSE & dead
+  // stores. x is read before it's stored, so it's the value the host set.
+  // Every type is known, so the code's ops are the unchecked ones, & it's the
+  // entry guard that catches the host giving x the wrong type.
+  {
+    const char* src =
+      "x = x + 1.5\n"
+      "a = 2 * 3 + 4\n"
+      "b = a << 2\n"
+      "t = true nand false xor (1 < 2) or not true\n"
+      "y = x * x + x * x\n"
+      "a = a + 1; z = 7 / (a - 11)\n";
+    char* e = NULL;
+    bytes = mvm_compile( src, &e );
+    mvm_Program p;
+    mvm_init_Program( &p );
+    if ( !bytes || mvm_Program_load( &p, bytes,
+                                     ((const mvm_Bytecode_Header*)bytes)->size )
+                     != MVM_OK ){
+      printf( "Optimized program didn't compile: %s\n", e ? e : "" );
+      result = MVM_ERROR;
+    }
+    else{
+      uint32_t stores = 0, checked = 0, unchecked = 0;
+      for ( uint32_t i = 0; i < p.size; ++i ){
+        uint32_t op = MVM_OP(p.code[i]);
+        stores += op == (uint32_t)mvm_op_id( "gstore" ) ||
+                  op == (uint32_t)mvm_op_id( "gstore_pop" );
+        checked += op == (uint32_t)mvm_op_id( "add" ) ||
+                   op == (uint32_t)mvm_op_id( "mul" );
+        unchecked += op == (uint32_t)mvm_op_id( "add_nip_nn" ) ||
+                     op == (uint32_t)mvm_op_id( "mul_nip_nn" );
+      }
+
+      // Only z's divide by zero is left to run (& fail at run time)
+      int x = mvm_Program_find_global( &p, "x" );
+      int a = mvm_Program_find_global( &p, "a" );
+      int b = mvm_Program_find_global( &p, "b" );
+      int t = mvm_Program_find_global( &p, "t" );
+      int y = mvm_Program_find_global( &p, "y" );
+      mvm_obj_set_number( p.globals[x], 2 );
+      if ( mvm_call( &p, p.main ) != MVM_ERROR_DIV_BY_ZERO || stores != 6 ||
+           p.size > 36 || mvm_obj_number( p.globals[x] ) != (mvmnum)3.5 ||
+           mvm_obj_int( p.globals[a] ) != 11 ||
+           mvm_obj_int( p.globals[b] ) != 40 ||
+           !mvm_obj_is( p.globals[t], MVM_TYPE::boolean ) ||
+           mvm_obj_bool( p.globals[t] ) ||
+           mvm_obj_number( p.globals[y] ) != (mvmnum)24.5 ){
+        printf( "Optimized program gave the wrong globals (%u ops, %u stores, "
+                "error %d)\n", p.size, stores, s->error );
+        result = MVM_ERROR;
+      }
+      s->error = MVM_OK;
+      s->sp = 0;
+
+      mvm_obj_set_bool( p.globals[x], true );
+      if ( checked || !unchecked ||
+           mvm_call( &p, p.main ) != MVM_ERROR_GLOBAL_TYPE ||
+           mvm_obj_number( p.globals[y] ) != (mvmnum)24.5 ){
+        printf( "Optimized program wasn't unchecked behind its guard (%u "
+                "checked ops, %u unchecked, error %d)\n", checked, unchecked,
+                s->error );
+        result = MVM_ERROR;
+      }
+    }
+    s->error = MVM_OK;
+    s->sp = 0;
+    free( e );
+    free( (void*)bytes );
+    mvm_cleanup_Program( &p );
+
+    // Type errors are caught at compile time, including a global changing
+    // type (x would be a boolean when main next reads it as a number)
+    const char* mistyped[] = { "a = 1\nb = a and true\n",
+                               "x = x\ny = x + 1.0\nx = y < 5.0\n" };
+    for ( uint32_t i = 0; i < 2; ++i ){
+      e = NULL;
+      bytes = mvm_compile( mistyped[i], &e );
+      if ( bytes || !e || !strstr( e, i ? "line 3" : "line 2" ) ){
+        printf( "Mistyped program compiled (%s)\n", e ? e : "no error" );
+        result = MVM_ERROR;
+      }
+      free( e );
+      free( (void*)bytes );
+    }
+  }
+
+  // Test batch compiles: modules share globals by name & run in order, and
+  // the linked program doesn't depend on how many threads compiled it
+  {
+    const char* srcs[] = {
+      "a = 1\nshared = 10.0\n",
+      "b = 2 * 2\nshared = shared + 1.5\n",
+      "c = 1 + 2\nshared = shared * 2; b = c\n",
+      "d = true and not false\n",
+    };
+    mvm_Program p, q;
+    mvm_init_Program( &p );
+    mvm_init_Program( &q );
+    char* e = NULL;
+    uint32_t psize = 0, qsize = 0;
+    char *pbytes = NULL, *qbytes = NULL;
+    int g = MVM_NOT_FOUND;
+    if ( mvm_compile_batch( &p, srcs, 4, 4, &e ) != MVM_OK ||
+         mvm_compile_batch( &q, srcs, 4, 1, NULL ) != MVM_OK ||
+         !(pbytes = mvm_Program_save( &p, &psize )) ||
+         !(qbytes = mvm_Program_save( &q, &qsize )) || psize != qsize ||
+         memcmp( pbytes, qbytes, psize ) ||
+         mvm_call( &p, p.main ) != MVM_OK || p.nglobals != 5 ||
+         (g = mvm_Program_find_global( &p, "shared" )) < 0 ||
+         mvm_obj_number( p.globals[g] ) != (mvmnum)23 ||
+         mvm_obj_int( p.globals[mvm_Program_find_global( &p, "b" )] ) != 3 ){
+      printf( "Batch compile went wrong (%s, error %d)\n", e ? e : "", s->error );
+      result = MVM_ERROR;
+    }
+    free( e );
+    free( pbytes );
+    free( qbytes );
+    mvm_cleanup_Program( &p );
+    mvm_cleanup_Program( &q );
+    s->error = MVM_OK;
+    s->sp = 0;
+
+    // Sources read each other's globals as the type they're given, which
+    // can't change
+    const char* typed[] = { "a = 1\n", "a = a + 1\nb = a < 3\n", "a = 1.5\n" };
+    mvm_Program m[2], linked;
+    mvm_init_Program( &linked );
+    mvm_init_Program( &p );
+    mvm_init_Program( &q );
+    mvm_init_Program( &m[0] );
+    mvm_init_Program( &m[1] );
+    const char *abytes = mvm_compile( typed[0], NULL );
+    const char *cbytes = mvm_compile( typed[2], NULL );
+    e = NULL;
+    if ( mvm_compile_batch( &p, typed, 2, 2, &e ) != MVM_OK ||
+         mvm_call( &p, p.main ) != MVM_OK || mvm_call( &p, p.main ) != MVM_OK ||
+         mvm_obj_int( p.globals[mvm_Program_find_global( &p, "a" )] ) != 2 ||
+         !mvm_obj_bool( p.globals[mvm_Program_find_global( &p, "b" )] ) ){
+      printf( "Batch sharing an integer went wrong (%s, error %d)\n",
+              e ? e : "", s->error );
+      result = MVM_ERROR;
+    }
+    free( e );
+    e = NULL;
+    if ( mvm_compile_batch( &q, typed, 3, 2, &e ) == MVM_OK || !e ||
+         strncmp( e, "Source 2:", 9 ) || !abytes || !cbytes ||
+         mvm_Program_load( &m[0], abytes,
+                           ((const mvm_Bytecode_Header*)abytes)->size ) != MVM_OK ||
+         mvm_Program_load( &m[1], cbytes,
+                           ((const mvm_Bytecode_Header*)cbytes)->size ) != MVM_OK ||
+         mvm_link( &linked, m, 2 ) != MVM_ERROR_GLOBAL_TYPE ){
+      printf( "Sources retyping a global linked (%s)\n", e ? e : "" );
+      result = MVM_ERROR;
+    }
+    free( e );
+    free( (void*)abytes );
+    free( (void*)cbytes );
+    mvm_cleanup_Program( &p );
+    mvm_cleanup_Program( &q );
+    mvm_cleanup_Program( &m[0] );
+    mvm_cleanup_Program( &m[1] );
+    mvm_cleanup_Program( &linked );
+    s->error = MVM_OK;
+    s->sp = 0;
+
+    // The first source that fails is the one reported
+    srcs[1] = "b = ";
+    srcs[3] = "d = ";
+    e = NULL;
+    mvm_init_Program( &p );
+    if ( mvm_compile_batch( &p, srcs, 4, 0, &e ) == MVM_OK || !e ||
+         strncmp( e, "Source 1:", 9 ) ){
+      printf( "Batch compile error was '%s'\n", e ? e : "" );
+      result = MVM_ERROR;
+    }
+    free( e );
+    mvm_cleanup_Program( &p );
+  }
+
+  // Test hot reloading: a changed module is patched into the running program
+  // (even half way through a call), keeping globals' values, constants &
+  // function slots
+  {
+    mvm_Library lib;
+    mvm_init_Library( &lib );
+    char* e = NULL;
+    mvm_Call x;
+    int y = MVM_NOT_FOUND, z = MVM_NOT_FOUND;
+    if ( mvm_Library_set( &lib, 0, "x = 1.5\ny = y + 1.0\n", &e ) != MVM_OK ||
+         mvm_Library_set( &lib, 1, "z = 2.5\n", &e ) != MVM_OK ||
+         mvm_call( &lib.p, lib.p.main ) != MVM_OK ||
+         (y = mvm_Program_find_global( &lib.p, "y" )) < 0 ||
+         (z = mvm_Program_find_global( &lib.p, "z" )) < 0 ){
+      printf( "Library didn't build (%s)\n", e ? e : "" );
+      result = MVM_ERROR;
+    }
+    else{
+      uint32_t nfuncs = lib.p.nfuncs, size = lib.p.size, nk = lib.p.nk;
+      mvm_begin_call( &x, &lib.p, lib.p.main );
+      mvm_continue_call( &x, 1 ); // into module 0
+      if ( mvm_Library_set( &lib, 0, "x = 1.5\ny = y + 1.0\n", &e ) != MVM_OK ||
+           lib.p.size != size ||
+           mvm_Library_set( &lib, 1, "z = 2.5 * 3\nw = 1.5\n", &e ) != MVM_OK ){
+        printf( "Library didn't reload (%s)\n", e ? e : "" );
+        result = MVM_ERROR;
+      }
+      while ( !x.done ) mvm_continue_call( &x, 100 );
+      mvm_end_call( &x );
+      if ( s->error != MVM_OK || lib.p.nfuncs != nfuncs || lib.p.nk != nk + 1 ||
+           mvm_obj_number( lib.p.globals[y] ) != 2 ||
+           mvm_obj_number( lib.p.globals[z] ) != (mvmnum)7.5 ||
+           mvm_obj_number( lib.p.globals[mvm_Program_find_global( &lib.p, "w" )] )
+             != (mvmnum)1.5 ){
+        printf( "Reloaded library gave the wrong globals (error %d)\n", s->error );
+        result = MVM_ERROR;
+      }
+
+      // A module that doesn't compile leaves the old one running
+      free( e );
+      e = NULL;
+      if ( mvm_Library_set( &lib, 1, "z = ", &e ) == MVM_OK || !e ||
+           mvm_call( &lib.p, lib.p.main ) != MVM_OK ||
+           mvm_obj_number( lib.p.globals[y] ) != 3 ){
+        printf( "Bad reload broke the library\n" );
+        result = MVM_ERROR;
+      }
+    }
+    free( e );
+    e = NULL;
+    s->error = MVM_OK;
+    s->sp = 0;
+
+#ifdef MVM_JIT
+    // Reloading half way through a call to a compiled function throws its
+    // native code away (it points into the old code), & functions the reload
+    // adds are counted & compiled like the others
+    {
+      mvm_Library hot;
+      mvm_init_Library( &hot );
+      bool built = mvm_Library_set( &hot, 0, "a = a + 1.0\n", NULL ) == MVM_OK;
+      for ( int i = 0; built && i < MVM_JIT_THRESHOLD; ++i ){
+        built = mvm_call( &hot.p, hot.p.main ) == MVM_OK;
+      }
+      bool compiled = built && hot.p.jit && hot.p.jit[hot.p.main].code;
+
+      mvm_Call hx;
+      uint32_t main = hot.p.main;
+      mvm_begin_call( &hx, &hot.p, main );
+      mvm_continue_call( &hx, 1 );
+      bool reloaded = mvm_Library_set( &hot, 1, "b = 2.5\nc = b * 2.0\n",
+                                       NULL ) == MVM_OK;
+      while ( !hx.done ) mvm_continue_call( &hx, 100 );
+      mvm_end_call( &hx );
+      bool dropped = !hot.p.jit || main >= hot.p.njit || !hot.p.jit[main].code;
+      for ( int i = 0; s->error == MVM_OK && i < MVM_JIT_THRESHOLD; ++i ){
+        mvm_call( &hot.p, hot.p.main );
+      }
+
+      int a = mvm_Program_find_global( &hot.p, "a" );
+      int c = mvm_Program_find_global( &hot.p, "c" );
+      uint32_t added = reloaded ? hot.modules[1].main : 0;
+      if ( !compiled || !reloaded || !dropped || s->error != MVM_OK || a < 0 ||
+           c < 0 ||
+           mvm_obj_number( hot.p.globals[a] ) != 2*MVM_JIT_THRESHOLD + 1 ||
+           mvm_obj_number( hot.p.globals[c] ) != 5 ||
+           hot.p.njit != hot.p.nfuncs || !hot.p.jit[added].code ){
+        printf( "Reloading a compiled library went wrong (error %d)\n",
+                s->error );
+        result = MVM_ERROR;
+      }
+      s->error = MVM_OK;
+      s->sp = 0;
+      mvm_cleanup_Library( &hot );
+    }
+#endif
+
+    // A module can't change the type of a global another module uses (u, as
+    // module 3 would read an integer as a number), but can change its own
+    int u = MVM_NOT_FOUND, t = MVM_NOT_FOUND;
+    if ( mvm_Library_set( &lib, 2, "u = 1.5\nt = 1.5\n", &e ) != MVM_OK ||
+         mvm_Library_set( &lib, 3, "u = u * 2.0\n", &e ) != MVM_OK ||
+         mvm_Library_set( &lib, 2, "u = 1\nt = 1.5\n", &e ) == MVM_OK || !e ||
+         mvm_Library_set( &lib, 2, "u = 1.5\nt = 1\n", NULL ) != MVM_OK ||
+         mvm_call( &lib.p, lib.p.main ) != MVM_OK ||
+         mvm_call( &lib.p, lib.p.main ) != MVM_OK ||
+         (u = mvm_Program_find_global( &lib.p, "u" )) < 0 ||
+         (t = mvm_Program_find_global( &lib.p, "t" )) < 0 ||
+         mvm_obj_number( lib.p.globals[u] ) != 3 ||
+         mvm_obj_int( lib.p.globals[t] ) != 1 ){
+      printf( "Reload changed a global's type (%s, error %d)\n", e ? e : "",
+              s->error );
+      result = MVM_ERROR;
+    }
+    free( e );
+    e = NULL;
+    s->error = MVM_OK;
+    s->sp = 0;
+
+    // Watched files are reloaded when they change
+    char path[] = "/tmp/mvm_watchXXXXXX";
+    int fd = mkstemp( path );
+    FILE *f = fd >= 0 ? fdopen( fd, "w" ) : NULL;
+    if ( f ){
+      fputs( "v = 1\n", f );
+      fclose( f );
+    }
+    int polls[2] = { -1, -1 };
+    if ( !f || mvm_Library_watch( &lib, path, &e ) != MVM_OK ||
+         (polls[0] = mvm_Library_poll( &lib, &e )) != 0 ||
+         !(f = fopen( path, "w" )) ){
+      printf( "Couldn't watch %s (%s)\n", path, e ? e : "" );
+      result = MVM_ERROR;
+    }
+    else{
+      fputs( "v = 20 + 2\n", f );
+      fclose( f );
+      polls[1] = mvm_Library_poll( &lib, &e );
+      int v = mvm_Program_find_global( &lib.p, "v" );
+      if ( polls[1] != 1 || mvm_call( &lib.p, lib.p.main ) != MVM_OK ||
+           mvm_obj_int( lib.p.globals[v] ) != 22 ){
+        printf( "Watched file wasn't reloaded (%d polls, %s)\n", polls[1],
+                e ? e : "" );
+        result = MVM_ERROR;
+      }
+    }
+    if ( fd >= 0 ) remove( path );
+    free( e );
+    mvm_cleanup_Library( &lib );
+    s->error = MVM_OK;
+    s->sp = 0;
+  }
+
+  // Test the bytecode cache: a miss compiles & saves, then it's a hit until
+  // the entry is damaged, or replaced by one running unchecked ops unguarded
+  {
+    char dir[] = "/tmp/mvm_cacheXXXXXX";
+    bool hits[4] = { true, false, true, true };
+    if ( !mkdtemp( dir ) ){
+      printf( "Couldn't make a cache directory\n" );
+      result = MVM_ERROR;
+    }
+    else{
+      char *path = mvm_cache_path( dir, mvm_hash_bytes( code, strlen( code ),
+                                                        MVM_HASH_SEED ) );
+      for ( int i = 0; i < 4; ++i ){
+        mvm_Program p;
+        mvm_init_Program( &p );
+        if ( mvm_compile_cached( &p, dir, code, NULL, &hits[i] ) != MVM_OK ||
+             p.nglobals != 4 || (hits[i] && !p.map) ){
+          printf( "Cached compile %d failed\n", i );
+          result = MVM_ERROR;
+        }
+        mvm_cleanup_Program( &p );
+
+        if ( i == 1 ){
+          FILE *f = fopen( path, "r+b" );
+          if ( f ){
+            fputc( 'X', f ); // bad magic
+            fclose( f );
+          }
+        }
+        else if ( i == 2 ){ // add_nip_nn with nothing on the stack
+          mvm_init_Program( &p );
+          p.main = mvm_Program_add_function( &p, 0, 0 );
+          mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("add_nip_nn"), 0) );
+          mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("ret"), 1) );
+          uint32_t size = 0;
+          char *bytes = mvm_Program_save( &p, &size );
+          if ( bytes ){
+            _mvm_cache_write( path, mvm_hash_bytes( code, strlen( code ),
+                                                    MVM_HASH_SEED ),
+                              (uint32_t)strlen( code ), bytes, size );
+          }
+          free( bytes );
+          mvm_cleanup_Program( &p );
+        }
+      }
+      if ( hits[0] || !hits[1] || hits[2] || hits[3] ){
+        printf( "Cache hits were %d %d %d %d, expected 0 1 0 0\n", hits[0],
+                hits[1], hits[2], hits[3] );
+        result = MVM_ERROR;
+      }
+      remove( path );
+      rmdir( dir );
+      free( path );
+    }
+  }
+
+  // Test the lexer: tokens are slices of the source, comments are skipped
+  {
+    const char src[] = "x1 = .5 + 42 // comment\n"
+                       "/* multi\nline */ s=\"a \\\"b\\\"\" <= ..\n"
+                       "\"open";
+    const char kinds[] = { MVM_TOKEN_NAME, MVM_TOKEN_OP, MVM_TOKEN_NUMBER,
+                           MVM_TOKEN_OP, MVM_TOKEN_INT, MVM_TOKEN_NAME,
+                           MVM_TOKEN_OP, MVM_TOKEN_STRING, MVM_TOKEN_OP,
+                           MVM_TOKEN_OP, MVM_TOKEN_ERROR };
+    const char* texts[] = { "x1", "=", ".5", "+", "42", "s", "=",
+                            "\"a \\\"b\\\"\"", "<=", "..", "\"open" };
+    mvm_Lexer l;
+    mvm_Token t;
+    mvm_init_Lexer( &l, src, sizeof(src) - 1 );
+    for ( uint32_t i = 0; i < sizeof(kinds); ++i ){
+      if ( mvm_lex( &l, &t ) != kinds[i] || !mvm_token_is( &l, &t, texts[i] ) ){
+        printf( "Token %u was '%.*s' (kind %d), expected '%s'\n", i,
+                (int)t.length, src + t.offset, t.kind, texts[i] );
+        result = MVM_ERROR;
+        break;
+      }
+    }
+    if ( t.line != 4 || mvm_lex( &l, &t ) != MVM_TOKEN_END ){
+      printf( "Lexer ended on line %u, expected 4\n", t.line );
+      result = MVM_ERROR;
+    }
+  }
+
+  // Test the dispatch table: 1.5 + 2.5 (operands are left on the stack)
+  {
+    mvm_push_number( 1.5f );
+    mvm_push_number( 2.5f );
+
+    const char prog[] = { (char)mvm_op_id("add"), (char)mvm_op_id("ipmul") };
+    bool worked = false;
+    mvm_exec( prog, sizeof(prog) );
+    mvmnum n = mvm_get_number( 2, &worked ); // (a + b) * b
+
+    if ( s->error != MVM_OK || !worked || n != 10.0f ){
+      printf( "mvm_exec gave %f (error %d), expected 10.0\n", n, s->error );
+      result = MVM_ERROR;
+    }
+    s->sp = 0;
+  }
+
+  // Test the object layout: values & types survive a round trip
+  {
+    mvm_Object o[5];
+    int x;
+    mvm_obj_set_number( o[0], -2.5f );
+    mvm_obj_set_number( o[1], NAN );
+    mvm_obj_set_bool( o[2], true );
+    mvm_obj_set_pointer( o[3], MVM_TYPE::pointer, &x );
+    mvm_obj_set_pointer( o[4], MVM_TYPE::string, "str" );
+
+    if ( !mvm_obj_is( o[0], MVM_TYPE::number ) ||
+         mvm_obj_number( o[0] ) != -2.5f ||
+         mvm_obj_type( o[1] ) != MVM_TYPE::number ||
+         !isnan( mvm_obj_number( o[1] ) ) ||
+         !mvm_obj_is( o[2], MVM_TYPE::boolean ) || !mvm_obj_bool( o[2] ) ||
+         mvm_obj_is( o[2], MVM_TYPE::number ) ||
+         mvm_obj_type( o[3] ) != MVM_TYPE::pointer ||
+         mvm_obj_pointer( o[3] ) != &x ||
+         !mvm_obj_is( o[4], MVM_TYPE::string ) ||
+         strcmp( mvm_obj_string( o[4] ), "str" ) ){
+      printf( "Objects didn't round trip\n" );
+      result = MVM_ERROR;
+    }
+#ifdef MVM_NAN_BOXING
+    if ( sizeof(mvm_Object) != 8 ){
+      printf( "NaN-boxed objects are %u bytes\n", (uint32_t)sizeof(mvm_Object) );
+      result = MVM_ERROR;
+    }
+#endif
+  }
+
+#ifdef MVM_DOUBLE
+  // Test double precision: (1e10 + 1) - 1e10 is 0 with floats
+  {
+    const char add[] = { (char)mvm_op_id("ipadd") };
+    const char sub[] = { (char)mvm_op_id("ipsub") };
+    bool worked = false;
+    mvm_push_number( 1e10 );
+    mvm_push_number( 1.0 );
+    mvm_exec( add, 1 );
+    mvm_pop( 1 );
+    mvm_push_number( 1e10 );
+    mvm_exec( sub, 1 );
+    mvmnum n = mvm_get_number( 2, &worked );
+    if ( !worked || n != 1.0 ){
+      printf( "Double mode gave %f for (1e10 + 1) - 1e10\n", n );
+      result = MVM_ERROR;
+    }
+    s->sp = 0;
+  }
+#endif
+
+  // Test the stack: it starts small, grows as it's pushed to & stops at ss
+  {
+    mvm_State *g = mvm_new_State( 0, 0, 0 ), *t = mvm_new_State( 300, 0, 0 );
+    bool worked = false;
+#ifndef MVM_STACK_GUARD
+    if ( g->sc != MVM_INITIAL_STACK_SIZE ){
+      printf( "New stack has room for %u objects, expected %u\n", g->sc,
+              MVM_INITIAL_STACK_SIZE );
+      result = MVM_ERROR;
+    }
+#endif
+
+    mvm_set_state( g );
+    for ( uint32_t i = 0; i < 10000; ++i ) mvm_push_number( (mvmnum)i );
+    mvmnum n = mvm_get_number( 5000, &worked );
+    if ( g->error != MVM_OK || g->sp != 10000 || !worked || n != 5000.0f ){
+      printf( "Grown stack gave %f at 5000 (error %d)\n", n, g->error );
+      result = MVM_ERROR;
+    }
+
+    mvm_set_state( t );
+    for ( uint32_t i = 0; i < 100000 && t->error == MVM_OK; ++i ){
+      mvm_push_number( (mvmnum)i );
+    }
+    if ( t->error != MVM_ERROR_STACK_OVERFLOW || t->sp + 1 < t->ss ||
+         t->sp > t->ss + 1 ){
+      printf( "Stack of %u overflowed at %u (error %d)\n", t->ss, t->sp,
+              t->error );
+      result = MVM_ERROR;
+    }
+
+    mvm_set_state( s );
+    mvm_del_State( g );
+    mvm_del_State( t );
+  }
+
+  // Overflowing a stack mustn't touch its neighbour's, even pushing well past
+  // the guard page (small stacks are likely to be mapped next to each other)
+  {
+    mvm_State *a = mvm_new_State( 256, 0, 0 ), *b = mvm_new_State( 256, 0, 0 );
+    bool worked = false;
+
+    mvm_set_state( a );
+    mvm_push_number( 42.0f );
+    mvm_set_state( b );
+    for ( uint32_t i = 0; i < 520; ++i ) mvm_push_number( 7.0f );
+    mvm_set_state( a );
+    mvmnum n = mvm_get_number( 1, &worked );
+    if ( b->error != MVM_ERROR_STACK_OVERFLOW || b->sp > b->ss + 1 ||
+         !worked || n != 42.0f ){
+      printf( "Overflowing a stack left %f in the next (error %d, sp %u)\n", n,
+              b->error, b->sp );
+      result = MVM_ERROR;
+    }
+
+    mvm_set_state( s );
+    mvm_del_State( a );
+    mvm_del_State( b );
+  }
+
+  // Test budgeted execution: the same program run one op at a time
+  {
+    mvm_push_number( 1.5f );
+    mvm_push_number( 2.5f );
+
+    const char prog[] = { (char)mvm_op_id("add"), (char)mvm_op_id("ipmul") };
+    unsigned int pc = 0;
+    bool worked = false;
+    s->ops_in_second = 0;
+    mvm_exec_slice( prog, sizeof(prog), &pc, 1 );
+    if ( pc != 1 || s->sp != 3 ){
+      printf( "First slice stopped at %u with %u objects\n", pc, s->sp );
+      result = MVM_ERROR;
+    }
+    mvm_exec_slice( prog, sizeof(prog), &pc, 1 );
+    mvm_exec_slice( prog, sizeof(prog), &pc, 1 ); // nothing left to run
+    mvmnum n = mvm_get_number( 2, &worked );
+
+    if ( s->error != MVM_OK || !worked || n != 10.0f || pc != 2 ||
+         s->ops_in_second != 2 ){
+      printf( "Sliced mvm_exec gave %f after %u ops, expected 10.0 after 2\n",
+              n, s->ops_in_second );
+      result = MVM_ERROR;
+    }
+    s->sp = 0;
+  }
+
+  // Test the cooperative scheduler: a runaway script limited to 100 ops a
+  // second can't hold up the other one, or the caller
+  {
+    char spin[1000];
+    const char prog[] = { (char)mvm_op_id("add"), (char)mvm_op_id("ipmul") };
+    memset( spin, mvm_op_id("ipnot"), sizeof(spin) );
+
+    mvm_State *a = mvm_new_State( 64, 0, 100 ), *b = mvm_new_State( 64, 0, 0 );
+    mvm_Job jobs[2];
+    mvm_init_exec_Job( &jobs[0], a, spin, sizeof(spin) );
+    mvm_init_exec_Job( &jobs[1], b, prog, sizeof(prog) );
+    mvm_set_state( a );
+    mvm_push_bool( true );
+    mvm_set_state( b );
+    mvm_push_number( 1.5f );
+    mvm_push_number( 2.5f );
+    mvm_set_state( s );
+
+    double start = mvm_now();
+    int left = mvm_run_jobs( jobs, 2, 8, 0.5 );
+    double took = mvm_now() - start;
+
+    if ( left != 1 || a->ops_in_second != 100 || !mvm_Job_done( &jobs[1] ) ||
+         took > 0.25 || mvm_get_state() != s ){
+      printf( "Scheduler left %d jobs after %f s, runaway ran %u ops\n",
+              left, took, a->ops_in_second );
+      result = MVM_ERROR;
+    }
+
+    mvm_del_State( a );
+    mvm_del_State( b );
+  }
+
+  // Test chunks: (2 + 3) * 3 in stack and register mode
+  {
+    mvm_Chunk sc, rc;
+    bool worked = false;
+
+    mvm_init_Chunk( &sc, MVM_CHUNK_STACK, 0 );
+    mvm_Chunk_add_number( &sc, 2.0f );
+    mvm_Chunk_add_number( &sc, 3.0f );
+    mvm_Chunk_emit( &sc, MVM_INSTR(mvm_op_id("pushk"), 0) );
+    mvm_Chunk_emit( &sc, MVM_INSTR(mvm_op_id("pushk"), 1) );
+    mvm_Chunk_emit( &sc, MVM_INSTR(mvm_op_id("add"), 0) );
+    mvm_Chunk_emit( &sc, MVM_INSTR(mvm_op_id("ipmul"), 0) );
+    mvm_exec_chunk( &sc );
+    mvmnum n = mvm_get_number( 2, &worked );
+    if ( s->error != MVM_OK || !worked || n != 15.0f ){
+      printf( "Stack chunk gave %f (error %d), expected 15.0\n", n, s->error );
+      result = MVM_ERROR;
+    }
+    s->sp = 0;
+
+    mvm_init_Chunk( &rc, MVM_CHUNK_REGISTER, 3 );
+    mvm_Chunk_add_number( &rc, 2.0f );
+    mvm_Chunk_add_number( &rc, 3.0f );
+    mvm_Chunk_emit( &rc, MVM_INSTR3(mvm_op_id("rloadk"), 0, 0, 0) );
+    mvm_Chunk_emit( &rc, MVM_INSTR3(mvm_op_id("rloadk"), 1, 1, 0) );
+    mvm_Chunk_emit( &rc, MVM_INSTR3(mvm_op_id("radd"), 2, 0, 1) );
+    mvm_Chunk_emit( &rc, MVM_INSTR3(mvm_op_id("rmul"), 2, 2, 1) );
+    mvm_Chunk_emit( &rc, MVM_INSTR3(mvm_op_id("rpush"), 0, 2, 0) );
+    mvm_exec_chunk( &rc );
+    n = mvm_get_number( 1, &worked );
+    if ( s->error != MVM_OK || !worked || n != 15.0f || s->sp != 1 ){
+      printf( "Register chunk gave %f (error %d), expected 15.0\n", n, 
+              s->error );
+      result = MVM_ERROR;
+    }
+    s->sp = 0;
+
+    // Fusing must not change the result: pushk, pushk, add, ipmul, nip 2
+    // becomes pushk, addk, ipmul, nip 2 and leaves just 2 + 3 behind
+    mvm_Chunk_emit( &sc, MVM_INSTR(mvm_op_id("nip"), 2) );
+    uint32_t fused = mvm_fuse( &sc );
+    mvm_exec_chunk( &sc );
+    n = mvm_get_number( 1, &worked );
+    if ( s->error != MVM_OK || !worked || n != 5.0f || s->sp != 1 || 
+         fused != 1 || sc.size != 4 ){
+      printf( "Fused chunk gave %f (error %d, %u fused), expected 5.0\n", n,
+              s->error, fused );
+      result = MVM_ERROR;
+    }
+    s->sp = 0;
+
+    // Specialized chunk: x + 2 for a number x left on the stack by the caller
+    mvm_Chunk xc;
+    const char entry[] = { MVM_TYPE::number };
+    mvm_init_Chunk( &xc, MVM_CHUNK_STACK, 0 );
+    mvm_Chunk_add_number( &xc, 2.0f );
+    mvm_Chunk_emit( &xc, MVM_INSTR(mvm_op_id("pushk"), 0) );
+    mvm_Chunk_emit( &xc, MVM_INSTR(mvm_op_id("add"), 0) );
+    mvm_Chunk_emit( &xc, MVM_INSTR(mvm_op_id("nip"), 2) );
+    mvm_fuse( &xc );
+    uint32_t specialized = mvm_specialize( &xc, entry, 1 );
+    mvm_push_number( 4.0f );
+    mvm_exec_chunk( &xc );
+    n = mvm_get_number( 1, &worked );
+    if ( s->error != MVM_OK || !worked || n != 6.0f || s->sp != 1 || 
+         specialized != 1 || MVM_OP(xc.code[0]) != (mvm_Instr)mvm_op_id("addk_n") ){
+      printf( "Specialized chunk gave %f (error %d), expected 6.0\n", n,
+              s->error );
+      result = MVM_ERROR;
+    }
+    s->sp = 0;
+
+    // The guard must catch a boolean where a number was promised
+    mvm_push_bool( true );
+    mvm_exec_chunk( &xc );
+    if ( s->error != MVM_BAD_ARG_1 ){
+      printf( "Specialized chunk guard let a bad type through\n" );
+      result = MVM_ERROR;
+    }
+    s->error = MVM_OK;
+    s->sp = 0;
+
+    // Quickening: `and` becomes and_qbb after running on two booleans, and
+    // goes back to (sticky) generic `and` when it later sees numbers
+    mvm_Chunk qc;
+    mvm_init_Chunk( &qc, MVM_CHUNK_STACK, 0 );
+    mvm_Chunk_emit( &qc, MVM_INSTR(mvm_op_id("and"), 0) );
+    mvm_push_bool( true );
+    mvm_push_bool( true );
+    mvm_exec_chunk( &qc );
+    mvmbool b = mvm_get_bool( 1, &worked );
+    if ( s->error != MVM_OK || !worked || !b ||
+         MVM_OP(qc.code[0]) != (mvm_Instr)mvm_op_id("and_qbb") ){
+      printf( "Quickening `and` failed (error %d)\n", s->error );
+      result = MVM_ERROR;
+    }
+    s->sp = 0;
+    mvm_push_number( 1.0f );
+    mvm_push_number( 2.0f );
+    mvm_exec_chunk( &qc );
+    if ( s->error != MVM_BAD_ARG_1 || 
+         qc.code[0] != (MVM_INSTR(mvm_op_id("and"), 0) | MVM_INSTR_STICKY) ){
+      printf( "De-quickening `and` failed (error %d)\n", s->error );
+      result = MVM_ERROR;
+    }
+    s->error = MVM_OK;
+    s->sp = 0;
+
+#ifdef MVM_JIT
+    // Run the register & specialized chunks until they're compiled, the
+    // results must stay the same. Specializing gives the JIT in-line ops.
+    mvm_Chunk yc;
+    const char nn[] = { MVM_TYPE::number, MVM_TYPE::number };
+    mvm_init_Chunk( &yc, MVM_CHUNK_STACK, 0 );
+    mvm_Chunk_emit( &yc, MVM_INSTR(mvm_op_id("add"), 0) );
+    mvm_Chunk_emit( &yc, MVM_INSTR(mvm_op_id("sub"), 0) );
+    mvm_specialize( &yc, nn, 2 );
+    mvm_specialize( &rc, NULL, 0 );
+    for ( int i = 0; i < MVM_JIT_THRESHOLD + 2; ++i ){
+      mvm_push_number( 4.0f );
+      mvm_push_number( 6.0f );
+      mvm_exec_chunk( &yc );
+      n = mvm_get_number( 1, &worked );
+      if ( s->error != MVM_OK || n != -4.0f || s->sp != 4 ){
+        printf( "JIT run %d gave %f (error %d)\n", i, n, s->error );
+        result = MVM_ERROR;
+        break;
+      }
+      s->sp = 0;
+      mvm_exec_chunk( &rc );
+      mvm_push_number( 4.0f );
+      mvm_exec_chunk( &xc );
+      n = mvm_get_number( 1, &worked );
+      mvmnum r = mvm_get_number( 2, &worked );
+      if ( s->error != MVM_OK || n != 6.0f || r != 15.0f ){
+        printf( "JIT run %d gave %f & %f (error %d)\n", i, r, n, s->error );
+        result = MVM_ERROR;
+        break;
+      }
+      s->sp = 0;
+    }
+    if ( !rc.jit || !xc.jit || !yc.jit ){
+      printf( "Chunks were never compiled\n" );
+      result = MVM_ERROR;
+    }
+    mvm_cleanup_Chunk( &yc );
+
+    // Errors in native code must still stop the chunk
+    for ( int i = 0; i < MVM_JIT_THRESHOLD + 2; ++i ){
+      mvm_push_number( 1.0f );
+      mvm_push_number( 2.0f );
+      mvm_exec_chunk( &qc );
+      if ( s->error != MVM_BAD_ARG_1 ){
+        printf( "JIT run %d didn't report error (error %d)\n", i, s->error );
+        result = MVM_ERROR;
+        break;
+      }
+      s->error = MVM_OK;
+      s->sp = 0;
+    }
+    if ( !qc.jit ){
+      printf( "Chunk was never compiled\n" );
+      result = MVM_ERROR;
+    }
+#endif
+
+    mvm_cleanup_Chunk( &sc );
+    mvm_cleanup_Chunk( &rc );
+    mvm_cleanup_Chunk( &xc );
+    mvm_cleanup_Chunk( &qc );
+  }
+
+  // Integer ops use integer math, wrap around & catch division by 0
+  {
+    const char prog[] = { (char)mvm_op_id("imul"), (char)mvm_op_id("iadd") };
+    const mvmint big = (mvmint)((mvmuint)1 << (MVM_INT_BITS - 2));
+    bool worked = false;
+    mvm_push_int( big );
+    mvm_push_int( 4 );
+    mvm_exec( prog, 1 ); // big*4 wraps to 0
+    mvmint i = mvm_get_int( 1, &worked );
+    if ( !worked || i != 0 ){
+      printf( "imul gave %lld, expected 0\n", (long long)i );
+      result = MVM_ERROR;
+    }
+    s->sp = 0;
+
+    mvm_push_int( 16777217 ); // not exact as a float
+    mvm_push_int( 2 );
+    mvm_exec( prog + 1, 1 );
+    i = mvm_get_int( 1, &worked );
+    if ( !worked || i != 16777219 ){
+      printf( "iadd gave %lld, expected 16777219\n", (long long)i );
+      result = MVM_ERROR;
+    }
+    s->sp = 0;
+
+    const char div[] = { (char)mvm_op_id("idiv") };
+    mvm_push_int( 7 );
+    mvm_push_int( 0 );
+    mvm_exec( div, 1 );
+    if ( s->error != MVM_ERROR_DIV_BY_ZERO || s->sp != 2 ){
+      printf( "7 idiv 0 gave error %d, expected %d\n", s->error,
+              MVM_ERROR_DIV_BY_ZERO );
+      result = MVM_ERROR;
+    }
+    s->error = MVM_OK;
+    s->sp = 0;
+
+    // Registers: r2 = (r0 << 3) ^ r1
+    mvm_Chunk c;
+    mvm_init_Chunk( &c, MVM_CHUNK_REGISTER, 3 );
+    mvm_Chunk_add_int( &c, 5 );
+    mvm_Chunk_add_int( &c, 3 );
+    mvm_Chunk_emit( &c, MVM_INSTR3(mvm_op_id("rloadk"), 0, 0, 0) );
+    mvm_Chunk_emit( &c, MVM_INSTR3(mvm_op_id("rloadk"), 1, 1, 0) );
+    mvm_Chunk_emit( &c, MVM_INSTR3(mvm_op_id("rshl"), 2, 0, 1) );
+    mvm_Chunk_emit( &c, MVM_INSTR3(mvm_op_id("rbxor"), 2, 2, 1) );
+    mvm_Chunk_emit( &c, MVM_INSTR3(mvm_op_id("rpush"), 0, 2, 0) );
+    mvm_exec_chunk( &c );
+    i = mvm_get_int( 1, &worked );
+    if ( s->error != MVM_OK || !worked || i != 43 ){
+      printf( "Register int ops gave %lld, expected 43\n", (long long)i );
+      result = MVM_ERROR;
+    }
+    mvm_cleanup_Chunk( &c );
+    s->sp = 0;
+  }
+
+  // Strings & compounds made by ops belong to the state
+  {
+    mvm_Chunk c;
+    mvm_init_Chunk( &c, MVM_CHUNK_STACK, 0 );
+    mvm_Chunk_add_string( &c, "Sol" );
+    mvm_Chunk_add_string( &c, "ar" );
+    mvm_Chunk_add_string( &c, "name" );
+    mvm_Chunk_add_string( &c, "mass" );
+    mvm_Chunk_emit( &c, MVM_INSTR(mvm_op_id("newc"), 0) );
+    mvm_Chunk_emit( &c, MVM_INSTR(mvm_op_id("pushk"), 0) );
+    mvm_Chunk_emit( &c, MVM_INSTR(mvm_op_id("pushk"), 1) );
+    mvm_Chunk_emit( &c, MVM_INSTR(mvm_op_id("sconcat"), 0) );
+    mvm_Chunk_emit( &c, MVM_INSTR(mvm_op_id("nip"), 2) );
+    mvm_Chunk_emit( &c, MVM_INSTR(mvm_op_id("setf"), 2) ); // c.name = "Solar"
+    mvm_Chunk_emit( &c, MVM_INSTR(mvm_op_id("getf"), 2) );
+    mvm_Chunk_emit( &c, MVM_INSTR(mvm_op_id("getf"), 3) ); // no c.mass
+    mvm_Run r;
+    mvm_begin_run( &r, &c );
+    mvm_continue_run( &r, 6 );
+    mvm_pop( 1 );
+    mvm_continue_run( &r, 1 );
+
+    bool worked = false;
+    const char* name = mvm_get_string( 1, &worked );
+    if ( s->error != MVM_OK || !worked || strcmp( name, "Solar" ) ){
+      printf( "Compound field was \"%s\" (error %d), expected \"Solar\"\n",
+              worked ? name : "", s->error );
+      result = MVM_ERROR;
+    }
+
+    // Missing fields are an error
+    mvm_pop( 1 );
+    mvm_continue_run( &r, 1 );
+    if ( s->error != MVM_ERROR_NO_FIELD ){
+      printf( "Missing field gave error %d, expected %d\n", s->error,
+              MVM_ERROR_NO_FIELD );
+      result = MVM_ERROR;
+    }
+    s->error = MVM_OK;
+    s->sp = 0;
+
+    const char cmp[] = { (char)mvm_op_id("scmp"), (char)mvm_op_id("slen") };
+    mvm_push_string( "Solar" );
+    mvm_push_string( "Sun" );
+    mvm_exec( cmp, 1 ); // "Solar" sorts before "Sun"
+    mvmint order = mvm_get_int( 1, &worked );
+    mvm_push_string( "Sun" );
+    mvm_exec( cmp + 1, 1 );
+    mvmint len = mvm_get_int( 1, &worked );
+    if ( len != 3 || order != -1 ){
+      printf( "scmp & slen gave %lld & %lld, expected -1 & 3\n",
+              (long long)order, (long long)len );
+      result = MVM_ERROR;
+    }
+    s->sp = 0;
+    mvm_State_clear_heap( s );
+    mvm_cleanup_Chunk( &c );
+
+    // A state may only own hs allocations at once
+    mvm_State *small = mvm_new_State( 16, 2, 0 );
+    mvm_set_state( small );
+    const char newc[] = { (char)mvm_op_id("newc") };
+    mvm_exec( newc, 1 );
+    mvm_exec( newc, 1 );
+    mvm_exec( newc, 1 );
+    if ( small->error != MVM_ERROR_HEAP_FULL || small->sp != 2 ){
+      printf( "Full heap gave error %d, expected %d\n", small->error,
+              MVM_ERROR_HEAP_FULL );
+      result = MVM_ERROR;
+    }
+    mvm_del_State( small );
+    mvm_set_state( s );
+  }
+
+  // Strings: small ones stay inline, appends grow geometrically, & ropes
+  // flatten to the same text
+  {
+    mvm_String a, b;
+    mvm_Rope r;
+    mvm_init_String( &a );
+    mvm_init_String( &b );
+    mvm_init_Rope( &r );
+    mvm_String_append_cstr( &a, "Sol" );
+    bool worked = a.str == a.buf && mvm_String_append_char( &a, 'a' ) &&
+                  mvm_String_appendf( &a, "r %s", "System" ) &&
+                  !strcmp( a.str, "Solar System" );
+    mvm_String_set( &b, &a );
+    uint32_t grows = 0, cap = b.cap;
+    for ( uint32_t i = 0; i < 2000; ++i ){
+      mvm_String_appendf( &b, " %u", i );
+      mvm_Rope_append_cstr( &r, i % 2 ? " " : "" );
+      if ( i % 2 ) mvm_Rope_append_ref( &r, "ref", 3 );
+      else mvm_Rope_append_n( &r, "copy", 4 );
+      grows += b.cap != cap;
+      cap = b.cap;
+    }
+    mvm_String_append_n( &b, b.str, 5 ); // from itself, as it grows
+    worked = worked && grows < 16 && b.len == strlen( b.str ) &&
+             !strcmp( b.str + b.len - 14, "1998 1999Solar" );
+
+    mvm_String_clear( &a );
+    worked = worked && mvm_Rope_flatten( &r, &a ) == MVM_OK &&
+             a.len == r.len && a.len == 8000 &&
+             !strncmp( a.str, "copy refcopy ref", 16 );
+    if ( !worked ){
+      printf( "Strings went wrong (\"%.32s\", %u grows)\n", a.str, grows );
+      result = MVM_ERROR;
+    }
+    mvm_cleanup_String( &a );
+    mvm_cleanup_String( &b );
+    mvm_cleanup_Rope( &r );
+  }
+
+  // Interning: equal strings share one copy, which stays put as the table
+  // grows, & op names are interned (& found without it by mvm_op_id)
+  {
+    const char* orbit = mvm_intern( "orbit" );
+    bool worked = orbit && mvm_intern_slice( "orbits", 5 ) == orbit &&
+                  !mvm_interned( "never interned" ) &&
+                  mvm_interned( "pushk" ) == mvm_find_op( "pushk" )->name &&
+                  mvm_op_id( "never interned" ) == MVM_NOT_FOUND;
+    for ( uint32_t i = 0; i < MVM.num_ops; ++i ){
+      worked = worked && mvm_op_id( MVM.op_names[i] ) == (int)i &&
+               mvm_find_op( MVM.op_names[i] )->id == i;
+    }
+    char name[32];
+    for ( uint32_t i = 0; i < 5000; ++i ){
+      snprintf( name, sizeof(name), "orbit_%u", i );
+      worked = worked && mvm_intern( name ) && mvm_intern( "orbit" ) == orbit;
+    }
+    mvm_Object *a = mvm_new_Object_string( "orbit_42" );
+    mvm_Object *b = mvm_new_Object_string( "orbit_42" );
+    worked = worked && a && b && mvm_obj_string( *a ) == mvm_obj_string( *b ) &&
+             !strcmp( orbit, "orbit" );
+    free( a );
+    free( b );
+    if ( !worked ){
+      printf( "Interning went wrong\n" );
+      result = MVM_ERROR;
+    }
+  }
+
+  // Hashing: reads only the key (whatever its length), and hashes by value
+  {
+    char *key = NULL;
+    bool worked = true;
+    mvm_hash h[65];
+    for ( uint32_t n = 0; n <= 64; ++n ){
+      key = (char*)malloc( n + 1 ); // exactly sized, for the sanitizers
+      memset( key, 'a', n );
+      key[n] = '\0';
+      h[n] = mvm_hash_cstr( key );
+      worked = worked && h[n] == mvm_hash_scstr( key, n );
+      for ( uint32_t m = 0; m < n; ++m ) worked = worked && h[m] != h[n];
+      if ( n ){
+        key[n/2] = 'b'; // one byte changed
+        worked = worked && mvm_hash_cstr( key ) != h[n];
+      }
+      free( key );
+    }
+    worked = worked && mvm_hash_double( -0.0 ) == mvm_hash_double( 0.0 ) &&
+             mvm_hash_float( 1.5f ) == mvm_hash_double( 1.5 ) &&
+             mvm_hash_int( 1 ) != mvm_hash_int( 2 );
+    if ( !worked ){
+      printf( "Hashing went wrong\n" );
+      result = MVM_ERROR;
+    }
+  }
+
+  // Hash maps: keys by value, growth, removal without tombstones & iteration
+  {
+    mvm_HMap m;
+    mvm_init_HMap( &m );
+    mvm_Object k, v;
+    bool worked = true;
+    for ( mvmint i = 0; i < 1000; ++i ){
+      mvm_obj_set_int( k, i );
+      mvm_obj_set_int( v, i*3 );
+      worked = worked && mvm_HMap_set( &m, &k, &v ) == MVM_OK;
+    }
+    for ( mvmint i = 0; i < 1000; i += 2 ){ // remove the evens
+      mvm_obj_set_int( k, i );
+      worked = worked && mvm_HMap_remove( &m, &k, &v ) && mvm_obj_int( v ) == i*3;
+    }
+    for ( mvmint i = 0; i < 1000; ++i ){
+      mvm_obj_set_int( k, i );
+      mvm_Object *got = mvm_HMap_get( &m, &k );
+      worked = worked && (i % 2 ? got && mvm_obj_int( *got ) == i*3 : !got);
+    }
+
+    // Strings match by contents, -0 is 0, and 1 the integer isn't 1.0
+    char name[] = "orbit";
+    mvm_obj_set_pointer( k, MVM_TYPE::string, "orbit" );
+    mvm_obj_set_number( v, (mvmnum)1.0 );
+    mvm_HMap_set( &m, &k, &v );
+    mvm_obj_set_pointer( k, MVM_TYPE::string, name );
+    mvm_obj_set_number( v, (mvmnum)2.0 );
+    mvm_HMap_set( &m, &k, &v ); // overwrites "orbit"
+    mvm_obj_set_number( k, (mvmnum)0.0 );
+    mvm_HMap_set( &m, &k, &v );
+    mvm_obj_set_number( k, (mvmnum)-0.0 );
+    worked = worked && mvm_HMap_get( &m, &k ) && m.count == 502;
+    mvm_obj_set_number( k, (mvmnum)1.0 );
+    worked = worked && !mvm_HMap_get( &m, &k );
+
+    uint32_t i = 0, n = 0;
+    mvmint sum = 0;
+    const mvm_Object *key;
+    mvm_Object *value;
+    while ( mvm_HMap_next( &m, &i, &key, &value ) ){
+      if ( mvm_obj_is( *key, MVM_TYPE::integer ) ) sum += mvm_obj_int( *value );
+      ++n;
+    }
+    if ( !worked || n != 502 || sum != 750000 ){
+      printf( "Hash map went wrong (%u entries, sum %lld)\n", n,
+              (long long)sum );
+      result = MVM_ERROR;
+    }
+    mvm_cleanup_HMap( &m );
+  }
+
+  // Programs: sum(n) calls itself, and main loops over it until a global
+  // reaches a limit, so jumps, branches, calls & returns all get exercised
+  {
+    mvm_Program p;
+    mvm_init_Program( &p );
+    int zero = mvm_Program_add_int( &p, 0 ), one = mvm_Program_add_int( &p, 1 );
+    int limit = mvm_Program_add_int( &p, 100 );
+    int total = mvm_Program_add_global( &p, "total" );
+
+    // sum(n): n > 0 ? n + sum(n - 1) : 0
+    int sum = mvm_Program_add_function( &p, 1, 2 );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("pushk"), zero) );
+    mvm_Program_emit( &p, MVM_INSTR3(mvm_op_id("rloadk"), 1, one, 0) );
+    mvm_Program_emit( &p, MVM_INSTR3(mvm_op_id("rilt"), 1, 1, 0) ); // 1 < n
+    mvm_Program_emit( &p, MVM_INSTR3(mvm_op_id("rpush"), 0, 1, 0) );
+    int skip = mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("jf"), 0) );
+    mvm_Program_emit( &p, MVM_INSTR3(mvm_op_id("rpush"), 0, 0, 0) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("pushk"), one) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("isub"), 0) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("nip"), 2) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("call"), sum) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("nip"), 1) );
+    mvm_Program_patch( &p, skip, mvm_Program_emit( &p,
+                       MVM_INSTR3(mvm_op_id("rpush"), 0, 0, 0) ) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("iadd"), 0) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("ret"), 1) );
+
+    // main: for ( i = 0; i < 100; ++i ) total += sum(i)
+    p.main = mvm_Program_add_function( &p, 0, 4 );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("pushk"), zero) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("gstore"), total) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("pop"), 1) );
+    mvm_Program_emit( &p, MVM_INSTR3(mvm_op_id("rloadk"), 0, zero, 0) );
+    mvm_Program_emit( &p, MVM_INSTR3(mvm_op_id("rloadk"), 1, one, 0) );
+    mvm_Program_emit( &p, MVM_INSTR3(mvm_op_id("rloadk"), 2, limit, 0) );
+    int loop = mvm_Program_emit( &p, MVM_INSTR3(mvm_op_id("rpush"), 0, 0, 0) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("call"), sum) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("gload"), total) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("iadd"), 0) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("gstore"), total) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("pop"), 3) );
+    mvm_Program_emit( &p, MVM_INSTR3(mvm_op_id("riadd"), 0, 0, 1) );
+    mvm_Program_emit( &p, MVM_INSTR3(mvm_op_id("rilt"), 3, 0, 2) );
+    mvm_Program_emit( &p, MVM_INSTR3(mvm_op_id("rpush"), 0, 3, 0) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("jt"), loop) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("ret"), 0) );
+
+    // Save & load it, then run it a few ops at a time
+    uint32_t size = 0;
+    char *bytes = mvm_Program_save( &p, &size );
+    mvm_Program q;
+    mvm_init_Program( &q );
+    if ( !bytes || mvm_Program_load( &q, bytes, size ) != MVM_OK ){
+      printf( "Program didn't save & load\n" );
+      result = MVM_ERROR;
+    }
+    free( bytes );
+
+    mvm_Call x;
+    uint32_t slices = 0;
+    mvm_begin_call( &x, &q, q.main );
+    while ( !x.done ){
+      mvm_continue_call( &x, 100 );
+      ++slices;
+    }
+    mvm_end_call( &x );
+
+    mvmint expected = 0;
+    for ( mvmint i = 0; i < 100; ++i ) expected += i*(i + 1)/2;
+    if ( s->error != MVM_OK || s->sp != 0 || q.nglobals != 1 ||
+         mvm_obj_int( q.globals[0] ) != expected || slices < 2 ){
+      printf( "Program gave %lld (error %d, %u left on the stack), expected "
+              "%lld\n", q.nglobals ? (long long)mvm_obj_int( q.globals[0] ) : 0,
+              s->error, s->sp, (long long)expected );
+      result = MVM_ERROR;
+    }
+#ifdef MVM_JIT
+    // sum is called & main loops more than enough to compile both, part way
+    // through the run (& main is entered again after each slice & call)
+    if ( !q.jit || !q.jit[sum].code || !q.jit[q.main].code ){
+      printf( "Program functions were never compiled\n" );
+      result = MVM_ERROR;
+    }
+#endif
+    s->error = MVM_OK;
+    s->sp = 0;
+
+    // Save the run (so quickened) program to a file & run it mapped: code &
+    // string constants are used in place, and nothing is written to them
+    {
+      char path[] = "/tmp/mvm_mapXXXXXX";
+      int fd = mkstemp( path );
+      mvm_Program_add_string( &q, "in place" );
+      bytes = mvm_Program_save( &q, &size );
+      bool saved = fd >= 0 && bytes && write( fd, bytes, size ) == (ssize_t)size;
+      free( bytes );
+      if ( fd >= 0 ) close( fd );
+
+      mvm_Program m;
+      mvm_init_Program( &m );
+      const char *k = NULL;
+      if ( !saved || mvm_Program_map( &m, path ) != MVM_OK ||
+           mvm_call( &m, m.main ) != MVM_OK ||
+           mvm_obj_int( m.globals[0] ) != expected ||
+           (const char*)m.code < m.map ||
+           (const char*)(m.code + m.size) > m.map + m.map_size ||
+           (k = mvm_obj_string( m.k[m.nk - 1] )) < m.map ||
+           k >= m.map + m.map_size || strcmp( k, "in place" ) ||
+           mvm_Program_emit( &m, 0 ) != MVM_ERROR ){
+        printf( "Mapped program didn't run in place (error %d)\n", s->error );
+        result = MVM_ERROR;
+      }
+      s->error = MVM_OK;
+      s->sp = 0;
+      mvm_cleanup_Program( &m );
+      if ( fd >= 0 ) remove( path );
+    }
+
+    // Jumping out of the code is caught before anything runs
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("jmp"), p.size + 5) );
+    if ( mvm_call( &p, p.main ) != MVM_ERROR_BAD_PROGRAM ){
+      printf( "Bad jump wasn't caught\n" );
+      result = MVM_ERROR;
+    }
+    s->error = MVM_OK;
+    s->sp = 0;
+
+    // So are unchecked ops without a room in front as deep as they go
+    {
+      mvm_Program u;
+      mvm_init_Program( &u );
+      int two = mvm_Program_add_number( &u, 2.0f );
+      int room = mvm_Program_add_function( &u, 0, 0 );
+      mvm_Program_emit( &u, MVM_INSTR(mvm_op_id("room"), 1) );
+      mvm_Program_emit( &u, MVM_INSTR(mvm_op_id("pushk"), two) );
+      mvm_Program_emit( &u, MVM_INSTR(mvm_op_id("pushk"), two) );
+      mvm_Program_emit( &u, MVM_INSTR(mvm_op_id("add_nip_nn"), 0) );
+      mvm_Program_emit( &u, MVM_INSTR(mvm_op_id("ret"), 1) );
+      int bad = mvm_call( &u, room );
+      s->error = MVM_OK;
+      s->sp = 0;
+
+      mvm_Program_patch( &u, u.funcs[room].entry, 2 ); // room 2 is enough
+      int good = mvm_call( &u, room );
+      if ( bad != MVM_ERROR_BAD_PROGRAM || good != MVM_OK || s->sp != 1 ||
+           mvm_obj_number( s->s[0] ) != 4.0f ){
+        printf( "Unguarded unchecked ops weren't caught (%d, then %d)\n", bad,
+                good );
+        result = MVM_ERROR;
+      }
+      s->error = MVM_OK;
+      s->sp = 0;
+      mvm_cleanup_Program( &u );
+    }
+
+    mvm_cleanup_Program( &p );
+    mvm_cleanup_Program( &q );
+  }
+
+  // Fusing a program: compares & the branches after them become branch ops,
+  // & jumps & function entries follow the code, but nothing fuses with an
+  // instruction that's jumped to. run() sums i for i < 10 into total & counts
+  // the i < 5 into hits (its unchecked ops need the room, 3 deep, in front).
+  {
+    mvm_Program p;
+    mvm_init_Program( &p );
+    int zero = mvm_Program_add_int( &p, 0 ), one = mvm_Program_add_int( &p, 1 );
+    int five = mvm_Program_add_int( &p, 5 ), ten = mvm_Program_add_int( &p, 10 );
+    int total = mvm_Program_add_global( &p, "total" );
+    int hits = mvm_Program_add_global( &p, "hits" );
+    mvm_obj_set_int( p.globals[total], 0 );
+    mvm_obj_set_int( p.globals[hits], 0 );
+
+    int run = mvm_Program_add_function( &p, 0, 2 );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("room"), 3) );
+    mvm_Program_emit( &p, MVM_INSTR3(mvm_op_id("rloadk"), 0, zero, 0) );
+    mvm_Program_emit( &p, MVM_INSTR3(mvm_op_id("rloadk"), 1, one, 0) );
+    int loop = mvm_Program_emit( &p, MVM_INSTR3(mvm_op_id("rpush"), 0, 0, 0) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("pushk"), ten) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("ilt"), 0) );
+    int done = mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("jf"), 0) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("pop"), 2) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("pushk"), zero) );
+    mvm_Program_emit( &p, MVM_INSTR3(mvm_op_id("rpush"), 0, 0, 0) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("pushk"), five) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("ilt_nip_ii"), 0) );
+    int skip = mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("jf"), 0) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("pop"), 1) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("gload"), hits) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("pushk"), one) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("iadd_nip_ii"), 0) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("gstore"), hits) );
+    mvm_Program_patch( &p, skip, mvm_Program_emit( &p,
+                       MVM_INSTR(mvm_op_id("pop"), 1) ) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("gload"), total) );
+    mvm_Program_emit( &p, MVM_INSTR3(mvm_op_id("rpush"), 0, 0, 0) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("iadd_nip_ii"), 0) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("gstore"), total) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("pop"), 1) );
+    mvm_Program_emit( &p, MVM_INSTR3(mvm_op_id("riadd"), 0, 0, 1) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("jmp"), loop) );
+    mvm_Program_patch( &p, done, mvm_Program_emit( &p,
+                       MVM_INSTR(mvm_op_id("pop"), 2) ) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("ret"), 0) );
+
+    p.main = mvm_Program_add_function( &p, 0, 0 );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("call"), run) );
+    mvm_Program_emit( &p, MVM_INSTR(mvm_op_id("ret"), 0) );
+
+    uint32_t size = p.size, fused = mvm_fuse_program( &p );
+    uint32_t branches = 0, stores = 0;
+    for ( uint32_t i = 0; i < p.size; ++i ){
+      branches += MVM_FLOW.kind[MVM_OP(p.code[i])] == MVM_FLOW_BRANCH;
+      stores += MVM_OP(p.code[i]) == (uint32_t)mvm_op_id( "gstore_pop" );
+    }
+    if ( fused != 3 || p.size != size - 3 || branches != 2 || stores != 1 ||
+         p.funcs[p.main].entry != p.size - 2 ||
+         mvm_call( &p, p.main ) != MVM_OK || s->sp != 0 ||
+         mvm_obj_int( p.globals[total] ) != 45 ||
+         mvm_obj_int( p.globals[hits] ) != 5 ){
+      printf( "Fused program went wrong (%u fused, error %d, total %lld, hits "
+              "%lld)\n", fused, s->error,
+              (long long)mvm_obj_int( p.globals[total] ),
+              (long long)mvm_obj_int( p.globals[hits] ) );
+      result = MVM_ERROR;
+    }
+    s->error = MVM_OK;
+    s->sp = 0;
+
+#ifdef MVM_JIT
+    // The branches run natively too, once run has looped enough
+    for ( int i = 0; i < MVM_JIT_THRESHOLD; ++i ){
+      mvm_obj_set_int( p.globals[total], 0 );
+      mvm_obj_set_int( p.globals[hits], 0 );
+      if ( mvm_call( &p, p.main ) != MVM_OK || s->sp != 0 ||
+           mvm_obj_int( p.globals[total] ) != 45 ||
+           mvm_obj_int( p.globals[hits] ) != 5 ){
+        printf( "Native fused program went wrong on run %d (error %d)\n", i,
+                s->error );
+        result = MVM_ERROR;
+        break;
+      }
+    }
+    if ( !p.jit || !p.jit[run].code ){
+      printf( "Fused program was never compiled\n" );
+      result = MVM_ERROR;
+    }
+    s->error = MVM_OK;
+    s->sp = 0;
+#endif
+    mvm_cleanup_Program( &p );
+  }
+
+  // States on different threads must run independently
+  {
+    const int nthreads = 4;
+    pthread_t t[nthreads];
+    mvmnum sums[nthreads];
+    for ( int i = 0; i < nthreads; ++i ){
+      sums[i] = (mvmnum)(1000 + i);
+      pthread_create( &t[i], NULL, sum_thread, &sums[i] );
+    }
+    for ( int i = 0; i < nthreads; ++i ){
+      pthread_join( t[i], NULL );
+      mvmnum n = (mvmnum)(1000 + i);
+      if ( sums[i] != n*(n + 1)/2 ){
+        printf( "Thread %d summed to %f, expected %f\n", i, sums[i],
+                n*(n + 1)/2 );
+        result = MVM_ERROR;
+      }
+    }
+    if ( mvm_get_state() != s ){
+      printf( "Other threads changed this thread's state\n" );
+      result = MVM_ERROR;
+    }
+  }
+
+  // Run lots of small jobs on a pool, a few ops at a time
+  {
+    const uint32_t njobs = 1000;
+    mvm_Pool *pool = mvm_new_Pool( 4, 3 );
+    mvm_State **states = (mvm_State**)malloc( sizeof(mvm_State*)*njobs );
+    mvm_Chunk *chunks = (mvm_Chunk*)malloc( sizeof(mvm_Chunk)*njobs );
+    mvm_Job *jobs = (mvm_Job*)malloc( sizeof(mvm_Job)*njobs );
+
+    for ( uint32_t i = 0; i < njobs; ++i ){
+      // (i + 1)*2 - 1, as a stack chunk of 7 ops
+      states[i] = mvm_new_State( 64, 0, 0 );
+      mvm_init_Chunk( &chunks[i], MVM_CHUNK_STACK, 0 );
+      mvm_Chunk_add_number( &chunks[i], (mvmnum)i );
+      mvm_Chunk_add_number( &chunks[i], 1.0f );
+      mvm_Chunk_add_number( &chunks[i], 2.0f );
+      mvm_Chunk_emit( &chunks[i], MVM_INSTR(mvm_op_id("pushk"), 0) );
+      mvm_Chunk_emit( &chunks[i], MVM_INSTR(mvm_op_id("pushk"), 1) );
+      mvm_Chunk_emit( &chunks[i], MVM_INSTR(mvm_op_id("add_nip"), 0) );
+      mvm_Chunk_emit( &chunks[i], MVM_INSTR(mvm_op_id("pushk"), 2) );
+      mvm_Chunk_emit( &chunks[i], MVM_INSTR(mvm_op_id("mul_nip"), 0) );
+      mvm_Chunk_emit( &chunks[i], MVM_INSTR(mvm_op_id("pushk"), 1) );
+      mvm_Chunk_emit( &chunks[i], MVM_INSTR(mvm_op_id("sub_nip"), 0) );
+      mvm_init_Job( &jobs[i], states[i], &chunks[i] );
+    }
+
+    int runs = 0, left = njobs;
+    while ( left > 0 && runs < 10 ){
+      left = mvm_Pool_run( pool, jobs, njobs );
+      ++runs;
+    }
+    if ( runs != 3 || left ){
+      printf( "Pool took %d runs, %d jobs left (expected 3 & 0)\n", runs, left );
+      result = MVM_ERROR;
+    }
+
+    for ( uint32_t i = 0; i < njobs; ++i ){
+      mvm_set_state( states[i] );
+      bool worked = false;
+      mvmnum n = mvm_get_number( 1, &worked );
+      if ( !worked || states[i]->sp != 1 || n != (mvmnum)(i*2 + 1) ){
+        printf( "Job %u left %f, expected %f\n", i, n, (mvmnum)(i*2 + 1) );
+        result = MVM_ERROR;
+        break;
+      }
+    }
+
+    // A state limited to 5 ops a second stops after 5 ops, however many
+    // runs it gets within that second
+    mvm_set_state( s );
+    states[0]->sp = 0;
+    states[0]->ops_per_second = 5;
+    mvm_init_Job( &jobs[0], states[0], &chunks[0] );
+    mvm_Pool_run( pool, jobs, 1 );
+    mvm_Pool_run( pool, jobs, 1 );
+    mvm_Pool_run( pool, jobs, 1 );
+    if ( jobs[0].run.pc != 5 || mvm_Job_done( &jobs[0] ) ){
+      printf( "Throttled job ran %u ops, expected 5\n", jobs[0].run.pc );
+      result = MVM_ERROR;
+    }
+
+    mvm_del_Pool( pool );
+    for ( uint32_t i = 0; i < njobs; ++i ){
+      mvm_cleanup_Chunk( &chunks[i] );
+      mvm_del_State( states[i] );
+    }
+    free( states );
+    free( chunks );
+    free( jobs );
+    mvm_set_state( s );
   }
 
-  mvm_exec( NULL, 0 );
+#ifdef MVM_PROFILE_OPS
+  mvm_profile_report( stdout, 10 );
+#endif
 
   MVM_CLEANUP();
 
@@ -2,13 +2,83 @@
 
 #include "defs.h"
 #include "aatree.h"
+#include "intern.h"
 #include <math.h>
 
 // Notes:
-// 1. Strings are immutable (re-created when changed, innefficient)
-// 2. Numbers are all 32bit floats
+// 1. Strings are immutable (re-created when changed, innefficient), and
+//    string objects made here are interned (see intern.h)
+// 2. Numbers are 32bit floats, or doubles with MVM_DOUBLE (see defs.h)
 // 3. Tables are AATrees of other objects
 
+/* Objects come in two layouts, picked at compile time:
+
+   tagged      - a type byte plus a pointer sized union (16 bytes on 64 bit)
+   NaN-boxed   - with MVM_NAN_BOXING defined, one 64 bit word (8 bytes).
+                 Numbers are stored as doubles, every other type lives in the
+                 payload of a negative quiet NaN with its type in bits 48-50:
+
+                 [ 1 | 11111111111 | 1 | type:3 | payload:48 ]
+
+                 NaN numbers are canonicalized to a positive quiet NaN so
+                 they can't be mistaken for anything else, and pointers must
+                 fit in 48 bits (they do on x86-64 & AArch64).
+
+   Only touch objects through the mvm_obj_* macros below, so code works with
+   either layout. Type checks are a single mask & compare with NaN-boxing. */
+
+#ifdef MVM_NAN_BOXING
+
+/// An object to be used by the MVM
+typedef struct _mvm_Object
+{
+  uint64_t v; // NaN-boxed value
+} mvm_Object;
+
+#define MVM_BOX_TAG 0xFFF8000000000000ull // set in all non-number objects
+#define MVM_BOX_TYPE_MASK 0xFFFF000000000000ull // tag & type bits
+#define MVM_BOX_PAYLOAD 0x0000FFFFFFFFFFFFull
+#define MVM_BOX_NAN 0x7FF8000000000000ull // canonical NaN number
+
+uint64_t _mvm_box_number( mvmnum n )
+{
+  double d = (double)n;
+  uint64_t v;
+  if ( d != d ) return MVM_BOX_NAN;
+  memcpy( &v, &d, sizeof(v) );
+  return v;
+}
+
+mvmnum _mvm_unbox_number( uint64_t v )
+{
+  double d;
+  memcpy( &d, &v, sizeof(d) );
+  return (mvmnum)d;
+}
+
+#define _MVM_BOX( T, P ) (MVM_BOX_TAG | ((uint64_t)(T) << 48) |\
+                          ((uint64_t)(P) & MVM_BOX_PAYLOAD))
+
+#define mvm_obj_is( O, T ) ((T) == MVM_TYPE::number ?\
+  ((O).v & MVM_BOX_TAG) != MVM_BOX_TAG :\
+  ((O).v & MVM_BOX_TYPE_MASK) == _MVM_BOX( T, 0 ))
+#define mvm_obj_type( O ) (((O).v & MVM_BOX_TAG) != MVM_BOX_TAG ?\
+  (char)MVM_TYPE::number : (char)(((O).v >> 48) & 7))
+
+#define mvm_obj_number( O ) _mvm_unbox_number( (O).v )
+#define mvm_obj_bool( O ) ((mvmbool)((O).v & 0xff))
+#define mvm_obj_int( O ) ((mvmint)(int32_t)(uint32_t)(O).v)
+#define mvm_obj_pointer( O ) ((void*)(uintptr_t)((O).v & MVM_BOX_PAYLOAD))
+#define mvm_obj_string( O ) ((const char*)mvm_obj_pointer( O ))
+
+#define mvm_obj_set_number( O, N ) ((O).v = _mvm_box_number( N ))
+#define mvm_obj_set_bool( O, B ) ((O).v = _MVM_BOX( MVM_TYPE::boolean, (B) ))
+#define mvm_obj_set_pointer( O, T, P ) ((O).v = _MVM_BOX( T, (uintptr_t)(P) ))
+#define mvm_obj_set_int( O, I )\
+  ((O).v = _MVM_BOX( MVM_TYPE::integer, (uint32_t)(I) ))
+
+#else
+
 /// An object to be used by the MVM
 typedef struct _mvm_Object
 {
@@ -17,59 +87,78 @@ typedef struct _mvm_Object
     int (*f)(); // A function
     void* p; // pointer
     mvmnum n; // number (float)
+    mvmint i; // integer
     mvmbool b; // boolean (unsigned char)
     const char* s; // duh, it's a c-string
   } data; // Data in object
 } mvm_Object;
 
+#define mvm_obj_is( O, T ) ((O).type == (T))
+#define mvm_obj_type( O ) ((O).type)
+
+#define mvm_obj_number( O ) ((O).data.n)
+#define mvm_obj_bool( O ) ((O).data.b)
+#define mvm_obj_int( O ) ((O).data.i)
+#define mvm_obj_pointer( O ) ((O).data.p)
+#define mvm_obj_string( O ) ((O).data.s)
+
+#define mvm_obj_set_number( O, N )\
+  ((O).type = MVM_TYPE::number, (O).data.n = (N))
+#define mvm_obj_set_bool( O, B )\
+  ((O).type = MVM_TYPE::boolean, (O).data.b = (B))
+#define mvm_obj_set_pointer( O, T, P ) ((O).type = (T), (O).data.p = (void*)(P))
+#define mvm_obj_set_int( O, I )\
+  ((O).type = MVM_TYPE::integer, (O).data.i = (I))
+
+#endif
+
+// Change the value of O, which is known to already be a number/bool (so a
+// tagged object's type needn't be written again)
+#ifdef MVM_NAN_BOXING
+#define mvm_obj_put_number( O, N ) mvm_obj_set_number( O, N )
+#define mvm_obj_put_bool( O, B ) mvm_obj_set_bool( O, B )
+#else
+#define mvm_obj_put_number( O, N ) ((O).data.n = (N))
+#define mvm_obj_put_bool( O, B ) ((O).data.b = (B))
+#endif
+
 mvm_Object *mvm_new_Object_number( mvmnum n )
 {
   mvm_Object *o = mvm_malloc(mvm_Object);
 
-  if ( o ){
-    o->type = MVM_TYPE::number;
-    o->data.n = n;
-  }
+  if ( o ) mvm_obj_set_number( *o, n );
 
   return o;
 }
 
-// Creates an mvm_Object with type string & copies s into o->data.s
+// Creates an mvm_Object with type string holding the interned copy of s (see
+// intern.h), which equal strings share & which mustn't be freed
 mvm_Object *mvm_new_Object_string( const char* s )
 {
-  mvm_Object *o = mvm_malloc(mvm_Object);
+  const char* str = mvm_intern( s );
+  mvm_Object *o = str ? mvm_malloc(mvm_Object) : NULL;
 
-  if ( o ){
-    o->type = MVM_TYPE::string;
-    o->data.s = (const char*)malloc(strlen(s)*sizeof(char) + 1);
-    strcpy((char*)(o->data.s), s);
-  }
+  if ( o ) mvm_obj_set_pointer( *o, MVM_TYPE::string, str );
 
   return o;
 }
 
-// Creates an mvm_Object with type pointer and sets o->data.p to p
+// Creates an mvm_Object with type pointer pointing to t
 mvm_Object *mvm_new_Object_table( mvm_AATree* t )
 {
   mvm_Object *o = mvm_malloc(mvm_Object);
 
-  if ( o ){
-    o->type = MVM_TYPE::pointer;
-    o->data.p = (void*)t;
-  }
+  if ( o ) mvm_obj_set_pointer( *o, MVM_TYPE::pointer, t );
 
   return o;
 }
 
-// Creates an mvm_Object with type pointer and sets o->data.p to p
+// Creates an mvm_Object with type pointer pointing to p
 mvm_Object *mvm_new_Object_pointer( void* p )
 {
   mvm_Object *o = mvm_malloc(mvm_Object);
 
-  if ( o ){
-    o->type = MVM_TYPE::pointer;
-    o->data.p = p;
-  }
+  if ( o ) mvm_obj_set_pointer( *o, MVM_TYPE::pointer, p );
 
   return o;
 }
\ No newline at end of file
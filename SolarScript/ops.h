@@ -5,12 +5,13 @@
 
 #include "defs.h"
 #include "state.h"
+#include "intern.h"
 
 #include <math.h>
 
 typedef struct _mvm_Operation
 {
-  const char* name; // name used during compilation
+  const char* name; // name used during compilation (interned)
   uint32_t id; // id used during execution
 
   /// use mvm_argc() to get the number of args, and mvm_get_<type>() functions
@@ -20,11 +21,11 @@ typedef struct _mvm_Operation
 
 int mvm_Operation_comp( void *a, void *b )
 {
-  /* Compare based on names, not ids */
+  /* Compare based on (interned) names, not ids */
   mvm_Operation *oa = (mvm_Operation*)a;
   mvm_Operation *ob = (mvm_Operation*)b;
 
-  return strcmp(oa->name, ob->name);
+  return mvm_interned_comp(oa->name, ob->name);
 }
 
 int mvm_Operation_comp_id( void *a, void *b )
@@ -36,19 +37,99 @@ int mvm_Operation_comp_id( void *a, void *b )
   return oa->id < ob->id ? -1 : oa->id > ob->id ? 1 : 0;
 }
 
-// Generate an operation from a name and exec function pointer
+// Slot of the op named name in MVM.op_slots, or the empty one it would go in.
+// Ops are only registered by MVM_INIT, so looking them up needs no lock.
+uint16_t *_mvm_op_slot( const char* name )
+{
+  uint32_t mask = MVM_OP_SLOTS - 1;
+  uint32_t i = (uint32_t)mvm_hash_cstr( name ) & mask;
+  for ( ;; i = (i + 1) & mask ){
+    uint16_t *slot = &MVM.op_slots[i];
+    if ( !*slot || !strcmp( MVM.op_names[*slot - 1], name ) ) return slot;
+  }
+}
+
+// Generate an operation from a name and exec function pointer. The id is the
+// next free opcode; use mvm_register_op() to make it visible to the VM.
 mvm_Operation *_mvm_genop( const char* name, int (*exec)() )
 {
+  if ( MVM.num_ops >= MVM_MAX_OPS ) return NULL; // out of opcodes
+  if ( !(name = mvm_intern( name )) ) return NULL;
+
   mvm_Operation *o = mvm_malloc( mvm_Operation );
   if ( o ){
-    static uint32_t id = 0;
     o->exec = exec;
-    o->name = "not";
-    o->id = id++;
+    o->name = name;
+    o->id = MVM.num_ops++;
   }
   return o;
 }
 
+// Add an operation to both the name tree (used by the compiler) and the dense
+// dispatch table (used by mvm_exec). Returns the new opcode or MVM_ERROR.
+int mvm_register_op( const char* name, int (*exec)() )
+{
+  mvm_Operation *o = _mvm_genop( name, exec );
+  if ( !o ) return MVM_ERROR;
+
+  mvm_AATree_insert( &MVM.global_funcs, o );
+  MVM.dispatch[o->id] = exec;
+  MVM.op_names[o->id] = o->name;
+  *_mvm_op_slot( o->name ) = (uint16_t)(o->id + 1);
+
+  return (int)o->id;
+}
+
+// Look up an operation by name - this walks the tree (& takes the intern
+// lock), so only use it while compiling, never while executing! mvm_op_id()
+// doesn't lock.
+mvm_Operation *mvm_find_op( const char* name )
+{
+  mvm_Operation key;
+  if ( !(key.name = mvm_interned( name )) ) return NULL; // no op has it
+  return (mvm_Operation*)mvm_AATree_get( &MVM.global_funcs, (void*)&key );
+}
+
+// Opcode of the named operation, or MVM_NOT_FOUND
+int mvm_op_id( const char* name )
+{
+  uint16_t id = *_mvm_op_slot( name );
+  return id ? (int)id - 1 : MVM_NOT_FOUND;
+}
+
+// Push constant k[arg] of the chunk being executed
+int _mvm_op_exec_pushk()
+{
+  mvm_State *s = MVM_STATE;
+  uint32_t i = mvm_arg();
+  if ( i >= s->nk ){
+    mvm_set_error( MVM_BAD_ARG_1 );
+    return 0;
+  }
+
+  mvm_push_object( &s->k[i] );
+
+  return 1;
+}
+
+// Drop arg objects from beneath the top of the stack, keeping the top. The
+// builtin ops leave their operands in place, so `add` followed by `nip 2`
+// gives the consuming form of add.
+int _mvm_op_exec_nip()
+{
+  mvm_State *s = MVM_STATE;
+  uint32_t n = mvm_arg();
+  if ( !s->sp || n >= s->sp ){
+    mvm_set_error( MVM_ERROR_STACK_UNDERFLOW );
+    return 0;
+  }
+
+  s->s[s->sp - 1 - n] = s->s[s->sp - 1];
+  s->sp -= n;
+
+  return -(int)n;
+}
+
 // Builtin operations for arithmatic & logic
 
 // Perform !a (not a) op and push result to stack
@@ -309,7 +390,7 @@ int _mvm_op_exec_pow() // push a ^ b to the stack
     mvm_set_error( MVM_BAD_ARG_2 );
     return 0;
   }
-  mvm_push_number( powf32(a,b) );
+  mvm_push_number( mvm_pow(a,b) );
 
   return 1;
 }
@@ -324,7 +405,7 @@ int _mvm_op_exec_abs() // push |a| to the stack
     return 0;
   }
 
-  mvm_push_number( fabsf(a) );
+  mvm_push_number( mvm_fabs(a) );
 
   return 1;
 }
@@ -430,7 +511,7 @@ int _mvm_op_exec_ippow() // performs a = a ^ b
     return 0;
   }
 
-  mvm_set_number( 2, powf32(a,b), &worked ); // a is an mvmnum, so this works
+  mvm_set_number( 2, mvm_pow(a,b), &worked ); // a is an mvmnum, so this works
 
   return 0;
 }
@@ -445,7 +526,7 @@ int _mvm_op_exec_ipabs() // performs a = |a|
     return 0;
   }
 
-  mvm_set_number( 1, fabsf(a), &worked ); // a is an mvmnum, so this works
+  mvm_set_number( 1, mvm_fabs(a), &worked ); // a is an mvmnum, so this works
 
   return 0;
 }
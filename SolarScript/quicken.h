@@ -0,0 +1,188 @@
+/* Quickening: run-time type specialization for code the compiler couldn't
+   type statically (see specialize.h for the static version).
+
+   When mvm_exec_chunk() is about to run a generic op that has a quick
+   version, it looks at the tags of the op's operands. If they match the quick
+   version, the instruction is rewritten in place and every later execution of
+   it dispatches straight to the quick op. Quick ops are the unchecked ops from
+   specialize.h behind one cheap guard on their operand tags; when the guard
+   fails they de-quicken - rewrite the instruction back to the generic op and
+   run that instead. De-quickened instructions are marked sticky so a site
+   whose types keep changing doesn't flip back and forth.
+
+   Quickening rewrites chunk code in place, so chunks must not be shared
+   between states running at the same time. */
+
+#pragma once
+
+#ifndef MVM_INCLUDE_QUICKEN
+#define MVM_INCLUDE_QUICKEN
+
+#include "defs.h"
+#include "state.h"
+#include "chunk.h"
+#include "specialize.h"
+
+// Set on instructions that have been de-quickened, and must stay generic.
+// Ops that can be quickened only use the low 16 bits of their arg.
+#define MVM_INSTR_STICKY ((mvm_Instr)1 << 31)
+
+struct __MVM_QUICK__
+{
+  uint32_t quick[MVM_MAX_OPS]; // quick version of each generic op
+  uint32_t generic[MVM_MAX_OPS]; // generic version of each quick op
+} MVM_QUICK;
+
+// Operand guards (stack room for one push is included)
+#define _MVM_QGUARD_1( S, T ) ((S)->sp >= 1 && _mvm_stack_room(S, 2) &&\
+  mvm_obj_is(_MVM_SLOT(S,1), T))
+#define _MVM_QGUARD_2( S, T ) ((S)->sp >= 2 && _mvm_stack_room(S, 2) &&\
+  mvm_obj_is(_MVM_SLOT(S,2), T) && mvm_obj_is(_MVM_SLOT(S,1), T))
+#define _MVM_QGUARD_K( S ) (_MVM_QGUARD_1(S, MVM_TYPE::number) &&\
+  mvm_arg() < (S)->nk && mvm_obj_is((S)->k[mvm_arg()], MVM_TYPE::number))
+
+// Turn the current (quick) instruction back into its generic op & run that
+int mvm_dequicken()
+{
+  mvm_State *s = MVM_STATE;
+  uint32_t g = MVM_QUICK.generic[MVM_OP(s->ir)];
+
+  s->ir = (s->ir & ~(mvm_Instr)0xff) | g | MVM_INSTR_STICKY;
+  *s->ip = s->ir;
+
+  return MVM.dispatch[g]();
+}
+
+// Quick op NAME runs the unchecked op SPEC if GUARD holds
+#define MVM_DEF_QUICK( NAME, SPEC, GUARD )\
+  int _mvm_op_exec_##NAME()\
+  {\
+    mvm_State *s = MVM_STATE;\
+    if ( GUARD ) return _mvm_op_exec_##SPEC();\
+    return mvm_dequicken();\
+  }
+
+MVM_DEF_QUICK( add_qnn, add_nn, _MVM_QGUARD_2(s, MVM_TYPE::number) )
+MVM_DEF_QUICK( sub_qnn, sub_nn, _MVM_QGUARD_2(s, MVM_TYPE::number) )
+MVM_DEF_QUICK( mul_qnn, mul_nn, _MVM_QGUARD_2(s, MVM_TYPE::number) )
+MVM_DEF_QUICK( div_qnn, div_nn, _MVM_QGUARD_2(s, MVM_TYPE::number) )
+MVM_DEF_QUICK( pow_qnn, pow_nn, _MVM_QGUARD_2(s, MVM_TYPE::number) )
+MVM_DEF_QUICK( abs_qn, abs_n, _MVM_QGUARD_1(s, MVM_TYPE::number) )
+MVM_DEF_QUICK( ipadd_qnn, ipadd_nn, _MVM_QGUARD_2(s, MVM_TYPE::number) )
+MVM_DEF_QUICK( ipsub_qnn, ipsub_nn, _MVM_QGUARD_2(s, MVM_TYPE::number) )
+MVM_DEF_QUICK( ipmul_qnn, ipmul_nn, _MVM_QGUARD_2(s, MVM_TYPE::number) )
+MVM_DEF_QUICK( ipdiv_qnn, ipdiv_nn, _MVM_QGUARD_2(s, MVM_TYPE::number) )
+MVM_DEF_QUICK( add_nip_qnn, add_nip_nn, _MVM_QGUARD_2(s, MVM_TYPE::number) )
+MVM_DEF_QUICK( sub_nip_qnn, sub_nip_nn, _MVM_QGUARD_2(s, MVM_TYPE::number) )
+MVM_DEF_QUICK( mul_nip_qnn, mul_nip_nn, _MVM_QGUARD_2(s, MVM_TYPE::number) )
+MVM_DEF_QUICK( div_nip_qnn, div_nip_nn, _MVM_QGUARD_2(s, MVM_TYPE::number) )
+MVM_DEF_QUICK( not_qb, not_b, _MVM_QGUARD_1(s, MVM_TYPE::boolean) )
+MVM_DEF_QUICK( and_qbb, and_bb, _MVM_QGUARD_2(s, MVM_TYPE::boolean) )
+MVM_DEF_QUICK( or_qbb, or_bb, _MVM_QGUARD_2(s, MVM_TYPE::boolean) )
+MVM_DEF_QUICK( xor_qbb, xor_bb, _MVM_QGUARD_2(s, MVM_TYPE::boolean) )
+MVM_DEF_QUICK( addk_qn, addk_n, _MVM_QGUARD_K(s) )
+MVM_DEF_QUICK( subk_qn, subk_n, _MVM_QGUARD_K(s) )
+MVM_DEF_QUICK( mulk_qn, mulk_n, _MVM_QGUARD_K(s) )
+MVM_DEF_QUICK( divk_qn, divk_n, _MVM_QGUARD_K(s) )
+
+mvm_Instr mvm_unquicken( mvm_Instr i )
+{
+  uint32_t g = MVM_QUICK.generic[MVM_OP(i)];
+  if ( g != MVM_NO_SPEC ) i = (i & ~(mvm_Instr)0xff) | g;
+  // (Other ops can use the sticky bit as part of their arg)
+  if ( MVM_QUICK.quick[MVM_OP(i)] != MVM_NO_SPEC ) i &= ~MVM_INSTR_STICKY;
+  return i;
+}
+
+// Pair generic op NAME with its quick version
+int mvm_add_quickening( const char* name, const char* quick )
+{
+  int op = mvm_op_id( name ), qop = mvm_op_id( quick );
+  if ( op < 0 || qop < 0 ) return MVM_NOT_FOUND;
+
+  MVM_QUICK.quick[op] = (uint32_t)qop;
+  MVM_QUICK.generic[qop] = (uint32_t)op;
+  // (quick ops check what they use, in their guard)
+  mvm_set_effect( (uint32_t)qop, MVM_FLOW.effect[op], MVM_FLOW.reads[op],
+                  MVM_FLOW.delta[op], false );
+
+  return MVM_OK;
+}
+
+// Called by MVM_INIT once all the ops are registered
+int mvm_init_quickenings()
+{
+  for ( uint32_t i = 0; i < MVM_MAX_OPS; ++i ){
+    MVM_QUICK.quick[i] = MVM_NO_SPEC;
+    MVM_QUICK.generic[i] = MVM_NO_SPEC;
+  }
+
+#define quick( NAME, QUICK )\
+  if ( mvm_add_quickening( #NAME, #QUICK ) != MVM_OK ) return MVM_ERROR;
+
+  quick( add, add_qnn )
+  quick( sub, sub_qnn )
+  quick( mul, mul_qnn )
+  quick( div, div_qnn )
+  quick( pow, pow_qnn )
+  quick( abs, abs_qn )
+  quick( ipadd, ipadd_qnn )
+  quick( ipsub, ipsub_qnn )
+  quick( ipmul, ipmul_qnn )
+  quick( ipdiv, ipdiv_qnn )
+  quick( add_nip, add_nip_qnn )
+  quick( sub_nip, sub_nip_qnn )
+  quick( mul_nip, mul_nip_qnn )
+  quick( div_nip, div_nip_qnn )
+  quick( not, not_qb )
+  quick( and, and_qbb )
+  quick( or, or_qbb )
+  quick( xor, xor_qbb )
+  quick( addk, addk_qn )
+  quick( subk, subk_qn )
+  quick( mulk, mulk_qn )
+  quick( divk, divk_qn )
+
+#undef quick
+
+  return MVM_OK;
+}
+
+// Called by the executor before running generic op op, which has a quick
+// version. If the operands on the stack suit the quick version the current
+// instruction is rewritten to use it. Returns the op to run.
+uint32_t mvm_quicken( uint32_t op )
+{
+  mvm_State *s = MVM_STATE;
+  uint32_t q = MVM_QUICK.quick[op];
+  bool fits = false;
+
+  switch ( MVM_SPEC.kind[op] ){
+    case MVM_SPEC_BIN_NUM:
+    case MVM_SPEC_IP_NUM:
+    case MVM_SPEC_NIP_NUM:
+      fits = _MVM_QGUARD_2( s, MVM_TYPE::number );
+      break;
+    case MVM_SPEC_UN_NUM:
+      fits = _MVM_QGUARD_1( s, MVM_TYPE::number );
+      break;
+    case MVM_SPEC_BIN_BOOL:
+      fits = _MVM_QGUARD_2( s, MVM_TYPE::boolean );
+      break;
+    case MVM_SPEC_UN_BOOL:
+      fits = _MVM_QGUARD_1( s, MVM_TYPE::boolean );
+      break;
+    case MVM_SPEC_K_NUM:
+      fits = _MVM_QGUARD_K( s );
+      break;
+  }
+
+  if ( !fits ) return op;
+
+  s->ir = (s->ir & ~(mvm_Instr)0xff) | q;
+  *s->ip = s->ir;
+
+  return q;
+}
+
+#endif // MVM_INCLUDE_QUICKEN
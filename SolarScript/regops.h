@@ -0,0 +1,164 @@
+/* Register machine versions of the builtin arithmatic & logic ops.
+
+   These only run in MVM_CHUNK_REGISTER chunks. Each is a three-address
+   instruction [op|d|a|b] computing r[d] = r[a] <op> r[b], so `a = b + c`
+   is one instruction instead of the push/push/add/store shuffle the stack
+   versions in ops.h need. Results never touch the stack, so all of these
+   return a stack difference of 0. */
+
+#pragma once
+
+#ifndef MVM_INCLUDE_REGOPS
+#define MVM_INCLUDE_REGOPS
+
+#include "defs.h"
+#include "state.h"
+#include "typeops.h"
+
+#include <math.h>
+
+// r[d] = r[a] (any type)
+int _mvm_op_exec_rmov()
+{
+  mvm_Object *a = mvm_get_reg( mvm_arg_a() );
+  mvm_Object *d = mvm_get_reg( mvm_arg_d() );
+  if ( !a ){
+    mvm_set_error( MVM_BAD_ARG_1 );
+    return 0;
+  }
+  if ( !d ){
+    mvm_set_error( MVM_BAD_ARG_0 );
+    return 0;
+  }
+
+  *d = *a;
+
+  return 0;
+}
+
+// r[d] = k[ab] (16 bit constant index)
+int _mvm_op_exec_rloadk()
+{
+  mvm_State *s = MVM_STATE;
+  uint32_t i = mvm_arg_ab();
+  mvm_Object *d = mvm_get_reg( mvm_arg_d() );
+  if ( i >= s->nk ){
+    mvm_set_error( MVM_BAD_ARG_1 );
+    return 0;
+  }
+  if ( !d ){
+    mvm_set_error( MVM_BAD_ARG_0 );
+    return 0;
+  }
+
+  *d = s->k[i];
+
+  return 0;
+}
+
+// push r[a] to the stack
+int _mvm_op_exec_rpush()
+{
+  mvm_Object *a = mvm_get_reg( mvm_arg_a() );
+  if ( !a ){
+    mvm_set_error( MVM_BAD_ARG_1 );
+    return 0;
+  }
+
+  mvm_push_object( a );
+
+  return 1;
+}
+
+// r[d] = the top of the stack (which is left there, like gstore)
+int _mvm_op_exec_rstore()
+{
+  mvm_State *s = MVM_STATE;
+  mvm_Object *d = mvm_get_reg( mvm_arg_d() );
+  if ( !d ){
+    mvm_set_error( MVM_BAD_ARG_0 );
+    return 0;
+  }
+  if ( s->sp <= s->fp + s->nregs ){ // nothing above the window
+    mvm_set_error( MVM_BAD_ARG_1 );
+    return 0;
+  }
+
+  *d = s->s[s->sp - 1];
+
+  return 0;
+}
+
+// Binary register ops all look the same: fetch two operands of C type CT
+// (via mvm_get_reg_T), compute EXPR from a & b and store the result in r[d]
+// as type R.
+#define MVM_DEF_REG_BINOP( NAME, CT, T, R, EXPR )\
+  int _mvm_op_exec_##NAME()\
+  {\
+    bool worked = false;\
+    CT a = mvm_get_reg_##T( mvm_arg_a(), &worked );\
+    if ( !worked ){\
+      mvm_set_error( MVM_BAD_ARG_1 );\
+      return 0;\
+    }\
+    CT b = mvm_get_reg_##T( mvm_arg_b(), &worked );\
+    if ( !worked ){\
+      mvm_set_error( MVM_BAD_ARG_2 );\
+      return 0;\
+    }\
+    mvm_set_reg_##R( mvm_arg_d(), EXPR, &worked );\
+    if ( !worked ) mvm_set_error( MVM_BAD_ARG_0 );\
+    return 0;\
+  }
+
+// Unary register ops: r[d] = EXPR(a)
+#define MVM_DEF_REG_UNOP( NAME, CT, T, R, EXPR )\
+  int _mvm_op_exec_##NAME()\
+  {\
+    bool worked = false;\
+    CT a = mvm_get_reg_##T( mvm_arg_a(), &worked );\
+    if ( !worked ){\
+      mvm_set_error( MVM_BAD_ARG_1 );\
+      return 0;\
+    }\
+    mvm_set_reg_##R( mvm_arg_d(), EXPR, &worked );\
+    if ( !worked ) mvm_set_error( MVM_BAD_ARG_0 );\
+    return 0;\
+  }
+
+// logic:
+MVM_DEF_REG_UNOP( rnot, mvmbool, bool, bool, !a )
+MVM_DEF_REG_BINOP( rand, mvmbool, bool, bool, a && b )
+MVM_DEF_REG_BINOP( ror, mvmbool, bool, bool, a || b )
+MVM_DEF_REG_BINOP( rnand, mvmbool, bool, bool, !(a && b) )
+MVM_DEF_REG_BINOP( rnor, mvmbool, bool, bool, !(a || b) )
+MVM_DEF_REG_BINOP( rxor, mvmbool, bool, bool, !(a && b) && (a || b) )
+MVM_DEF_REG_BINOP( rnxor, mvmbool, bool, bool, !(!(a && b) && (a || b)) )
+
+// arithmatic:
+MVM_DEF_REG_BINOP( radd, mvmnum, number, number, a + b )
+MVM_DEF_REG_BINOP( rsub, mvmnum, number, number, a - b )
+MVM_DEF_REG_BINOP( rmul, mvmnum, number, number, a * b )
+MVM_DEF_REG_BINOP( rdiv, mvmnum, number, number, a / b )
+MVM_DEF_REG_BINOP( rpow, mvmnum, number, number, mvm_pow(a,b) )
+MVM_DEF_REG_UNOP( rabs, mvmnum, number, number, mvm_fabs(a) )
+
+// integers & bitwise (wrapping, see typeops.h):
+MVM_DEF_REG_BINOP( riadd, mvmint, int, int, _MVM_WRAP(a, +, b) )
+MVM_DEF_REG_BINOP( risub, mvmint, int, int, _MVM_WRAP(a, -, b) )
+MVM_DEF_REG_BINOP( rimul, mvmint, int, int, _MVM_WRAP(a, *, b) )
+MVM_DEF_REG_BINOP( rband, mvmint, int, int, a & b )
+MVM_DEF_REG_BINOP( rbor, mvmint, int, int, a | b )
+MVM_DEF_REG_BINOP( rbxor, mvmint, int, int, a ^ b )
+MVM_DEF_REG_BINOP( rshl, mvmint, int, int, (mvmint)((mvmuint)a << _MVM_SHIFT(b)) )
+MVM_DEF_REG_BINOP( rshr, mvmint, int, int, a >> _MVM_SHIFT(b) )
+
+// compares (see flowops.h):
+MVM_DEF_REG_BINOP( rlt, mvmnum, number, bool, a < b )
+MVM_DEF_REG_BINOP( rle, mvmnum, number, bool, a <= b )
+MVM_DEF_REG_BINOP( req, mvmnum, number, bool, a == b )
+MVM_DEF_REG_BINOP( rilt, mvmint, int, bool, a < b )
+MVM_DEF_REG_BINOP( rile, mvmint, int, bool, a <= b )
+MVM_DEF_REG_BINOP( rieq, mvmint, int, bool, a == b )
+
+#endif // MVM_INCLUDE_REGOPS
@@ -0,0 +1,335 @@
+/* Hot reloading: a library of script modules linked into one program, which
+   keeps running while modules are changed underneath it.
+
+   Changing a module recompiles only that module, and links the new version
+   onto the end of the program (see mvm_Linker_add in batch.h):
+
+   - its functions keep their slots in the function table, which are pointed
+     at the new code, so callers (the library's main, or a call that's half
+     way through - mvm_continue_call picks up the program's tables every
+     slice) get the new version the next time they call it
+   - constants already in the pool are reused, only new ones are added
+   - globals are matched by name, so they keep their values across reloads;
+     a long running simulation carries on from where it was
+   - the module is compiled knowing the types the other modules give
+     globals (see mvm_compile_module), and a version changing one of those
+     types is rejected, as the other modules' code relies on it. A global
+     no other module uses can change type freely.
+
+   Old versions' code is left where it was (frames returning into it stay
+   valid), so a library that's reloaded many times slowly grows. A source
+   whose hash hasn't changed isn't recompiled at all, and one that doesn't
+   compile leaves the old version running.
+
+   mvm_Library_poll() is the watch mode: call it every so often (between
+   slices of the program, on the thread running it) to reload any module
+   whose file has changed. */
+
+#pragma once
+
+#ifndef MVM_INCLUDE_RELOAD
+#define MVM_INCLUDE_RELOAD
+
+#include "defs.h"
+#include "bytecode.h"
+#include "batch.h"
+
+#include <stdio.h>
+#include <sys/stat.h>
+
+typedef struct _mvm_Module
+{
+  char *path; // file the module is watched in (NULL if it isn't)
+  int64_t mtime; // path's modification time when it was last read
+  int64_t fsize; // & its size
+  uint64_t hash; // mvm_hash_bytes() of the source it was compiled from
+  uint32_t *slots; // function table slots of its functions
+  uint32_t nslots;
+  uint32_t *globals; // the program's indices of its globals
+  char *types; // & the type it gives each one
+  uint32_t nglobals;
+  uint32_t main; // slot of its main (MVM_NO_SLOT if it has no functions)
+} mvm_Module;
+
+/// A library of modules. Run its program's main (p.main) to run every module
+/// in the order they were added. The library must stay where it is once
+/// initialized, since its linker points to p.
+typedef struct _mvm_Library
+{
+  mvm_Program p; // every module, linked
+  mvm_Linker lk;
+  mvm_Module *modules;
+  uint32_t nmodules, cap;
+} mvm_Library;
+
+void mvm_init_Library( mvm_Library *lib )
+{
+  mvm_init_Program( &lib->p );
+  mvm_init_Linker( &lib->lk, &lib->p );
+  lib->modules = NULL;
+  lib->nmodules = lib->cap = 0;
+}
+
+void mvm_cleanup_Library( mvm_Library *lib )
+{
+  if ( lib ){
+    for ( uint32_t i = 0; i < lib->nmodules; ++i ){
+      free( lib->modules[i].path );
+      free( lib->modules[i].slots );
+      free( lib->modules[i].globals );
+      free( lib->modules[i].types );
+    }
+    free( lib->modules );
+    mvm_cleanup_Program( &lib->p );
+    mvm_cleanup_Linker( &lib->lk );
+    lib->modules = NULL;
+    lib->nmodules = lib->cap = 0;
+  }
+}
+
+// Give the library a main calling every module's main in order
+int _mvm_Library_main( mvm_Library *lib )
+{
+  uint32_t *mains = (uint32_t*)malloc( sizeof(uint32_t)*(lib->nmodules + 1) );
+  if ( !mains ) return MVM_ERROR_OUT_OF_MEMORY;
+
+  uint32_t n = 0;
+  for ( uint32_t i = 0; i < lib->nmodules; ++i ){
+    if ( lib->modules[i].main != MVM_NO_SLOT ) mains[n++] = lib->modules[i].main;
+  }
+  int result = mvm_Linker_main( &lib->lk, mains, n );
+
+  free( mains );
+  return result;
+}
+
+// Set the types of lib's globals to the ones its modules give them, leaving
+// out module skip (lib->nmodules to leave out none)
+void _mvm_Library_types( mvm_Library *lib, uint32_t skip )
+{
+  for ( uint32_t g = 0; g < lib->p.nglobals; ++g ){
+    lib->p.gtypes[g] = MVM_TYPE_UNKNOWN;
+  }
+  for ( uint32_t i = 0; i < lib->nmodules; ++i ){
+    const mvm_Module *mod = &lib->modules[i];
+    for ( uint32_t j = 0; j < mod->nglobals && i != skip; ++j ){
+      if ( mod->types[j] != MVM_TYPE_UNKNOWN ){
+        mvm_Program_type_global( &lib->p, mod->globals[j], mod->types[j] );
+      }
+    }
+  }
+}
+
+/// Compile text as module m of lib, replacing the module if m is one it
+/// already has, or adding it if m is lib->nmodules. Nothing is recompiled if
+/// the module's source hasn't changed. Returns MVM_OK, or an error with *err
+/// set like mvm_compile() (in which case the module is left as it was) -
+/// including when it changes the type of a global other modules use.
+int mvm_Library_set( mvm_Library *lib, uint32_t m, const char* text,
+                     char** err )
+{
+  if ( m > lib->nmodules ) return MVM_ERROR;
+
+  uint64_t hash = mvm_hash_bytes( text, strlen( text ), MVM_HASH_SEED );
+  if ( m < lib->nmodules && lib->modules[m].hash == hash ) return MVM_OK;
+
+  if ( m == lib->nmodules ){
+    if ( !_MVM_GROW( lib->modules, lib->nmodules, lib->cap, mvm_Module ) ){
+      return MVM_ERROR_OUT_OF_MEMORY;
+    }
+    mvm_Module *mod = &lib->modules[m];
+    mod->path = NULL;
+    mod->mtime = mod->fsize = -1;
+    mod->hash = 0;
+    mod->slots = NULL;
+    mod->nslots = 0;
+    mod->globals = NULL;
+    mod->types = NULL;
+    mod->nglobals = 0;
+    mod->main = MVM_NO_SLOT;
+  }
+  mvm_Module *mod = &lib->modules[m];
+
+  // While it's compiled & linked the program's globals only have the types
+  // the other modules give them, so it can't change those but can change
+  // its own (every module's are put back at the end)
+  mvm_AATree types;
+  mvm_init_AATree( &types, _mvm_MNode_interned_to_uint32_comp );
+  _mvm_Library_types( lib, m );
+  bool typed = _mvm_batch_add_types( &types, &lib->p );
+  const char* bytes = typed ? mvm_compile_module( text, &types, err ) : NULL;
+  mvm_cleanup_AATree( &types, true );
+  if ( !bytes ){
+    _mvm_Library_types( lib, lib->nmodules );
+    return typed ? MVM_ERROR : MVM_ERROR_OUT_OF_MEMORY;
+  }
+
+  mvm_Program q;
+  mvm_init_Program( &q );
+  int result = mvm_Program_load( &q, bytes,
+                                 ((const mvm_Bytecode_Header*)bytes)->size );
+  free( (void*)bytes );
+
+  // The new version's functions take over the old one's slots, in order
+  uint32_t n = q.nfuncs > mod->nslots ? q.nfuncs : mod->nslots;
+  uint32_t *slots = NULL, *globals = NULL;
+  char *gtypes = NULL;
+  if ( result == MVM_OK ){
+    slots = (uint32_t*)malloc( sizeof(uint32_t)*(n + 1) );
+    globals = (uint32_t*)malloc( sizeof(uint32_t)*(q.nglobals + 1) );
+    gtypes = (char*)malloc( q.nglobals + 1 );
+    if ( !slots || !globals || !gtypes ) result = MVM_ERROR_OUT_OF_MEMORY;
+    for ( uint32_t i = 0; slots && i < n; ++i ){
+      slots[i] = i < mod->nslots ? mod->slots[i] : MVM_NO_SLOT;
+    }
+  }
+  if ( result == MVM_OK && q.nfuncs && q.funcs[q.main].nargs ){
+    result = MVM_ERROR_BAD_PROGRAM;
+  }
+  if ( result == MVM_OK ) result = mvm_Linker_add( &lib->lk, &q, slots );
+
+  if ( result == MVM_OK ){
+    uint32_t main = q.nfuncs ? slots[q.main] : MVM_NO_SLOT;
+    bool added = m == lib->nmodules;
+    free( mod->slots );
+    free( mod->globals );
+    free( mod->types );
+    if ( q.nglobals ){
+      memcpy( globals, lib->lk.gmap, sizeof(uint32_t)*q.nglobals );
+      memcpy( gtypes, q.gtypes, q.nglobals );
+    }
+    mod->slots = slots;
+    mod->nslots = n;
+    mod->globals = globals;
+    mod->types = gtypes;
+    mod->nglobals = q.nglobals;
+    mod->hash = hash;
+    slots = globals = NULL;
+    gtypes = NULL;
+    if ( added ) ++lib->nmodules;
+    if ( added || main != mod->main ){
+      mod->main = main;
+      result = _mvm_Library_main( lib );
+    }
+  }
+  else if ( err ){
+    *err = (char*)malloc( 64 );
+    if ( *err ) sprintf( *err, "Module couldn't be linked (error %d)", result );
+  }
+
+  _mvm_Library_types( lib, lib->nmodules );
+  free( slots );
+  free( globals );
+  free( gtypes );
+  mvm_cleanup_Program( &q );
+  return result;
+}
+
+// Read the text file at path (free() it), NULL if it can't be
+char *_mvm_read_text( const char* path )
+{
+  FILE *f = fopen( path, "rb" );
+  if ( !f ) return NULL;
+
+  char *text = NULL;
+  long n = 0;
+  if ( !fseek( f, 0, SEEK_END ) && (n = ftell( f )) >= 0 &&
+       !fseek( f, 0, SEEK_SET ) && (text = (char*)malloc( (size_t)n + 1 )) ){
+    if ( fread( text, 1, (size_t)n, f ) == (size_t)n ) text[n] = '\0';
+    else{
+      free( text );
+      text = NULL;
+    }
+  }
+  fclose( f );
+  return text;
+}
+
+// (Re)compile module m from its file, if the file has changed since it was
+// last read. Sets *changed to whether it had.
+int _mvm_Library_reload( mvm_Library *lib, uint32_t m, char** err,
+                         bool *changed )
+{
+  mvm_Module *mod = &lib->modules[m];
+  struct stat st;
+  *changed = false;
+  if ( stat( mod->path, &st ) ){
+    if ( err && (*err = (char*)malloc( strlen( mod->path ) + 32 )) ){
+      sprintf( *err, "Can't read %s", mod->path );
+    }
+    return MVM_ERROR;
+  }
+  if ( (int64_t)st.st_mtime == mod->mtime && (int64_t)st.st_size == mod->fsize ){
+    return MVM_OK;
+  }
+
+  char *text = _mvm_read_text( mod->path );
+  if ( !text ){
+    if ( err && (*err = (char*)malloc( strlen( mod->path ) + 32 )) ){
+      sprintf( *err, "Can't read %s", mod->path );
+    }
+    return MVM_ERROR;
+  }
+
+  // The file's stamp is taken even if it doesn't compile, so it isn't tried
+  // again until it's next saved
+  mod->mtime = (int64_t)st.st_mtime;
+  mod->fsize = (int64_t)st.st_size;
+  uint64_t hash = mod->hash;
+  int result = mvm_Library_set( lib, m, text, err );
+  *changed = result == MVM_OK && lib->modules[m].hash != hash;
+
+  free( text );
+  return result;
+}
+
+/// Add the script in the file at path to lib as a new module, which
+/// mvm_Library_poll() watches for changes. Returns MVM_OK, or an error with
+/// *err set (like mvm_Library_set).
+int mvm_Library_watch( mvm_Library *lib, const char* path, char** err )
+{
+  char *copy = (char*)malloc( strlen( path ) + 1 );
+  char *text = _mvm_read_text( path );
+  int result = !copy ? MVM_ERROR_OUT_OF_MEMORY :
+               !text ? MVM_ERROR : mvm_Library_set( lib, lib->nmodules, text, err );
+  if ( !text && copy && err && (*err = (char*)malloc( strlen( path ) + 32 )) ){
+    sprintf( *err, "Can't read %s", path );
+  }
+  free( text );
+
+  if ( result != MVM_OK ){
+    free( copy );
+    return result;
+  }
+
+  // Its stamp is read now, so the first poll doesn't reload it
+  mvm_Module *mod = &lib->modules[lib->nmodules - 1];
+  struct stat st;
+  strcpy( copy, path );
+  mod->path = copy;
+  if ( !stat( path, &st ) ){
+    mod->mtime = (int64_t)st.st_mtime;
+    mod->fsize = (int64_t)st.st_size;
+  }
+  return MVM_OK;
+}
+
+/// Reload every watched module whose file has changed. Returns the number of
+/// modules recompiled, or an error (after trying them all) with *err set for
+/// the first one that failed, which keeps running its old version.
+int mvm_Library_poll( mvm_Library *lib, char** err )
+{
+  int reloaded = 0, result = MVM_OK;
+  for ( uint32_t i = 0; i < lib->nmodules; ++i ){
+    if ( !lib->modules[i].path ) continue;
+
+    bool changed = false;
+    int r = _mvm_Library_reload( lib, i, result == MVM_OK ? err : NULL,
+                                 &changed );
+    if ( r != MVM_OK && result == MVM_OK ) result = r;
+    reloaded += changed;
+  }
+  return result == MVM_OK ? reloaded : result;
+}
+
+#endif // MVM_INCLUDE_RELOAD
@@ -0,0 +1,400 @@
+/* Scheduling for running many small states, e.g. one per body in the
+   simulation.
+
+   A job is a chunk (or an mvm_exec() opcode sequence) to run on a state. Jobs
+   run in slices and carry on from where they stopped in the next one, and no
+   job runs more ops in a second than its state's ops_per_second. Time is only
+   read once per round of slices, never per op.
+
+   mvm_run_jobs() is the cooperative scheduler: it runs slices round robin on
+   the calling thread until every job is done or out of ops, or the time it
+   was given is up - so a misbehaving script can't blow a frame.
+
+   mvm_Pool_run() gives every unfinished job one slice on a fixed set of
+   worker threads, and returns once every job has had its slice.
+
+   Jobs are dealt out to per-worker deques, and a worker that runs out of
+   jobs steals from the other end of somebody else's deque (Chase & Lev,
+   "Dynamic Circular Work-Stealing Deque"). Deques are only filled between
+   runs, while the workers are parked, so they never have to grow under a
+   thief.
+
+   Every job needs its own state & chunk: two jobs must never share either,
+   since chunks are rewritten as they run (see quicken.h). */
+
+#pragma once
+
+#ifndef MVM_INCLUDE_SCHED
+#define MVM_INCLUDE_SCHED
+
+#include "defs.h"
+#include "state.h"
+#include "chunk.h"
+#include "vm.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#define MVM_DEFAULT_SLICE 4096 // most ops a job runs per slice
+
+typedef struct _mvm_Job
+{
+  mvm_State *state;
+  mvm_Chunk *chunk; // NULL for opcode sequence jobs
+  mvm_Run run; // where the job is up to (chunk jobs)
+  const char *ops; // opcode sequence (see mvm_exec)
+  unsigned int num; // size of ops
+  bool started; // whether run has begun
+} mvm_Job;
+
+// Job that runs chunk c on state s
+void mvm_init_Job( mvm_Job *j, mvm_State *s, mvm_Chunk *c )
+{
+  j->state = s;
+  j->chunk = c;
+  j->ops = NULL;
+  j->num = 0;
+  j->started = false;
+  j->run.pc = 0;
+  j->run.done = false;
+  j->run.diff = 0;
+}
+
+// Job that runs the opcode sequence ops (of num bytes) on state s
+void mvm_init_exec_Job( mvm_Job *j, mvm_State *s, const char *ops,
+                        unsigned int num )
+{
+  mvm_init_Job( j, s, NULL );
+  j->ops = ops;
+  j->num = num;
+}
+
+bool mvm_Job_done( const mvm_Job *j )
+{
+  return j->started && j->run.done;
+}
+
+/// Run at most slice ops of j on the calling thread (fewer if its state is
+/// running out of ops for the second, as of now - see mvm_ops_left). Sets
+/// the current state to j's. Returns the number of ops run.
+uint32_t mvm_Job_slice( mvm_Job *j, uint32_t slice, double now )
+{
+  if ( mvm_Job_done( j ) ) return 0;
+
+  mvm_set_state( j->state );
+
+  uint32_t budget = mvm_ops_left( j->state, now );
+  if ( budget > slice ) budget = slice;
+  if ( !budget ) return 0; // out of ops until its next second
+
+  if ( !j->chunk ){
+    // Opcode sequence jobs keep their place in run.pc
+    uint32_t pc = j->run.pc;
+    j->started = true;
+    j->run.diff += mvm_exec_slice( j->ops, j->num, &j->run.pc, budget );
+    j->run.done = j->run.pc >= j->num || j->state->error != MVM_OK;
+    return j->run.pc - pc;
+  }
+
+  if ( !j->started ){
+    j->started = true;
+    if ( mvm_begin_run( &j->run, j->chunk ) != MVM_OK ) return 0;
+  }
+
+  return mvm_continue_run( &j->run, budget );
+}
+
+/// Cooperatively run jobs on the calling thread, giving each up to slice ops
+/// (0 for MVM_DEFAULT_SLICE) at a time round robin, until they're all done,
+/// none of them can run any more this second, or seconds have passed.
+/// Returns the number of jobs still unfinished. The current state is kept.
+int mvm_run_jobs( mvm_Job *jobs, uint32_t njobs, uint32_t slice,
+                  double seconds )
+{
+  mvm_State *caller = MVM_STATE;
+  double start = mvm_now(), now = start;
+  uint32_t ran;
+  int left;
+
+  if ( !slice ) slice = MVM_DEFAULT_SLICE;
+
+  do{
+    ran = 0;
+    left = 0;
+    for ( uint32_t i = 0; i < njobs; ++i ){
+      ran += mvm_Job_slice( &jobs[i], slice, now );
+      if ( !mvm_Job_done( &jobs[i] ) ) ++left;
+    }
+    now = mvm_now();
+  } while ( left && ran && now - start < seconds );
+
+  mvm_set_state( caller );
+  return left;
+}
+
+// Job deque: the owning worker pops from the bottom, thieves take from the top
+typedef struct _mvm_Deque
+{
+  mvm_Job **jobs; // ring buffer
+  uint32_t cap; // size of jobs, a power of two
+  int64_t top; // next job to steal
+  int64_t bottom; // next free slot
+} mvm_Deque;
+
+// Only called while the workers are parked
+int _mvm_deque_push( mvm_Deque *q, mvm_Job *j )
+{
+  if ( q->bottom - q->top == (int64_t)q->cap ){
+    uint32_t cap = q->cap ? q->cap*2 : 64;
+    mvm_Job **jobs = (mvm_Job**)malloc( sizeof(mvm_Job*)*cap );
+    if ( !jobs ) return MVM_ERROR;
+
+    for ( int64_t i = q->top; i < q->bottom; ++i ){
+      jobs[i & (cap - 1)] = q->jobs[i & (q->cap - 1)];
+    }
+    if ( q->jobs ) free( q->jobs );
+    q->jobs = jobs;
+    q->cap = cap;
+  }
+
+  q->jobs[q->bottom & (q->cap - 1)] = j;
+  ++q->bottom;
+
+  return MVM_OK;
+}
+
+// Owner only
+mvm_Job *_mvm_deque_pop( mvm_Deque *q )
+{
+  int64_t b = __atomic_load_n( &q->bottom, __ATOMIC_RELAXED ) - 1;
+  __atomic_store_n( &q->bottom, b, __ATOMIC_RELAXED );
+  __atomic_thread_fence( __ATOMIC_SEQ_CST );
+  int64_t t = __atomic_load_n( &q->top, __ATOMIC_RELAXED );
+
+  if ( t > b ){ // empty
+    __atomic_store_n( &q->bottom, b + 1, __ATOMIC_RELAXED );
+    return NULL;
+  }
+
+  mvm_Job *j = __atomic_load_n( &q->jobs[b & (q->cap - 1)], __ATOMIC_RELAXED );
+
+  if ( t == b ){
+    // Last job, race the thieves for it
+    if ( !__atomic_compare_exchange_n( &q->top, &t, t + 1, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED ) ){
+      j = NULL;
+    }
+    __atomic_store_n( &q->bottom, b + 1, __ATOMIC_RELAXED );
+  }
+
+  return j;
+}
+
+// Any thread. Sets *retry if it lost a race, rather than q being empty.
+mvm_Job *_mvm_deque_steal( mvm_Deque *q, bool *retry )
+{
+  int64_t t = __atomic_load_n( &q->top, __ATOMIC_ACQUIRE );
+  __atomic_thread_fence( __ATOMIC_SEQ_CST );
+  int64_t b = __atomic_load_n( &q->bottom, __ATOMIC_ACQUIRE );
+
+  if ( t >= b ) return NULL;
+
+  mvm_Job *j = __atomic_load_n( &q->jobs[t & (q->cap - 1)], __ATOMIC_RELAXED );
+  if ( !__atomic_compare_exchange_n( &q->top, &t, t + 1, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED ) ){
+    *retry = true;
+    return NULL;
+  }
+
+  return j;
+}
+
+struct _mvm_Pool;
+
+typedef struct _mvm_Worker
+{
+  struct _mvm_Pool *pool;
+  pthread_t thread;
+  mvm_Deque q;
+  uint32_t index; // in pool->workers
+  uint32_t seed; // picks who to steal from first
+} mvm_Worker;
+
+typedef struct _mvm_Pool
+{
+  mvm_Worker *workers;
+  uint32_t nworkers;
+  uint32_t slice; // most ops a job runs per mvm_Pool_run()
+
+  // Shared with the workers under lock:
+  pthread_mutex_t lock;
+  pthread_cond_t start; // signalled when a run starts (or on quit)
+  pthread_cond_t finished; // signalled when the last busy worker parks
+  uint64_t runs; // incremented to start a run
+  uint32_t busy; // workers still working on the current run
+  double now; // time the current run started (see mvm_now)
+  bool quit;
+} mvm_Pool;
+
+// Next job for w: its own, or failing that somebody else's. NULL once every
+// deque is empty - nothing gets added during a run, so w is done.
+mvm_Job *_mvm_find_job( mvm_Pool *p, mvm_Worker *w )
+{
+  mvm_Job *j = _mvm_deque_pop( &w->q );
+  if ( j ) return j;
+
+  bool retry = true;
+  while ( retry ){
+    retry = false;
+
+    // xorshift, so the workers don't all pile onto the same victim
+    w->seed ^= w->seed << 13;
+    w->seed ^= w->seed >> 17;
+    w->seed ^= w->seed << 5;
+
+    for ( uint32_t i = 0; i < p->nworkers; ++i ){
+      uint32_t v = (w->seed + i) % p->nworkers;
+      if ( v == w->index ) continue;
+
+      j = _mvm_deque_steal( &p->workers[v].q, &retry );
+      if ( j ) return j;
+    }
+  }
+
+  return NULL;
+}
+
+void *_mvm_worker_main( void *arg )
+{
+  mvm_Worker *w = (mvm_Worker*)arg;
+  mvm_Pool *p = w->pool;
+  uint64_t seen = 0; // last run this worker took part in
+
+  for ( ;; ){
+    pthread_mutex_lock( &p->lock );
+    while ( p->runs == seen && !p->quit ) pthread_cond_wait( &p->start, &p->lock );
+    if ( p->quit ){
+      pthread_mutex_unlock( &p->lock );
+      break;
+    }
+    seen = p->runs;
+    pthread_mutex_unlock( &p->lock );
+
+    mvm_Job *j;
+    while ( (j = _mvm_find_job( p, w )) ) mvm_Job_slice( j, p->slice, p->now );
+
+    pthread_mutex_lock( &p->lock );
+    if ( --p->busy == 0 ) pthread_cond_signal( &p->finished );
+    pthread_mutex_unlock( &p->lock );
+  }
+
+  mvm_set_state( NULL );
+  return NULL;
+}
+
+void mvm_del_Pool( mvm_Pool *p );
+
+/// Start a pool of nworkers threads (0 for one per CPU) giving jobs at most
+/// slice ops per run (0 for MVM_DEFAULT_SLICE). Returns NULL on failure.
+mvm_Pool *mvm_new_Pool( uint32_t nworkers, uint32_t slice )
+{
+  if ( !nworkers ){
+    long n = sysconf( _SC_NPROCESSORS_ONLN );
+    nworkers = n > 0 ? (uint32_t)n : 1;
+  }
+
+  mvm_Pool *p = mvm_malloc(mvm_Pool);
+  if ( !p ) return NULL;
+
+  p->workers = (mvm_Worker*)calloc( nworkers, sizeof(mvm_Worker) );
+  if ( !p->workers ){
+    free( p );
+    return NULL;
+  }
+  p->nworkers = 0; // counts threads as they start, for mvm_del_Pool
+  p->slice = slice ? slice : MVM_DEFAULT_SLICE;
+  p->runs = 0;
+  p->busy = 0;
+  p->now = 0.0;
+  p->quit = false;
+  pthread_mutex_init( &p->lock, NULL );
+  pthread_cond_init( &p->start, NULL );
+  pthread_cond_init( &p->finished, NULL );
+
+  for ( uint32_t i = 0; i < nworkers; ++i ){
+    mvm_Worker *w = &p->workers[i];
+    w->pool = p;
+    w->index = i;
+    w->seed = 2463534242u + i*2654435761u;
+
+    if ( pthread_create( &w->thread, NULL, _mvm_worker_main, w ) ){
+      mvm_del_Pool( p );
+      return NULL;
+    }
+    ++p->nworkers;
+  }
+
+  return p;
+}
+
+void mvm_del_Pool( mvm_Pool *p )
+{
+  if ( !p ) return;
+
+  pthread_mutex_lock( &p->lock );
+  p->quit = true;
+  pthread_cond_broadcast( &p->start );
+  pthread_mutex_unlock( &p->lock );
+
+  for ( uint32_t i = 0; i < p->nworkers; ++i ){
+    pthread_join( p->workers[i].thread, NULL );
+    if ( p->workers[i].q.jobs ) free( p->workers[i].q.jobs );
+  }
+
+  pthread_mutex_destroy( &p->lock );
+  pthread_cond_destroy( &p->start );
+  pthread_cond_destroy( &p->finished );
+  free( p->workers );
+  free( p );
+}
+
+/// Give every unfinished job in jobs one slice, blocking until they've all
+/// had it. Returns the number of jobs still unfinished (or MVM_ERROR if out of
+/// memory). Only one thread may run a pool at a time.
+int mvm_Pool_run( mvm_Pool *p, mvm_Job *jobs, uint32_t njobs )
+{
+  int left = 0;
+
+  pthread_mutex_lock( &p->lock );
+
+  // Deal the jobs out round robin - stealing evens out the rest
+  for ( uint32_t i = 0; i < p->nworkers; ++i ){
+    p->workers[i].q.top = p->workers[i].q.bottom = 0;
+  }
+  for ( uint32_t i = 0, w = 0; i < njobs; ++i ){
+    if ( mvm_Job_done( &jobs[i] ) ) continue;
+
+    if ( _mvm_deque_push( &p->workers[w].q, &jobs[i] ) != MVM_OK ){
+      pthread_mutex_unlock( &p->lock );
+      return MVM_ERROR;
+    }
+    if ( ++w == p->nworkers ) w = 0;
+  }
+
+  p->now = mvm_now();
+  p->busy = p->nworkers;
+  ++p->runs;
+  pthread_cond_broadcast( &p->start );
+  while ( p->busy ) pthread_cond_wait( &p->finished, &p->lock );
+
+  pthread_mutex_unlock( &p->lock );
+
+  for ( uint32_t i = 0; i < njobs; ++i ){
+    if ( !mvm_Job_done( &jobs[i] ) ) ++left;
+  }
+
+  return left;
+}
+
+#endif // MVM_INCLUDE_SCHED
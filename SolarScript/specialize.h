@@ -0,0 +1,582 @@
+/* Type specialized ops and the pass (mvm_specialize) that emits them.
+
+   The generic ops re-check the state, the stack bounds and the type of every
+   operand on every execution. When the types flowing through a chunk are
+   known ahead of time - from constants, from results of earlier ops, or from
+   the types the caller promises to leave on the stack - the pass rewrites
+   ops into unchecked variants like add_nn (add, number, number) that read
+   the stack directly.
+
+   Everything the unchecked ops would have checked is instead checked once by
+   a guard when the chunk is entered: the promised entry types and enough
+   room on the stack for the deepest point the chunk reaches. If the guard
+   fails mvm_exec_chunk() runs an untouched copy of the generic code instead,
+   so specializing never changes what a chunk computes.
+
+   Compiled programs know every type statically, so mvm_IR_emit() (see
+   ir.h) emits unchecked ops directly: each op & the nip of its operands
+   becomes one op like add_nip_nn or ilt_nip_ii (see MVM_SPEC.unchecked),
+   behind an entry guard of its own (see gcheck & room in flowops.h). */
+
+#pragma once
+
+#ifndef MVM_INCLUDE_SPECIALIZE
+#define MVM_INCLUDE_SPECIALIZE
+
+#include "defs.h"
+#include "state.h"
+#include "chunk.h"
+#include "ops.h"
+#include "typeops.h"
+#include "flowops.h"
+
+#include <math.h>
+
+// Unchecked access to stack slot sp - I and register R
+#define _MVM_SLOT( S, I ) ((S)->s[(S)->sp - (I)])
+#define _MVM_REG( S, R ) ((S)->s[(S)->fp + (R)])
+
+// a <op> b for the two numbers on top, result pushed
+#define MVM_DEF_SPEC_NN( NAME, EXPR )\
+  int _mvm_op_exec_##NAME()\
+  {\
+    mvm_State *s = MVM_STATE;\
+    mvmnum a = mvm_obj_number( _MVM_SLOT(s,2) );\
+    mvmnum b = mvm_obj_number( _MVM_SLOT(s,1) );\
+    mvm_obj_set_number( _MVM_SLOT(s,0), EXPR );\
+    ++s->sp;\
+    return 1;\
+  }
+
+// a = a <op> b for the two numbers on top
+#define MVM_DEF_SPEC_IPNN( NAME, EXPR )\
+  int _mvm_op_exec_##NAME()\
+  {\
+    mvm_State *s = MVM_STATE;\
+    mvmnum a = mvm_obj_number( _MVM_SLOT(s,2) );\
+    mvmnum b = mvm_obj_number( _MVM_SLOT(s,1) );\
+    mvm_obj_put_number( _MVM_SLOT(s,2), EXPR );\
+    return 0;\
+  }
+
+// a & b replaced by a <op> b
+#define MVM_DEF_SPEC_NIP_NN( NAME, EXPR )\
+  int _mvm_op_exec_##NAME()\
+  {\
+    mvm_State *s = MVM_STATE;\
+    mvmnum a = mvm_obj_number( _MVM_SLOT(s,2) );\
+    mvmnum b = mvm_obj_number( _MVM_SLOT(s,1) );\
+    mvm_obj_put_number( _MVM_SLOT(s,2), EXPR );\
+    --s->sp;\
+    return -1;\
+  }
+
+// a <op> b for the two booleans on top, result pushed
+#define MVM_DEF_SPEC_BB( NAME, EXPR )\
+  int _mvm_op_exec_##NAME()\
+  {\
+    mvm_State *s = MVM_STATE;\
+    mvmbool a = mvm_obj_bool( _MVM_SLOT(s,2) );\
+    mvmbool b = mvm_obj_bool( _MVM_SLOT(s,1) );\
+    mvm_obj_set_bool( _MVM_SLOT(s,0), EXPR );\
+    ++s->sp;\
+    return 1;\
+  }
+
+// a & b (CT values, read with mvm_obj_T) replaced by EXPR, of type R
+#define MVM_DEF_SPEC_NIP( NAME, CT, T, R, EXPR )\
+  int _mvm_op_exec_##NAME()\
+  {\
+    mvm_State *s = MVM_STATE;\
+    CT a = mvm_obj_##T( _MVM_SLOT(s,2) );\
+    CT b = mvm_obj_##T( _MVM_SLOT(s,1) );\
+    mvm_obj_set_##R( _MVM_SLOT(s,2), EXPR );\
+    --s->sp;\
+    return -1;\
+  }
+
+// a (a CT value, read with mvm_obj_T) replaced by EXPR, of type R
+#define MVM_DEF_SPEC_IP1( NAME, CT, T, R, EXPR )\
+  int _mvm_op_exec_##NAME()\
+  {\
+    mvm_State *s = MVM_STATE;\
+    CT a = mvm_obj_##T( _MVM_SLOT(s,1) );\
+    mvm_obj_set_##R( _MVM_SLOT(s,1), EXPR );\
+    return 0;\
+  }
+
+// pushk k; <op> with a number on top and a number constant
+#define MVM_DEF_SPEC_KN( NAME, EXPR )\
+  int _mvm_op_exec_##NAME()\
+  {\
+    mvm_State *s = MVM_STATE;\
+    const mvm_Object *k = &s->k[mvm_arg()];\
+    mvmnum a = mvm_obj_number( _MVM_SLOT(s,1) ), b = mvm_obj_number( *k );\
+    s->s[s->sp] = *k;\
+    mvm_obj_set_number( s->s[s->sp + 1], EXPR );\
+    s->sp += 2;\
+    return 2;\
+  }
+
+// r[d] = r[a] <op> r[b] for number registers
+#define MVM_DEF_SPEC_RNN( NAME, EXPR )\
+  int _mvm_op_exec_##NAME()\
+  {\
+    mvm_State *s = MVM_STATE;\
+    mvmnum a = mvm_obj_number( _MVM_REG(s,mvm_arg_a()) );\
+    mvmnum b = mvm_obj_number( _MVM_REG(s,mvm_arg_b()) );\
+    mvm_obj_set_number( _MVM_REG(s,mvm_arg_d()), EXPR );\
+    return 0;\
+  }
+
+MVM_DEF_SPEC_NN( add_nn, a + b )
+MVM_DEF_SPEC_NN( sub_nn, a - b )
+MVM_DEF_SPEC_NN( mul_nn, a * b )
+MVM_DEF_SPEC_NN( div_nn, a / b )
+MVM_DEF_SPEC_NN( pow_nn, mvm_pow(a,b) )
+
+MVM_DEF_SPEC_IPNN( ipadd_nn, a + b )
+MVM_DEF_SPEC_IPNN( ipsub_nn, a - b )
+MVM_DEF_SPEC_IPNN( ipmul_nn, a * b )
+MVM_DEF_SPEC_IPNN( ipdiv_nn, a / b )
+
+MVM_DEF_SPEC_NIP_NN( add_nip_nn, a + b )
+MVM_DEF_SPEC_NIP_NN( sub_nip_nn, a - b )
+MVM_DEF_SPEC_NIP_NN( mul_nip_nn, a * b )
+MVM_DEF_SPEC_NIP_NN( div_nip_nn, a / b )
+
+MVM_DEF_SPEC_NIP( pow_nip_nn, mvmnum, number, number, mvm_pow(a,b) )
+MVM_DEF_SPEC_NIP( lt_nip_nn, mvmnum, number, bool, a < b )
+MVM_DEF_SPEC_NIP( le_nip_nn, mvmnum, number, bool, a <= b )
+MVM_DEF_SPEC_NIP( gt_nip_nn, mvmnum, number, bool, a > b )
+MVM_DEF_SPEC_NIP( ge_nip_nn, mvmnum, number, bool, a >= b )
+MVM_DEF_SPEC_NIP( eq_nip_nn, mvmnum, number, bool, a == b )
+MVM_DEF_SPEC_NIP( ne_nip_nn, mvmnum, number, bool, a != b )
+
+// (idiv & imod stay checked, for their divide by zero)
+MVM_DEF_SPEC_NIP( iadd_nip_ii, mvmint, int, int, _MVM_WRAP(a, +, b) )
+MVM_DEF_SPEC_NIP( isub_nip_ii, mvmint, int, int, _MVM_WRAP(a, -, b) )
+MVM_DEF_SPEC_NIP( imul_nip_ii, mvmint, int, int, _MVM_WRAP(a, *, b) )
+MVM_DEF_SPEC_NIP( band_nip_ii, mvmint, int, int, a & b )
+MVM_DEF_SPEC_NIP( bor_nip_ii, mvmint, int, int, a | b )
+MVM_DEF_SPEC_NIP( bxor_nip_ii, mvmint, int, int, a ^ b )
+MVM_DEF_SPEC_NIP( shl_nip_ii, mvmint, int, int,
+                  (mvmint)((mvmuint)a << _MVM_SHIFT(b)) )
+MVM_DEF_SPEC_NIP( shr_nip_ii, mvmint, int, int, a >> _MVM_SHIFT(b) )
+MVM_DEF_SPEC_NIP( ilt_nip_ii, mvmint, int, bool, a < b )
+MVM_DEF_SPEC_NIP( ile_nip_ii, mvmint, int, bool, a <= b )
+MVM_DEF_SPEC_NIP( igt_nip_ii, mvmint, int, bool, a > b )
+MVM_DEF_SPEC_NIP( ige_nip_ii, mvmint, int, bool, a >= b )
+MVM_DEF_SPEC_NIP( ieq_nip_ii, mvmint, int, bool, a == b )
+MVM_DEF_SPEC_NIP( ine_nip_ii, mvmint, int, bool, a != b )
+
+MVM_DEF_SPEC_NIP( and_nip_bb, mvmbool, bool, bool, a && b )
+MVM_DEF_SPEC_NIP( or_nip_bb, mvmbool, bool, bool, a || b )
+MVM_DEF_SPEC_NIP( xor_nip_bb, mvmbool, bool, bool, !(a && b) && (a || b) )
+MVM_DEF_SPEC_NIP( nand_nip_bb, mvmbool, bool, bool, !(a && b) )
+MVM_DEF_SPEC_NIP( nor_nip_bb, mvmbool, bool, bool, !(a || b) )
+MVM_DEF_SPEC_NIP( nxor_nip_bb, mvmbool, bool, bool, !(!(a && b) && (a || b)) )
+
+MVM_DEF_SPEC_IP1( ipnot_b, mvmbool, bool, bool, !a )
+MVM_DEF_SPEC_IP1( ipineg_i, mvmint, int, int, _MVM_WRAP(0, -, a) )
+MVM_DEF_SPEC_IP1( ipbnot_i, mvmint, int, int, ~a )
+MVM_DEF_SPEC_IP1( ipitof_i, mvmint, int, number, (mvmnum)a )
+
+MVM_DEF_SPEC_BB( and_bb, a && b )
+MVM_DEF_SPEC_BB( or_bb, a || b )
+MVM_DEF_SPEC_BB( xor_bb, !(a && b) && (a || b) )
+
+MVM_DEF_SPEC_KN( addk_n, a + b )
+MVM_DEF_SPEC_KN( subk_n, a - b )
+MVM_DEF_SPEC_KN( mulk_n, a * b )
+MVM_DEF_SPEC_KN( divk_n, a / b )
+
+MVM_DEF_SPEC_RNN( radd_nn, a + b )
+MVM_DEF_SPEC_RNN( rsub_nn, a - b )
+MVM_DEF_SPEC_RNN( rmul_nn, a * b )
+MVM_DEF_SPEC_RNN( rdiv_nn, a / b )
+
+// |a| for the number on top, result pushed
+int _mvm_op_exec_abs_n()
+{
+  mvm_State *s = MVM_STATE;
+  mvm_obj_set_number( _MVM_SLOT(s,0), mvm_fabs(mvm_obj_number( _MVM_SLOT(s,1) )) );
+  ++s->sp;
+  return 1;
+}
+
+// !a for the boolean on top, result pushed
+int _mvm_op_exec_not_b()
+{
+  mvm_State *s = MVM_STATE;
+  mvm_obj_set_bool( _MVM_SLOT(s,0), !mvm_obj_bool( _MVM_SLOT(s,1) ) );
+  ++s->sp;
+  return 1;
+}
+
+// How each op moves types around, so the pass can follow them
+#define MVM_SPEC_UNKNOWN 0 // pass stops here
+#define MVM_SPEC_PUSHK 1 // push k[arg]
+#define MVM_SPEC_PUSHK2 2 // push k[arg & 0xfff], k[arg >> 12]
+#define MVM_SPEC_NIP 3 // drop arg objects under the top
+#define MVM_SPEC_BIN_NUM 4 // read 2 numbers, push number
+#define MVM_SPEC_UN_NUM 5 // read 1 number, push number
+#define MVM_SPEC_IP_NUM 6 // read 2 numbers, result in the lower one
+#define MVM_SPEC_IP1 7 // read 1 object, result in place (same type)
+#define MVM_SPEC_BIN_BOOL 8 // read 2 booleans, push boolean
+#define MVM_SPEC_UN_BOOL 9 // read 1 boolean, push boolean
+#define MVM_SPEC_NIP_NUM 10 // replace 2 numbers with a number
+#define MVM_SPEC_NIP_BOOL 11 // replace 2 booleans with a boolean
+#define MVM_SPEC_K_NUM 12 // read 1 number & number k[arg], push k, number
+#define MVM_SPEC_IPK_NUM 13 // read 1 number & number k[arg], push k
+#define MVM_SPEC_R_NUM 14 // r[d] = number from registers a & b
+#define MVM_SPEC_R_UN_NUM 15 // r[d] = number from register a
+#define MVM_SPEC_R_BOOL 16 // r[d] = boolean from registers a & b
+#define MVM_SPEC_R_UN_BOOL 17 // r[d] = boolean from register a
+#define MVM_SPEC_RMOV 18 // r[d] = r[a]
+#define MVM_SPEC_RLOADK 19 // r[d] = k[ab]
+#define MVM_SPEC_RPUSH 20 // push r[a]
+
+#define MVM_NO_SPEC MVM_MAX_OPS // "no specialized version"
+
+struct __MVM_SPEC__
+{
+  char kind[MVM_MAX_OPS]; // MVM_SPEC_* of each op
+  uint32_t spec[MVM_MAX_OPS]; // specialized version of each op
+  uint32_t unchecked[MVM_MAX_OPS]; // each op followed by a nip of its
+                                   // operands, as one unchecked op
+} MVM_SPEC;
+
+// Describe op NAME to the pass, and name its specialized version (or NULL)
+int mvm_add_specialization( const char* name, char kind, const char* spec )
+{
+  int op = mvm_op_id( name );
+  int sop = spec ? mvm_op_id( spec ) : (int)MVM_NO_SPEC;
+  if ( op < 0 || sop < 0 ) return MVM_NOT_FOUND;
+
+  MVM_SPEC.kind[op] = kind;
+  MVM_SPEC.spec[op] = (uint32_t)sop;
+
+  // The specialized op moves the stack like op, without checking it (fused
+  // ops get theirs in mvm_add_fusion)
+  if ( spec ){
+    bool regs = kind >= MVM_SPEC_R_NUM && kind <= MVM_SPEC_R_UN_BOOL;
+    mvm_set_effect( (uint32_t)sop, regs ? MVM_EFFECT_REGS : MVM_FLOW.effect[op],
+                    MVM_FLOW.reads[op], MVM_FLOW.delta[op], true );
+  }
+
+  return MVM_OK;
+}
+
+// Name the unchecked op that does what op NAME followed by a nip of its
+// operands does, for operands of the types NAME takes (see mvm_IR_emit)
+int mvm_add_unchecked( const char* name, const char* unchecked )
+{
+  int op = mvm_op_id( name ), uop = mvm_op_id( unchecked );
+  if ( op < 0 || uop < 0 ) return MVM_NOT_FOUND;
+
+  MVM_SPEC.unchecked[op] = (uint32_t)uop;
+
+  int nip = mvm_op_id( "nip" );
+  if ( nip < 0 ) return MVM_NOT_FOUND;
+  mvm_set_effect_seq( (uint32_t)uop, (uint32_t)op, (uint32_t)nip,
+                      (uint32_t)MVM_FLOW.reads[op] );
+  MVM_FLOW.guarded[uop] = true;
+
+  return MVM_OK;
+}
+
+// Called by MVM_INIT once all the ops are registered (& MVM_FLOW filled in)
+int mvm_init_specializations()
+{
+  for ( uint32_t i = 0; i < MVM_MAX_OPS; ++i ){
+    MVM_SPEC.kind[i] = MVM_SPEC_UNKNOWN;
+    MVM_SPEC.spec[i] = MVM_NO_SPEC;
+    MVM_SPEC.unchecked[i] = MVM_NO_SPEC;
+  }
+
+#define spec( NAME, KIND, SPEC )\
+  if ( mvm_add_specialization( #NAME, MVM_SPEC_##KIND, SPEC ) != MVM_OK )\
+    return MVM_ERROR;
+
+  spec( pushk, PUSHK, NULL )
+  spec( pushk2, PUSHK2, NULL )
+  spec( nip, NIP, NULL )
+  spec( add, BIN_NUM, "add_nn" )
+  spec( sub, BIN_NUM, "sub_nn" )
+  spec( mul, BIN_NUM, "mul_nn" )
+  spec( div, BIN_NUM, "div_nn" )
+  spec( pow, BIN_NUM, "pow_nn" )
+  spec( abs, UN_NUM, "abs_n" )
+  spec( ipadd, IP_NUM, "ipadd_nn" )
+  spec( ipsub, IP_NUM, "ipsub_nn" )
+  spec( ipmul, IP_NUM, "ipmul_nn" )
+  spec( ipdiv, IP_NUM, "ipdiv_nn" )
+  spec( ippow, IP_NUM, NULL )
+  spec( ipabs, IP1, NULL )
+  spec( ipnot, IP1, NULL )
+  spec( not, UN_BOOL, "not_b" )
+  spec( and, BIN_BOOL, "and_bb" )
+  spec( or, BIN_BOOL, "or_bb" )
+  spec( xor, BIN_BOOL, "xor_bb" )
+  spec( nand, BIN_BOOL, NULL )
+  spec( nor, BIN_BOOL, NULL )
+  spec( nxor, BIN_BOOL, NULL )
+  spec( add_nip, NIP_NUM, "add_nip_nn" )
+  spec( sub_nip, NIP_NUM, "sub_nip_nn" )
+  spec( mul_nip, NIP_NUM, "mul_nip_nn" )
+  spec( div_nip, NIP_NUM, "div_nip_nn" )
+  spec( pow_nip, NIP_NUM, NULL )
+  spec( and_nip, NIP_BOOL, NULL )
+  spec( or_nip, NIP_BOOL, NULL )
+  spec( xor_nip, NIP_BOOL, NULL )
+  spec( addk, K_NUM, "addk_n" )
+  spec( subk, K_NUM, "subk_n" )
+  spec( mulk, K_NUM, "mulk_n" )
+  spec( divk, K_NUM, "divk_n" )
+  spec( powk, K_NUM, NULL )
+  spec( ipaddk, IPK_NUM, NULL )
+  spec( ipsubk, IPK_NUM, NULL )
+  spec( ipmulk, IPK_NUM, NULL )
+  spec( ipdivk, IPK_NUM, NULL )
+  spec( radd, R_NUM, "radd_nn" )
+  spec( rsub, R_NUM, "rsub_nn" )
+  spec( rmul, R_NUM, "rmul_nn" )
+  spec( rdiv, R_NUM, "rdiv_nn" )
+  spec( rpow, R_NUM, NULL )
+  spec( rabs, R_UN_NUM, NULL )
+  spec( rand, R_BOOL, NULL )
+  spec( ror, R_BOOL, NULL )
+  spec( rnand, R_BOOL, NULL )
+  spec( rnor, R_BOOL, NULL )
+  spec( rxor, R_BOOL, NULL )
+  spec( rnxor, R_BOOL, NULL )
+  spec( rnot, R_UN_BOOL, NULL )
+  spec( rmov, RMOV, NULL )
+  spec( rloadk, RLOADK, NULL )
+  spec( rpush, RPUSH, NULL )
+
+#undef spec
+
+#define unchecked( NAME, UNCHECKED )\
+  if ( mvm_add_unchecked( #NAME, #UNCHECKED ) != MVM_OK ) return MVM_ERROR;
+
+  unchecked( add, add_nip_nn )
+  unchecked( sub, sub_nip_nn )
+  unchecked( mul, mul_nip_nn )
+  unchecked( div, div_nip_nn )
+  unchecked( pow, pow_nip_nn )
+  unchecked( lt, lt_nip_nn )
+  unchecked( le, le_nip_nn )
+  unchecked( gt, gt_nip_nn )
+  unchecked( ge, ge_nip_nn )
+  unchecked( eq, eq_nip_nn )
+  unchecked( ne, ne_nip_nn )
+  unchecked( iadd, iadd_nip_ii )
+  unchecked( isub, isub_nip_ii )
+  unchecked( imul, imul_nip_ii )
+  unchecked( band, band_nip_ii )
+  unchecked( bor, bor_nip_ii )
+  unchecked( bxor, bxor_nip_ii )
+  unchecked( shl, shl_nip_ii )
+  unchecked( shr, shr_nip_ii )
+  unchecked( ilt, ilt_nip_ii )
+  unchecked( ile, ile_nip_ii )
+  unchecked( igt, igt_nip_ii )
+  unchecked( ige, ige_nip_ii )
+  unchecked( ieq, ieq_nip_ii )
+  unchecked( ine, ine_nip_ii )
+  unchecked( and, and_nip_bb )
+  unchecked( or, or_nip_bb )
+  unchecked( xor, xor_nip_bb )
+  unchecked( nand, nand_nip_bb )
+  unchecked( nor, nor_nip_bb )
+  unchecked( nxor, nxor_nip_bb )
+  unchecked( not, ipnot_b )
+  unchecked( ineg, ipineg_i )
+  unchecked( bnot, ipbnot_i )
+  unchecked( itof, ipitof_i )
+
+#undef unchecked
+
+  return MVM_OK;
+}
+
+// Type of the object i from the top of the simulated stack ts (of size n)
+char _mvm_spec_peek( const char *ts, uint32_t n, uint32_t i )
+{
+  return i && i <= n ? ts[n - i] : MVM_TYPE_UNKNOWN;
+}
+
+// Type of constant i of c
+char _mvm_spec_ktype( const mvm_Chunk *c, uint32_t i )
+{
+  return i < c->nk ? mvm_obj_type( c->k[i] ) : MVM_TYPE_UNKNOWN;
+}
+
+// Rewrite ops of c into type specialized versions wherever the types of their
+// operands are known. entry_types lists the nentry types the caller promises
+// to be on top of the stack when c runs (bottom first), and is checked once
+// by mvm_exec_chunk() before c runs. Returns the number of ops specialized.
+// Run this after mvm_fuse(), never before.
+uint32_t mvm_specialize( mvm_Chunk *c, const char *entry_types,
+                         uint32_t nentry )
+{
+  if ( !c || c->generic ) return 0; // already specialized
+
+  // Register chunks push above their window, so they can't see entry objects
+  if ( c->mode == MVM_CHUNK_REGISTER ) nentry = 0;
+
+  // Each op pushes at most 2 objects, so this is the deepest we can go
+  uint32_t cap = nentry + 2*c->size + 1;
+  char *ts = (char*)malloc( cap ); // types on the simulated stack
+  char *rt = (char*)malloc( MVM_MAX_REGISTERS ); // types in registers
+  mvm_Instr *code = (mvm_Instr*)malloc( sizeof(mvm_Instr)*(c->size + 1) );
+  if ( !ts || !rt || !code ){
+    free( ts ); free( rt ); free( code );
+    return 0;
+  }
+
+  uint32_t n = nentry; // simulated stack size (relative to entry - nentry)
+  uint32_t max = 0; // most objects pushed above the entry stack
+  uint32_t count = 0; // number of ops specialized
+  if ( nentry ) memcpy( ts, entry_types, nentry );
+  memcpy( code, c->code, sizeof(mvm_Instr)*c->size );
+
+  // Register windows always start zeroed, as numbers
+  for ( uint32_t r = 0; r < MVM_MAX_REGISTERS; ++r ) rt[r] = MVM_TYPE::number;
+
+  for ( uint32_t i = 0; i < c->size; ++i ){
+    mvm_Instr ins = c->code[i];
+    uint32_t op = MVM_OP(ins);
+    char a = _mvm_spec_peek( ts, n, 2 ), b = _mvm_spec_peek( ts, n, 1 );
+    bool known = false; // whether all operands have the right type
+    const char num = MVM_TYPE::number, bol = MVM_TYPE::boolean;
+    uint32_t d = MVM_ARG_D(ins), ra = MVM_ARG_A(ins), rb = MVM_ARG_B(ins);
+    bool regs_ok = d < c->nregs && ra < c->nregs && rb < c->nregs;
+
+    switch ( MVM_SPEC.kind[op] ){
+      case MVM_SPEC_PUSHK:
+        ts[n++] = _mvm_spec_ktype( c, MVM_ARG(ins) );
+        break;
+      case MVM_SPEC_PUSHK2:
+        ts[n++] = _mvm_spec_ktype( c, MVM_ARG(ins) & 0xfff );
+        ts[n++] = _mvm_spec_ktype( c, MVM_ARG(ins) >> 12 );
+        break;
+      case MVM_SPEC_NIP:
+        if ( MVM_ARG(ins) >= n ) goto done; // reaches below what we know
+        ts[n - 1 - MVM_ARG(ins)] = ts[n - 1];
+        n -= MVM_ARG(ins);
+        break;
+      case MVM_SPEC_BIN_NUM:
+        known = a == num && b == num;
+        ts[n++] = num;
+        break;
+      case MVM_SPEC_UN_NUM:
+        known = b == num;
+        ts[n++] = num;
+        break;
+      case MVM_SPEC_IP_NUM:
+        known = a == num && b == num;
+        if ( n >= 2 ) ts[n - 2] = num;
+        break;
+      case MVM_SPEC_IP1:
+        break;
+      case MVM_SPEC_BIN_BOOL:
+        known = a == bol && b == bol;
+        ts[n++] = bol;
+        break;
+      case MVM_SPEC_UN_BOOL:
+        known = b == bol;
+        ts[n++] = bol;
+        break;
+      case MVM_SPEC_NIP_NUM:
+      case MVM_SPEC_NIP_BOOL:
+        if ( n < 2 ) goto done;
+        known = MVM_SPEC.kind[op] == MVM_SPEC_NIP_NUM ?
+                a == num && b == num : a == bol && b == bol;
+        ts[n - 2] = MVM_SPEC.kind[op] == MVM_SPEC_NIP_NUM ? num : bol;
+        --n;
+        break;
+      case MVM_SPEC_K_NUM:
+        known = b == num && _mvm_spec_ktype( c, MVM_ARG(ins) ) == num;
+        ts[n++] = _mvm_spec_ktype( c, MVM_ARG(ins) );
+        ts[n++] = num;
+        break;
+      case MVM_SPEC_IPK_NUM:
+        if ( n ) ts[n - 1] = num;
+        ts[n++] = _mvm_spec_ktype( c, MVM_ARG(ins) );
+        break;
+      case MVM_SPEC_R_NUM:
+      case MVM_SPEC_R_UN_NUM:
+        if ( !regs_ok ) goto done;
+        known = rt[ra] == num && rt[rb] == num;
+        rt[d] = num;
+        break;
+      case MVM_SPEC_R_BOOL:
+      case MVM_SPEC_R_UN_BOOL:
+        if ( !regs_ok ) goto done;
+        rt[d] = bol;
+        break;
+      case MVM_SPEC_RMOV:
+        if ( !regs_ok ) goto done;
+        rt[d] = rt[ra];
+        break;
+      case MVM_SPEC_RLOADK:
+        if ( !regs_ok ) goto done;
+        rt[d] = _mvm_spec_ktype( c, MVM_ARG_AB(ins) );
+        break;
+      case MVM_SPEC_RPUSH:
+        if ( !regs_ok ) goto done;
+        ts[n++] = rt[ra];
+        break;
+      default:
+        goto done; // we don't know what this op does to the stack
+    }
+
+    if ( n > nentry && n - nentry > max ) max = n - nentry;
+
+    if ( known && MVM_SPEC.spec[op] != MVM_NO_SPEC ){
+      c->code[i] = (ins & ~(mvm_Instr)0xff) | MVM_SPEC.spec[op];
+      ++count;
+    }
+  }
+
+done:
+  free( rt );
+  free( ts );
+
+  if ( !count ){
+    free( code );
+    return 0;
+  }
+
+  // Keep the generic code to fall back on when the entry guard fails
+  c->generic = code;
+  c->generic_size = c->size;
+  c->guard = (char*)malloc( nentry + 1 );
+  if ( c->guard && nentry ) memcpy( c->guard, entry_types, nentry );
+  c->nguard = nentry;
+  c->max_stack = max;
+
+  return count;
+}
+
+// Check the entry guard of a specialized chunk against the current state
+bool mvm_chunk_guard( const mvm_Chunk *c )
+{
+  mvm_State *s = MVM_STATE;
+
+  if ( s->sp < c->nguard ) return false;
+  if ( !mvm_reserve_stack( s, c->nregs + c->max_stack + 1 ) ) return false;
+
+  for ( uint32_t i = 0; i < c->nguard; ++i ){
+    if ( mvm_obj_type( s->s[s->sp - c->nguard + i] ) != c->guard[i] ){
+      return false;
+    }
+  }
+
+  return true;
+}
+
+#endif // MVM_INCLUDE_SPECIALIZE
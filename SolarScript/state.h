@@ -3,29 +3,74 @@
 #include "defs.h"
 #include "object.h"
 #include "aatree.h"
+#include "chunk.h"
+#include "compound.h"
+
+#include <time.h>
+
+#ifdef MVM_STACK_GUARD
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #define MVM_DEFAULT_HEAP_SIZE 8388608 // measured in #objects (~64MB)
 #define MVM_DEFAULT_STACK_SIZE 1048576 // measured in # of objects (~8MB)
+#define MVM_INITIAL_STACK_SIZE 64 // objects allocated up front (~1KB)
+
+// Opcodes are a single byte, so the dispatch table is a flat array of 256
+// handlers indexed directly by opcode.
+#define MVM_MAX_OPS 256
+#define MVM_OP_SLOTS 512 // slots of the op name hash table (a power of 2)
 
 
 struct _mvm_State;
 
-// Global state information
+// Global state information - shared by every thread, and only written to by
+// MVM_INIT & MVM_CLEANUP
 struct __MVM__// MVM
 {
-  struct _mvm_State *state; // current state
-  mvm_AATree global_funcs;
+  mvm_AATree global_funcs; // operations sorted by name (compile-time lookup)
+  int (*dispatch[MVM_MAX_OPS])(); // opcode -> exec function (run-time lookup)
+  const char* op_names[MVM_MAX_OPS]; // opcode -> name (for debug output)
+  uint16_t op_slots[MVM_OP_SLOTS]; // name hash -> opcode + 1 (0 if empty)
+  uint32_t num_ops; // number of registered operations (next free opcode)
+
+#ifdef MVM_PROFILE_OPS
+  // How often op b executed straight after op a, at op_pairs[a*MVM_MAX_OPS+b]
+  // (see mvm_profile_report() in superops.h)
+  uint64_t *op_pairs;
+#endif
 } MVM;
 
 // MVM_INIT is in vm.h!
 
+// The state that ops on this thread work on (see mvm_set_state in vm.h).
+// Each thread has its own, so any number of states can run at once as long
+// as no two threads use the same state (or chunk) at the same time.
+MVM_THREAD_LOCAL struct _mvm_State *MVM_STATE = NULL;
+
+// An allocation owned by a state, freed with del (or free() if that's NULL)
+typedef struct _mvm_Owned
+{
+  void *p;
+  void (*del)( void *p );
+} mvm_Owned;
+
 /// Stores state information
 typedef struct _mvm_State
 {
   mvm_Object *s; // Actual stack data
   uint32_t sp; // stack pointer
-  uint32_t ss; // stack size (#objects)
-  uint32_t hs; // heap size (#objects)
+  uint32_t ss; // stack size limit (#objects)
+  uint32_t sc; // stack capacity, objects there's room for at s right now
+  uint32_t hs; // heap size (most allocations the state may own at once)
+
+  // Allocations the state owns (strings & compounds made by ops, see
+  // mvm_State_own)
+  struct _mvm_Owned *heap;
+  uint32_t nheap; // number of allocations in heap
+  uint32_t heapcap; // allocated size of heap
 
   uint32_t floating; // number of "floating" objects on the stack.
   // floating objects are those that were pushed to the stack by an operation
@@ -36,57 +81,303 @@ typedef struct _mvm_State
   // pointer that are not claimed will cause the MVM to set the error flag
   // to true, as these require manual handling by the user.
 
-  // Performance settings - these can be implemented later!
-  uint32_t ops_per_second; // Number of allowed operations in 1 second
+  // Performance settings (see mvm_ops_left)
+  uint32_t ops_per_second; // Number of allowed operations in 1 second (0=any)
   uint32_t ops_in_second; // Number of operations in the last second
   double perf_last_reset; // Last time the vm's perf stats were reset
 
+  // Execution registers - set up by mvm_exec_chunk(), read by ops through
+  // mvm_arg*() and the mvm_*_reg_*() helpers.
+  mvm_Instr ir; // instruction currently executing
+  mvm_Instr *ip; // where ir came from (ops may rewrite it, see quicken.h)
+  uint32_t fp; // frame pointer (base of the register window in s)
+  uint32_t nregs; // size of the register window
+  const mvm_Object *k; // constants of the chunk currently executing
+  uint32_t nk; // number of constants in k
+  mvm_Object *g; // globals of the program currently executing (see mvm_call)
+  const char *gt; // & the types the program keeps them as
+  uint32_t ng; // number of globals in g
+
   int error; // Anything else means there's an error!
   const char* error_message; // Custom message to describe error better
+
+#ifdef MVM_STACK_GUARD
+  bool guard_open; // the guard page was hit, and is writable until re-armed
+#endif
 } mvm_State;
 
+/* Stacks start small and grow (by doubling) up to ss as they're pushed to,
+   so idle states only cost a KB or so. Growing moves s, so never hold a
+   pointer into the stack over anything that might push!
+
+   With MVM_STACK_GUARD defined the whole stack is reserved up front as
+   virtual memory instead - the OS only commits pages as they're touched -
+   with a guard page after it. Pushes then skip their size checks: the
+   first one onto the guard page sets MVM_ERROR_STACK_OVERFLOW from a
+   signal handler (see mvm_install_stack_guard), which opens the page so
+   the op can finish on it, and the executor stops as it would for any other
+   error. Nothing past the guard page is protected, so once it's open every
+   push fails until it's re-armed, and reservations bigger than one object
+   (call frames, chunk windows) are still checked against ss. */
+
+#ifdef MVM_STACK_GUARD
+// The guard page catches overflows, until it's been hit
+#define _mvm_stack_room( S, N ) (!(S)->guard_open)
+#else
+// Whether there's room for N more objects on S's stack, growing it if needed
+#define _mvm_stack_room( S, N )\
+  ((S)->sp + (N) < (S)->sc || mvm_reserve_stack( (S), (N) ))
+#endif
+
+// cpu_freq is the state's ops_per_second (0 for no limit)
 mvm_State *mvm_new_State( uint32_t stack_size, uint32_t heap_size,
                           uint32_t cpu_freq )
 {
   mvm_State *s = mvm_malloc(mvm_State);
   if ( s ){
     s->ss = stack_size ? stack_size : MVM_DEFAULT_STACK_SIZE;
+    s->sc = s->ss < MVM_INITIAL_STACK_SIZE ? s->ss : MVM_INITIAL_STACK_SIZE;
     s->sp = 0;
     s->hs = heap_size ? heap_size : MVM_DEFAULT_HEAP_SIZE;
     s->ops_per_second = cpu_freq;
     s->ops_in_second = 0;
     s->perf_last_reset = 0.0;
+    s->ir = 0;
+    s->ip = NULL;
+    s->fp = s->nregs = 0;
+    s->k = NULL;
+    s->nk = 0;
+    s->g = NULL;
+    s->gt = NULL;
+    s->ng = 0;
+    s->heap = NULL;
+    s->nheap = s->heapcap = 0;
     s->error = MVM_OK;
     s->error_message = "No error";
-    s->s = (mvm_Object*)malloc(sizeof(mvm_Object) * s->ss);
+#ifdef MVM_STACK_GUARD
+    // Reserve (don't commit) the whole stack, plus the guard page
+    size_t page = (size_t)sysconf( _SC_PAGESIZE );
+    size_t size = (sizeof(mvm_Object)*s->ss + page - 1) & ~(page - 1);
+    void *p = mmap( NULL, size + page, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+    if ( p == MAP_FAILED || mprotect( (char*)p + size, page, PROT_NONE ) ){
+      if ( p != MAP_FAILED ) munmap( p, size + page );
+      free( s );
+      return NULL;
+    }
+    s->s = (mvm_Object*)p;
+    s->ss = s->sc = (uint32_t)(size/sizeof(mvm_Object));
+    s->guard_open = false;
+#else
+    s->s = (mvm_Object*)malloc(sizeof(mvm_Object) * s->sc);
+    if ( !s->s ){
+      free( s );
+      return NULL;
+    }
+#endif
   }
 
   return s;  
 }
 
+// Seconds on a monotonic clock, for perf_last_reset
+double mvm_now()
+{
+  struct timespec t;
+  clock_gettime( CLOCK_MONOTONIC, &t );
+  return (double)t.tv_sec + (double)t.tv_nsec*1e-9;
+}
+
+// How many more ops s may run before its second is up, given the time now
+// (from mvm_now()). Starts a new second once the last one has passed. States
+// with an ops_per_second of 0 aren't limited.
+uint32_t mvm_ops_left( mvm_State *s, double now )
+{
+  if ( !s->ops_per_second ) return UINT32_MAX;
+
+  if ( now - s->perf_last_reset >= 1.0 ){
+    s->perf_last_reset = now;
+    s->ops_in_second = 0;
+  }
+
+  return s->ops_in_second < s->ops_per_second ?
+         s->ops_per_second - s->ops_in_second : 0;
+}
+
+// Free everything s owns. Only call this when nothing on the stack (or in
+// any compound) refers to it any more, e.g. between runs.
+void mvm_State_clear_heap( mvm_State *s )
+{
+  for ( uint32_t i = s->nheap; i > 0; --i ){
+    mvm_Owned *o = &s->heap[i - 1];
+    if ( o->del ) o->del( o->p );
+    else free( o->p );
+  }
+  s->nheap = 0;
+}
+
+// Hand p over to s, which frees it with del (free() if NULL) when it's deleted
+// or its heap is cleared. If s can't take it (it owns hs allocations already,
+// or is out of memory) p is freed straight away, the error is set and false
+// is returned.
+bool mvm_State_own( mvm_State *s, void *p, void (*del)( void *p ) )
+{
+  int error = MVM_OK;
+
+  if ( !p ) error = MVM_ERROR_OUT_OF_MEMORY;
+  else if ( s->nheap >= s->hs ) error = MVM_ERROR_HEAP_FULL;
+  else if ( s->nheap == s->heapcap ){
+    uint32_t cap = s->heapcap ? s->heapcap*2 : 16;
+    mvm_Owned *h = (mvm_Owned*)realloc( s->heap, sizeof(mvm_Owned)*cap );
+    if ( h ){
+      s->heap = h;
+      s->heapcap = cap;
+    }
+    else{
+      error = MVM_ERROR_OUT_OF_MEMORY;
+    }
+  }
+
+  if ( error != MVM_OK ){
+    if ( p && del ) del( p );
+    else if ( p ) free( p );
+    s->error = error;
+    return false;
+  }
+
+  s->heap[s->nheap].p = p;
+  s->heap[s->nheap].del = del;
+  ++s->nheap;
+  return true;
+}
+
+// malloc size bytes owned by s, NULL (with the error set) on failure
+void *mvm_State_alloc( mvm_State *s, size_t size )
+{
+  void *p = malloc( size );
+  return mvm_State_own( s, p, NULL ) ? p : NULL;
+}
+
 // Only call this if you KNOW the error message of this state is NULL
 // or not heap allocated!
 void mvm_del_State( mvm_State *s )
 {
   if ( !s ) return;
 
+  mvm_State_clear_heap( s );
+  if ( s->heap ) free( s->heap );
+
+#ifdef MVM_STACK_GUARD
+  size_t page = (size_t)sysconf( _SC_PAGESIZE );
+  if ( s->s ) munmap( (void*)s->s, sizeof(mvm_Object)*s->ss + page );
+#else
   if ( s->s ) free( (void*)s->s );
+#endif
   free( s );
 }
 
+// Make room for n more objects on the stack of s (one slot above them is
+// always kept spare). Returns false if that would take it past ss.
+bool mvm_reserve_stack( mvm_State *s, uint32_t n )
+{
+#ifdef MVM_STACK_GUARD
+  if ( s->guard_open ) return false;
+#endif
+  if ( s->sp + n < s->sc ) return true;
+  if ( (uint64_t)s->sp + n >= s->ss ) return false;
+
+#ifdef MVM_STACK_GUARD
+  return false; // (sc == ss)
+#else
+  uint32_t sc = s->sc ? s->sc : 1;
+  while ( s->sp + n >= sc ) sc = sc > s->ss/2 ? s->ss : sc*2;
+
+  mvm_Object *o = (mvm_Object*)realloc( s->s, sizeof(mvm_Object)*sc );
+  if ( !o ) return false;
+
+  s->s = o;
+  s->sc = sc;
+  return true;
+#endif
+}
+
+#ifdef MVM_STACK_GUARD
+// Previous handlers, for faults that aren't stack overflows
+struct sigaction _mvm_old_segv, _mvm_old_bus;
+
+void _mvm_stack_guard_handler( int sig, siginfo_t *info, void *ctx )
+{
+  mvm_State *s = MVM_STATE;
+  size_t page = (size_t)sysconf( _SC_PAGESIZE );
+  char *guard = s ? (char*)s->s + sizeof(mvm_Object)*s->ss : NULL;
+  char *at = (char*)info->si_addr;
+
+  if ( guard && at >= guard && at < guard + page &&
+       !mprotect( guard, page, PROT_READ | PROT_WRITE ) ){
+    // Let the op finish on the guard page, the executor stops after it
+    s->guard_open = true;
+    s->error = MVM_ERROR_STACK_OVERFLOW;
+    return;
+  }
+
+  // Not ours: pass it on to whoever was installed before us
+  const struct sigaction *old = sig == SIGSEGV ? &_mvm_old_segv : &_mvm_old_bus;
+  if ( old->sa_flags & SA_SIGINFO ) old->sa_sigaction( sig, info, ctx );
+  else if ( old->sa_handler != SIG_DFL && old->sa_handler != SIG_IGN ){
+    old->sa_handler( sig );
+  }
+  else{
+    // Default action (ignoring a fault isn't possible): the fault happens
+    // again once we return, and kills the process as it would without us
+    signal( sig, SIG_DFL );
+  }
+}
+
+// Called by MVM_INIT
+int mvm_install_stack_guard()
+{
+  struct sigaction sa;
+  memset( &sa, 0, sizeof(sa) );
+  sa.sa_sigaction = _mvm_stack_guard_handler;
+  sa.sa_flags = SA_SIGINFO;
+  sigemptyset( &sa.sa_mask );
+
+  if ( sigaction( SIGSEGV, &sa, &_mvm_old_segv ) ) return MVM_ERROR;
+  if ( sigaction( SIGBUS, &sa, &_mvm_old_bus ) ) return MVM_ERROR;
+  return MVM_OK;
+}
+
+// Called by MVM_CLEANUP
+void mvm_remove_stack_guard()
+{
+  sigaction( SIGSEGV, &_mvm_old_segv, NULL );
+  sigaction( SIGBUS, &_mvm_old_bus, NULL );
+}
+
+// Protect the guard page again once the stack is back below it (called as
+// execution starts)
+void mvm_rearm_stack_guard( mvm_State *s )
+{
+  if ( s->guard_open && s->sp < s->ss ){
+    size_t page = (size_t)sysconf( _SC_PAGESIZE );
+    mprotect( (char*)s->s + sizeof(mvm_Object)*s->ss, page, PROT_NONE );
+    s->guard_open = false;
+  }
+}
+#endif
+
 // Stack manipulation functions:
 
 // we gonna start simple...
 void mvm_push_number( mvmnum n )
 {
-  if ( MVM.state ){
-    if ( MVM.state->sp + 1 < MVM.state->ss ){
-      ++MVM.state->sp;
-      MVM.state->s[MVM.state->sp].type = MVM_TYPE::number;
-      MVM.state->s[MVM.state->sp].data.n = n;
+  if ( MVM_STATE ){
+    if ( _mvm_stack_room( MVM_STATE, 1 ) ){
+      mvm_obj_set_number( MVM_STATE->s[MVM_STATE->sp], n );
+      ++MVM_STATE->sp;
     }
     else{
-      MVM.state->error = MVM_ERROR_STACK_OVERFLOW;
+      MVM_STATE->error = MVM_ERROR_STACK_OVERFLOW;
     }
   }
 }
@@ -97,13 +388,13 @@ void mvm_push_number( mvmnum n )
 // (0.0f can be returned when worked == true as well)
 mvmnum mvm_get_number( uint32_t i, bool *worked )
 {
-  mvm_State *s = MVM.state;
+  mvm_State *s = MVM_STATE;
 
-  if ( s && i && s->sp - i > 0 && 
-       s->s[s->sp - i].type == MVM_TYPE::number ){
+  if ( s && i && i <= s->sp && 
+       mvm_obj_is( s->s[s->sp - i], MVM_TYPE::number ) ){
     *worked = true;
 
-    return s->s[s->sp - i].data.n;
+    return mvm_obj_number( s->s[s->sp - i] );
   }
   else {
     *worked = false;
@@ -118,13 +409,13 @@ mvmnum mvm_get_number( uint32_t i, bool *worked )
 // (0.0f can be returned when worked == true as well)
 void mvm_set_number( uint32_t i, mvmnum n, bool *worked )
 {
-  mvm_State *s = MVM.state;
+  mvm_State *s = MVM_STATE;
 
-  if ( s && i && s->sp - i > 0 && 
-       s->s[s->sp - i].type == MVM_TYPE::number ){
+  if ( s && i && i <= s->sp && 
+       mvm_obj_is( s->s[s->sp - i], MVM_TYPE::number ) ){
     *worked = true;
 
-    s->s[s->sp - i].data.n = n;
+    mvm_obj_put_number( s->s[s->sp - i], n );
   }
   else {
     *worked = false;
@@ -136,13 +427,13 @@ void mvm_set_number( uint32_t i, mvmnum n, bool *worked )
 // On failure worked is set to false
 mvmbool mvm_get_bool( uint32_t i, bool *worked )
 {
-  mvm_State *s = MVM.state;
+  mvm_State *s = MVM_STATE;
 
-  if ( s && i && s->sp - i > 0 && 
-       s->s[s->sp - i].type == MVM_TYPE::boolean ){
+  if ( s && i && i <= s->sp && 
+       mvm_obj_is( s->s[s->sp - i], MVM_TYPE::boolean ) ){
     *worked = true;
 
-    return s->s[s->sp - i].data.b;
+    return mvm_obj_bool( s->s[s->sp - i] );
   }
   else {
     *worked = false;
@@ -156,13 +447,13 @@ mvmbool mvm_get_bool( uint32_t i, bool *worked )
 // On failure worked is set to false
 void mvm_set_bool( uint32_t i, mvmbool b, bool *worked )
 {
-  mvm_State *s = MVM.state;
+  mvm_State *s = MVM_STATE;
 
-  if ( s && i && s->sp - i > 0 && 
-       s->s[s->sp - i].type == MVM_TYPE::boolean ){
+  if ( s && i && i <= s->sp && 
+       mvm_obj_is( s->s[s->sp - i], MVM_TYPE::boolean ) ){
     *worked = true;
 
-    s->s[s->sp - i].data.b = b;
+    mvm_obj_put_bool( s->s[s->sp - i], b );
   }
   else {
     *worked = false;
@@ -171,26 +462,122 @@ void mvm_set_bool( uint32_t i, mvmbool b, bool *worked )
 
 void mvm_push_bool( mvmbool b )
 {
-  if ( MVM.state ){
-    if ( MVM.state->sp + 1 < MVM.state->ss ){
-      ++MVM.state->sp;
-      MVM.state->s[MVM.state->sp].type = MVM_TYPE::boolean;
-      MVM.state->s[MVM.state->sp].data.b = b;
+  if ( MVM_STATE ){
+    if ( _mvm_stack_room( MVM_STATE, 1 ) ){
+      mvm_obj_set_bool( MVM_STATE->s[MVM_STATE->sp], b );
+      ++MVM_STATE->sp;
+    }
+    else{
+      MVM_STATE->error = MVM_ERROR_STACK_OVERFLOW;
+    }
+  }
+}
+
+// Push a copy of any object
+void mvm_push_object( const mvm_Object *o )
+{
+  if ( MVM_STATE ){
+    mvm_Object copy = *o; // o may be on the stack, which might move
+    if ( _mvm_stack_room( MVM_STATE, 1 ) ){
+      MVM_STATE->s[MVM_STATE->sp] = copy;
+      ++MVM_STATE->sp;
+    }
+    else{
+      MVM_STATE->error = MVM_ERROR_STACK_OVERFLOW;
+    }
+  }
+}
+
+// Remove n objects from the top of the stack
+void mvm_pop( uint32_t n )
+{
+  if ( MVM_STATE ){
+    if ( n <= MVM_STATE->sp ){
+      MVM_STATE->sp -= n;
     }
     else{
-      MVM.state->error = MVM_ERROR_STACK_OVERFLOW;
+      MVM_STATE->error = MVM_ERROR_STACK_UNDERFLOW;
     }
   }
 }
 
-// Use this to set the MVM.state->error code to notify the VM of a runtime
+// Operands of the instruction currently executing (see chunk.h)
+#define mvm_arg() MVM_ARG(MVM_STATE->ir)
+#define mvm_arg_d() MVM_ARG_D(MVM_STATE->ir)
+#define mvm_arg_a() MVM_ARG_A(MVM_STATE->ir)
+#define mvm_arg_b() MVM_ARG_B(MVM_STATE->ir)
+#define mvm_arg_ab() MVM_ARG_AB(MVM_STATE->ir)
+
+// Register access: registers are the nregs objects starting at s[fp].
+// On failure worked is set to false.
+
+// Grab a number from register r
+mvmnum mvm_get_reg_number( uint32_t r, bool *worked )
+{
+  mvm_State *s = MVM_STATE;
+
+  if ( s && r < s->nregs && mvm_obj_is( s->s[s->fp + r], MVM_TYPE::number ) ){
+    *worked = true;
+
+    return mvm_obj_number( s->s[s->fp + r] );
+  }
+  else {
+    *worked = false;
+  }
+
+  return 0.0f;
+}
+
+// Grab a boolean from register r
+mvmbool mvm_get_reg_bool( uint32_t r, bool *worked )
+{
+  mvm_State *s = MVM_STATE;
+
+  if ( s && r < s->nregs && mvm_obj_is( s->s[s->fp + r], MVM_TYPE::boolean ) ){
+    *worked = true;
+
+    return mvm_obj_bool( s->s[s->fp + r] );
+  }
+  else {
+    *worked = false;
+  }
+
+  return false;
+}
+
+// Grab a pointer to register r (any type), NULL if r is out of the window
+mvm_Object *mvm_get_reg( uint32_t r )
+{
+  mvm_State *s = MVM_STATE;
+  return s && r < s->nregs ? &s->s[s->fp + r] : NULL;
+}
+
+// Registers take the type of whatever is stored in them, so setting one only
+// fails if r is outside of the window.
+void mvm_set_reg_number( uint32_t r, mvmnum n, bool *worked )
+{
+  mvm_Object *o = mvm_get_reg( r );
+  if ( (*worked = o != NULL) ){
+    mvm_obj_set_number( *o, n );
+  }
+}
+
+void mvm_set_reg_bool( uint32_t r, mvmbool b, bool *worked )
+{
+  mvm_Object *o = mvm_get_reg( r );
+  if ( (*worked = o != NULL) ){
+    mvm_obj_set_bool( *o, b );
+  }
+}
+
+// Use this to set the MVM_STATE->error code to notify the VM of a runtime
 // error.
 void mvm_set_error( int code )
 {
-  if ( MVM.state ) MVM.state->error = code;
+  if ( MVM_STATE ) MVM_STATE->error = code;
 }
 
-// Use this to set the MVM.state->error_message - you must also set the error
+// Use this to set the MVM_STATE->error_message - you must also set the error
 // code in order for the VM to recognize an issue. This is just for additional
 // debugging information, or custom errors.
 // The message _should_ be a heap allocated char*.
@@ -198,19 +585,69 @@ void mvm_set_error( int code )
 // (If you use a stack allocated string, then you do not need to deallocate)
 void mvm_set_error_message( const char* msg )
 {
-  if ( MVM.state ) MVM.state->error_message = msg;
+  if ( MVM_STATE ) MVM_STATE->error_message = msg;
 }
 
 // Deletes the manualluy set error_message if it's not a nullptr...
 // Be careful to not accidentally 
 void mvm__error_message( const char* msg )
 {
-  if ( MVM.state && MVM.state->error_message ) 
-    free( (char*)(MVM.state->error_message) );
+  if ( MVM_STATE && MVM_STATE->error_message ) 
+    free( (char*)(MVM_STATE->error_message) );
 }
 
-/* void mvm_push_char( mvmnum n );
-void mvm_push_string( mvmnum n );
-void mvm_push_pointer( mvmnum n );
-void mvm_push_pointer( mvmnum n ); */
+// Push/get/set on the stack & registers for the rest of the types. They work
+// just like the number & bool helpers above: get & set fail (worked = false)
+// unless the object already has the right type.
+#define MVM_DEF_ACCESS( NAME, CT, TYPE, GET, SET )\
+  void mvm_push_##NAME( CT v )\
+  {\
+    mvm_State *s = MVM_STATE;\
+    if ( s ){\
+      if ( _mvm_stack_room( s, 1 ) ){\
+        SET( s->s[s->sp], v );\
+        ++s->sp;\
+      }\
+      else{\
+        s->error = MVM_ERROR_STACK_OVERFLOW;\
+      }\
+    }\
+  }\
+  CT mvm_get_##NAME( uint32_t i, bool *worked )\
+  {\
+    mvm_State *s = MVM_STATE;\
+    *worked = s && i && i <= s->sp && mvm_obj_is( s->s[s->sp - i], TYPE );\
+    return *worked ? GET( s->s[s->sp - i] ) : (CT)0;\
+  }\
+  void mvm_set_##NAME( uint32_t i, CT v, bool *worked )\
+  {\
+    mvm_State *s = MVM_STATE;\
+    *worked = s && i && i <= s->sp && mvm_obj_is( s->s[s->sp - i], TYPE );\
+    if ( *worked ) SET( s->s[s->sp - i], v );\
+  }\
+  CT mvm_get_reg_##NAME( uint32_t r, bool *worked )\
+  {\
+    mvm_State *s = MVM_STATE;\
+    *worked = s && r < s->nregs && mvm_obj_is( s->s[s->fp + r], TYPE );\
+    return *worked ? GET( s->s[s->fp + r] ) : (CT)0;\
+  }\
+  void mvm_set_reg_##NAME( uint32_t r, CT v, bool *worked )\
+  {\
+    mvm_Object *o = mvm_get_reg( r );\
+    if ( (*worked = o != NULL) ) SET( *o, v );\
+  }
+
+#define _MVM_GET_STRING( O ) ((const char*)mvm_obj_string( O ))
+#define _MVM_GET_COMPOUND( O ) ((mvm_Compound*)mvm_obj_pointer( O ))
+#define _MVM_SET_STRING( O, V ) mvm_obj_set_pointer( O, MVM_TYPE::string, V )
+#define _MVM_SET_POINTER( O, V ) mvm_obj_set_pointer( O, MVM_TYPE::pointer, V )
+#define _MVM_SET_COMPOUND( O, V ) mvm_obj_set_pointer( O, MVM_TYPE::compound, V )
+
+MVM_DEF_ACCESS( int, mvmint, MVM_TYPE::integer, mvm_obj_int, mvm_obj_set_int )
+MVM_DEF_ACCESS( string, const char*, MVM_TYPE::string, _MVM_GET_STRING,
+                _MVM_SET_STRING )
+MVM_DEF_ACCESS( pointer, void*, MVM_TYPE::pointer, mvm_obj_pointer,
+                _MVM_SET_POINTER )
+MVM_DEF_ACCESS( compound, mvm_Compound*, MVM_TYPE::compound,
+                _MVM_GET_COMPOUND, _MVM_SET_COMPOUND )
 
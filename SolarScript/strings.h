@@ -4,23 +4,110 @@
 // written permission from the copyright holder named above.
 //
 
+/* Growable strings, for building text (log lines, reports, generated source)
+   a piece at a time.
+
+   An mvm_String tracks its capacity & grows it geometrically (at least
+   doubling), so n appends cost O(n) copying overall rather than a fresh
+   allocation each. Strings of up to MVM_STRING_INLINE characters live in
+   the string itself & never allocate. str always points at the characters
+   (nul terminated), wherever they are - so an mvm_String mustn't be copied
+   or moved with memcpy or =, use mvm_String_set.
+
+   An mvm_Rope is for very large concatenations: pieces are copied into big
+   blocks that are never moved or regrown (or, with mvm_Rope_append_ref, not
+   copied at all), and the text is only joined up once, by mvm_Rope_flatten,
+   when it's done. */
+
+#pragma once
+
+#ifndef MVM_INCLUDE_STRINGS
+#define MVM_INCLUDE_STRINGS
 
 #include "defs.h"
-#include "aatree.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#define MVM_STRING_INLINE 23 // characters a string holds without allocating
+#define MVM_STRING_MAX 0xfffffffe // longest a string can be
+#define MVM_ROPE_BLOCK 65536 // bytes in each of a rope's blocks (at least)
 
 typedef struct _mvm_String
 {
-  const char* str;
-  unsigned int len; // length of used characters (excluding null terminator)
+  char* str; // the characters, nul terminated (buf while they fit)
+  uint32_t len; // length of used characters (excluding null terminator)
+  uint32_t cap; // characters str has room for (excluding null terminator)
+  char buf[MVM_STRING_INLINE + 1]; // small strings' characters
 } mvm_String;
 
+void mvm_init_String( mvm_String *s )
+{
+  if ( s ){
+    s->str = s->buf;
+    s->buf[0] = '\0';
+    s->len = 0;
+    s->cap = MVM_STRING_INLINE;
+  }
+}
+
+// To cleanup a string that's created on the stack, call this! (It's left
+// empty & ready to use again.)
+void mvm_cleanup_String( mvm_String *s )
+{
+  if ( s ){
+    if ( s->str != s->buf ) free( s->str );
+    mvm_init_String( s );
+  }
+}
+
+// Make sure s has room for cap characters. Returns false if it can't.
+bool mvm_String_reserve( mvm_String *s, size_t cap )
+{
+  if ( cap <= s->cap ) return true;
+  if ( cap > MVM_STRING_MAX ) return false;
+
+  size_t grown = (size_t)s->cap*2;
+  if ( grown > cap ) cap = grown < MVM_STRING_MAX ? grown : MVM_STRING_MAX;
+
+  char* str = (char*)realloc( s->str == s->buf ? NULL : s->str, cap + 1 );
+  if ( !str ) return false;
+  if ( s->str == s->buf ) memcpy( str, s->buf, s->len + 1 );
+  s->str = str;
+  s->cap = (uint32_t)cap;
+  return true;
+}
+
+// Empty s, keeping its room
+void mvm_String_clear( mvm_String *s )
+{
+  s->len = 0;
+  s->str[0] = '\0';
+}
+
+// Append the len characters at p to s. Returns s, or NULL (leaving s as it
+// was) if out of memory.
+mvm_String *mvm_String_append_n( mvm_String *s, const char* p, size_t len )
+{
+  // p may be in s, which growing moves
+  uintptr_t at = (uintptr_t)p - (uintptr_t)s->str;
+  bool inside = at <= s->len;
+  if ( !mvm_String_reserve( s, (size_t)s->len + len ) ) return NULL;
+  if ( inside ) p = s->str + at;
+
+  memcpy( s->str + s->len, p, len );
+  s->len += (uint32_t)len;
+  s->str[s->len] = '\0';
+  return s;
+}
+
 mvm_String *mvm_new_String( const char* str )
 {
   mvm_String *s = mvm_malloc(mvm_String);
-  if ( s ){
-    s->len = strlen(str);
-    s->str = (const char*)malloc(s->len * sizeof(char) + 1);
-    strcpy((char*)s->str, str);
+  mvm_init_String( s );
+  if ( s && !mvm_String_append_n( s, str, strlen( str ) ) ){
+    free( s );
+    s = NULL;
   }
 
   return s;
@@ -29,7 +116,7 @@ mvm_String *mvm_new_String( const char* str )
 void mvm_del_String( mvm_String *s )
 {
   if ( s ){
-    if ( s->str ) free((void*)s->str);
+    mvm_cleanup_String( s );
     free( s );
   }
 }
@@ -38,10 +125,10 @@ void mvm_del_String( mvm_String *s )
 mvm_String *mvm_String_set_cstr( mvm_String *s, const char* s2 )
 {
   if ( s && s2 ){
-    if ( s->str ) free((void*)s->str);
-    s->len = strlen(s2);
-    s->str = (const char*)malloc(sizeof(char)*(s->len+1));
-    strcpy((char*)s->str,s2);
+    size_t len = strlen( s2 );
+    if ( !mvm_String_reserve( s, len ) ) return NULL;
+    memmove( s->str, s2, len + 1 );
+    s->len = (uint32_t)len;
   }
   return s;
 }
@@ -49,35 +136,191 @@ mvm_String *mvm_String_set_cstr( mvm_String *s, const char* s2 )
 // Append s2 to s1
 mvm_String *mvm_String_append_cstr( mvm_String *s, const char* s2 )
 {
-  if ( s && s2 ){
-    if ( s->str ) free((void*)s->str);
-    s->len = s->len + strlen(s2);
-    s->str = (const char*)malloc(s->len + 1);
-    strcat( (char*)s->str, s2 );
-  }
+  if ( s && s2 ) return mvm_String_append_n( s, s2, strlen( s2 ) );
   return s;
 }
 
 // Change s to s2
-mvm_String *mvm_String_set( mvm_String *s, mvm_String *s2 )
+mvm_String *mvm_String_set( mvm_String *s, const mvm_String *s2 )
 {
-  if ( s && s2 ){
-    if ( s->str ) free((void*)s->str);
+  if ( s && s2 && s != s2 ){
+    if ( !mvm_String_reserve( s, s2->len ) ) return NULL;
+    memcpy( s->str, s2->str, s2->len + 1 );
     s->len = s2->len;
-    s->str = (const char*)malloc(s->len+1);
-    strcpy((char*)s->str,(char*)s2->str);
   }
   return s;
 }
 
 // Append s2 to s1
-mvm_String *mvm_String_append( mvm_String *s, mvm_String *s2 )
+mvm_String *mvm_String_append( mvm_String *s, const mvm_String *s2 )
 {
-  if ( s && s2 ){
-    if ( s->str ) free((void*)s->str);
-    s->len = s->len + s2->len;
-    s->str = (const char*)malloc(s->len + 1);
-    strcat( (char*)s->str, (char*)s2->str );
+  if ( s && s2 ) return mvm_String_append_n( s, s2->str, s2->len );
+  return s;
+}
+
+mvm_String *mvm_String_append_char( mvm_String *s, char c )
+{
+  if ( s->len == s->cap && !mvm_String_reserve( s, (size_t)s->len + 1 ) ){
+    return NULL;
+  }
+  s->str[s->len++] = c;
+  s->str[s->len] = '\0';
+  return s;
+}
+
+// Append printf style formatted text to s. Returns s, or NULL (leaving s as
+// it was) if out of memory or the format is bad.
+mvm_String *mvm_String_appendf( mvm_String *s, const char* fmt, ... )
+{
+  va_list args;
+  va_start( args, fmt );
+  int n = vsnprintf( s->str + s->len, (size_t)(s->cap - s->len) + 1, fmt,
+                     args );
+  va_end( args );
+  if ( n < 0 ){
+    s->str[s->len] = '\0';
+    return NULL;
+  }
+
+  // It didn't fit, so make room & format it again
+  if ( (uint32_t)n > s->cap - s->len ){
+    if ( !mvm_String_reserve( s, (size_t)s->len + (size_t)n ) ){
+      s->str[s->len] = '\0';
+      return NULL;
+    }
+    va_start( args, fmt );
+    vsnprintf( s->str + s->len, (size_t)n + 1, fmt, args );
+    va_end( args );
   }
+  s->len += (uint32_t)n;
   return s;
-}
\ No newline at end of file
+}
+
+//------------------------------------------------------------------------------
+// Ropes
+
+// A piece of a rope's text
+typedef struct _mvm_Rope_Piece
+{
+  const char* p;
+  size_t len;
+} mvm_Rope_Piece;
+
+typedef struct _mvm_Rope
+{
+  mvm_Rope_Piece *pieces; // the text, in order
+  uint32_t npieces, cap;
+  char **blocks; // blocks copied pieces are in (the last is being filled)
+  uint32_t nblocks, bcap;
+  size_t bsize, bused; // size of the last block, & bytes used of it
+  size_t len; // length of the whole text
+} mvm_Rope;
+
+void mvm_init_Rope( mvm_Rope *r )
+{
+  if ( r ){
+    r->pieces = NULL;
+    r->npieces = r->cap = 0;
+    r->blocks = NULL;
+    r->nblocks = r->bcap = 0;
+    r->bsize = r->bused = r->len = 0;
+  }
+}
+
+void mvm_cleanup_Rope( mvm_Rope *r )
+{
+  if ( r ){
+    for ( uint32_t i = 0; i < r->nblocks; ++i ) free( r->blocks[i] );
+    free( r->blocks );
+    free( r->pieces );
+    mvm_init_Rope( r );
+  }
+}
+
+// Make room for one more entry in the array at *p, of n entries of size bytes
+bool _mvm_Rope_room( void **p, uint32_t n, uint32_t *cap, size_t size )
+{
+  if ( n < *cap ) return true;
+  if ( *cap > UINT32_MAX/2 ) return false;
+
+  uint32_t c = *cap ? *cap*2 : 16;
+  void *grown = realloc( *p, size*c );
+  if ( !grown ) return false;
+  *p = grown;
+  *cap = c;
+  return true;
+}
+
+// Append the len bytes at p to r, without copying them - they have to stay
+// where they are until r is flattened. Returns MVM_OK or
+// MVM_ERROR_OUT_OF_MEMORY.
+int mvm_Rope_append_ref( mvm_Rope *r, const char* p, size_t len )
+{
+  if ( !len ) return MVM_OK;
+  if ( !_mvm_Rope_room( (void**)&r->pieces, r->npieces, &r->cap,
+                        sizeof(mvm_Rope_Piece) ) ){
+    return MVM_ERROR_OUT_OF_MEMORY;
+  }
+  r->pieces[r->npieces].p = p;
+  r->pieces[r->npieces++].len = len;
+  r->len += len;
+  return MVM_OK;
+}
+
+// Append a copy of the len bytes at p to r. Returns MVM_OK or
+// MVM_ERROR_OUT_OF_MEMORY.
+int mvm_Rope_append_n( mvm_Rope *r, const char* p, size_t len )
+{
+  if ( !len ) return MVM_OK;
+
+  if ( len > r->bsize - r->bused ){
+    size_t size = len > MVM_ROPE_BLOCK ? len : MVM_ROPE_BLOCK;
+    char *b = NULL;
+    if ( !_mvm_Rope_room( (void**)&r->blocks, r->nblocks, &r->bcap,
+                          sizeof(char*) ) || !(b = (char*)malloc( size )) ){
+      return MVM_ERROR_OUT_OF_MEMORY;
+    }
+    r->blocks[r->nblocks++] = b;
+    r->bsize = size;
+    r->bused = 0;
+  }
+
+  char *to = r->blocks[r->nblocks - 1] + r->bused;
+  memcpy( to, p, len );
+  r->bused += len;
+
+  // A copy that carries straight on from the last piece just extends it
+  mvm_Rope_Piece *last = r->npieces ? &r->pieces[r->npieces - 1] : NULL;
+  if ( last && last->p + last->len == to ){
+    last->len += len;
+    r->len += len;
+    return MVM_OK;
+  }
+  return mvm_Rope_append_ref( r, to, len );
+}
+
+int mvm_Rope_append_cstr( mvm_Rope *r, const char* str )
+{
+  return mvm_Rope_append_n( r, str, strlen( str ) );
+}
+
+// Append r's whole text to s, in one go. Returns MVM_OK, or
+// MVM_ERROR_OUT_OF_MEMORY (leaving s as it was) if out of memory or the text
+// is too long for a string.
+int mvm_Rope_flatten( const mvm_Rope *r, mvm_String *s )
+{
+  if ( !mvm_String_reserve( s, (size_t)s->len + r->len ) ){
+    return MVM_ERROR_OUT_OF_MEMORY;
+  }
+
+  char *to = s->str + s->len;
+  for ( uint32_t i = 0; i < r->npieces; ++i ){
+    memcpy( to, r->pieces[i].p, r->pieces[i].len );
+    to += r->pieces[i].len;
+  }
+  *to = '\0';
+  s->len += (uint32_t)r->len;
+  return MVM_OK;
+}
+
+#endif // MVM_INCLUDE_STRINGS
@@ -0,0 +1,533 @@
+/* Superinstructions: single ops that do the work of a common sequence of
+   stack ops, plus the peephole passes that rewrite code to use them -
+   mvm_fuse for chunks & mvm_fuse_program for programs.
+
+   Each fused op leaves the stack exactly as the sequence it replaces would,
+   so fusing never changes what a chunk computes - only how many times we go
+   around the dispatch loop. Which pairs get fused is decided by the rules
+   added in mvm_init_fusions(); build with MVM_PROFILE_OPS to count op pairs
+   in real runs and mvm_profile_report() to see which ones are worth adding.
+
+   mvm_fuse only looks at adjacent instructions, so it must run before any
+   jump offsets are resolved. mvm_fuse_program moves jump targets & function
+   entries along with the code, never fuses across one, and also fuses a
+   compare with the jt/jf after it into a branch op (see MVM_FLOW_BRANCH). */
+
+#pragma once
+
+#ifndef MVM_INCLUDE_SUPEROPS
+#define MVM_INCLUDE_SUPEROPS
+
+#include "defs.h"
+#include "state.h"
+#include "chunk.h"
+#include "ops.h"
+#include "flowops.h"
+#include "specialize.h"
+
+#include <stdio.h>
+#include <math.h>
+
+// pushk2 packs two constant indices into its 24 bit arg
+#define MVM_PUSHK2_MAX 4096
+
+// Push k[arg & 0xfff] then k[arg >> 12] (pushk; pushk)
+int _mvm_op_exec_pushk2()
+{
+  mvm_State *s = MVM_STATE;
+  uint32_t i = mvm_arg() & (MVM_PUSHK2_MAX - 1);
+  uint32_t j = mvm_arg() >> 12;
+  if ( i >= s->nk || j >= s->nk ){
+    mvm_set_error( MVM_BAD_ARG_1 );
+    return 0;
+  }
+
+  mvm_push_object( &s->k[i] );
+  mvm_push_object( &s->k[j] );
+
+  return 2;
+}
+
+// pushk k; <op>  ->  push k, then push a <op> k
+// (k is masked to 16 bits, the top arg bit is used by quicken.h)
+#define MVM_DEF_FUSED_K( NAME, EXPR )\
+  int _mvm_op_exec_##NAME()\
+  {\
+    mvm_State *s = MVM_STATE;\
+    bool worked = false;\
+    uint32_t i = mvm_arg() & (MVM_MAX_CONSTANTS - 1);\
+    mvmnum a = mvm_get_number( 1, &worked );\
+    if ( !worked ){\
+      mvm_set_error( MVM_BAD_ARG_1 );\
+      return 0;\
+    }\
+    if ( i >= s->nk || !mvm_obj_is( s->k[i], MVM_TYPE::number ) ){\
+      mvm_set_error( MVM_BAD_ARG_2 );\
+      return 0;\
+    }\
+    mvmnum b = mvm_obj_number( s->k[i] );\
+    mvm_push_object( &s->k[i] );\
+    mvm_push_number( EXPR );\
+    return 2;\
+  }
+
+// pushk k; ip<op>  ->  a = a <op> k, then push k
+#define MVM_DEF_FUSED_IPK( NAME, EXPR )\
+  int _mvm_op_exec_##NAME()\
+  {\
+    mvm_State *s = MVM_STATE;\
+    bool worked = false;\
+    uint32_t i = mvm_arg();\
+    mvmnum a = mvm_get_number( 1, &worked );\
+    if ( !worked ){\
+      mvm_set_error( MVM_BAD_ARG_1 );\
+      return 0;\
+    }\
+    if ( i >= s->nk || !mvm_obj_is( s->k[i], MVM_TYPE::number ) ){\
+      mvm_set_error( MVM_BAD_ARG_2 );\
+      return 0;\
+    }\
+    mvmnum b = mvm_obj_number( s->k[i] );\
+    mvm_set_number( 1, EXPR, &worked );\
+    mvm_push_object( &s->k[i] );\
+    return 1;\
+  }
+
+// <op>; nip 2  ->  replace a & b with a <op> b
+#define MVM_DEF_FUSED_NIP( NAME, CT, T, R, EXPR )\
+  int _mvm_op_exec_##NAME()\
+  {\
+    bool worked = false;\
+    CT a = mvm_get_##T( 2, &worked );\
+    if ( !worked ){\
+      mvm_set_error( MVM_BAD_ARG_1 );\
+      return 0;\
+    }\
+    CT b = mvm_get_##T( 1, &worked );\
+    if ( !worked ){\
+      mvm_set_error( MVM_BAD_ARG_2 );\
+      return 0;\
+    }\
+    mvm_pop( 2 );\
+    mvm_push_##R( EXPR );\
+    return -1;\
+  }
+
+MVM_DEF_FUSED_K( addk, a + b )
+MVM_DEF_FUSED_K( subk, a - b )
+MVM_DEF_FUSED_K( mulk, a * b )
+MVM_DEF_FUSED_K( divk, a / b )
+MVM_DEF_FUSED_K( powk, mvm_pow(a,b) )
+
+MVM_DEF_FUSED_IPK( ipaddk, a + b )
+MVM_DEF_FUSED_IPK( ipsubk, a - b )
+MVM_DEF_FUSED_IPK( ipmulk, a * b )
+MVM_DEF_FUSED_IPK( ipdivk, a / b )
+
+MVM_DEF_FUSED_NIP( add_nip, mvmnum, number, number, a + b )
+MVM_DEF_FUSED_NIP( sub_nip, mvmnum, number, number, a - b )
+MVM_DEF_FUSED_NIP( mul_nip, mvmnum, number, number, a * b )
+MVM_DEF_FUSED_NIP( div_nip, mvmnum, number, number, a / b )
+MVM_DEF_FUSED_NIP( pow_nip, mvmnum, number, number, mvm_pow(a,b) )
+MVM_DEF_FUSED_NIP( and_nip, mvmbool, bool, bool, a && b )
+MVM_DEF_FUSED_NIP( or_nip, mvmbool, bool, bool, a || b )
+MVM_DEF_FUSED_NIP( xor_nip, mvmbool, bool, bool, !(a && b) && (a || b) )
+
+// gstore g; pop 1  ->  global g = a, popped
+int _mvm_op_exec_gstore_pop()
+{
+  mvm_State *s = MVM_STATE;
+  uint32_t i = mvm_arg();
+  if ( i >= s->ng ){
+    mvm_set_error( MVM_BAD_ARG_0 );
+    return 0;
+  }
+  if ( !s->sp ){
+    mvm_set_error( MVM_BAD_ARG_1 );
+    return 0;
+  }
+
+  s->g[i] = s->s[--s->sp];
+
+  return -1;
+}
+
+// <cmp>; jt/jf t  ->  NAME_jt/NAME_jf t, branching on a <cmp> b & leaving
+// them on the stack. mvm_call() runs them (see MVM_FLOW_BRANCH) with the test
+// defined here.
+#define MVM_DEF_FUSED_BRANCH( NAME, CT, T, EXPR )\
+  int _mvm_test_##NAME( mvm_State *s )\
+  {\
+    bool worked = false;\
+    CT a = mvm_get_##T( 2, &worked );\
+    if ( !worked ){\
+      s->error = MVM_BAD_ARG_1;\
+      return -1;\
+    }\
+    CT b = mvm_get_##T( 1, &worked );\
+    if ( !worked ){\
+      s->error = MVM_BAD_ARG_2;\
+      return -1;\
+    }\
+    return EXPR;\
+  }\
+  int _mvm_op_exec_##NAME##_jt() { return _mvm_op_exec_flow(); }\
+  int _mvm_op_exec_##NAME##_jf() { return _mvm_op_exec_flow(); }
+
+// <cmp>_nip_<types>; jt/jf t  ->  the same, but a & b are dropped & not
+// checked (like the unchecked compare, see specialize.h)
+#define MVM_DEF_FUSED_BRANCH_NIP( NAME, CT, T, EXPR )\
+  int _mvm_test_##NAME( mvm_State *s )\
+  {\
+    CT a = mvm_obj_##T( _MVM_SLOT(s,2) );\
+    CT b = mvm_obj_##T( _MVM_SLOT(s,1) );\
+    s->sp -= 2;\
+    return EXPR;\
+  }\
+  int _mvm_op_exec_##NAME##_jt() { return _mvm_op_exec_flow(); }\
+  int _mvm_op_exec_##NAME##_jf() { return _mvm_op_exec_flow(); }
+
+MVM_DEF_FUSED_BRANCH( lt, mvmnum, number, a < b )
+MVM_DEF_FUSED_BRANCH( le, mvmnum, number, a <= b )
+MVM_DEF_FUSED_BRANCH( gt, mvmnum, number, a > b )
+MVM_DEF_FUSED_BRANCH( ge, mvmnum, number, a >= b )
+MVM_DEF_FUSED_BRANCH( eq, mvmnum, number, a == b )
+MVM_DEF_FUSED_BRANCH( ne, mvmnum, number, a != b )
+MVM_DEF_FUSED_BRANCH( ilt, mvmint, int, a < b )
+MVM_DEF_FUSED_BRANCH( ile, mvmint, int, a <= b )
+MVM_DEF_FUSED_BRANCH( igt, mvmint, int, a > b )
+MVM_DEF_FUSED_BRANCH( ige, mvmint, int, a >= b )
+MVM_DEF_FUSED_BRANCH( ieq, mvmint, int, a == b )
+MVM_DEF_FUSED_BRANCH( ine, mvmint, int, a != b )
+
+MVM_DEF_FUSED_BRANCH_NIP( lt_nip_nn, mvmnum, number, a < b )
+MVM_DEF_FUSED_BRANCH_NIP( le_nip_nn, mvmnum, number, a <= b )
+MVM_DEF_FUSED_BRANCH_NIP( gt_nip_nn, mvmnum, number, a > b )
+MVM_DEF_FUSED_BRANCH_NIP( ge_nip_nn, mvmnum, number, a >= b )
+MVM_DEF_FUSED_BRANCH_NIP( eq_nip_nn, mvmnum, number, a == b )
+MVM_DEF_FUSED_BRANCH_NIP( ne_nip_nn, mvmnum, number, a != b )
+MVM_DEF_FUSED_BRANCH_NIP( ilt_nip_ii, mvmint, int, a < b )
+MVM_DEF_FUSED_BRANCH_NIP( ile_nip_ii, mvmint, int, a <= b )
+MVM_DEF_FUSED_BRANCH_NIP( igt_nip_ii, mvmint, int, a > b )
+MVM_DEF_FUSED_BRANCH_NIP( ige_nip_ii, mvmint, int, a >= b )
+MVM_DEF_FUSED_BRANCH_NIP( ieq_nip_ii, mvmint, int, a == b )
+MVM_DEF_FUSED_BRANCH_NIP( ine_nip_ii, mvmint, int, a != b )
+
+// How the args of a fused pair are combined into the fused instruction
+#define MVM_FUSE_ARG_NONE 0 // fused op takes no arg
+#define MVM_FUSE_ARG_FIRST 1 // fused op takes the first instruction's arg
+#define MVM_FUSE_ARG_PAIR12 2 // both args (each < 4096) packed as 12+12 bits
+#define MVM_FUSE_ARG_SECOND 3 // fused op takes the second instruction's arg
+
+#define MVM_MAX_FUSIONS 128
+
+typedef struct _mvm_Fusion
+{
+  uint32_t first, second; // opcodes of the sequence
+  int64_t second_arg; // arg the second op must have, or -1 for any
+  uint32_t fused; // opcode of the superinstruction
+  char arg_mode; // MVM_FUSE_ARG_*
+  char priority; // when two rules overlap, the higher priority one wins
+} mvm_Fusion;
+
+struct __MVM_FUSIONS__
+{
+  mvm_Fusion rules[MVM_MAX_FUSIONS];
+  uint32_t count;
+} MVM_FUSIONS;
+
+// Add a rule fusing op first followed by op second into op fused
+int mvm_add_fusion( const char* first, const char* second,
+                    int64_t second_arg, const char* fused, char arg_mode,
+                    char priority )
+{
+  int a = mvm_op_id( first ), b = mvm_op_id( second ), f = mvm_op_id( fused );
+  if ( a < 0 || b < 0 || f < 0 ) return MVM_NOT_FOUND;
+  if ( MVM_FUSIONS.count == MVM_MAX_FUSIONS ) return MVM_ERROR;
+
+  mvm_Fusion *r = &MVM_FUSIONS.rules[MVM_FUSIONS.count++];
+  r->first = (uint32_t)a;
+  r->second = (uint32_t)b;
+  r->second_arg = second_arg;
+  r->fused = (uint32_t)f;
+  r->arg_mode = arg_mode;
+  r->priority = priority;
+
+  // The fused op moves the stack like the pair, & so does its specialized
+  // version (see mvm_add_specialization)
+  mvm_set_effect_seq( r->fused, r->first, r->second,
+                      second_arg < 0 ? 0 : (uint32_t)second_arg );
+  uint32_t s = MVM_SPEC.spec[f];
+  if ( s != MVM_NO_SPEC && MVM_FLOW.effect[s] == MVM_EFFECT_UNKNOWN ){
+    mvm_set_effect( s, MVM_FLOW.effect[f], MVM_FLOW.reads[f],
+                    MVM_FLOW.delta[f], true );
+  }
+
+  return MVM_OK;
+}
+
+// Add the rules fusing op cmp followed by jt or jf into cmp_jt or cmp_jf,
+// branch ops that mvm_call() runs with test
+int mvm_add_branch_fusion( const char* cmp, int (*test)( mvm_State *s ) )
+{
+  const char* jumps[] = { "jf", "jt" };
+  for ( int on = 0; on < 2; ++on ){
+    char name[64];
+    snprintf( name, sizeof(name), "%s_%s", cmp, jumps[on] );
+    int f = mvm_op_id( name );
+    if ( f < 0 ) return MVM_NOT_FOUND;
+
+    int result = mvm_add_fusion( cmp, jumps[on], -1, name,
+                                 MVM_FUSE_ARG_SECOND, 1 );
+    if ( result != MVM_OK ) return result;
+    MVM_FLOW.kind[f] = MVM_FLOW_BRANCH;
+    MVM_FLOW.test[f] = test;
+    MVM_FLOW.on[f] = on;
+  }
+
+  return MVM_OK;
+}
+
+// Called by MVM_INIT once all the ops are registered (& MVM_FLOW & MVM_SPEC
+// filled in)
+int mvm_init_fusions()
+{
+  MVM_FUSIONS.count = 0;
+
+#define fuse( A, B, ARG, F, MODE, PRIORITY )\
+  if ( mvm_add_fusion( #A, #B, ARG, #F, MODE, PRIORITY ) != MVM_OK )\
+    return MVM_ERROR;
+
+  // load + arith
+  fuse( pushk, add, -1, addk, MVM_FUSE_ARG_FIRST, 1 )
+  fuse( pushk, sub, -1, subk, MVM_FUSE_ARG_FIRST, 1 )
+  fuse( pushk, mul, -1, mulk, MVM_FUSE_ARG_FIRST, 1 )
+  fuse( pushk, div, -1, divk, MVM_FUSE_ARG_FIRST, 1 )
+  fuse( pushk, pow, -1, powk, MVM_FUSE_ARG_FIRST, 1 )
+  fuse( pushk, ipadd, -1, ipaddk, MVM_FUSE_ARG_FIRST, 1 )
+  fuse( pushk, ipsub, -1, ipsubk, MVM_FUSE_ARG_FIRST, 1 )
+  fuse( pushk, ipmul, -1, ipmulk, MVM_FUSE_ARG_FIRST, 1 )
+  fuse( pushk, ipdiv, -1, ipdivk, MVM_FUSE_ARG_FIRST, 1 )
+
+  // arith + store (consume the operands)
+  fuse( add, nip, 2, add_nip, MVM_FUSE_ARG_NONE, 1 )
+  fuse( sub, nip, 2, sub_nip, MVM_FUSE_ARG_NONE, 1 )
+  fuse( mul, nip, 2, mul_nip, MVM_FUSE_ARG_NONE, 1 )
+  fuse( div, nip, 2, div_nip, MVM_FUSE_ARG_NONE, 1 )
+  fuse( pow, nip, 2, pow_nip, MVM_FUSE_ARG_NONE, 1 )
+  fuse( and, nip, 2, and_nip, MVM_FUSE_ARG_NONE, 1 )
+  fuse( or, nip, 2, or_nip, MVM_FUSE_ARG_NONE, 1 )
+  fuse( xor, nip, 2, xor_nip, MVM_FUSE_ARG_NONE, 1 )
+
+  // store + drop it
+  fuse( gstore, pop, 1, gstore_pop, MVM_FUSE_ARG_FIRST, 1 )
+
+  // load + load (lowest priority, so pushk; pushk; add -> pushk; addk)
+  fuse( pushk, pushk, -1, pushk2, MVM_FUSE_ARG_PAIR12, 0 )
+
+#undef fuse
+
+  // compare + branch (programs only)
+#define branch( CMP )\
+  if ( mvm_add_branch_fusion( #CMP, _mvm_test_##CMP ) != MVM_OK )\
+    return MVM_ERROR;
+
+  branch( lt ) branch( le ) branch( gt ) branch( ge ) branch( eq ) branch( ne )
+  branch( ilt ) branch( ile ) branch( igt ) branch( ige ) branch( ieq )
+  branch( ine )
+  branch( lt_nip_nn ) branch( le_nip_nn ) branch( gt_nip_nn )
+  branch( ge_nip_nn ) branch( eq_nip_nn ) branch( ne_nip_nn )
+  branch( ilt_nip_ii ) branch( ile_nip_ii ) branch( igt_nip_ii )
+  branch( ige_nip_ii ) branch( ieq_nip_ii ) branch( ine_nip_ii )
+
+#undef branch
+
+  return MVM_OK;
+}
+
+const mvm_Fusion *_mvm_find_fusion( mvm_Instr a, mvm_Instr b )
+{
+  for ( uint32_t i = 0; i < MVM_FUSIONS.count; ++i ){
+    const mvm_Fusion *r = &MVM_FUSIONS.rules[i];
+    if ( r->first != MVM_OP(a) || r->second != MVM_OP(b) ) continue;
+    if ( r->second_arg >= 0 && (int64_t)MVM_ARG(b) != r->second_arg ) continue;
+    if ( r->arg_mode == MVM_FUSE_ARG_PAIR12 &&
+         (MVM_ARG(a) >= MVM_PUSHK2_MAX || MVM_ARG(b) >= MVM_PUSHK2_MAX) ){
+      continue;
+    }
+    return r;
+  }
+
+  return NULL;
+}
+
+mvm_Instr _mvm_fuse_instr( const mvm_Fusion *r, mvm_Instr a, mvm_Instr b )
+{
+  switch ( r->arg_mode ){
+    case MVM_FUSE_ARG_FIRST:
+      return MVM_INSTR( r->fused, MVM_ARG(a) );
+    case MVM_FUSE_ARG_PAIR12:
+      return MVM_INSTR( r->fused, MVM_ARG(a) | (MVM_ARG(b) << 12) );
+    case MVM_FUSE_ARG_SECOND:
+      return MVM_INSTR( r->fused, MVM_ARG(b) );
+    default:
+      return MVM_INSTR( r->fused, 0 );
+  }
+}
+
+// Peephole pass: rewrite adjacent pairs of stack ops in c into
+// superinstructions. Returns the number of pairs fused. Register chunks are
+// left alone (their ops are already three-address).
+uint32_t mvm_fuse( mvm_Chunk *c )
+{
+  if ( !c || c->mode != MVM_CHUNK_STACK ) return 0;
+
+  uint32_t i = 0, out = 0, fused = 0;
+
+  while ( i < c->size ){
+    const mvm_Fusion *r =
+      i + 1 < c->size ? _mvm_find_fusion( c->code[i], c->code[i+1] ) : NULL;
+
+    // Don't take this pair if the next one overlaps it and is better
+    if ( r && i + 2 < c->size ){
+      const mvm_Fusion *n = _mvm_find_fusion( c->code[i+1], c->code[i+2] );
+      if ( n && n->priority > r->priority ) r = NULL;
+    }
+
+    if ( r ){
+      c->code[out++] = _mvm_fuse_instr( r, c->code[i], c->code[i+1] );
+      i += 2;
+      ++fused;
+    }
+    else{
+      c->code[out++] = c->code[i++];
+    }
+  }
+
+  c->size = out;
+
+  return fused;
+}
+
+// Whether instruction i jumps (to its arg)
+bool _mvm_is_jump( mvm_Instr i )
+{
+  switch ( MVM_FLOW.kind[MVM_OP(i)] ){
+    case MVM_FLOW_JMP:
+    case MVM_FLOW_JT:
+    case MVM_FLOW_JF:
+    case MVM_FLOW_BRANCH:
+      return true;
+  }
+  return false;
+}
+
+// mvm_fuse for a program (before it's run, since quickened code won't match
+// the rules): pairs are fused wherever the second isn't jumped to or a
+// function's entry, & jumps & entries are moved to where their targets end
+// up. Returns the number of pairs fused, or 0 if p can't be written to.
+uint32_t mvm_fuse_program( mvm_Program *p )
+{
+  if ( !p || p->map || !p->size ) return 0;
+
+  bool *target = (bool*)calloc( p->size, sizeof(bool) );
+  uint32_t *to = (uint32_t*)malloc( sizeof(uint32_t)*p->size );
+  if ( !target || !to ){
+    free( target );
+    free( to );
+    return 0;
+  }
+
+  for ( uint32_t i = 0; i < p->nfuncs; ++i ){
+    if ( p->funcs[i].entry < p->size ) target[p->funcs[i].entry] = true;
+  }
+  for ( uint32_t i = 0; i < p->size; ++i ){
+    uint32_t arg = MVM_ARG(p->code[i]);
+    if ( _mvm_is_jump( p->code[i] ) && arg < p->size ) target[arg] = true;
+  }
+
+  uint32_t i = 0, out = 0, fused = 0;
+
+  while ( i < p->size ){
+    const mvm_Fusion *r = i + 1 < p->size && !target[i+1] ?
+      _mvm_find_fusion( p->code[i], p->code[i+1] ) : NULL;
+
+    // Don't take this pair if the next one overlaps it and is better
+    if ( r && i + 2 < p->size && !target[i+2] ){
+      const mvm_Fusion *n = _mvm_find_fusion( p->code[i+1], p->code[i+2] );
+      if ( n && n->priority > r->priority ) r = NULL;
+    }
+
+    to[i] = out;
+    if ( r ){
+      to[i+1] = out;
+      p->code[out++] = _mvm_fuse_instr( r, p->code[i], p->code[i+1] );
+      i += 2;
+      ++fused;
+    }
+    else{
+      p->code[out++] = p->code[i++];
+    }
+  }
+
+  for ( uint32_t j = 0; j < out; ++j ){
+    uint32_t arg = MVM_ARG(p->code[j]);
+    if ( _mvm_is_jump( p->code[j] ) && arg < p->size ){
+      p->code[j] = MVM_INSTR(MVM_OP(p->code[j]), to[arg]);
+    }
+  }
+  for ( uint32_t j = 0; j < p->nfuncs; ++j ){
+    if ( p->funcs[j].entry < p->size ) p->funcs[j].entry = to[p->funcs[j].entry];
+  }
+
+  p->size = out;
+  p->checked = false;
+  free( target );
+  free( to );
+
+  return fused;
+}
+
+#ifdef MVM_PROFILE_OPS
+// Clear the op pair counts gathered so far
+void mvm_profile_reset()
+{
+  if ( MVM.op_pairs ){
+    memset( MVM.op_pairs, 0, sizeof(uint64_t)*MVM_MAX_OPS*MVM_MAX_OPS );
+  }
+}
+
+// Print the n most frequently executed op pairs to f
+void mvm_profile_report( FILE *f, uint32_t n )
+{
+  if ( !MVM.op_pairs ) return;
+
+  fprintf( f, "Most frequent op pairs:\n" );
+
+  uint64_t last = UINT64_MAX; // count of the previously printed pair
+  uint32_t last_i = 0;
+  for ( uint32_t printed = 0; printed < n; ++printed ){
+    // Find the next largest count (ties are printed in opcode order)
+    uint64_t best = 0;
+    uint32_t best_i = 0;
+    for ( uint32_t i = 0; i < MVM_MAX_OPS*MVM_MAX_OPS; ++i ){
+      uint64_t c = MVM.op_pairs[i];
+      if ( (c < last || (c == last && i > last_i)) && c > best ){
+        best = c;
+        best_i = i;
+      }
+    }
+    if ( !best ) break;
+
+    const char* a = MVM.op_names[best_i / MVM_MAX_OPS];
+    const char* b = MVM.op_names[best_i % MVM_MAX_OPS];
+    fprintf( f, "  %12llu  %s -> %s\n", (unsigned long long)best,
+             a ? a : "?", b ? b : "?" );
+
+    last = best;
+    last_i = best_i;
+  }
+}
+#endif
+
+#endif // MVM_INCLUDE_SUPEROPS
@@ -1,4 +1,6 @@
-/* Testing out the AAMap */
+/* Testing out the AAMap, & benchmarking it: inserts, gets & removes of n keys
+   (in a shuffled order) for n = 10^3 up to 10^7, or 10^max with
+   `./test_aatree max`. The AA tree rules are checked after every round. */
 
 #include "aatree.h"
 #include <stdio.h>
@@ -18,54 +20,115 @@ int comp( void* _a, void *_b )
 #define mvm_remove mvm_AATree_remove
 #define mvm_get mvm_AATree_get
 
-int main( int argc, const char* argv[] )
+double now()
 {
-  time_t raw_time;
-  struct tm *time_info;
-  time( &raw_time );
-  time_info = localtime( &raw_time );
-
-  int seconds = time_info->tm_sec;
-  int minutes = time_info->tm_min;
-  int hours = time_info->tm_hour;
-
-  int seed = seconds*minutes*hours;
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
 
-  srand(seed);
+// Number of nodes under n, or -1 if they break a rule: a left child is a
+// level below its parent, a right child the same or a level below, & a right
+// grandchild below its grandparent (nil being level 0, these also keep
+// leaves at level 1). Keys must be in order between lo & hi.
+long check( mvm_AATree *t, mvm_AANode *n, int lo, int hi )
+{
+  if ( n == t->nil ) return 0;
 
-  mvm_AATree *t = mvm_new_AATree( comp );
+  int key = *(int*)n->data;
+  if ( key < lo || key > hi ) return -1;
+  if ( n->left->level + 1 != n->level ) return -1;
+  if ( n->right->level != n->level && n->right->level + 1 != n->level ){
+    return -1;
+  }
+  if ( n->right->right->level >= n->level ) return -1;
 
-  int *key = mvm_new_int(0);
+  long l = check( t, n->left, lo, key - 1 );
+  long r = check( t, n->right, key + 1, hi );
+  return l < 0 || r < 0 ? -1 : l + r + 1;
+}
 
-  int num_items = 50000;
+// Insert, get, remove (half) & get again n keys, printing ops per second.
+// Returns whether the tree held what it should throughout.
+bool bench( int n )
+{
+  int *keys = (int*)malloc( sizeof(int)*n );
+  int *order = (int*)malloc( sizeof(int)*n );
+  for ( int i = 0; i < n; ++i ) keys[i] = order[i] = i;
+  for ( int i = n - 1; i > 0; --i ){ // shuffle
+    int j = rand() % (i + 1);
+    int swap = order[i];
+    order[i] = order[j];
+    order[j] = swap;
+  }
 
-  for ( int i = 0; i < num_items; ++i ){
-    *key = i;
-    mvm_insert( t, mvm_new_int(*key) ); // clone the key & insert it
+  mvm_AATree t;
+  mvm_init_AATree( &t, comp );
+  bool worked = true;
+
+  double start = now();
+  for ( int i = 0; i < n; ++i ) mvm_insert( &t, &keys[order[i]] );
+  double inserted = now();
+  worked = worked && t.size == (uint32_t)n &&
+           check( &t, t.root, 0, n - 1 ) == n;
+
+  long found = 0;
+  double got_start = now();
+  for ( int i = 0; i < n; ++i ) found += mvm_get( &t, &keys[order[i]] ) != NULL;
+  double got = now();
+  worked = worked && found == n;
+
+  for ( int i = 0; i < n; i += 2 ){
+    worked = worked && mvm_remove( &t, &keys[order[i]] ) &&
+             mvm_AATree_last_deleted( &t ) == &keys[order[i]];
   }
+  double removed = now();
+  int missing = -1;
+  worked = worked && !mvm_remove( &t, &missing ) &&
+           t.size == (uint32_t)(n/2) && check( &t, t.root, 0, n - 1 ) == n/2;
+
+  // Removed nodes are reused
+  for ( int i = 0; i < n; i += 2 ) mvm_insert( &t, &keys[order[i]] );
+  worked = worked && t.size == (uint32_t)n &&
+           check( &t, t.root, 0, n - 1 ) == n;
+
+  double torn = now();
+  mvm_cleanup_AATree( &t, false );
+  double teardown = now() - torn;
+
+  printf( "%9d keys: %7.2f Minserts/s %7.2f Mgets/s %7.2f Mremoves/s,"
+          " teardown %.3f ms\n", n, n/(inserted - start)/1e6,
+          n/(got - got_start)/1e6, (n + 1)/2/(removed - got)/1e6,
+          teardown*1e3 );
+
+  free( keys );
+  free( order );
+  return worked;
+}
 
-  for ( int i = 0; i < num_items; ++i ){
-    *key = rand()%100 + 1;
-    if ( *key > 50 ){
-      *key = i;
-      /* int * v = (int*)mvm_get( t, key ); */
-      mvm_remove( t, key );
-      int *v = (int*)mvm_AATree_last_deleted(t);
-      free( v );
-    }
-    else{
-      *key = i;
-      int * v = (int*)mvm_get( t, key );
+int main( int argc, const char* argv[] )
+{
+  int max = argc > 1 ? atoi( argv[1] ) : 7;
+  srand( (unsigned)time( NULL ) );
+
+  bool worked = true;
+  for ( int e = 3, n = 1000; e <= max; ++e, n *= 10 ){
+    if ( !bench( n ) ){
+      printf( "Tree of %d keys went wrong\n", n );
+      worked = false;
     }
   }
 
-  printf( "\nSize of tree is: %u\n", t->size );
-
-  // Cleanup:
+  // Trees own their keys' data when cleaned up with freeData
+  mvm_AATree *t = mvm_new_AATree( comp );
+  for ( int i = 0; i < 1000; ++i ) mvm_insert( t, mvm_new_int( i ) );
+  int key = 500;
+  mvm_remove( t, &key );
+  free( mvm_AATree_last_deleted( t ) );
   mvm_del_AATree( t, true ); // del tree and all data in it
-  free( key ); key = NULL;
 
+  if ( !worked ) return 1;
   printf( "A-OK\n" );
 
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,295 @@
+/* Builtin ops on integers, strings & compounds (ops.h has the number and
+   boolean ones). They follow the same rules: operands are left on the stack,
+   the result is pushed, and bad operands set MVM_BAD_ARG_n.
+
+   Integer ops use integer instructions all the way through (no round trip
+   via mvmnum), and wrap around on overflow instead of being undefined.
+   Strings & compounds made by ops are owned by the state (see
+   mvm_State_own), so they live until it's deleted or its heap is cleared. */
+
+#pragma once
+
+#ifndef MVM_INCLUDE_TYPEOPS
+#define MVM_INCLUDE_TYPEOPS
+
+#include "defs.h"
+#include "state.h"
+#include "compound.h"
+
+// Push EXPR(a, b) for the two integers on top
+#define MVM_DEF_INT_BINOP( NAME, EXPR )\
+  int _mvm_op_exec_##NAME()\
+  {\
+    bool worked = false;\
+    mvmint a = mvm_get_int( 2, &worked );\
+    if ( !worked ){\
+      mvm_set_error( MVM_BAD_ARG_1 );\
+      return 0;\
+    }\
+    mvmint b = mvm_get_int( 1, &worked );\
+    if ( !worked ){\
+      mvm_set_error( MVM_BAD_ARG_2 );\
+      return 0;\
+    }\
+    mvm_push_int( EXPR );\
+    return 1;\
+  }
+
+// As MVM_DEF_INT_BINOP, but b must not be 0
+#define MVM_DEF_INT_DIVOP( NAME, EXPR )\
+  int _mvm_op_exec_##NAME()\
+  {\
+    bool worked = false;\
+    mvmint a = mvm_get_int( 2, &worked );\
+    if ( !worked ){\
+      mvm_set_error( MVM_BAD_ARG_1 );\
+      return 0;\
+    }\
+    mvmint b = mvm_get_int( 1, &worked );\
+    if ( !worked ){\
+      mvm_set_error( MVM_BAD_ARG_2 );\
+      return 0;\
+    }\
+    if ( b == 0 ){\
+      mvm_set_error( MVM_ERROR_DIV_BY_ZERO );\
+      return 0;\
+    }\
+    mvm_push_int( EXPR );\
+    return 1;\
+  }
+
+// Push EXPR(a) for the integer on top
+#define MVM_DEF_INT_UNOP( NAME, EXPR )\
+  int _mvm_op_exec_##NAME()\
+  {\
+    bool worked = false;\
+    mvmint a = mvm_get_int( 1, &worked );\
+    if ( !worked ){\
+      mvm_set_error( MVM_BAD_ARG_1 );\
+      return 0;\
+    }\
+    mvm_push_int( EXPR );\
+    return 1;\
+  }
+
+// Wrapping arithmetic (signed overflow is undefined, unsigned isn't)
+#define _MVM_WRAP( A, OP, B ) ((mvmint)((mvmuint)(A) OP (mvmuint)(B)))
+#define _MVM_SHIFT( B ) ((B) & (MVM_INT_BITS - 1))
+
+MVM_DEF_INT_BINOP( iadd, _MVM_WRAP(a, +, b) )
+MVM_DEF_INT_BINOP( isub, _MVM_WRAP(a, -, b) )
+MVM_DEF_INT_BINOP( imul, _MVM_WRAP(a, *, b) )
+// (MIN / -1 overflows, and traps on x86)
+MVM_DEF_INT_DIVOP( idiv, b == -1 ? _MVM_WRAP(0, -, a) : a / b )
+MVM_DEF_INT_DIVOP( imod, b == -1 ? 0 : a % b )
+MVM_DEF_INT_UNOP( ineg, _MVM_WRAP(0, -, a) )
+
+// bitwise:
+MVM_DEF_INT_BINOP( band, a & b )
+MVM_DEF_INT_BINOP( bor, a | b )
+MVM_DEF_INT_BINOP( bxor, a ^ b )
+MVM_DEF_INT_UNOP( bnot, ~a )
+MVM_DEF_INT_BINOP( shl, (mvmint)((mvmuint)a << _MVM_SHIFT(b)) )
+MVM_DEF_INT_BINOP( shr, a >> _MVM_SHIFT(b) ) // arithmetic shift
+
+// conversions:
+int _mvm_op_exec_itof() // push integer a as a number
+{
+  bool worked = false;
+
+  mvmint a = mvm_get_int( 1, &worked );
+  if ( !worked ){
+    mvm_set_error( MVM_BAD_ARG_1 );
+    return 0;
+  }
+
+  mvm_push_number( (mvmnum)a );
+
+  return 1;
+}
+
+int _mvm_op_exec_ftoi() // push number a as an integer (rounded toward 0)
+{
+  bool worked = false;
+
+  mvmnum a = mvm_get_number( 1, &worked );
+  if ( !worked ){
+    mvm_set_error( MVM_BAD_ARG_1 );
+    return 0;
+  }
+
+  // Out of range conversions are undefined, so clamp (NaN becomes 0)
+  const mvmnum lim = (mvmnum)((mvmuint)1 << (MVM_INT_BITS - 1));
+  mvmint i = a != a ? 0 :
+             a >= lim ? (mvmint)(((mvmuint)1 << (MVM_INT_BITS - 1)) - 1) :
+             a <= -lim ? (mvmint)((mvmuint)1 << (MVM_INT_BITS - 1)) :
+             (mvmint)a;
+  mvm_push_int( i );
+
+  return 1;
+}
+
+// strings:
+int _mvm_op_exec_sconcat() // push a .. b
+{
+  bool worked = false;
+
+  const char* a = mvm_get_string( 2, &worked );
+  if ( !worked ){
+    mvm_set_error( MVM_BAD_ARG_1 );
+    return 0;
+  }
+
+  const char* b = mvm_get_string( 1, &worked );
+  if ( !worked ){
+    mvm_set_error( MVM_BAD_ARG_2 );
+    return 0;
+  }
+
+  size_t la = strlen( a ), lb = strlen( b );
+  char *r = (char*)mvm_State_alloc( MVM_STATE, la + lb + 1 );
+  if ( !r ) return 0;
+
+  memcpy( r, a, la );
+  memcpy( r + la, b, lb + 1 );
+  mvm_push_string( r );
+
+  return 1;
+}
+
+int _mvm_op_exec_slen() // push the length of a
+{
+  bool worked = false;
+
+  const char* a = mvm_get_string( 1, &worked );
+  if ( !worked ){
+    mvm_set_error( MVM_BAD_ARG_1 );
+    return 0;
+  }
+
+  mvm_push_int( (mvmint)strlen( a ) );
+
+  return 1;
+}
+
+int _mvm_op_exec_scmp() // push -1, 0 or 1 as a sorts before, with or after b
+{
+  bool worked = false;
+
+  const char* a = mvm_get_string( 2, &worked );
+  if ( !worked ){
+    mvm_set_error( MVM_BAD_ARG_1 );
+    return 0;
+  }
+
+  const char* b = mvm_get_string( 1, &worked );
+  if ( !worked ){
+    mvm_set_error( MVM_BAD_ARG_2 );
+    return 0;
+  }
+
+  int c = strcmp( a, b );
+  mvm_push_int( c < 0 ? -1 : c > 0 ? 1 : 0 );
+
+  return 1;
+}
+
+int _mvm_op_exec_seq() // push a == b
+{
+  bool worked = false;
+
+  const char* a = mvm_get_string( 2, &worked );
+  if ( !worked ){
+    mvm_set_error( MVM_BAD_ARG_1 );
+    return 0;
+  }
+
+  const char* b = mvm_get_string( 1, &worked );
+  if ( !worked ){
+    mvm_set_error( MVM_BAD_ARG_2 );
+    return 0;
+  }
+
+  mvm_push_bool( a == b || !strcmp( a, b ) );
+
+  return 1;
+}
+
+// compounds:
+void _mvm_del_compound( void *c )
+{
+  mvm_del_Object_compound( (mvm_Compound*)c );
+}
+
+int _mvm_op_exec_newc() // push a new, empty compound
+{
+  mvm_Compound *c = mvm_new_Compound( NULL );
+  if ( !mvm_State_own( MVM_STATE, c, _mvm_del_compound ) ) return 0;
+
+  mvm_push_compound( c );
+
+  return 1;
+}
+
+// Name of the field an op refers to: string constant k[arg], or NULL
+const char* _mvm_field_name()
+{
+  mvm_State *s = MVM_STATE;
+  uint32_t i = mvm_arg();
+
+  if ( i >= s->nk || !mvm_obj_is( s->k[i], MVM_TYPE::string ) ) return NULL;
+  return mvm_obj_string( s->k[i] );
+}
+
+int _mvm_op_exec_getf() // push field k[arg] of compound a
+{
+  bool worked = false;
+
+  mvm_Compound *a = mvm_get_compound( 1, &worked );
+  if ( !worked ){
+    mvm_set_error( MVM_BAD_ARG_1 );
+    return 0;
+  }
+
+  const char* name = _mvm_field_name();
+  if ( !name ){
+    mvm_set_error( MVM_BAD_ARG_0 );
+    return 0;
+  }
+
+  mvm_Object *f = mvm_Compound_get( a, name );
+  if ( !f ){
+    mvm_set_error( MVM_ERROR_NO_FIELD );
+    return 0;
+  }
+
+  mvm_push_object( f );
+
+  return 1;
+}
+
+int _mvm_op_exec_setf() // field k[arg] of compound a = b
+{
+  bool worked = false;
+  mvm_State *s = MVM_STATE;
+
+  mvm_Compound *a = mvm_get_compound( 2, &worked );
+  if ( !worked ){
+    mvm_set_error( MVM_BAD_ARG_1 );
+    return 0;
+  }
+
+  const char* name = _mvm_field_name();
+  if ( !name ){
+    mvm_set_error( MVM_BAD_ARG_0 );
+    return 0;
+  }
+
+  if ( mvm_Compound_set( a, name, &s->s[s->sp - 1] ) != MVM_OK ){
+    mvm_set_error( MVM_ERROR_OUT_OF_MEMORY );
+  }
+
+  return 0;
+}
+
+#endif // MVM_INCLUDE_TYPEOPS
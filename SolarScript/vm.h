@@ -4,25 +4,34 @@
 #include "object.h"
 #include "state.h"
 #include "ops.h"
+#include "typeops.h"
+#include "regops.h"
+#include "flowops.h"
+#include "superops.h"
+#include "specialize.h"
+#include "quicken.h"
+#include "jit.h"
+#include "chunk.h"
+#include "bytecode.h"
 
 #define MVM_SAFE
 
 int MVM_INIT()
 {
-  MVM.state = NULL;
-  mvm_init_AATree( &MVM.global_funcs, mvm_Operation_comp_id );
+  MVM_STATE = NULL;
+  MVM.num_ops = 0;
+  memset( MVM.dispatch, 0, sizeof(MVM.dispatch) );
+  memset( MVM.op_slots, 0, sizeof(MVM.op_slots) );
+  mvm_init_AATree( &MVM.global_funcs, mvm_Operation_comp );
   
-  // go through standard operations and add them to global_funcs
+  // go through standard operations and add them to global_funcs & dispatch
   {
-    mvm_Operation *o;
-
   // Make quick work of prep by using this macro
 #define prep( NAME )\
-    o = _mvm_genop( #NAME, _mvm_op_exec_##NAME );\
-    if ( !o ) return MVM_ERROR;\
-    mvm_AATree_insert( &MVM.global_funcs, o );
+    if ( mvm_register_op( #NAME, _mvm_op_exec_##NAME ) < 0 ) return MVM_ERROR;
 
     prep(not)
+    prep(ipnot)
     prep(and)
     prep(or)
     prep(nand)
@@ -41,10 +50,215 @@ int MVM_INIT()
     prep(ipdiv)
     prep(ipabs)
     prep(ippow)
+    prep(pushk)
+    prep(nip)
+    prep(pop)
+    prep(gload)
+    prep(gstore)
+    prep(gcheck)
+    prep(room)
+    prep(lt)
+    prep(le)
+    prep(gt)
+    prep(ge)
+    prep(eq)
+    prep(ne)
+    prep(ilt)
+    prep(ile)
+    prep(igt)
+    prep(ige)
+    prep(ieq)
+    prep(ine)
+    prep(jmp)
+    prep(jt)
+    prep(jf)
+    prep(call)
+    prep(ret)
+
+    // register machine ops (regops.h)
+    prep(iadd)
+    prep(isub)
+    prep(imul)
+    prep(idiv)
+    prep(imod)
+    prep(ineg)
+    prep(band)
+    prep(bor)
+    prep(bxor)
+    prep(bnot)
+    prep(shl)
+    prep(shr)
+    prep(itof)
+    prep(ftoi)
+    prep(sconcat)
+    prep(slen)
+    prep(scmp)
+    prep(seq)
+    prep(newc)
+    prep(getf)
+    prep(setf)
+    prep(rmov)
+    prep(rloadk)
+    prep(rpush)
+    prep(rstore)
+    prep(rnot)
+    prep(rand)
+    prep(ror)
+    prep(rnand)
+    prep(rnor)
+    prep(rxor)
+    prep(rnxor)
+    prep(radd)
+    prep(rsub)
+    prep(rmul)
+    prep(rdiv)
+    prep(rpow)
+    prep(rabs)
+    prep(riadd)
+    prep(risub)
+    prep(rimul)
+    prep(rband)
+    prep(rbor)
+    prep(rbxor)
+    prep(rshl)
+    prep(rshr)
+    prep(rlt)
+    prep(rle)
+    prep(req)
+    prep(rilt)
+    prep(rile)
+    prep(rieq)
+
+    // superinstructions (superops.h)
+    prep(pushk2)
+    prep(addk)
+    prep(subk)
+    prep(mulk)
+    prep(divk)
+    prep(powk)
+    prep(ipaddk)
+    prep(ipsubk)
+    prep(ipmulk)
+    prep(ipdivk)
+    prep(add_nip)
+    prep(sub_nip)
+    prep(mul_nip)
+    prep(div_nip)
+    prep(pow_nip)
+    prep(and_nip)
+    prep(or_nip)
+    prep(xor_nip)
+    prep(gstore_pop)
+#define prep_branch( CMP ) prep(CMP##_jt) prep(CMP##_jf)
+    prep_branch(lt) prep_branch(le) prep_branch(gt) prep_branch(ge)
+    prep_branch(eq) prep_branch(ne)
+    prep_branch(ilt) prep_branch(ile) prep_branch(igt) prep_branch(ige)
+    prep_branch(ieq) prep_branch(ine)
+    prep_branch(lt_nip_nn) prep_branch(le_nip_nn) prep_branch(gt_nip_nn)
+    prep_branch(ge_nip_nn) prep_branch(eq_nip_nn) prep_branch(ne_nip_nn)
+    prep_branch(ilt_nip_ii) prep_branch(ile_nip_ii) prep_branch(igt_nip_ii)
+    prep_branch(ige_nip_ii) prep_branch(ieq_nip_ii) prep_branch(ine_nip_ii)
+#undef prep_branch
+
+    // type specialized ops (specialize.h)
+    prep(add_nn)
+    prep(sub_nn)
+    prep(mul_nn)
+    prep(div_nn)
+    prep(pow_nn)
+    prep(abs_n)
+    prep(ipadd_nn)
+    prep(ipsub_nn)
+    prep(ipmul_nn)
+    prep(ipdiv_nn)
+    prep(add_nip_nn)
+    prep(sub_nip_nn)
+    prep(mul_nip_nn)
+    prep(div_nip_nn)
+    prep(pow_nip_nn)
+    prep(lt_nip_nn)
+    prep(le_nip_nn)
+    prep(gt_nip_nn)
+    prep(ge_nip_nn)
+    prep(eq_nip_nn)
+    prep(ne_nip_nn)
+    prep(iadd_nip_ii)
+    prep(isub_nip_ii)
+    prep(imul_nip_ii)
+    prep(band_nip_ii)
+    prep(bor_nip_ii)
+    prep(bxor_nip_ii)
+    prep(shl_nip_ii)
+    prep(shr_nip_ii)
+    prep(ilt_nip_ii)
+    prep(ile_nip_ii)
+    prep(igt_nip_ii)
+    prep(ige_nip_ii)
+    prep(ieq_nip_ii)
+    prep(ine_nip_ii)
+    prep(and_nip_bb)
+    prep(or_nip_bb)
+    prep(xor_nip_bb)
+    prep(nand_nip_bb)
+    prep(nor_nip_bb)
+    prep(nxor_nip_bb)
+    prep(ipnot_b)
+    prep(ipineg_i)
+    prep(ipbnot_i)
+    prep(ipitof_i)
+    prep(not_b)
+    prep(and_bb)
+    prep(or_bb)
+    prep(xor_bb)
+    prep(addk_n)
+    prep(subk_n)
+    prep(mulk_n)
+    prep(divk_n)
+    prep(radd_nn)
+    prep(rsub_nn)
+    prep(rmul_nn)
+    prep(rdiv_nn)
+
+    // quickened ops (quicken.h)
+    prep(add_qnn)
+    prep(sub_qnn)
+    prep(mul_qnn)
+    prep(div_qnn)
+    prep(pow_qnn)
+    prep(abs_qn)
+    prep(ipadd_qnn)
+    prep(ipsub_qnn)
+    prep(ipmul_qnn)
+    prep(ipdiv_qnn)
+    prep(add_nip_qnn)
+    prep(sub_nip_qnn)
+    prep(mul_nip_qnn)
+    prep(div_nip_qnn)
+    prep(not_qb)
+    prep(and_qbb)
+    prep(or_qbb)
+    prep(xor_qbb)
+    prep(addk_qn)
+    prep(subk_qn)
+    prep(mulk_qn)
+    prep(divk_qn)
 
 #undef prep
   }
 
+  if ( mvm_init_flow() != MVM_OK ) return MVM_ERROR;
+  if ( mvm_init_specializations() != MVM_OK ) return MVM_ERROR;
+  if ( mvm_init_fusions() != MVM_OK ) return MVM_ERROR;
+  if ( mvm_init_quickenings() != MVM_OK ) return MVM_ERROR;
+
+#ifdef MVM_PROFILE_OPS
+  MVM.op_pairs = (uint64_t*)calloc( MVM_MAX_OPS*MVM_MAX_OPS, sizeof(uint64_t) );
+  if ( !MVM.op_pairs ) return MVM_ERROR;
+#endif
+#ifdef MVM_STACK_GUARD
+  if ( mvm_install_stack_guard() != MVM_OK ) return MVM_ERROR;
+#endif
+
   return MVM_OK;  
 }
 
@@ -54,44 +268,171 @@ void MVM_CLEANUP()
   printf( "Cleanup!\n" ); fflush(stdout);
   printf( "Deleting global function objects\n" );
   mvm_cleanup_AATree( &MVM.global_funcs, true );
+  mvm_cleanup_interned();
+
+#ifdef MVM_PROFILE_OPS
+  free( MVM.op_pairs );
+  MVM.op_pairs = NULL;
+#endif
+#ifdef MVM_STACK_GUARD
+  mvm_remove_stack_guard();
+#endif
 }
 
-/// Set the state to use for the following operations
+/// Set the state to use for the following operations on this thread. Every
+/// thread has its own current state, so each thread can run its own.
 void mvm_set_state( mvm_State *s );
 
-/// Execute a pre-compiled opcode sequence
-/// Use mvm_compile( const char* text, const char* ops, unsigned int *num )
-/// to compile text into bytecode.
+/// The state operations on this thread currently use
+mvm_State *mvm_get_state();
+
+/// Execute a sequence of one byte opcodes (no arguments or control flow -
+/// mvm_compile() makes programs, which run with mvm_call())
 int mvm_exec( const char *ops, unsigned int num );
 
+/// Execute at most budget ops of an opcode sequence, starting at *pc (which
+/// is left at the next op to run, so calling again carries on from there).
+/// Every op run is counted in the state's ops_in_second. Returns the stack
+/// difference, like mvm_exec.
+int mvm_exec_slice( const char *ops, unsigned int num, unsigned int *pc,
+                    uint32_t budget );
+
+/// Execute a chunk (see chunk.h) in whichever mode it was compiled for.
+/// Generic ops are quickened in place as they run (see quicken.h), and with
+/// MVM_JIT defined hot chunks are compiled to native code (see jit.h).
+/// Register chunks get a fresh window of c->nregs registers at the top of the
+/// stack; anything they push is moved down over the window when they finish,
+/// so callers see the same results a stack chunk would leave.
+int mvm_exec_chunk( mvm_Chunk *c );
+
+/// A run of a chunk that can stop after some number of ops & carry on later,
+/// e.g. to share a thread between many states (see sched.h). The state keeps
+/// the run's register window open on its stack in between.
+typedef struct _mvm_Run
+{
+  mvm_Chunk *c; // chunk being run
+  mvm_Instr *code; // c->code, or c->generic if the guard failed
+  uint32_t size; // number of instructions in code
+  uint32_t pc; // index of the next instruction to run
+  uint32_t fp; // base of the register window (register chunks)
+  int diff; // stack difference so far
+  bool done; // set once the run reaches the end of code or an error
+} mvm_Run;
+
+/// Start running c on the current state, without running any ops yet
+int mvm_begin_run( mvm_Run *r, mvm_Chunk *c );
+
+/// Run at most budget more ops of r on the current state (which must be the
+/// one r began on), returns the number of ops run. Every op run is counted in
+/// the state's ops_in_second.
+uint32_t mvm_continue_run( mvm_Run *r, uint32_t budget );
+
+/// A frame of a function call in a program: where its caller carries on
+typedef struct _mvm_Frame
+{
+  uint32_t ret; // caller's next instruction
+  uint32_t fp; // caller's frame pointer
+  uint32_t nregs; // size of the caller's register window
+  uint32_t fn; // caller
+} mvm_Frame;
+
+/// A call of a program's function (see bytecode.h) that can stop after some
+/// number of ops & carry on later, just like mvm_Run. Each function gets a
+/// register window on the state's stack, starting with its arguments.
+typedef struct _mvm_Call
+{
+  mvm_Program *p; // program being run
+  uint32_t pc; // index of the next instruction to run
+  uint32_t fn; // function being run
+  uint32_t fp; // base of the current function's register window
+  uint32_t nregs; // size of the current function's register window
+  mvm_Frame *frames; // callers of the current function (not the entry)
+  uint32_t nframes;
+  uint32_t framecap;
+  uint32_t nresults; // objects the call returned, once done
+  bool done; // set once the call returns or hits an error
+} mvm_Call;
+
+/// Start calling function fn of p on the current state, with its arguments
+/// on top of the stack. No ops are run yet.
+int mvm_begin_call( mvm_Call *x, mvm_Program *p, uint32_t fn );
+
+/// Run at most budget more ops of x, returns the number of ops run. Like
+/// mvm_continue_run, every op is counted in the state's ops_in_second. When
+/// done, the arguments have been replaced by the call's results. With
+/// MVM_JIT defined hot functions are compiled to native code (see jit.h).
+uint32_t mvm_continue_call( mvm_Call *x, uint32_t budget );
+
+/// Free what x allocated (call once it's done, or to abandon it)
+void mvm_end_call( mvm_Call *x );
+
+/// Call function fn of p (arguments on top of the stack) to completion.
+/// Returns MVM_OK, or the state's error.
+int mvm_call( mvm_Program *p, uint32_t fn );
+
 ////////////////////////////////////////////////////////////////////////////////
 // Implementation:
 
 void mvm_set_state( mvm_State *s )
 {
-  MVM.state = s;
+  MVM_STATE = s;
+}
+
+mvm_State *mvm_get_state()
+{
+  return MVM_STATE;
 }
 
 int mvm_exec( const char *ops, unsigned int num )
+{
+  unsigned int pc = 0;
+  return mvm_exec_slice( ops, num, &pc, UINT32_MAX );
+}
+
+int mvm_exec_slice( const char *ops, unsigned int num, unsigned int *pc,
+                    uint32_t budget )
 {
   int diff = 0; // stack difference (total cumulative over all ops)
 
 #ifdef MVM_SAFE
   // Only check for a state if we're being super safe (one less check if not!)
-  if ( MVM.state ){
+  if ( MVM_STATE ){
+#endif
+
+  mvm_State *s = MVM_STATE;
+  const mvmbyte *start = (const mvmbyte*)ops + *pc, *op = start;
+#ifdef MVM_STACK_GUARD
+  mvm_rearm_stack_guard( s );
+#endif
+  const mvmbyte *end = (const mvmbyte*)ops + num;
+#ifdef MVM_PROFILE_OPS
+  uint32_t prev = MVM_MAX_OPS; // no op before the first one
 #endif
 
-  for ( uint32_t i = 0; i < num && MVM.state->error == MVM_OK; ++i ){
-    // Get a function pointer to the function corrisponding to the provided
-    // operation:
-    mvm_Operation *fp = (mvm_Operation*)mvm_AATree_get( &MVM.global_funcs, 
-                                                        (void*)&ops[i] );
+  // One byte per op & no jumps, so the budget only moves the end
+  if ( *pc < num && budget < num - *pc ) end = op + budget;
+
+  while ( op < end && s->error == MVM_OK ){
+#ifdef MVM_PROFILE_OPS
+    if ( prev < MVM_MAX_OPS ) ++MVM.op_pairs[prev*MVM_MAX_OPS + *op];
+    prev = *op;
+#endif
+    // Opcodes index the dispatch table directly (no tree walk per op). The
+    // table has an entry for every possible byte, unused ones are NULL.
+    int (*exec)() = MVM.dispatch[*op++];
     
-    if ( !fp ){
-      MVM.state->error = MVM_ERROR_INVALID_OP;
+    if ( !exec ){
+      s->error = MVM_ERROR_INVALID_OP;
+      break;
     }
 
-    MVM.state->sp += (diff += fp->exec());
+    // The push/set helpers move sp themselves, exec only reports the change
+    diff += exec();
+  }
+
+  if ( op > start ){
+    *pc += (unsigned int)(op - start);
+    s->ops_in_second += (uint32_t)(op - start);
   }
 
 #ifdef MVM_SAFE
@@ -99,4 +440,480 @@ int mvm_exec( const char *ops, unsigned int num )
 #endif
 
   return diff;
-}
\ No newline at end of file
+}
+
+int mvm_begin_run( mvm_Run *r, mvm_Chunk *c )
+{
+  mvm_State *s = MVM_STATE;
+
+  r->c = c;
+  r->code = c->code;
+  r->size = c->size;
+  r->pc = 0;
+  r->fp = s->sp;
+  r->diff = 0;
+  r->done = false;
+
+#ifdef MVM_STACK_GUARD
+  mvm_rearm_stack_guard( s );
+#endif
+
+  if ( c->mode == MVM_CHUNK_REGISTER && !mvm_reserve_stack( s, c->nregs ) ){
+    s->error = MVM_ERROR_STACK_OVERFLOW;
+    r->done = true;
+    return MVM_ERROR_STACK_OVERFLOW;
+  }
+
+  // Specialized chunks skip per-op checks, so check everything once up front
+  // and fall back to the generic code if anything doesn't hold
+  if ( c->generic && !mvm_chunk_guard( c ) ){
+    r->code = c->generic;
+    r->size = c->generic_size;
+  }
+
+  if ( c->mode == MVM_CHUNK_REGISTER ){
+    // Open a zeroed register window at the top of the stack
+    for ( uint32_t i = 0; i < c->nregs; ++i ){
+      mvm_obj_set_number( s->s[r->fp + i], 0.0f );
+    }
+    s->sp += c->nregs;
+  }
+
+  return MVM_OK;
+}
+
+uint32_t mvm_continue_run( mvm_Run *r, uint32_t budget )
+{
+  mvm_State *s = MVM_STATE;
+  mvm_Chunk *c = r->c;
+
+  if ( r->done ) return 0;
+
+  // Save the callers registers so chunks can be executed from within ops
+  mvm_Instr ir = s->ir, *cip = s->ip;
+  uint32_t fp = s->fp, nregs = s->nregs, nk = s->nk;
+  const mvm_Object *k = s->k;
+
+  s->k = c->k;
+  s->nk = c->nk;
+  if ( c->mode == MVM_CHUNK_REGISTER ){
+    s->fp = r->fp;
+    s->nregs = c->nregs;
+  }
+
+  mvm_Instr *start = r->code + r->pc, *ip = start;
+  const mvm_Instr *end = r->code + r->size;
+
+  // Chunks are straight-line code, each instruction runs at most once, so
+  // the budget only moves the end (no counting in the loop)
+  if ( budget < r->size - r->pc ) end = ip + budget;
+
+#ifdef MVM_JIT
+  // Native code only covers the whole of the main code, not the generic
+  // fallback or part of a run
+  if ( ip == c->code && end == c->code + c->size && s->error == MVM_OK ){
+    if ( !c->jit && ++c->calls >= MVM_JIT_THRESHOLD ){
+      if ( mvm_jit_compile( c ) != MVM_OK ) c->calls = 0; // try again later
+    }
+
+    // Carry on interpreting from wherever the native code stopped
+    if ( c->jit ) ip = c->code + mvm_jit_run( c, &r->diff );
+  }
+#endif
+
+#ifdef MVM_PROFILE_OPS
+  uint32_t prev = MVM_MAX_OPS; // no op before the first one
+#endif
+
+  while ( ip < end && s->error == MVM_OK ){
+    s->ip = ip;
+    s->ir = *ip++;
+    uint32_t op = MVM_OP(s->ir);
+
+#ifdef MVM_PROFILE_OPS
+    if ( prev < MVM_MAX_OPS ) ++MVM.op_pairs[prev*MVM_MAX_OPS + op];
+    prev = op;
+#endif
+#ifndef MVM_NO_QUICKEN
+    if ( MVM_QUICK.quick[op] != MVM_NO_SPEC && !(s->ir & MVM_INSTR_STICKY) ){
+      op = mvm_quicken( op );
+    }
+#endif
+    int (*exec)() = MVM.dispatch[op];
+
+    if ( !exec ){
+      s->error = MVM_ERROR_INVALID_OP;
+      break;
+    }
+
+    r->diff += exec();
+  }
+
+  uint32_t ran = (uint32_t)(ip - start);
+  r->pc += ran;
+  s->ops_in_second += ran;
+
+  if ( r->pc == r->size || s->error != MVM_OK ){
+    r->done = true;
+
+    if ( c->mode == MVM_CHUNK_REGISTER ){
+      // Close the window, keeping anything pushed above it
+      uint32_t top = s->fp + s->nregs;
+      uint32_t pushed = s->sp > top ? s->sp - top : 0;
+      memmove( &s->s[s->fp], &s->s[s->fp + s->nregs], 
+               sizeof(mvm_Object)*pushed );
+      s->sp = s->fp + pushed;
+    }
+  }
+
+  s->ir = ir;
+  s->ip = cip;
+  s->fp = fp;
+  s->nregs = nregs;
+  s->k = k;
+  s->nk = nk;
+
+  return ran;
+}
+
+int mvm_exec_chunk( mvm_Chunk *c )
+{
+#ifdef MVM_SAFE
+  if ( !MVM_STATE || !c ) return 0;
+#endif
+
+  mvm_Run r;
+  if ( mvm_begin_run( &r, c ) == MVM_OK ) mvm_continue_run( &r, UINT32_MAX );
+
+  return r.diff;
+}
+
+// Open fn's register window over its arguments & jump to its entry
+int _mvm_call_enter( mvm_State *s, mvm_Call *x, uint32_t fn )
+{
+  const mvm_Function *f = &x->p->funcs[fn];
+
+  if ( s->sp < x->fp + x->nregs + f->nargs ) return MVM_ERROR_STACK_UNDERFLOW;
+  if ( f->nregs > f->nargs && !mvm_reserve_stack( s, f->nregs - f->nargs ) ){
+    return MVM_ERROR_STACK_OVERFLOW;
+  }
+
+  x->fp = s->sp - f->nargs;
+  x->nregs = f->nregs;
+  x->pc = f->entry;
+  x->fn = fn;
+  for ( uint32_t i = f->nargs; i < f->nregs; ++i ){
+    mvm_obj_set_number( s->s[x->fp + i], 0.0f );
+  }
+  s->sp = x->fp + f->nregs;
+  s->fp = x->fp;
+  s->nregs = x->nregs;
+
+  return MVM_OK;
+}
+
+// Check p again if its code has changed since it last was (throwing away the
+// native code compiled from the old code), MVM_OK if it can be run
+int _mvm_call_check( mvm_Program *p )
+{
+  if ( p->checked ) return MVM_OK;
+#ifdef MVM_JIT
+  mvm_jit_cleanup_Program( p );
+#endif
+  return mvm_Program_check( p );
+}
+
+int mvm_begin_call( mvm_Call *x, mvm_Program *p, uint32_t fn )
+{
+  mvm_State *s = MVM_STATE;
+
+  x->p = p;
+  x->pc = x->fn = 0;
+  x->fp = x->nregs = 0;
+  x->frames = NULL;
+  x->nframes = x->framecap = 0;
+  x->nresults = 0;
+  x->done = true;
+
+  if ( _mvm_call_check( p ) != MVM_OK || fn >= p->nfuncs ){
+    s->error = MVM_ERROR_BAD_PROGRAM;
+    return s->error;
+  }
+
+#ifdef MVM_STACK_GUARD
+  mvm_rearm_stack_guard( s );
+#endif
+
+  // The window is opened by the first mvm_continue_call(), which sets up
+  // the state's frame pointer
+  uint32_t fp = s->fp, nregs = s->nregs;
+  int result = _mvm_call_enter( s, x, fn );
+  s->fp = fp;
+  s->nregs = nregs;
+  if ( result != MVM_OK ){
+    s->error = result;
+    return result;
+  }
+
+#ifdef MVM_JIT
+  mvm_jit_count( p, fn );
+#endif
+
+  x->done = false;
+  return MVM_OK;
+}
+
+uint32_t mvm_continue_call( mvm_Call *x, uint32_t budget )
+{
+  mvm_State *s = MVM_STATE;
+  mvm_Program *p = x->p;
+
+  if ( x->done ) return 0;
+
+  // The program can change between slices (see reload.h), & its code move
+  if ( _mvm_call_check( p ) != MVM_OK ){
+    s->error = MVM_ERROR_BAD_PROGRAM;
+    x->done = true;
+    return 0;
+  }
+
+  // Save the caller's registers, so programs can be called from within ops
+  mvm_Instr ir = s->ir, *cip = s->ip;
+  uint32_t fp = s->fp, nregs = s->nregs, nk = s->nk, ng = s->ng;
+  const mvm_Object *k = s->k;
+  mvm_Object *g = s->g;
+  const char *gt = s->gt;
+
+  s->k = p->k;
+  s->nk = p->nk;
+  s->g = p->globals;
+  s->gt = p->gtypes;
+  s->ng = p->nglobals;
+  s->fp = x->fp;
+  s->nregs = x->nregs;
+
+  mvm_Instr *code = p->code;
+  uint32_t pc = x->pc, size = p->size, ran = 0;
+#ifndef MVM_NO_QUICKEN
+  bool quicken = !p->map; // mapped code is read only
+#endif
+
+#ifdef MVM_PROFILE_OPS
+  uint32_t prev = MVM_MAX_OPS; // no op before the first one
+#endif
+#ifdef MVM_JIT
+  bool entered = true; // whether to see if native code can take over
+#endif
+  uint32_t op;
+
+#ifdef MVM_THREADED
+  // The handler of each MVM_FLOW kind, so an op is dispatched with one
+  // indirect jump. In plain builds each handler also fetches the next op &
+  // jumps straight to its handler (_MVM_CALL_NEXT), so every handler's jump
+  // is predicted on its own.
+  static void* const flow[] = { &&flow_op, &&flow_jmp, &&flow_jt, &&flow_jf,
+                                &&flow_call, &&flow_ret, &&flow_branch };
+#define _MVM_FLOW_LABEL( L ) L:
+#if !defined(MVM_JIT) && !defined(MVM_PROFILE_OPS)
+#define _MVM_CALL_NEXT()\
+    if ( ran < budget && s->error == MVM_OK && pc < size ){\
+      s->ip = code + pc++;\
+      s->ir = *s->ip;\
+      ++ran;\
+      op = MVM_OP(s->ir);\
+      goto *flow[(uint8_t)MVM_FLOW.kind[op]];\
+    }\
+    break
+#endif
+#endif
+#ifndef _MVM_FLOW_LABEL
+#define _MVM_FLOW_LABEL( L )
+#endif
+#ifndef _MVM_CALL_NEXT
+#define _MVM_CALL_NEXT() break
+#endif
+
+  // With jumps in the code the budget has to be counted per op
+  while ( ran < budget && s->error == MVM_OK ){
+#ifdef MVM_JIT
+    // Functions are counted as they're called & loop (jump back), & once
+    // they're hot run natively from where they're entered, until they call,
+    // return, jump out or use up the budget
+    if ( entered ){
+      uint32_t left = budget - ran;
+      entered = false;
+      if ( mvm_jit_run_function( p, x->fn, &pc, &left ) ){
+        ran = budget - left;
+        continue;
+      }
+    }
+#endif
+
+    if ( pc >= size ){ // ran off the end without a ret
+      s->error = MVM_ERROR_BAD_PROGRAM;
+      break;
+    }
+
+    s->ip = code + pc++;
+    s->ir = *s->ip;
+    ++ran;
+    op = MVM_OP(s->ir);
+
+#ifdef MVM_PROFILE_OPS
+    if ( prev < MVM_MAX_OPS ) ++MVM.op_pairs[prev*MVM_MAX_OPS + op];
+    prev = op;
+#endif
+
+    // One table lookup sorts out the control ops, which mvm_Program_check()
+    // has already bounds checked
+#ifdef MVM_THREADED
+    goto *flow[(uint8_t)MVM_FLOW.kind[op]];
+#endif
+    switch ( MVM_FLOW.kind[op] ){
+      case MVM_FLOW_OP: _MVM_FLOW_LABEL( flow_op ){
+#ifndef MVM_NO_QUICKEN
+        if ( quicken && MVM_QUICK.quick[op] != MVM_NO_SPEC &&
+             !(s->ir & MVM_INSTR_STICKY) ){
+          op = mvm_quicken( op );
+        }
+#endif
+        int (*exec)() = MVM.dispatch[op];
+        if ( !exec ) s->error = MVM_ERROR_INVALID_OP;
+        else exec();
+        _MVM_CALL_NEXT();
+      }
+
+      case MVM_FLOW_JMP: _MVM_FLOW_LABEL( flow_jmp )
+        pc = MVM_ARG(s->ir);
+        _MVM_CALL_NEXT();
+
+      case MVM_FLOW_JT: _MVM_FLOW_LABEL( flow_jt )
+      case MVM_FLOW_JF: _MVM_FLOW_LABEL( flow_jf ){
+        bool worked = false;
+        mvmbool b = mvm_get_bool( 1, &worked );
+        if ( !worked ){
+          s->error = MVM_BAD_ARG_1;
+          break;
+        }
+        --s->sp;
+        if ( !b == (MVM_FLOW.kind[op] == MVM_FLOW_JF) ) pc = MVM_ARG(s->ir);
+        _MVM_CALL_NEXT();
+      }
+
+      case MVM_FLOW_BRANCH: _MVM_FLOW_LABEL( flow_branch ){
+        int b = MVM_FLOW.test[op]( s );
+        if ( b >= 0 && b == MVM_FLOW.on[op] ) pc = MVM_ARG(s->ir);
+        _MVM_CALL_NEXT();
+      }
+
+      case MVM_FLOW_CALL: _MVM_FLOW_LABEL( flow_call ){
+        if ( x->nframes >= s->ss ){
+          s->error = MVM_ERROR_STACK_OVERFLOW;
+          break;
+        }
+        if ( x->nframes == x->framecap ){
+          uint32_t cap = x->framecap ? x->framecap*2 : 16;
+          mvm_Frame *f = (mvm_Frame*)realloc( x->frames, sizeof(mvm_Frame)*cap );
+          if ( !f ){
+            s->error = MVM_ERROR_OUT_OF_MEMORY;
+            break;
+          }
+          x->frames = f;
+          x->framecap = cap;
+        }
+
+        x->frames[x->nframes] = { pc, x->fp, x->nregs, x->fn };
+        int result = _mvm_call_enter( s, x, MVM_ARG(s->ir) );
+        if ( result != MVM_OK ){
+          s->error = result;
+          break;
+        }
+        ++x->nframes;
+        pc = x->pc;
+#ifdef MVM_JIT
+        mvm_jit_count( p, x->fn );
+        entered = true;
+#endif
+        _MVM_CALL_NEXT();
+      }
+
+      case MVM_FLOW_RET: _MVM_FLOW_LABEL( flow_ret ){
+        uint32_t n = MVM_ARG(s->ir);
+        if ( n > s->sp - x->fp ){
+          s->error = MVM_ERROR_STACK_UNDERFLOW;
+          break;
+        }
+
+        // Results replace the arguments
+        memmove( &s->s[x->fp], &s->s[s->sp - n], sizeof(mvm_Object)*n );
+        s->sp = x->fp + n;
+
+        if ( !x->nframes ){
+          x->nresults = n;
+          x->done = true;
+          break;
+        }
+
+        mvm_Frame *f = &x->frames[--x->nframes];
+        pc = f->ret;
+        s->fp = x->fp = f->fp;
+        s->nregs = x->nregs = f->nregs;
+        x->fn = f->fn;
+#ifdef MVM_JIT
+        entered = true;
+#endif
+        _MVM_CALL_NEXT();
+      }
+    }
+
+#ifdef MVM_JIT
+    // A jump back is a loop, which counts like a call
+    if ( _mvm_is_jump( s->ir ) && pc <= (uint32_t)(s->ip - code) ){
+      mvm_jit_count( p, x->fn );
+      entered = true;
+    }
+#endif
+
+    if ( x->done ) break;
+  }
+
+  x->pc = pc;
+  s->ops_in_second += ran;
+  if ( s->error != MVM_OK ) x->done = true;
+
+  s->ir = ir;
+  s->ip = cip;
+  s->fp = fp;
+  s->nregs = nregs;
+  s->k = k;
+  s->nk = nk;
+  s->g = g;
+  s->gt = gt;
+  s->ng = ng;
+
+  return ran;
+}
+
+#undef _MVM_CALL_NEXT
+#undef _MVM_FLOW_LABEL
+
+void mvm_end_call( mvm_Call *x )
+{
+  if ( x->frames ) free( x->frames );
+  x->frames = NULL;
+  x->nframes = x->framecap = 0;
+  x->done = true;
+}
+
+int mvm_call( mvm_Program *p, uint32_t fn )
+{
+  mvm_State *s = MVM_STATE;
+  mvm_Call x;
+
+  if ( mvm_begin_call( &x, p, fn ) == MVM_OK ){
+    while ( !x.done ) mvm_continue_call( &x, UINT32_MAX );
+  }
+  mvm_end_call( &x );
+
+  return s->error == MVM_OK ? MVM_OK : s->error;
+}